@@ -0,0 +1,210 @@
+/*
+  dma is a front-end which selects a space-saving dynamic memory allocator
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef DMA_H__
+#define DMA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* block id (same as Multiheap-fit and Virtual Multiheap-fit) */
+typedef uint32_t blockid_t;
+
+/* Allocators which can be selected by 'dma_init' */
+typedef enum {
+  /* decided by the environment variable DMA_BACKEND and /dev/vmf_module0 */
+  DMA_BACKEND_AUTO,
+  /* Multiheap-fit */
+  DMA_BACKEND_MF,
+  /* Virtual Multiheap-fit with the kernel module */
+  DMA_BACKEND_VMF,
+  /* Virtual Multiheap-fit emulating the kernel module in user space */
+  DMA_BACKEND_VMF_USERSPACE,
+  /* small blocks in Multiheap-fit and large blocks in Virtual Multiheap-fit */
+  DMA_BACKEND_HYBRID,
+  DMA_BACKEND_NB
+} dma_backend_t;
+
+/* Default size threshold of DMA_BACKEND_HYBRID (see 'dma_init_hybrid') */
+#define DMA_HYBRID_THRESHOLD 16384
+
+/* Operations of a backend. Handlers of all backends are 'void*'. */
+typedef struct {
+  void   (*final)(void* handler);
+  int    (*allocate)(void* handler, blockid_t bid, size_t length);
+  void   (*deallocate)(void* handler, blockid_t bid);
+  int    (*reallocate)(void* handler, blockid_t bid, size_t new_length);
+  void*  (*dereference)(void* handler, blockid_t bid);
+  size_t (*length)(void* handler, blockid_t bid);
+  size_t (*dereference_and_length)(void* handler, blockid_t bid,
+    void** block_addr);
+  size_t (*using_mem)(void* handler);
+  size_t (*syscall_count)(void* handler);
+  size_t (*moved_bytes)(void* handler);
+} dma_ops_t;
+
+/* Type of the front-end. Members should not be touched directly. */
+typedef struct {
+  /* operations of the selected backend */
+  const dma_ops_t* ops;
+  /* handler of the selected backend */
+  void* handler;
+  /* selected backend */
+  dma_backend_t backend;
+} dma_main_t;
+
+typedef dma_main_t* dma_t;
+
+/**
+ * Select an allocator and initialize it.
+ * @param backend      allocator to use, or DMA_BACKEND_AUTO
+ * @param mem_min      min size of allocated block
+ * @param mem_max      max size of allocated block
+ * @param elem_nr_max  max number of allocated block
+ * @param max_byte     max total allocated size
+ * @return             dma handler
+ *
+ * If 'backend' is DMA_BACKEND_AUTO, the environment variable DMA_BACKEND
+ * ("mf", "vmf", "vmf_userspace" or "hybrid") is used. If it is not set either,
+ * Virtual Multiheap-fit is selected when /dev/vmf_module0 is available,
+ * and Multiheap-fit otherwise.
+ *
+ * Multiheap-fit can be initialized only once in a process.
+ */
+dma_t dma_init(dma_backend_t backend, size_t mem_min, size_t mem_max,
+  size_t elem_nr_max, size_t max_byte);
+
+/**
+ * Initialize the hybrid allocator with a size threshold.
+ * @param threshold  blocks of 'threshold' bytes or more are allocated in
+ *                   Virtual Multiheap-fit and the others in Multiheap-fit.
+ *                   If 0, the environment variable DMA_HYBRID_THRESHOLD or
+ *                   the macro DMA_HYBRID_THRESHOLD is used.
+ *
+ * The other parameters are the same as 'dma_init'. Both allocators share
+ * the block ids [0, elem_nr_max). Virtual Multiheap-fit uses the kernel
+ * module if it is available, and emulates it in user space otherwise.
+ * A block moves to the other allocator when it is reallocated across
+ * the threshold.
+ */
+dma_t dma_init_hybrid(size_t mem_min, size_t mem_max,
+  size_t elem_nr_max, size_t max_byte, size_t threshold);
+
+/**
+ * Finalize the allocator.
+ */
+void dma_final(dma_t dma);
+
+/**
+ * @return  selected backend (never DMA_BACKEND_AUTO)
+ */
+dma_backend_t dma_get_backend(const dma_t dma);
+
+/**
+ * @return  name of the backend (the same as the value of DMA_BACKEND)
+ */
+const char* dma_backend_name(dma_backend_t backend);
+
+/* The following functions behave like the ones of the selected allocator.
+   They are inlined to a single indirect call. */
+
+/**
+ * allocate memory block
+ * @param bid     allocating block id   [0, elem_nr_max)
+ * @param length  required memory size  [mem_min, mem_max]
+ * @return        0 on success, -1 on failure (errno is set)
+ */
+static inline int dma_allocate(dma_t dma, blockid_t bid, size_t length) {
+  return dma->ops->allocate(dma->handler, bid, length);
+}
+
+/**
+ * deallocate memory block
+ * @param bid  deallocating block id
+ */
+static inline void dma_deallocate(dma_t dma, blockid_t bid) {
+  dma->ops->deallocate(dma->handler, bid);
+}
+
+/**
+ * change size of allocated memory block
+ * @param bid         resizing block id
+ * @param new_length  new block length
+ * @return            0 on success, -1 on failure (errno is set)
+ */
+static inline int dma_reallocate(dma_t dma, blockid_t bid,
+    size_t new_length) {
+  return dma->ops->reallocate(dma->handler, bid, new_length);
+}
+
+/**
+ * dereference memory block
+ * @param bid  dereferencing block id
+ * @return     current addres of the block
+ */
+static inline void* dma_dereference(dma_t dma, blockid_t bid) {
+  return dma->ops->dereference(dma->handler, bid);
+}
+
+/**
+ * calculate the length of the allocated memory block
+ * @param  bid  allocated block id
+ * @return      internal length of bid
+ */
+static inline size_t dma_length(const dma_t dma, blockid_t bid) {
+  return dma->ops->length(dma->handler, bid);
+}
+
+/**
+ * dereference and calculate the length of the allocated memory block.
+ * @param  bid         allocated block id
+ * @param  block_addr  used to store dereferenced address
+ * @return             internal length of bid
+ */
+static inline size_t dma_dereference_and_length(dma_t dma, blockid_t bid,
+    void** block_addr) {
+  return dma->ops->dereference_and_length(dma->handler, bid, block_addr);
+}
+
+/**
+ * calculate total using size
+ */
+static inline size_t dma_using_mem(const dma_t dma) {
+  return dma->ops->using_mem(dma->handler);
+}
+
+/**
+ * count system calls issued by the backend (see 'mf_get_stat' and
+ * 'vmf_get_stat'). Only the difference of two calls is meaningful.
+ */
+static inline size_t dma_syscall_count(const dma_t dma) {
+  return dma->ops->syscall_count(dma->handler);
+}
+
+/**
+ * count bytes copied by the backend to move blocks into holes left by
+ * deallocation. Only the difference of two calls is meaningful.
+ */
+static inline size_t dma_moved_bytes(const dma_t dma) {
+  return dma->ops->moved_bytes(dma->handler);
+}
+
+#endif /* DMA_H__ */
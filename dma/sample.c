@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dma.h"
+
+#define SAMPLE_STR "Hello World"
+
+int main(int argc, char* argv[]) {
+  void* addr;
+  dma_t dma;
+
+  dma = dma_init(DMA_BACKEND_AUTO, 1, 2048, 16, 32768);
+  printf("backend : %s\n", dma_backend_name(dma_get_backend(dma)));
+  dma_allocate(dma, 0, 1024);
+  dma_allocate(dma, 1, 1024);
+
+  addr = dma_dereference(dma, 1);
+  strcpy(addr, SAMPLE_STR);
+  printf("%p : %s\n", addr, (char*)addr);
+
+  dma_deallocate(dma, 0);
+  addr = dma_dereference(dma, 1);
+  printf("%p : %s\n", addr, (char*)addr);
+
+  dma_final(dma);
+  return EXIT_SUCCESS;
+}
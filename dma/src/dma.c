@@ -0,0 +1,381 @@
+/*
+  dma is a front-end which selects a space-saving dynamic memory allocator
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dma.h"
+#include "multiheap_fit.h"
+#include "virtual_multiheap_fit.h"
+
+#define DEVICE_NAME "/dev/vmf_module0"
+#define ENV_NAME "DMA_BACKEND"
+#define ENV_THRESHOLD "DMA_HYBRID_THRESHOLD"
+#define DMA_INLINE static inline
+
+/* Hybrid of Multiheap-fit and Virtual Multiheap-fit */
+typedef struct {
+  /* allocator for blocks smaller than 'threshold' (NULL if not used) */
+  mf_t mf;
+  /* allocator for blocks of 'threshold' bytes or more (NULL if not used) */
+  vmf_t vmf;
+  /* size threshold */
+  size_t threshold;
+  /* i-th bit is set if i-th block is in 'vmf' */
+  uint8_t* in_vmf;
+  /* byte size of 'in_vmf' */
+  size_t bitmap_size;
+} hybrid_t;
+
+static void hybrid_final(void* handler);
+static int hybrid_allocate(void* handler, blockid_t bid, size_t length);
+static void hybrid_deallocate(void* handler, blockid_t bid);
+static int hybrid_reallocate(void* handler, blockid_t bid,
+  size_t new_length);
+static void* hybrid_dereference(void* handler, blockid_t bid);
+static size_t hybrid_length(void* handler, blockid_t bid);
+static size_t hybrid_dereference_and_length(void* handler, blockid_t bid,
+  void** block_addr);
+static size_t hybrid_using_mem(void* handler);
+static size_t hybrid_syscall_count(void* handler);
+static size_t mf_syscall_count(void* handler);
+static size_t vmf_syscall_count(void* handler);
+static size_t hybrid_moved_bytes(void* handler);
+static size_t mf_moved_bytes(void* handler);
+static size_t vmf_moved_bytes(void* handler);
+
+/* Handlers of Multiheap-fit and Virtual Multiheap-fit are 'void*',
+   so their functions can be stored directly. */
+static const dma_ops_t mf_ops = {
+  mf_final, mf_allocate, mf_deallocate, mf_reallocate,
+  mf_dereference, mf_length, mf_dereference_and_length, mf_using_mem,
+  mf_syscall_count, mf_moved_bytes
+};
+
+static const dma_ops_t vmf_ops = {
+  vmf_final, vmf_allocate, vmf_deallocate, vmf_reallocate,
+  vmf_dereference, vmf_length, vmf_dereference_and_length, vmf_using_mem,
+  vmf_syscall_count, vmf_moved_bytes
+};
+
+static const dma_ops_t hybrid_ops = {
+  hybrid_final, hybrid_allocate, hybrid_deallocate, hybrid_reallocate,
+  hybrid_dereference, hybrid_length, hybrid_dereference_and_length,
+  hybrid_using_mem, hybrid_syscall_count, hybrid_moved_bytes
+};
+
+static const char* const backend_names[DMA_BACKEND_NB] = {
+  "auto", "mf", "vmf", "vmf_userspace", "hybrid"
+};
+
+/** call 'malloc' and exit if 'malloc' is failed */
+DMA_INLINE void* safe_malloc(size_t size) {
+  void* addr = malloc(size);
+  if (addr == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  return addr;
+}
+
+/** true if /dev/vmf_module0 can be used */
+DMA_INLINE bool module_available(void) {
+  return access(DEVICE_NAME, R_OK | W_OK) == 0;
+}
+
+/** Decide the backend from DMA_BACKEND and the kernel module */
+static dma_backend_t select_backend(void) {
+  const char* name = getenv(ENV_NAME);
+  int i;
+
+  if (name != NULL && name[0] != '\0') {
+    for (i = DMA_BACKEND_MF; i < DMA_BACKEND_NB; ++i) {
+      if (strcmp(name, backend_names[i]) == 0) return (dma_backend_t) i;
+    }
+    fprintf(stderr, "%s: unknown backend '%s'\n", ENV_NAME, name);
+  }
+
+  if (module_available()) {
+    return DMA_BACKEND_VMF;
+  } else {
+    return DMA_BACKEND_MF;
+  }
+}
+
+dma_t dma_init(dma_backend_t backend, size_t mem_min, size_t mem_max,
+    size_t elem_nr_max, size_t max_byte) {
+  dma_main_t* dma;
+
+  if (backend == DMA_BACKEND_AUTO || backend >= DMA_BACKEND_NB) {
+    backend = select_backend();
+  }
+  if (backend == DMA_BACKEND_HYBRID) {
+    return dma_init_hybrid(mem_min, mem_max, elem_nr_max, max_byte, 0);
+  }
+
+  dma = (dma_main_t*) safe_malloc(sizeof(dma_main_t));
+  dma->backend = backend;
+
+  switch (backend) {
+  case DMA_BACKEND_MF:
+    dma->ops = &mf_ops;
+    dma->handler = mf_init(mem_min, mem_max, elem_nr_max, max_byte);
+    break;
+  case DMA_BACKEND_VMF:
+    dma->ops = &vmf_ops;
+    dma->handler = vmf_init(mem_min, mem_max, elem_nr_max, max_byte);
+    break;
+  case DMA_BACKEND_VMF_USERSPACE:
+  default:
+    dma->ops = &vmf_ops;
+    dma->handler = vmf_init_flags(mem_min, mem_max, elem_nr_max, max_byte,
+      VMF_FLAG_USERSPACE);
+    break;
+  }
+
+  return dma;
+}
+
+dma_t dma_init_hybrid(size_t mem_min, size_t mem_max,
+    size_t elem_nr_max, size_t max_byte, size_t threshold) {
+  dma_main_t* dma;
+  hybrid_t* hybrid;
+  const char* env;
+  unsigned vmf_flags;
+
+  if (threshold == 0) {
+    env = getenv(ENV_THRESHOLD);
+    threshold = (env != NULL && env[0] != '\0')
+      ? strtoull(env, NULL, 0) : DMA_HYBRID_THRESHOLD;
+  }
+
+  hybrid = (hybrid_t*) safe_malloc(sizeof(hybrid_t));
+  hybrid->threshold   = threshold;
+  hybrid->bitmap_size = (elem_nr_max + 7) / 8;
+  hybrid->in_vmf      = (uint8_t*) calloc(hybrid->bitmap_size, 1);
+  if (hybrid->in_vmf == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+
+  /* An allocator which receives no block is not initialized */
+  hybrid->mf = NULL;
+  if (mem_min < threshold) {
+    hybrid->mf = mf_init(mem_min,
+      mem_max < threshold ? mem_max : threshold - 1, elem_nr_max, max_byte);
+  }
+  hybrid->vmf = NULL;
+  if (mem_max >= threshold) {
+    vmf_flags = module_available() ? 0 : VMF_FLAG_USERSPACE;
+    hybrid->vmf = vmf_init_flags(mem_min > threshold ? mem_min : threshold,
+      mem_max, elem_nr_max, max_byte, vmf_flags);
+  }
+
+  dma = (dma_main_t*) safe_malloc(sizeof(dma_main_t));
+  dma->backend = DMA_BACKEND_HYBRID;
+  dma->ops     = &hybrid_ops;
+  dma->handler = hybrid;
+  return dma;
+}
+
+void dma_final(dma_t dma) {
+  dma->ops->final(dma->handler);
+  free(dma);
+}
+
+dma_backend_t dma_get_backend(const dma_t dma) {
+  return dma->backend;
+}
+
+const char* dma_backend_name(dma_backend_t backend) {
+  if (backend >= DMA_BACKEND_NB) return "unknown";
+  return backend_names[backend];
+}
+
+/* ========================================================================== */
+/* hybrid */
+/* ========================================================================== */
+
+DMA_INLINE bool hybrid_in_vmf(const hybrid_t* hybrid, blockid_t bid) {
+  return (hybrid->in_vmf[bid / 8] >> (bid % 8)) & 1;
+}
+
+DMA_INLINE void hybrid_set(hybrid_t* hybrid, blockid_t bid, bool in_vmf) {
+  if (in_vmf) {
+    hybrid->in_vmf[bid / 8] |= (uint8_t)(1u << (bid % 8));
+  } else {
+    hybrid->in_vmf[bid / 8] &= (uint8_t)~(1u << (bid % 8));
+  }
+}
+
+static void hybrid_final(void* handler) {
+  hybrid_t* hybrid = (hybrid_t*) handler;
+
+  if (hybrid->mf  != NULL) mf_final(hybrid->mf);
+  if (hybrid->vmf != NULL) vmf_final(hybrid->vmf);
+  free(hybrid->in_vmf);
+  free(hybrid);
+}
+
+static int hybrid_allocate(void* handler, blockid_t bid, size_t length) {
+  hybrid_t* hybrid = (hybrid_t*) handler;
+
+  if (length >= hybrid->threshold) {
+    if (vmf_allocate(hybrid->vmf, bid, length) != 0) return -1;
+    hybrid_set(hybrid, bid, true);
+  } else {
+    if (mf_allocate(hybrid->mf, bid, length) != 0) return -1;
+    hybrid_set(hybrid, bid, false);
+  }
+  return 0;
+}
+
+static void hybrid_deallocate(void* handler, blockid_t bid) {
+  hybrid_t* hybrid = (hybrid_t*) handler;
+
+  if (hybrid_in_vmf(hybrid, bid)) {
+    vmf_deallocate(hybrid->vmf, bid);
+  } else {
+    mf_deallocate(hybrid->mf, bid);
+  }
+}
+
+static int hybrid_reallocate(void* handler, blockid_t bid,
+    size_t new_length) {
+  hybrid_t* hybrid = (hybrid_t*) handler;
+  bool old_in_vmf = hybrid_in_vmf(hybrid, bid);
+  bool new_in_vmf = (new_length >= hybrid->threshold);
+  void* old_addr;
+  size_t old_length;
+
+  if (old_in_vmf == new_in_vmf) {
+    if (new_in_vmf) {
+      return vmf_reallocate(hybrid->vmf, bid, new_length);
+    } else {
+      return mf_reallocate(hybrid->mf, bid, new_length);
+    }
+  }
+
+  /* The block moves to the other allocator. The same bid can be used
+     because the two allocators have independent block tables.
+     The old block is kept until the new one is allocated. */
+  if (hybrid_allocate(handler, bid, new_length) != 0) return -1;
+  if (old_in_vmf) {
+    old_length = vmf_dereference_and_length(hybrid->vmf, bid, &old_addr);
+    memcpy(mf_dereference(hybrid->mf, bid), old_addr,
+      old_length < new_length ? old_length : new_length);
+    vmf_deallocate(hybrid->vmf, bid);
+  } else {
+    old_length = mf_dereference_and_length(hybrid->mf, bid, &old_addr);
+    memcpy(vmf_dereference(hybrid->vmf, bid), old_addr,
+      old_length < new_length ? old_length : new_length);
+    mf_deallocate(hybrid->mf, bid);
+  }
+  return 0;
+}
+
+static void* hybrid_dereference(void* handler, blockid_t bid) {
+  hybrid_t* hybrid = (hybrid_t*) handler;
+
+  if (hybrid_in_vmf(hybrid, bid)) {
+    return vmf_dereference(hybrid->vmf, bid);
+  } else {
+    return mf_dereference(hybrid->mf, bid);
+  }
+}
+
+static size_t hybrid_length(void* handler, blockid_t bid) {
+  hybrid_t* hybrid = (hybrid_t*) handler;
+
+  if (hybrid_in_vmf(hybrid, bid)) {
+    return vmf_length(hybrid->vmf, bid);
+  } else {
+    return mf_length(hybrid->mf, bid);
+  }
+}
+
+static size_t hybrid_dereference_and_length(void* handler, blockid_t bid,
+    void** block_addr) {
+  hybrid_t* hybrid = (hybrid_t*) handler;
+
+  if (hybrid_in_vmf(hybrid, bid)) {
+    return vmf_dereference_and_length(hybrid->vmf, bid, block_addr);
+  } else {
+    return mf_dereference_and_length(hybrid->mf, bid, block_addr);
+  }
+}
+
+static size_t hybrid_using_mem(void* handler) {
+  hybrid_t* hybrid = (hybrid_t*) handler;
+  size_t using_mem = sizeof(hybrid_t) + hybrid->bitmap_size;
+
+  if (hybrid->mf  != NULL) using_mem += mf_using_mem(hybrid->mf);
+  if (hybrid->vmf != NULL) using_mem += vmf_using_mem(hybrid->vmf);
+  return using_mem;
+}
+
+static size_t hybrid_syscall_count(void* handler) {
+  hybrid_t* hybrid = (hybrid_t*) handler;
+  size_t count = 0;
+
+  if (hybrid->mf  != NULL) count += mf_syscall_count(hybrid->mf);
+  if (hybrid->vmf != NULL) count += vmf_syscall_count(hybrid->vmf);
+  return count;
+}
+
+static size_t mf_syscall_count(void* handler) {
+  mf_stat_t stat;
+
+  mf_get_stat(handler, &stat);
+  return stat.mmap_nr + stat.unmap_nr;
+}
+
+static size_t vmf_syscall_count(void* handler) {
+  vmf_stat_t stat;
+
+  vmf_get_stat(handler, &stat);
+  return stat.mmap_nr + stat.unmap_nr + stat.mremap_nr + stat.driver_nr;
+}
+
+static size_t hybrid_moved_bytes(void* handler) {
+  hybrid_t* hybrid = (hybrid_t*) handler;
+  size_t bytes = 0;
+
+  if (hybrid->mf  != NULL) bytes += mf_moved_bytes(hybrid->mf);
+  if (hybrid->vmf != NULL) bytes += vmf_moved_bytes(hybrid->vmf);
+  return bytes;
+}
+
+static size_t mf_moved_bytes(void* handler) {
+  mf_stat_t stat;
+
+  mf_get_stat(handler, &stat);
+  return stat.moved_bytes;
+}
+
+static size_t vmf_moved_bytes(void* handler) {
+  vmf_stat_t stat;
+
+  vmf_get_stat(handler, &stat);
+  return stat.moved_bytes;
+}
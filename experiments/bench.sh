@@ -0,0 +1,234 @@
+#!/bin/sh
+# Run the experiment programs over every combination of build, allocator and
+# trace, and summarize repeated measurements by median and its 95% confidence
+# interval. With -C, compare two result files and flag regressions.
+
+usage() {
+  cat <<EOF
+Usage: $0 [options]
+       $0 -C [-T percent] <old.csv> <new.csv> [-T percent]
+
+Options:
+  -a "<numbers>"  allocators (default: all)
+  -t "<files>"    memlogs (default: real_app/*.memlog)
+  -b <name=dir>   build variant whose programs are in <dir> (repeatable,
+                  default: current=.)
+  -m "<metrics>"  metric groups among time, replay, touch, counters, memory
+                  (default: "time counters memory")
+  -n <N>          repetitions of timed runs (default: 10)
+  -w <W>          warm-up runs before them (default: 2)
+  -c <cpu>        CPU to pin runs with taskset, or "none" (default: 0)
+  -k <interval>   sampling interval of memory_test -k (default: 1000)
+  -o <prefix>     write <prefix>.csv and <prefix>.json (default: bench)
+  -C              compare mode
+  -T <percent>    smallest change reported as a regression (default: 5)
+
+Exit status: 0 on success, 1 if a regression is found, 2 on a usage error.
+EOF
+  exit 2
+}
+
+# Print median, confidence interval and samples of the numbers in $1 as
+# "n,median,ci_low,ci_high,samples". Rank bounds of the median are
+# n/2 -/+ 1.96 sqrt(n) / 2, which does not assume a distribution.
+summarize() {
+  echo "$1" | awk '{
+    n = 0
+    samples = $1
+    for (i = 1; i <= NF; ++i) x[++n] = $i + 0
+    for (i = 2; i <= NF; ++i) samples = samples " " $i
+    for (i = 2; i <= n; ++i) {
+      v = x[i]
+      for (j = i - 1; j >= 1 && x[j] > v; --j) x[j + 1] = x[j]
+      x[j + 1] = v
+    }
+    if (n % 2) median = x[(n + 1) / 2]; else median = (x[n / 2] + x[n / 2 + 1]) / 2
+    d = 0.98 * sqrt(n)
+    lo = int(n / 2 - d); if (lo < 1) lo = 1
+    hi = n / 2 + 1 + d; if (hi > int(hi)) hi = int(hi) + 1; if (hi > n) hi = n
+    printf "%d,%.10g,%.10g,%.10g,%s\n", n, median, x[lo], x[hi], samples
+  }'
+}
+
+# Append a row to the CSV: emit <metric> "<samples>"
+emit() {
+  [ -z "$2" ] && return
+  echo "$variant,$name,$trace_name,$1,$(summarize "$2")" >> "$csv"
+}
+
+compare() {
+  [ $# -eq 2 ] || usage
+  awk -F, -v threshold="$threshold" '
+    FNR == 1 { next }
+    NR == FNR { old[$1 "," $2 "," $3 "," $4] = $0; next }
+    {
+      key = $1 "," $2 "," $3 "," $4
+      if (!(key in old)) next
+      split(old[key], o, ",")
+      change = o[6] == 0 ? 0 : 100 * ($6 - o[6]) / o[6]
+      verdict = ""
+      # All metrics are lower-is-better. Medians differ significantly when
+      # their confidence intervals do not overlap.
+      if ($7 > o[8] && change > threshold) {
+        verdict = "REGRESSION"
+        regression++
+      } else if ($8 < o[7] && change < -threshold) {
+        verdict = "improved"
+      }
+      printf "%-60s %12s %12s %+8.1f%% %s\n", key, o[6], $6, change, verdict
+    }
+    END {
+      printf "%d regression(s)\n", regression
+      exit regression > 0
+    }' "$1" "$2"
+}
+
+# Convert the CSV into an array of JSON objects
+to_json() {
+  awk -F, '
+    BEGIN { print "[" }
+    FNR == 1 { next }
+    {
+      if (row++) print ","
+      gsub(/ +/, ",", $9)
+      printf "  {\"variant\": \"%s\", \"allocator\": \"%s\", \"trace\": \"%s\", ", $1, $2, $3
+      printf "\"metric\": \"%s\", \"n\": %s, \"median\": %s, ", $4, $5, $6
+      printf "\"ci_low\": %s, \"ci_high\": %s, \"samples\": [%s]}", $7, $8, $9
+    }
+    END { print ""; print "]" }' "$1"
+}
+
+allocators=""
+traces=""
+variants=""
+metrics="time counters memory"
+repeat=10
+warmup=2
+cpu=0
+interval=1000
+prefix=bench
+compare_mode=0
+threshold=5
+
+while getopts a:t:b:m:n:w:c:k:o:CT: opt; do
+  case $opt in
+    a) allocators=$OPTARG ;;
+    t) traces=$OPTARG ;;
+    b) variants="$variants $OPTARG" ;;
+    m) metrics=$OPTARG ;;
+    n) repeat=$OPTARG ;;
+    w) warmup=$OPTARG ;;
+    c) cpu=$OPTARG ;;
+    k) interval=$OPTARG ;;
+    o) prefix=$OPTARG ;;
+    C) compare_mode=1 ;;
+    T) threshold=$OPTARG ;;
+    *) usage ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+if [ $compare_mode -eq 1 ]; then
+  # getopts stops at the first file, so -T may also follow the files
+  old=""
+  new=""
+  while [ $# -gt 0 ]; do
+    case $1 in
+      -T) [ $# -ge 2 ] || usage; threshold=$2; shift 2 ;;
+      -*) usage ;;
+      *)
+        if [ -z "$old" ]; then old=$1
+        elif [ -z "$new" ]; then new=$1
+        else usage
+        fi
+        shift
+        ;;
+    esac
+  done
+  [ -n "$new" ] || usage
+  compare "$old" "$new"
+  exit $?
+fi
+
+[ -z "$variants" ] && variants="current=."
+[ -z "$traces" ] && traces=$(ls real_app/*.memlog)
+if [ -z "$allocators" ]; then
+  set -- $variants
+  allocators=$("${1#*=}/time_test.out" 2>/dev/null |
+    awk -F'|' '$1 ~ /^ *[0-9]+ *$/ { printf "%d ", $1 }')
+fi
+pin=""
+if [ "$cpu" != none ] && command -v taskset >/dev/null 2>&1; then
+  pin="taskset -c $cpu"
+fi
+
+csv=$prefix.csv
+echo "variant,allocator,trace,metric,n,median,ci_low,ci_high,samples" > "$csv"
+
+for spec in $variants; do
+  variant=${spec%%=*}
+  dir=${spec#*=}
+  for trace in $traces; do
+    trace_name=$(basename "$trace")
+    for allocator in $allocators; do
+      # Allocators unavailable here (e.g. without the kernel module) fail
+      name=$($pin "$dir/time_test.out" "$trace" "$allocator" 2>/dev/null |
+        sed -n '1s/ [0-9]* us$//p')
+      if [ -z "$name" ]; then
+        echo "skip: $variant allocator $allocator on $trace_name" >&2
+        continue
+      fi
+      echo "run: $variant $name $trace_name" >&2
+
+      for group in $metrics; do
+        case $group in
+          time|replay|touch)
+            case $group in
+              replay) mode="-s" ;;
+              touch) mode="-t 4" ;;
+              *) mode="" ;;
+            esac
+            i=0
+            while [ $i -lt "$warmup" ]; do
+              $pin "$dir/time_test.out" "$trace" "$allocator" $mode >/dev/null
+              i=$((i + 1))
+            done
+            samples=""
+            i=0
+            while [ $i -lt "$repeat" ]; do
+              samples="$samples $($pin "$dir/time_test.out" "$trace" \
+                "$allocator" $mode | awk 'NR == 1 { print $(NF - 1) }')"
+              i=$((i + 1))
+            done
+            emit "${group}_us" "$samples"
+            ;;
+          counters)
+            # Counts hardly vary, so they are taken once
+            out=$($pin "$dir/time_test.out" "$trace" "$allocator" -c)
+            emit syscalls "$(echo "$out" | awk '
+              /^(allocate|deallocate|reallocate) / && $4 != "-" { s += $4; f = 1 }
+              END { if (f) print s }')"
+            emit minflt "$(echo "$out" | awk '
+              /^(allocate|deallocate|reallocate) / { s += $5 } END { print s }')"
+            emit vma_max "$(echo "$out" | awk '/^VMAs:/ { print $NF }')"
+            ;;
+          memory)
+            out=$($pin "$dir/memory_test.out" "$trace" "$allocator" \
+              -k "$interval" -t | grep '^# [pf]')
+            emit peak_rss "$(echo "$out" | sed -n 's/.* rss \([0-9]*\),.*/\1/p')"
+            emit peak_self "$(echo "$out" | sed -n 's/.* self \([0-9]*\),.*/\1/p')"
+            emit fragmentation "$(echo "$out" |
+              sed -n 's/^# fragmentation .* rss \([0-9.]*\)$/\1/p')"
+            ;;
+          *)
+            echo "unknown metric group: $group" >&2
+            exit 2
+            ;;
+        esac
+      done
+    done
+  done
+done
+
+to_json "$csv" > "$prefix.json"
+echo "wrote $csv and $prefix.json" >&2
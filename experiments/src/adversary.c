@@ -0,0 +1,700 @@
+/*
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+#include "allocator.h"
+#include "memlog.h"
+
+/* Default number of commands of a trace */
+#define DEFAULT_LENGTH 256
+/* Default number of candidates evaluated */
+#define DEFAULT_ITERATION 2000
+/* Default range of block sizes */
+#define DEFAULT_SIZE_MIN 16
+#define DEFAULT_SIZE_MAX 65536
+/* Number of genes changed by a mutation at most */
+#define MUTATION_MAX 4
+
+/* Metrics to be maximized */
+enum metric {
+  /* Maximum number of user-space instructions of an operation */
+  METRIC_INSTRUCTION,
+  /* Maximum latency of an operation [ns] */
+  METRIC_TIME,
+  /* Bytes copied by the allocator to move blocks / bytes requested */
+  METRIC_MOVED,
+  /* System calls per operation */
+  METRIC_SYSCALL,
+  /* Peak memory usage / peak total size of live blocks */
+  METRIC_PEAK_RATIO,
+  METRIC_NB,
+};
+
+static const char* const metric_name[METRIC_NB] = {
+  "inst", "time", "moved", "syscall", "peak",
+};
+
+/* Kinds of genes */
+enum gene_kind {
+  GENE_ALLOCATE,
+  GENE_DEALLOCATE,
+  GENE_REALLOCATE,
+  GENE_KIND_NB,
+};
+
+/**
+ * A gene is decoded into a command so that any sequence is a valid trace.
+ * 'target' selects a live block (modulo the number of them) and freed idx
+ * are reused from the smallest.
+ */
+typedef struct {
+  uint8_t kind;
+  uint32_t target;
+  uint32_t size;
+} gene_t;
+
+typedef struct {
+  gene_t* genes;
+  size_t nr;
+} genome_t;
+
+/* Decoded trace */
+typedef struct {
+  command_t* commands;
+  size_t nr;
+  size_t mem_min;
+  size_t mem_max;
+  size_t block_max;
+  size_t require_size;
+} trace_t;
+
+static struct {
+  int allocator;
+  enum metric metric;
+  size_t size_min;
+  size_t size_max;
+  uint64_t rng;
+} g_search;
+
+/** Decode 'genome' into 'trace' */
+static void decode(const genome_t* genome, trace_t* trace);
+/** Evaluate a trace in a child process. The score is NAN if the metric
+    is unavailable, and 'status' is the wait status of the child. */
+static double evaluate(const trace_t* trace, int* status);
+/** Whether the child of 'status' crashed or exited with an error */
+static bool child_failed(int status);
+/** Save a trace on which the allocator failed, and report it */
+static void save_failure(const char* output, size_t iteration,
+  const trace_t* trace, int status, int argc, char* argv[]);
+/** Replay a trace and calculate the metric */
+static double replay(const trace_t* trace);
+/** Change some genes of 'genome' */
+static void mutate(genome_t* genome, size_t capacity);
+/** Make a random gene */
+static void random_gene(gene_t* gene);
+/** Load a memlog as the initial genome */
+static void load_genome(const char* filename, genome_t* genome,
+  size_t* capacity);
+/** Write a trace as a text memlog. 'result' is recorded in the header. */
+static void write_trace(const char* filename, const trace_t* trace,
+  const char* result, int argc, char* argv[]);
+/** Open a counter of user-space instructions of this process */
+static int open_instruction_counter(void);
+static void print_usage(const char* program_name);
+
+/** xorshift64* */
+static inline uint64_t rand_u64(void) {
+  g_search.rng ^= g_search.rng >> 12;
+  g_search.rng ^= g_search.rng << 25;
+  g_search.rng ^= g_search.rng >> 27;
+  return g_search.rng * 0x2545F4914F6CDD1DULL;
+}
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Read a counter (0 if it is not opened) */
+static inline uint64_t read_counter(int fd) {
+  uint64_t value = 0;
+  if (fd >= 0 && read(fd, &value, sizeof(value)) != sizeof(value)) value = 0;
+  return value;
+}
+
+int main(int argc, char* argv[]) {
+  const char* output = "adversary.memlog";
+  const char* input = NULL;
+  genome_t best, candidate;
+  trace_t trace;
+  size_t length = DEFAULT_LENGTH;
+  size_t iteration = DEFAULT_ITERATION;
+  size_t capacity;
+  size_t i;
+  size_t failure_nr = 0;
+  double best_score, score;
+  char result[64];
+  uint64_t seed = 1;
+  int status;
+  int opt;
+
+  g_search.metric   = METRIC_NB;
+  g_search.size_min = DEFAULT_SIZE_MIN;
+  g_search.size_max = DEFAULT_SIZE_MAX;
+  while ((opt = getopt(argc, argv, "n:l:s:i:o:z:Z:")) != -1) {
+    switch (opt) {
+    case 'n': iteration = strtoul(optarg, NULL, 10); break;
+    case 'l': length = strtoul(optarg, NULL, 10); break;
+    case 's': seed = strtoull(optarg, NULL, 0); break;
+    case 'i': input = optarg; break;
+    case 'o': output = optarg; break;
+    case 'z': g_search.size_min = strtoul(optarg, NULL, 10); break;
+    case 'Z': g_search.size_max = strtoul(optarg, NULL, 10); break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind + 2 > argc) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  g_search.allocator = atoi(argv[optind]);
+  for (i = 0; i < METRIC_NB; ++i) {
+    if (strcmp(argv[optind + 1], metric_name[i]) == 0) g_search.metric = i;
+  }
+  if (g_search.allocator < 0 || g_search.allocator >= ALLOC_NB ||
+      g_search.metric == METRIC_NB || length == 0 ||
+      g_search.size_min == 0 || g_search.size_min > g_search.size_max) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (g_search.metric == METRIC_SYSCALL &&
+      getsyscall_funcs[g_search.allocator] == NULL) {
+    fprintf(stderr, "%s cannot count system calls\n",
+      allocator_name[g_search.allocator]);
+    return EXIT_FAILURE;
+  }
+  if (g_search.metric == METRIC_MOVED &&
+      getmoved_funcs[g_search.allocator] == NULL) {
+    fprintf(stderr, "%s cannot count moved bytes\n",
+      allocator_name[g_search.allocator]);
+    return EXIT_FAILURE;
+  }
+  g_search.rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+  if (g_search.rng == 0) g_search.rng = 1;
+
+  capacity = 2 * length;
+  if (input != NULL) {
+    load_genome(input, &best, &capacity);
+  } else {
+    best.genes = malloc(capacity * sizeof(gene_t));
+    if (best.genes == NULL) {
+      perror("malloc");
+      return EXIT_FAILURE;
+    }
+    best.nr = length;
+    for (i = 0; i < length; ++i) random_gene(&best.genes[i]);
+  }
+  candidate.genes = malloc(capacity * sizeof(gene_t));
+  trace.commands  = malloc(capacity * sizeof(command_t));
+  if (candidate.genes == NULL || trace.commands == NULL) {
+    perror("malloc");
+    return EXIT_FAILURE;
+  }
+
+  decode(&best, &trace);
+  best_score = evaluate(&trace, &status);
+  if (child_failed(status)) {
+    save_failure(output, 0, &trace, status, argc, argv);
+    return EXIT_FAILURE;
+  }
+  if (isnan(best_score)) {
+    fprintf(stderr, "%s cannot be evaluated by '%s'\n",
+      allocator_name[g_search.allocator], metric_name[g_search.metric]);
+    return EXIT_FAILURE;
+  }
+  printf("%s, %s, initial %g\n", allocator_name[g_search.allocator],
+    metric_name[g_search.metric], best_score);
+
+  /* Hill climbing. Candidates as good as the best are accepted to move
+     across plateaus. */
+  for (i = 1; i <= iteration; ++i) {
+    candidate.nr = best.nr;
+    memcpy(candidate.genes, best.genes, best.nr * sizeof(gene_t));
+    mutate(&candidate, capacity);
+    decode(&candidate, &trace);
+    score = evaluate(&trace, &status);
+    /* A trace breaking the allocator is the worst case of all, but it
+       cannot be scored, so it is kept aside and the search goes on */
+    if (child_failed(status)) {
+      save_failure(output, i, &trace, status, argc, argv);
+      failure_nr++;
+      continue;
+    }
+    if (isnan(score) || score < best_score) continue;
+    if (score > best_score) {
+      printf("%8zu %g\n", i, score);
+      fflush(stdout);
+    }
+    best_score = score;
+    best.nr = candidate.nr;
+    memcpy(best.genes, candidate.genes, candidate.nr * sizeof(gene_t));
+  }
+
+  decode(&best, &trace);
+  snprintf(result, sizeof(result), "%s = %g", metric_name[g_search.metric],
+    best_score);
+  write_trace(output, &trace, result, argc, argv);
+  printf("best %g, %zu commands written to %s\n", best_score, trace.nr,
+    output);
+  if (failure_nr > 0) {
+    printf("%zu candidates made %s fail\n", failure_nr,
+      allocator_name[g_search.allocator]);
+  }
+
+  free(trace.commands);
+  free(candidate.genes);
+  free(best.genes);
+  return failure_nr > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void decode(const genome_t* genome, trace_t* trace) {
+  static size_t* live = NULL;
+  static size_t* sizes = NULL;
+  static size_t* free_ids = NULL;
+  static size_t capacity = 0;
+  size_t live_nr = 0, free_id_nr = 0, id_nr = 0;
+  size_t curr_size = 0;
+  size_t i, j, pos, idx;
+  command_t* command;
+  gene_t gene;
+
+  if (capacity < genome->nr) {
+    capacity = genome->nr;
+    live     = realloc(live, capacity * sizeof(size_t));
+    sizes    = realloc(sizes, capacity * sizeof(size_t));
+    free_ids = realloc(free_ids, capacity * sizeof(size_t));
+    if (live == NULL || sizes == NULL || free_ids == NULL) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  trace->nr           = 0;
+  trace->mem_min      = SIZE_MAX;
+  trace->mem_max      = 0;
+  trace->require_size = 0;
+  for (i = 0; i < genome->nr; ++i) {
+    gene = genome->genes[i];
+    if (live_nr == 0) gene.kind = GENE_ALLOCATE;
+    command = &trace->commands[trace->nr++];
+    memset(command, 0, sizeof(command_t));
+    command->line = trace->nr;
+    command->timestamp = MEMLOG_NO_TIMESTAMP;
+
+    if (gene.kind == GENE_ALLOCATE) {
+      /* The smallest free idx keeps ids dense */
+      if (free_id_nr > 0) {
+        pos = 0;
+        for (j = 1; j < free_id_nr; ++j) {
+          if (free_ids[j] < free_ids[pos]) pos = j;
+        }
+        idx = free_ids[pos];
+        free_ids[pos] = free_ids[--free_id_nr];
+      } else {
+        idx = id_nr++;
+      }
+      live[live_nr++] = idx;
+      sizes[idx] = gene.size;
+      curr_size += gene.size;
+      command->type = COMMAND_ALLOCATE;
+      command->idx  = idx;
+      command->size = gene.size;
+    } else {
+      pos = gene.target % live_nr;
+      idx = live[pos];
+      command->idx = idx;
+      if (gene.kind == GENE_DEALLOCATE) {
+        live[pos] = live[--live_nr];
+        free_ids[free_id_nr++] = idx;
+        curr_size -= sizes[idx];
+        command->type = COMMAND_DEALLOCATE;
+        continue;
+      }
+      curr_size = curr_size - sizes[idx] + gene.size;
+      sizes[idx] = gene.size;
+      command->type = COMMAND_REALLOCATE;
+      command->size = gene.size;
+    }
+    if (gene.size < trace->mem_min) trace->mem_min = gene.size;
+    if (gene.size > trace->mem_max) trace->mem_max = gene.size;
+    if (curr_size > trace->require_size) trace->require_size = curr_size;
+  }
+  trace->block_max = id_nr;
+}
+
+static double evaluate(const trace_t* trace, int* status) {
+  double score = NAN;
+  int fds[2];
+  pid_t pid;
+
+  /* Each trace is replayed by a new instance in a child process because
+     some allocators can be initialized only once in a process. */
+  if (pipe(fds) < 0) {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid > 0) {
+    close(fds[1]);
+    if (read(fds[0], &score, sizeof(score)) != sizeof(score)) score = NAN;
+    close(fds[0]);
+    if (waitpid(pid, status, 0) < 0) {
+      perror("waitpid");
+      exit(EXIT_FAILURE);
+    }
+    return score;
+  }
+  close(fds[0]);
+  score = replay(trace);
+  if (write(fds[1], &score, sizeof(score)) != sizeof(score)) _exit(1);
+  _exit(0);
+}
+
+static bool child_failed(int status) {
+  return WIFSIGNALED(status) ||
+    (WIFEXITED(status) && WEXITSTATUS(status) != 0);
+}
+
+static void save_failure(const char* output, size_t iteration,
+    const trace_t* trace, int status, int argc, char* argv[]) {
+  const char* suffix = ".memlog";
+  size_t length = strlen(output);
+  char filename[PATH_MAX];
+  char result[64];
+
+  /* adversary.memlog -> adversary.fail<iteration>.memlog */
+  if (length >= strlen(suffix) &&
+      strcmp(output + length - strlen(suffix), suffix) == 0) {
+    length -= strlen(suffix);
+  }
+  snprintf(filename, sizeof(filename), "%.*s.fail%zu.memlog", (int)length,
+    output, iteration);
+  if (WIFSIGNALED(status)) {
+    snprintf(result, sizeof(result), "failed (killed by %s)",
+      strsignal(WTERMSIG(status)));
+  } else {
+    snprintf(result, sizeof(result), "failed (exit status %d)",
+      WEXITSTATUS(status));
+  }
+  write_trace(filename, trace, result, argc, argv);
+  printf("%8zu %s: %s, %zu commands written to %s\n", iteration,
+    allocator_name[g_search.allocator], result, trace->nr, filename);
+  fflush(stdout);
+}
+
+static double replay(const trace_t* trace) {
+  int allocator = g_search.allocator;
+  getsyscall_t getsyscall = getsyscall_funcs[allocator];
+  getmoved_t getmoved = getmoved_funcs[allocator];
+  /* Sizes of live blocks for the peak of them */
+  size_t* sizes = calloc(trace->block_max, sizeof(size_t));
+  size_t peak_live = 0, peak_usage = 0, curr_size = 0;
+  size_t requested = 0;
+  size_t syscall_start = 0, moved_start = 0;
+  uint64_t worst = 0, start, cost;
+  int fd = -1;
+  size_t i;
+  command_t command;
+
+  if (sizes == NULL) return NAN;
+  init_funcs[allocator](trace->mem_min, trace->mem_max, trace->block_max,
+    trace->require_size);
+  if (g_search.metric == METRIC_INSTRUCTION) {
+    fd = open_instruction_counter();
+    if (fd < 0) return NAN;
+  }
+  if (getsyscall != NULL) syscall_start = getsyscall();
+  if (getmoved != NULL) moved_start = getmoved();
+
+  for (i = 0; i < trace->nr; ++i) {
+    command = trace->commands[i];
+    start = fd >= 0 ? read_counter(fd) : now_ns();
+    if (command.type == COMMAND_ALLOCATE) {
+      allocate_funcs[allocator](command.idx, command.size);
+    } else if (command.type == COMMAND_DEALLOCATE) {
+      deallocate_funcs[allocator](command.idx);
+    } else {
+      reallocate_funcs[allocator](command.idx, command.size);
+    }
+    cost = (fd >= 0 ? read_counter(fd) : now_ns()) - start;
+    if (cost > worst) worst = cost;
+
+    /* Blocks are not dereferenced, which would change the state of the
+       allocators measured (e.g. the page tables of VMF) */
+    if (command.type == COMMAND_DEALLOCATE) {
+      curr_size -= sizes[command.idx];
+      sizes[command.idx] = 0;
+    } else {
+      curr_size = curr_size - sizes[command.idx] + command.size;
+      requested += command.size;
+      sizes[command.idx] = command.size;
+    }
+    if (g_search.metric == METRIC_PEAK_RATIO) {
+      if (curr_size > peak_live) peak_live = curr_size;
+      if (getsize_funcs[allocator]() > peak_usage) {
+        peak_usage = getsize_funcs[allocator]();
+      }
+    }
+  }
+
+  switch (g_search.metric) {
+  case METRIC_INSTRUCTION:
+  case METRIC_TIME:
+    return (double)worst;
+  case METRIC_MOVED:
+    return requested == 0 ? 0.0 :
+      (double)(getmoved() - moved_start) / requested;
+  case METRIC_SYSCALL:
+    return (double)(getsyscall() - syscall_start) / trace->nr;
+  case METRIC_PEAK_RATIO:
+    return peak_live == 0 ? 0.0 : (double)peak_usage / peak_live;
+  default:
+    return NAN;
+  }
+}
+
+static void mutate(genome_t* genome, size_t capacity) {
+  size_t nr = 1 + rand_u64() % MUTATION_MAX;
+  size_t i, pos, other;
+  gene_t* gene;
+  gene_t tmp;
+
+  for (i = 0; i < nr; ++i) {
+    pos = rand_u64() % genome->nr;
+    gene = &genome->genes[pos];
+    switch (rand_u64() % 6) {
+    case 0:
+      /* Double or halve the size */
+      if (rand_u64() & 1) {
+        if (gene->size * 2 <= g_search.size_max) gene->size *= 2;
+      } else {
+        if (gene->size / 2 >= g_search.size_min) gene->size /= 2;
+      }
+      break;
+    case 1:
+      /* Shift the size slightly, e.g. across a size class */
+      if (rand_u64() & 1) {
+        if (gene->size < g_search.size_max) gene->size++;
+      } else {
+        if (gene->size > g_search.size_min) gene->size--;
+      }
+      break;
+    case 2:
+      gene->kind = rand_u64() % GENE_KIND_NB;
+      break;
+    case 3:
+      gene->target = (uint32_t)rand_u64();
+      break;
+    case 4:
+      other = rand_u64() % genome->nr;
+      tmp = genome->genes[other];
+      genome->genes[other] = *gene;
+      *gene = tmp;
+      break;
+    default:
+      /* Insert or delete a gene */
+      if ((rand_u64() & 1) && genome->nr < capacity) {
+        memmove(gene + 1, gene, (genome->nr - pos) * sizeof(gene_t));
+        random_gene(gene);
+        genome->nr++;
+      } else if (genome->nr > 1) {
+        memmove(gene, gene + 1, (genome->nr - pos - 1) * sizeof(gene_t));
+        genome->nr--;
+      }
+      break;
+    }
+  }
+}
+
+static void random_gene(gene_t* gene) {
+  double log_min = log((double)g_search.size_min);
+  double log_max = log((double)g_search.size_max);
+  double u = (rand_u64() >> 11) * (1.0 / 9007199254740992.0);
+
+  gene->kind   = rand_u64() % GENE_KIND_NB;
+  gene->target = (uint32_t)rand_u64();
+  /* Sizes are log-uniform so that every size class appears */
+  gene->size   = (uint32_t)exp(log_min + (log_max - log_min) * u);
+  if (gene->size < g_search.size_min) gene->size = g_search.size_min;
+  if (gene->size > g_search.size_max) gene->size = g_search.size_max;
+}
+
+static void load_genome(const char* filename, genome_t* genome,
+    size_t* capacity) {
+  memlog_stream_t* memlog = memlog_stream_open(filename);
+  size_t* live = malloc(memlog->block_max * sizeof(size_t));
+  /* Commands on blocks which are not live target the position 0 */
+  size_t* live_pos = calloc(memlog->block_max, sizeof(size_t));
+  size_t live_nr = 0;
+  command_t command;
+  enum command_type kind;
+  gene_t* gene;
+
+  if (live == NULL || live_pos == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  genome->nr = 0;
+  genome->genes = NULL;
+  *capacity = 0;
+  /* Targets are positions in the live list maintained as decode() does */
+  while (memlog_stream_next(memlog, &command)) {
+    kind = command_kind(command.type);
+    if (kind != COMMAND_ALLOCATE && kind != COMMAND_DEALLOCATE &&
+        kind != COMMAND_REALLOCATE) {
+      continue;
+    }
+    if (genome->nr == *capacity) {
+      *capacity = *capacity == 0 ? 1024 : 2 * *capacity;
+      genome->genes = realloc(genome->genes, *capacity * sizeof(gene_t));
+      if (genome->genes == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+    }
+    gene = &genome->genes[genome->nr++];
+    gene->target = 0;
+    gene->size   = (uint32_t)command.size;
+    if (kind == COMMAND_ALLOCATE) {
+      gene->kind = GENE_ALLOCATE;
+      live_pos[command.idx] = live_nr;
+      live[live_nr++] = command.idx;
+    } else if (kind == COMMAND_DEALLOCATE) {
+      gene->kind = GENE_DEALLOCATE;
+      gene->target = (uint32_t)live_pos[command.idx];
+      live[live_pos[command.idx]] = live[--live_nr];
+      live_pos[live[live_pos[command.idx]]] = live_pos[command.idx];
+    } else {
+      gene->kind = GENE_REALLOCATE;
+      gene->target = (uint32_t)live_pos[command.idx];
+    }
+  }
+  /* Room for insertions */
+  *capacity = 2 * genome->nr + 1;
+  genome->genes = realloc(genome->genes, *capacity * sizeof(gene_t));
+  if (genome->genes == NULL || genome->nr == 0) {
+    fprintf(stderr, "no command in %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  memlog_stream_close(memlog);
+  free(live_pos);
+  free(live);
+}
+
+static void write_trace(const char* filename, const trace_t* trace,
+    const char* result, int argc, char* argv[]) {
+  FILE* fp = fopen(filename, "w");
+  const command_t* command;
+  size_t i;
+  int j;
+
+  if (fp == NULL) {
+    perror(filename);
+    exit(EXIT_FAILURE);
+  }
+  fprintf(fp, "# %s %s by", allocator_name[g_search.allocator], result);
+  for (j = 0; j < argc; ++j) fprintf(fp, " %s", argv[j]);
+  fputc('\n', fp);
+  for (i = 0; i < trace->nr; ++i) {
+    command = &trace->commands[i];
+    if (command->type == COMMAND_ALLOCATE) {
+      fprintf(fp, "m %zu %zu\n", command->idx, command->size);
+    } else if (command->type == COMMAND_DEALLOCATE) {
+      fprintf(fp, "f %zu\n", command->idx);
+    } else {
+      fprintf(fp, "r %zu %zu\n", command->idx, command->size);
+    }
+  }
+  fclose(fp);
+}
+
+static int open_instruction_counter(void) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = PERF_TYPE_HARDWARE;
+  attr.config         = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv     = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void print_usage(const char* program_name) {
+  int i;
+  printf("%s [options] <allocator number> <metric>\n", program_name);
+  printf("Search a trace maximizing the metric by hill climbing.\n");
+  printf("Metrics:\n");
+  printf("  inst     maximum user-space instructions of an operation\n");
+  printf("  time     maximum latency of an operation [ns]\n");
+  printf("  moved    bytes copied to move blocks / bytes requested\n");
+  printf("  syscall  system calls per operation\n");
+  printf("  peak     peak memory usage / peak size of live blocks\n");
+  printf("Options:\n");
+  printf("  -n <N>       number of candidates (default %d)\n",
+    DEFAULT_ITERATION);
+  printf("  -l <L>       initial number of commands (default %d)\n",
+    DEFAULT_LENGTH);
+  printf("  -z <size>    minimum block size (default %d)\n",
+    DEFAULT_SIZE_MIN);
+  printf("  -Z <size>    maximum block size (default %d)\n",
+    DEFAULT_SIZE_MAX);
+  printf("  -i <memlog>  start from the trace instead of a random one\n");
+  printf("  -s <seed>    seed of random numbers (default 1)\n");
+  printf("  -o <file>    output memlog (default adversary.memlog)\n");
+  putchar('\n');
+  printf(" Number |        Allocator Name \n");
+  printf("--------+-----------------------\n");
+  for (i = 0; i < ALLOC_NB; ++i) {
+    printf("%7d | %21s\n", i, allocator_name[i]);
+  }
+}
@@ -18,11 +18,15 @@
   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
+#define _GNU_SOURCE /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "allocator.h"
+#include "dma.h"
 #include "multiheap_fit.h"
 #include "virtual_multiheap_fit.h"
 #include "malloc.h"
@@ -36,7 +40,6 @@
 #endif
 
 #ifdef ENABLE_CF
-#include <sys/mman.h>
 #include "cf.h"
 #endif
 
@@ -49,9 +52,52 @@
 #define NO_OPTIMIZE __attribute__((optimize("0")))
 #endif /* INSTRUCTION_COUNTER_ENABLE */
 
+/* If THREAD_LOCAL_ALLOCATOR is set, each thread has its own instance
+   created by calling 'init_funcs' in the thread. */
+#ifndef THREAD_LOCAL_ALLOCATOR
+#  define THREAD_LOCAL_ALLOCATOR 0
+#endif
+#if THREAD_LOCAL_ALLOCATOR
+#  define ALLOCATOR_LOCAL __thread
+#else
+#  define ALLOCATOR_LOCAL
+#endif
+
 #define ALLOCATOR_MAX(x, y) ((x) > (y) ? (x) : (y))
 #define ALLOCATOR_MIN(x, y) ((x) < (y) ? (x) : (y))
 
+/* Replay loops are instantiated per allocator by DEFINE_REPLAY with the
+   wrappers inlined into them */
+#if defined(__GNUC__) && !defined(INSTRUCTION_COUNTER_ENABLE)
+#  define REPLAY_FLATTEN __attribute__((flatten))
+#else
+#  define REPLAY_FLATTEN
+#endif
+
+#define DEFINE_REPLAY(name)                                               \
+  static void REPLAY_FLATTEN replay_##name(                               \
+      const replay_command_t* commands, size_t nr) {                      \
+    const replay_command_t* end = commands + nr;                          \
+    for (; commands != end; ++commands) {                                 \
+      switch (commands->kind) {                                           \
+      case REPLAY_ALLOCATE:                                               \
+        allocate_##name(commands->idx, commands->size);                   \
+        break;                                                            \
+      case REPLAY_DEALLOCATE:                                             \
+        deallocate_##name(commands->idx);                                 \
+        break;                                                            \
+      case REPLAY_REALLOCATE:                                             \
+        reallocate_##name(commands->idx, commands->size);                 \
+        break;                                                            \
+      }                                                                   \
+    }                                                                     \
+  }
+
+/* Alignment of blocks in the arena allocator */
+#define ARENA_ALIGN 16
+/* Initial size of the arena */
+#define ARENA_INITIAL_SIZE (1 << 20)
+
 /* structure to store addresses and lengths of memory blocks. */
 typedef struct {
   void** addrs;
@@ -64,7 +110,7 @@ typedef struct {
 #endif /* MEMORY_TEST */
 } block_info_t;
 
-static block_info_t g_binfo;
+static ALLOCATOR_LOCAL block_info_t g_binfo;
 static inline void* ptr_diff(void* addr, ptrdiff_t diff);
 static inline void binfo_init(size_t id_num);
 static inline void binfo_malloc(size_t idx, void* addr, size_t len);
@@ -75,8 +121,24 @@ static inline void* binfo_dereference(size_t idx);
 static inline size_t binfo_getsize(void);
 #endif /* MEMORY_TEST */
 
+/* glibc functions, whose <malloc.h> is shadowed by the one of DL malloc */
+struct glibc_mallinfo2 {
+  size_t arena;
+  size_t ordblks;
+  size_t smblks;
+  size_t hblks;
+  size_t hblkhd;
+  size_t usmblks;
+  size_t fsmblks;
+  size_t uordblks;
+  size_t fordblks;
+  size_t keepcost;
+};
+extern struct glibc_mallinfo2 mallinfo2(void);
+extern int malloc_trim(size_t pad);
+
 /* Multiheap-fit */
-static mf_t mf;
+static ALLOCATOR_LOCAL mf_t mf;
 static void init_mf(size_t mem_min, size_t mem_max,
     size_t id_num, size_t require_size) {
   mf = mf_init(mem_min, mem_max, id_num, require_size);
@@ -102,6 +164,24 @@ static size_t getsize_mf(void) {
   return mf_using_mem(mf);
 }
 
+static size_t getsyscall_mf(void) {
+  mf_stat_t stat;
+  mf_get_stat(mf, &stat);
+  return stat.mmap_nr + stat.unmap_nr;
+}
+
+static size_t getmoved_mf(void) {
+  mf_stat_t stat;
+  mf_get_stat(mf, &stat);
+  return stat.moved_bytes;
+}
+
+static size_t getpool_mf(void) {
+  mf_stat_t stat;
+  mf_get_stat(mf, &stat);
+  return stat.pool_bytes + stat.garbage_bytes;
+}
+
 #ifdef INSTRUCTION_COUNTER_ENABLE
 static void NO_OPTIMIZE allocate_measure_mf(size_t idx, size_t size) {
   instruction_count_start();
@@ -123,7 +203,7 @@ static void NO_OPTIMIZE reallocate_measure_mf(size_t idx, size_t size) {
 #endif /* INSTRUCTION_COUNTER_ENABLE */
 
 /* Virtual Multiheap-fit */
-static vmf_t vmf;
+static ALLOCATOR_LOCAL vmf_t vmf;
 static void init_vmf(size_t mem_min, size_t mem_max,
     size_t id_num, size_t require_size) {
   vmf = vmf_init(mem_min, mem_max, id_num, require_size);
@@ -149,6 +229,24 @@ static size_t getsize_vmf(void) {
   return vmf_using_mem(vmf);
 }
 
+static size_t getsyscall_vmf(void) {
+  vmf_stat_t stat;
+  vmf_get_stat(vmf, &stat);
+  return stat.mmap_nr + stat.unmap_nr + stat.mremap_nr + stat.driver_nr;
+}
+
+static size_t getmoved_vmf(void) {
+  vmf_stat_t stat;
+  vmf_get_stat(vmf, &stat);
+  return stat.moved_bytes;
+}
+
+static size_t getpool_vmf(void) {
+  vmf_stat_t stat;
+  vmf_get_stat(vmf, &stat);
+  return stat.pool_bytes;
+}
+
 #ifdef INSTRUCTION_COUNTER_ENABLE
 static void NO_OPTIMIZE allocate_measure_vmf(size_t idx, size_t size) {
   instruction_count_start();
@@ -170,7 +268,7 @@ static void NO_OPTIMIZE reallocate_measure_vmf(size_t idx, size_t size) {
 #endif /* INSTRUCTION_COUNTER_ENABLE */
 
 /* DLmalloc */
-static mspace msp;
+static ALLOCATOR_LOCAL mspace msp;
 static void init_dl(size_t mem_min, size_t mem_max,
     size_t id_num, size_t require_size) {
   msp = create_mspace(0, 0);
@@ -399,6 +497,469 @@ static void NO_OPTIMIZE reallocate_measure_cf(size_t idx, size_t size) {
 #endif /* INSTRUCTION_COUNTER_ENABLE */
 #endif /* ENABLE_CF */
 
+/* Hybrid of Multiheap-fit and Virtual Multiheap-fit.
+   The threshold is given by the environment variable DMA_HYBRID_THRESHOLD. */
+static ALLOCATOR_LOCAL dma_t hybrid;
+static void init_hybrid(size_t mem_min, size_t mem_max,
+    size_t id_num, size_t require_size) {
+  hybrid = dma_init_hybrid(mem_min, mem_max, id_num, require_size, 0);
+}
+
+static void allocate_hybrid(size_t idx, size_t size) {
+  dma_allocate(hybrid, idx, size);
+}
+
+static void deallocate_hybrid(size_t idx) {
+  dma_deallocate(hybrid, idx);
+}
+
+static void reallocate_hybrid(size_t idx, size_t size) {
+  dma_reallocate(hybrid, idx, size);
+}
+
+static void* dereference_hybrid(size_t idx) {
+  return dma_dereference(hybrid, idx);
+}
+
+static size_t getsize_hybrid(void) {
+  return dma_using_mem(hybrid);
+}
+
+static size_t getsyscall_hybrid(void) {
+  return dma_syscall_count(hybrid);
+}
+
+static size_t getmoved_hybrid(void) {
+  return dma_moved_bytes(hybrid);
+}
+
+#ifdef INSTRUCTION_COUNTER_ENABLE
+static void NO_OPTIMIZE allocate_measure_hybrid(size_t idx, size_t size) {
+  instruction_count_start();
+  dma_allocate(hybrid, idx, size);
+  instruction_count_end();
+}
+
+static void NO_OPTIMIZE deallocate_measure_hybrid(size_t idx) {
+  instruction_count_start();
+  dma_deallocate(hybrid, idx);
+  instruction_count_end();
+}
+
+static void NO_OPTIMIZE reallocate_measure_hybrid(size_t idx, size_t size) {
+  instruction_count_start();
+  dma_reallocate(hybrid, idx, size);
+  instruction_count_end();
+}
+#endif /* INSTRUCTION_COUNTER_ENABLE */
+
+/* malloc of glibc.
+   Tunables are given by GLIBC_TUNABLES, and malloc_trim is called every
+   GLIBC_TRIM_INTERVAL deallocations if the environment variable is set. */
+static ALLOCATOR_LOCAL struct {
+  size_t trim_interval;
+  size_t free_count;
+  /* Memory obtained before the initialization */
+  size_t base_size;
+} g_glibc;
+
+static size_t glibc_footprint(void) {
+  struct glibc_mallinfo2 info = mallinfo2();
+  return info.arena + info.hblkhd;
+}
+
+static void init_glibc(size_t mem_min, size_t mem_max,
+    size_t id_num, size_t require_size) {
+  const char* interval = getenv("GLIBC_TRIM_INTERVAL");
+
+  binfo_init(id_num);
+  g_glibc.trim_interval = interval != NULL ? strtoul(interval, NULL, 10) : 0;
+  g_glibc.free_count    = 0;
+  g_glibc.base_size     = glibc_footprint();
+}
+
+static void allocate_glibc(size_t idx, size_t size) {
+  void* addr = malloc(size);
+  binfo_malloc(idx, addr, size);
+}
+
+static void deallocate_glibc(size_t idx) {
+  void* addr = binfo_dereference(idx);
+  free(addr);
+  binfo_free(idx);
+  if (g_glibc.trim_interval != 0 &&
+      ++g_glibc.free_count % g_glibc.trim_interval == 0) {
+    malloc_trim(0);
+  }
+}
+
+static void reallocate_glibc(size_t idx, size_t size) {
+  void* old_addr = binfo_dereference(idx);
+  void* new_addr = realloc(old_addr, size);
+  binfo_realloc(idx, new_addr, size);
+}
+
+static void* dereference_glibc(size_t idx) {
+  return binfo_dereference(idx);
+}
+
+static size_t getsize_glibc(void) {
+  /* Memory of the harness is also counted after the initialization */
+  size_t size = glibc_footprint();
+  return size > g_glibc.base_size ? size - g_glibc.base_size : 0;
+}
+
+#ifdef INSTRUCTION_COUNTER_ENABLE
+static void NO_OPTIMIZE allocate_measure_glibc(size_t idx, size_t size) {
+  void* addr;
+  instruction_count_start();
+  addr = malloc(size);
+  instruction_count_end();
+
+  binfo_malloc(idx, addr, size);
+}
+
+static void NO_OPTIMIZE deallocate_measure_glibc(size_t idx) {
+  void* addr = binfo_dereference(idx);
+  instruction_count_start();
+  free(addr);
+  instruction_count_end();
+
+  binfo_free(idx);
+}
+
+static void NO_OPTIMIZE reallocate_measure_glibc(size_t idx, size_t size) {
+  void* old_addr = binfo_dereference(idx);
+  void* new_addr;
+  instruction_count_start();
+  new_addr = realloc(old_addr, size);
+  instruction_count_end();
+
+  binfo_realloc(idx, new_addr, size);
+}
+#endif /* INSTRUCTION_COUNTER_ENABLE */
+
+/* mmap for each block, which never fragments but issues system calls */
+typedef struct {
+  /* Mapped length of each block */
+  size_t* lens;
+  size_t mapped_size;
+  size_t syscall_nr;
+} mmap_alloc_t;
+
+static ALLOCATOR_LOCAL mmap_alloc_t g_mmap;
+static size_t g_page_size;
+
+static inline size_t page_round(size_t size) {
+  if (size == 0) size = 1;
+  return (size + g_page_size - 1) & ~(g_page_size - 1);
+}
+
+static void init_mmap(size_t mem_min, size_t mem_max,
+    size_t id_num, size_t require_size) {
+  binfo_init(id_num);
+  g_page_size = (size_t)sysconf(_SC_PAGESIZE);
+  g_mmap.lens = calloc(id_num, sizeof(size_t));
+  if (g_mmap.lens == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  g_mmap.mapped_size = 0;
+  g_mmap.syscall_nr  = 0;
+}
+
+static void allocate_mmap(size_t idx, size_t size) {
+  size_t len = page_round(size);
+  void* addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  g_mmap.syscall_nr++;
+  if (addr == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+  g_mmap.lens[idx] = len;
+  g_mmap.mapped_size += len;
+  binfo_malloc(idx, addr, size);
+}
+
+static void deallocate_mmap(size_t idx) {
+  munmap(binfo_dereference(idx), g_mmap.lens[idx]);
+  g_mmap.syscall_nr++;
+  g_mmap.mapped_size -= g_mmap.lens[idx];
+  g_mmap.lens[idx] = 0;
+  binfo_free(idx);
+}
+
+static void reallocate_mmap(size_t idx, size_t size) {
+  size_t len = page_round(size);
+  void* addr = binfo_dereference(idx);
+
+  /* A block never allocated is allocated, as realloc(NULL, size) */
+  if (g_mmap.lens[idx] == 0) {
+    allocate_mmap(idx, size);
+    return;
+  }
+  if (len != g_mmap.lens[idx]) {
+    addr = mremap(addr, g_mmap.lens[idx], len, MREMAP_MAYMOVE);
+    g_mmap.syscall_nr++;
+    if (addr == MAP_FAILED) {
+      perror("mremap");
+      exit(EXIT_FAILURE);
+    }
+    g_mmap.mapped_size = g_mmap.mapped_size - g_mmap.lens[idx] + len;
+    g_mmap.lens[idx] = len;
+  }
+  binfo_realloc(idx, addr, size);
+}
+
+static void* dereference_mmap(size_t idx) {
+  return binfo_dereference(idx);
+}
+
+static size_t getsize_mmap(void) {
+  return g_mmap.mapped_size;
+}
+
+static size_t getsyscall_mmap(void) {
+  return g_mmap.syscall_nr;
+}
+
+#ifdef INSTRUCTION_COUNTER_ENABLE
+static void NO_OPTIMIZE allocate_measure_mmap(size_t idx, size_t size) {
+  instruction_count_start();
+  allocate_mmap(idx, size);
+  instruction_count_end();
+}
+
+static void NO_OPTIMIZE deallocate_measure_mmap(size_t idx) {
+  instruction_count_start();
+  deallocate_mmap(idx);
+  instruction_count_end();
+}
+
+static void NO_OPTIMIZE reallocate_measure_mmap(size_t idx, size_t size) {
+  instruction_count_start();
+  reallocate_mmap(idx, size);
+  instruction_count_end();
+}
+#endif /* INSTRUCTION_COUNTER_ENABLE */
+
+/* Naive moving allocator.
+   Blocks are placed in order at the top of an arena and referenced through
+   handles (offsets). When the top reaches the end of the arena, all live
+   blocks are slid to the front by memmove, and the arena is doubled by
+   mremap if live blocks still occupy more than a half of it. */
+typedef struct {
+  size_t idx;
+  size_t offset;
+} arena_entry_t;
+
+typedef struct {
+  uint8_t* base;
+  size_t capacity;
+  size_t top;
+  /* Offset and rounded size of each block (size 0: not allocated) */
+  size_t* offsets;
+  size_t* sizes;
+  size_t live_size;
+  /* Blocks in address order. Entries whose offset differs from 'offsets'
+     are of deallocated or moved blocks, and removed by compaction. */
+  arena_entry_t* order;
+  size_t order_nr;
+  size_t order_capacity;
+  size_t syscall_nr;
+  /* bytes slid by compaction */
+  size_t moved_bytes;
+} arena_t;
+
+static ALLOCATOR_LOCAL arena_t g_arena;
+
+static inline size_t arena_round(size_t size) {
+  if (size == 0) size = 1;
+  return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static void arena_compact(void) {
+  arena_entry_t entry;
+  size_t top = 0;
+  size_t nr = 0;
+  size_t i;
+
+  for (i = 0; i < g_arena.order_nr; ++i) {
+    entry = g_arena.order[i];
+    if (g_arena.sizes[entry.idx] == 0 ||
+        g_arena.offsets[entry.idx] != entry.offset) {
+      continue;
+    }
+    if (entry.offset != top) {
+      memmove(g_arena.base + top, g_arena.base + entry.offset,
+        g_arena.sizes[entry.idx]);
+      g_arena.offsets[entry.idx] = top;
+      g_arena.moved_bytes += g_arena.sizes[entry.idx];
+    }
+    g_arena.order[nr].idx    = entry.idx;
+    g_arena.order[nr].offset = top;
+    nr++;
+    top += g_arena.sizes[entry.idx];
+  }
+  g_arena.order_nr = nr;
+  g_arena.top      = top;
+}
+
+/* Make room for 'size' bytes at the top */
+static void arena_reserve(size_t size) {
+  size_t capacity;
+  void* base;
+
+  if (g_arena.top + size <= g_arena.capacity) return;
+  arena_compact();
+  if (2 * (g_arena.top + size) <= g_arena.capacity) return;
+
+  capacity = g_arena.capacity;
+  while (2 * (g_arena.top + size) > capacity) capacity *= 2;
+  base = mremap(g_arena.base, g_arena.capacity, capacity, MREMAP_MAYMOVE);
+  g_arena.syscall_nr++;
+  if (base == MAP_FAILED) {
+    perror("mremap");
+    exit(EXIT_FAILURE);
+  }
+  g_arena.base     = base;
+  g_arena.capacity = capacity;
+}
+
+/* Assign the top to the block 'idx' of rounded size 'size' */
+static void arena_place(size_t idx, size_t size) {
+  if (g_arena.order_nr == g_arena.order_capacity) {
+    g_arena.order_capacity *= 2;
+    g_arena.order = realloc(g_arena.order,
+      g_arena.order_capacity * sizeof(arena_entry_t));
+    if (g_arena.order == NULL) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  g_arena.order[g_arena.order_nr].idx    = idx;
+  g_arena.order[g_arena.order_nr].offset = g_arena.top;
+  g_arena.order_nr++;
+  g_arena.offsets[idx] = g_arena.top;
+  g_arena.sizes[idx]   = size;
+  g_arena.top         += size;
+  g_arena.live_size   += size;
+}
+
+static void init_arena(size_t mem_min, size_t mem_max,
+    size_t id_num, size_t require_size) {
+  g_arena.capacity = ARENA_INITIAL_SIZE;
+  g_arena.base = mmap(NULL, g_arena.capacity, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  g_arena.offsets = calloc(id_num, sizeof(size_t));
+  g_arena.sizes   = calloc(id_num, sizeof(size_t));
+  g_arena.order_capacity = ALLOCATOR_MAX(id_num, 1024);
+  g_arena.order   = malloc(g_arena.order_capacity * sizeof(arena_entry_t));
+  if (g_arena.base == MAP_FAILED || g_arena.offsets == NULL ||
+      g_arena.sizes == NULL || g_arena.order == NULL) {
+    perror("init_arena");
+    exit(EXIT_FAILURE);
+  }
+  g_arena.top        = 0;
+  g_arena.live_size  = 0;
+  g_arena.order_nr   = 0;
+  g_arena.syscall_nr = 1;
+  g_arena.moved_bytes = 0;
+}
+
+static void allocate_arena(size_t idx, size_t size) {
+  size = arena_round(size);
+  arena_reserve(size);
+  arena_place(idx, size);
+}
+
+static void deallocate_arena(size_t idx) {
+  /* The hole is left until the next compaction */
+  g_arena.live_size -= g_arena.sizes[idx];
+  g_arena.sizes[idx] = 0;
+}
+
+static void reallocate_arena(size_t idx, size_t size) {
+  size_t old_size = g_arena.sizes[idx];
+  size_t offset   = g_arena.offsets[idx];
+
+  size = arena_round(size);
+  if (size <= old_size) {
+    /* Shrink in place */
+    g_arena.sizes[idx] = size;
+    g_arena.live_size -= old_size - size;
+    if (offset + old_size == g_arena.top) g_arena.top = offset + size;
+    return;
+  }
+  if (offset + old_size == g_arena.top &&
+      offset + size <= g_arena.capacity) {
+    /* Extend the last block */
+    g_arena.sizes[idx] = size;
+    g_arena.live_size += size - old_size;
+    g_arena.top = offset + size;
+    return;
+  }
+
+  /* The old block stays live (and may be moved) while making room */
+  arena_reserve(size);
+  offset = g_arena.offsets[idx];
+  memcpy(g_arena.base + g_arena.top, g_arena.base + offset, old_size);
+  g_arena.live_size -= old_size;
+  arena_place(idx, size);
+}
+
+static void* dereference_arena(size_t idx) {
+  return g_arena.base + g_arena.offsets[idx];
+}
+
+static size_t getsize_arena(void) {
+  return g_arena.capacity;
+}
+
+static size_t getsyscall_arena(void) {
+  return g_arena.syscall_nr;
+}
+
+static size_t getmoved_arena(void) {
+  return g_arena.moved_bytes;
+}
+
+#ifdef INSTRUCTION_COUNTER_ENABLE
+static void NO_OPTIMIZE allocate_measure_arena(size_t idx, size_t size) {
+  instruction_count_start();
+  allocate_arena(idx, size);
+  instruction_count_end();
+}
+
+static void NO_OPTIMIZE deallocate_measure_arena(size_t idx) {
+  instruction_count_start();
+  deallocate_arena(idx);
+  instruction_count_end();
+}
+
+static void NO_OPTIMIZE reallocate_measure_arena(size_t idx, size_t size) {
+  instruction_count_start();
+  reallocate_arena(idx, size);
+  instruction_count_end();
+}
+#endif /* INSTRUCTION_COUNTER_ENABLE */
+
+DEFINE_REPLAY(mf)
+DEFINE_REPLAY(vmf)
+DEFINE_REPLAY(dl)
+#ifdef ENABLE_TLSF
+DEFINE_REPLAY(tlsf)
+#endif
+#ifdef ENABLE_CF
+DEFINE_REPLAY(cf)
+#endif
+DEFINE_REPLAY(hybrid)
+DEFINE_REPLAY(glibc)
+DEFINE_REPLAY(mmap)
+DEFINE_REPLAY(arena)
+
 const init_t        init_funcs[ALLOC_NB] = {
   init_mf, init_vmf, init_dl,
 #ifdef ENABLE_TLSF
@@ -407,6 +968,7 @@ const init_t        init_funcs[ALLOC_NB] = {
 #ifdef ENABLE_CF
   init_cf,
 #endif
+  init_hybrid, init_glibc, init_mmap, init_arena,
 };
 
 const allocate_t    allocate_funcs[ALLOC_NB] = {
@@ -417,6 +979,7 @@ const allocate_t    allocate_funcs[ALLOC_NB] = {
 #ifdef ENABLE_CF
   allocate_cf,
 #endif
+  allocate_hybrid, allocate_glibc, allocate_mmap, allocate_arena,
 };
 
 const deallocate_t  deallocate_funcs[ALLOC_NB] = {
@@ -427,6 +990,7 @@ const deallocate_t  deallocate_funcs[ALLOC_NB] = {
 #ifdef ENABLE_CF
   deallocate_cf,
 #endif
+  deallocate_hybrid, deallocate_glibc, deallocate_mmap, deallocate_arena,
 };
 
 const reallocate_t  reallocate_funcs[ALLOC_NB] = {
@@ -437,6 +1001,7 @@ const reallocate_t  reallocate_funcs[ALLOC_NB] = {
 #ifdef ENABLE_CF
   reallocate_cf,
 #endif
+  reallocate_hybrid, reallocate_glibc, reallocate_mmap, reallocate_arena,
 };
 
 const dereference_t dereference_funcs[ALLOC_NB] = {
@@ -447,6 +1012,7 @@ const dereference_t dereference_funcs[ALLOC_NB] = {
 #ifdef ENABLE_CF
   dereference_cf,
 #endif
+  dereference_hybrid, dereference_glibc, dereference_mmap, dereference_arena,
 };
 
 const getsize_t     getsize_funcs[ALLOC_NB] = {
@@ -457,6 +1023,100 @@ const getsize_t     getsize_funcs[ALLOC_NB] = {
 #ifdef ENABLE_CF
   getsize_cf,
 #endif
+  getsize_hybrid, getsize_glibc, getsize_mmap, getsize_arena,
+};
+
+const getsyscall_t  getsyscall_funcs[ALLOC_NB] = {
+  getsyscall_mf, getsyscall_vmf, NULL,
+#ifdef ENABLE_TLSF
+  NULL,
+#endif
+#ifdef ENABLE_CF
+  NULL,
+#endif
+  getsyscall_hybrid, NULL, getsyscall_mmap, getsyscall_arena,
+};
+
+const getmoved_t    getmoved_funcs[ALLOC_NB] = {
+  getmoved_mf, getmoved_vmf, NULL,
+#ifdef ENABLE_TLSF
+  NULL,
+#endif
+#ifdef ENABLE_CF
+  NULL,
+#endif
+  getmoved_hybrid, NULL, NULL, getmoved_arena,
+};
+
+const getpool_t     getpool_funcs[ALLOC_NB] = {
+  getpool_mf, getpool_vmf, NULL,
+#ifdef ENABLE_TLSF
+  NULL,
+#endif
+#ifdef ENABLE_CF
+  NULL,
+#endif
+  NULL, NULL, NULL, NULL,
+};
+
+const bool    allocator_multi_instance[ALLOC_NB] = {
+  false, true, true,
+#ifdef ENABLE_TLSF
+  false,
+#endif
+#ifdef ENABLE_CF
+  false,
+#endif
+  false, true, true, true,
+};
+
+/* Instances used by the calling thread */
+struct allocator_instance {
+  block_info_t binfo;
+  mf_t   mf;
+  vmf_t  vmf;
+  mspace msp;
+  dma_t  hybrid;
+  mmap_alloc_t mmap;
+  arena_t arena;
+};
+
+allocator_instance_t* allocator_get_instance(void) {
+  allocator_instance_t* instance = malloc(sizeof(allocator_instance_t));
+
+  if (instance == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  instance->binfo  = g_binfo;
+  instance->mf     = mf;
+  instance->vmf    = vmf;
+  instance->msp    = msp;
+  instance->hybrid = hybrid;
+  instance->mmap   = g_mmap;
+  instance->arena  = g_arena;
+  return instance;
+}
+
+void allocator_set_instance(const allocator_instance_t* instance) {
+  g_binfo = instance->binfo;
+  mf      = instance->mf;
+  vmf     = instance->vmf;
+  msp     = instance->msp;
+  hybrid  = instance->hybrid;
+  g_mmap  = instance->mmap;
+  g_arena = instance->arena;
+}
+
+const replay_t      replay_funcs[ALLOC_NB] = {
+  replay_mf, replay_vmf, replay_dl,
+#ifdef ENABLE_TLSF
+  replay_tlsf,
+#endif
+#ifdef ENABLE_CF
+  replay_cf,
+#endif
+  replay_hybrid, replay_glibc, replay_mmap, replay_arena,
 };
 
 const char*   allocator_name[ALLOC_NB] = {
@@ -465,8 +1125,9 @@ const char*   allocator_name[ALLOC_NB] = {
   "TLSF",
 #endif
 #ifdef ENABLE_CF
-  "Compact-fit"
+  "Compact-fit",
 #endif
+  "Hybrid", "glibc malloc", "mmap", "memmove arena",
 };
 
 #ifdef INSTRUCTION_COUNTER_ENABLE
@@ -478,6 +1139,8 @@ const allocate_t allocate_measure_funcs[ALLOC_NB] = {
 #ifdef ENABLE_CF
   allocate_measure_cf,
 #endif
+  allocate_measure_hybrid, allocate_measure_glibc, allocate_measure_mmap,
+  allocate_measure_arena,
 };
 
 const deallocate_t deallocate_measure_funcs[ALLOC_NB] = {
@@ -488,6 +1151,8 @@ const deallocate_t deallocate_measure_funcs[ALLOC_NB] = {
 #ifdef ENABLE_CF
   deallocate_measure_cf,
 #endif
+  deallocate_measure_hybrid, deallocate_measure_glibc, deallocate_measure_mmap,
+  deallocate_measure_arena,
 };
 
 const reallocate_t reallocate_measure_funcs[ALLOC_NB] = {
@@ -498,6 +1163,8 @@ const reallocate_t reallocate_measure_funcs[ALLOC_NB] = {
 #ifdef ENABLE_CF
   reallocate_measure_cf,
 #endif
+  reallocate_measure_hybrid, reallocate_measure_glibc, reallocate_measure_mmap,
+  reallocate_measure_arena,
 };
 #endif /* INSTRUCTION_COUNTER_ENABLE */
 
@@ -22,6 +22,8 @@
 #define ALLOCATORS_H__
 
 #include <stddef.h>  /* size_t */
+#include <stdint.h>
+#include <stdbool.h>
 
 /* Allocator IDs */
 enum Allocator {
@@ -37,6 +39,11 @@ enum Allocator {
   ALLOC_CF,   /* Compact-fit */
 #endif /* ENABLE_CF */
 
+  ALLOC_HYBRID, /* Multiheap-fit and Virtual Multiheap-fit by size */
+  ALLOC_GLIBC,  /* malloc of glibc */
+  ALLOC_MMAP,   /* mmap for each block */
+  ALLOC_ARENA,  /* Naive compaction of an arena by memmove */
+
   ALLOC_NB,  /* number of allocators */
 };
 
@@ -48,6 +55,31 @@ typedef void (*deallocate_t)(size_t idx);
 typedef void (*reallocate_t)(size_t idx, size_t size);
 typedef void* (*dereference_t)(size_t idx);
 typedef size_t (*getsize_t)(void);
+/* Number of system calls issued by the allocator (only differences matter) */
+typedef size_t (*getsyscall_t)(void);
+/* Bytes copied by the allocator to move live blocks (only differences
+   matter) */
+typedef size_t (*getmoved_t)(void);
+/* Bytes of pages kept for reuse without blocks (pools and garbage lists) */
+typedef size_t (*getpool_t)(void);
+
+/* Kinds of commands of 'replay_funcs' (the same values as
+   COMMAND_ALLOCATE, ... of memlog.h) */
+enum replay_kind {
+  REPLAY_ALLOCATE   = 0,
+  REPLAY_DEALLOCATE = 1,
+  REPLAY_REALLOCATE = 2,
+};
+
+/* Pre-decoded command of 'replay_funcs' */
+typedef struct {
+  uint32_t kind;
+  uint32_t idx;
+  uint64_t size;
+} replay_command_t;
+
+/* Replay 'nr' commands with the wrappers of an allocator inlined */
+typedef void (*replay_t)(const replay_command_t* commands, size_t nr);
 
 /* Wrapped allocator functions */
 extern const init_t        init_funcs[ALLOC_NB];
@@ -56,7 +88,29 @@ extern const deallocate_t  deallocate_funcs[ALLOC_NB];
 extern const reallocate_t  reallocate_funcs[ALLOC_NB];
 extern const dereference_t dereference_funcs[ALLOC_NB];
 extern const getsize_t     getsize_funcs[ALLOC_NB];
+/* NULL if the allocator cannot count system calls */
+extern const getsyscall_t  getsyscall_funcs[ALLOC_NB];
+/* NULL if the allocator cannot count moved bytes */
+extern const getmoved_t    getmoved_funcs[ALLOC_NB];
+/* NULL if the allocator does not report them */
+extern const getpool_t     getpool_funcs[ALLOC_NB];
+/* Replay loops specialized per allocator. Only one indirect call is made
+   for 'nr' commands, so the cost of an operation is measured without the
+   dispatch through the tables above. */
+extern const replay_t      replay_funcs[ALLOC_NB];
 extern const char*   allocator_name[ALLOC_NB];
+/* Whether several instances can exist in a process at the same time.
+   Multiheap-fit (also used in Hybrid), TLSF and Compact-fit use
+   process-wide variables, so they have only one instance. */
+extern const bool    allocator_multi_instance[ALLOC_NB];
+
+/* Handles of allocator instances (see THREAD_LOCAL_ALLOCATOR in
+   allocator.c) */
+typedef struct allocator_instance allocator_instance_t;
+/* Copy the handles of the calling thread (free it by 'free') */
+allocator_instance_t* allocator_get_instance(void);
+/* Make the calling thread use the instances 'instance' */
+void allocator_set_instance(const allocator_instance_t* instance);
 
 #ifdef INSTRUCTION_COUNTER_ENABLE
 extern const allocate_t    allocate_measure_funcs[ALLOC_NB];
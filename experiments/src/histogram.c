@@ -0,0 +1,72 @@
+/*
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "histogram.h"
+
+/** Calculate the largest value counted in the bucket 'index' */
+static uint64_t bucket_upper(size_t index);
+
+histogram_t* histogram_create(void) {
+  histogram_t* histogram = calloc(1, sizeof(histogram_t));
+
+  if (histogram == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  return histogram;
+}
+
+void histogram_destroy(histogram_t* histogram) {
+  free(histogram);
+}
+
+uint64_t histogram_percentile(const histogram_t* histogram,
+    double percentile) {
+  uint64_t target;
+  uint64_t total = 0;
+  uint64_t upper;
+  size_t i;
+
+  if (histogram->count == 0) return 0;
+  target = (uint64_t)(percentile / 100.0 * histogram->count + 0.5);
+  if (target == 0) target = 1;
+  if (target > histogram->count) target = histogram->count;
+
+  for (i = 0; i < HISTOGRAM_BUCKET_NR; ++i) {
+    total += histogram->counts[i];
+    if (total >= target) {
+      upper = bucket_upper(i);
+      return upper < histogram->max ? upper : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+static uint64_t bucket_upper(size_t index) {
+  unsigned shift;
+  uint64_t mantissa;
+
+  if (index < HISTOGRAM_SUB_NR) return index;
+  shift = (unsigned)(index >> HISTOGRAM_SUB_BITS) - 1;
+  mantissa = (index & (HISTOGRAM_SUB_NR - 1)) | HISTOGRAM_SUB_NR;
+  return (mantissa << shift) + (((uint64_t)1 << shift) - 1);
+}
@@ -0,0 +1,76 @@
+/*
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef HISTOGRAM_H__
+#define HISTOGRAM_H__
+
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+  Log-linear histogram like HdrHistogram.
+  Values less than 2^HISTOGRAM_SUB_BITS are counted exactly, and each
+  larger power of two range is divided into 2^HISTOGRAM_SUB_BITS buckets,
+  so the relative error of a recorded value is less than
+  2^-HISTOGRAM_SUB_BITS.
+ */
+#define HISTOGRAM_SUB_BITS  5
+#define HISTOGRAM_SUB_NR    (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKET_NR ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_NR)
+
+typedef struct {
+  /* Number of values in each bucket */
+  uint64_t counts[HISTOGRAM_BUCKET_NR];
+  /* Number of recorded values */
+  uint64_t count;
+  /* Sum of recorded values */
+  uint64_t sum;
+  /* Maximum recorded value */
+  uint64_t max;
+} histogram_t;
+
+/* Allocate an empty histogram */
+histogram_t* histogram_create(void);
+/* Free the histogram */
+void histogram_destroy(histogram_t* histogram);
+/* Return the value at 'percentile' [0, 100] (upper bound of the bucket) */
+uint64_t histogram_percentile(const histogram_t* histogram,
+  double percentile);
+
+/* Calculate the bucket index of 'value' */
+static inline size_t histogram_index(uint64_t value) {
+  unsigned exponent;
+
+  if (value < HISTOGRAM_SUB_NR) return (size_t)value;
+  exponent = 63 - __builtin_clzll(value);
+  return ((size_t)(exponent - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+    | (size_t)((value >> (exponent - HISTOGRAM_SUB_BITS))
+      & (HISTOGRAM_SUB_NR - 1));
+}
+
+/* Record 'value' */
+static inline void histogram_record(histogram_t* histogram, uint64_t value) {
+  histogram->counts[histogram_index(value)]++;
+  histogram->count++;
+  histogram->sum += value;
+  if (value > histogram->max) histogram->max = value;
+}
+
+#endif /* HISTOGRAM_H__ */
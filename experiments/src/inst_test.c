@@ -28,18 +28,17 @@
 static void print_usage(const char* program_name);
 
 int main(int argc, char* argv[]) {
-  memlog_t* memlog;
+  memlog_stream_t* memlog;
   int allocator;
-  size_t i;
-  enum command_type type;
-  size_t command_nr, idx, size;
+  command_t command;
+  size_t idx, size;
 
   if (argc < 3) {
     print_usage(argv[0]);
     return EXIT_FAILURE;
   }
 
-  memlog = memlog_open(argv[1]);
+  memlog = memlog_stream_open(argv[1]);
   allocator = atoi(argv[2]);
   if (allocator >= ALLOC_NB) {
     fprintf(stderr, "allocator error\n");
@@ -51,12 +50,10 @@ int main(int argc, char* argv[]) {
   instruction_count_init();
 
   instruction_count_set_string(allocator_name[allocator]);
-  command_nr = memlog->command_nr;
-  for (i = 0; i < command_nr; ++i) {
-    type = memlog->commands[i].type;
-    idx  = memlog->commands[i].idx;
-    size = memlog->commands[i].size;
-    switch (type) {
+  while (memlog_stream_next(memlog, &command)) {
+    idx  = command.idx;
+    size = command.size;
+    switch (command.type) {
     case COMMAND_ALLOCATE:
       allocate_funcs[allocator](idx, size); break;
     case COMMAND_DEALLOCATE:
@@ -73,6 +70,7 @@ int main(int argc, char* argv[]) {
       {} /* pass */
     }
   }
+  memlog_stream_close(memlog);
 
   return EXIT_SUCCESS;
 }
@@ -20,7 +20,12 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "memlog.h"
 
 #define BUFFER_SIZE 1024
@@ -28,24 +33,49 @@
 #define MEMLOG_MIN(x, y) ((x) < (y) ? (x) : (y))
 #define MEMLOG_MAX(x, y) ((x) > (y) ? (x) : (y))
 
+/* Statistics calculated while reading commands one by one */
+typedef struct {
+  /* Current size of each block */
+  size_t* idx2size;
+  /* Number of elements of 'idx2size' */
+  size_t  idx2size_nr;
+  size_t  idx_max;
+  size_t  mem_min;
+  size_t  mem_max;
+  size_t  curr_size;
+  size_t  require_size;
+} stat_builder_t;
+
 static inline void* safe_malloc(size_t size);
+static inline void* safe_realloc(void* addr, size_t size);
+/**
+ * Parse a line of a text memlog file.
+ * Return false if the line is not a command.
+ */
+static bool parse_line(const char* line, command_t* command);
+/** Initialize 'builder' */
+static void stat_init(stat_builder_t* builder);
 /**
- * Generate information about 'mem_min', 'mem_max', 'require_size'
- * from 'memlog'
+ * Update information about 'mem_min', 'mem_max', 'require_size'
+ * by 'command'
  */
-static void generate_stat_info(memlog_t* memlog);
+static void stat_update(stat_builder_t* builder, const command_t* command);
+/** Finalize 'builder' */
+static void stat_final(stat_builder_t* builder);
+/** Write 'value' as varint */
+static inline void write_varint(FILE* fp, uint64_t value, uint64_t* size);
 
 memlog_t* memlog_open(const char* filename) {
   FILE* input_file;
   char str_buffer[BUFFER_SIZE];
-  char command_chr;
-  size_t idx, size;
-  size_t idx_max = 0;
+  size_t capacity = 1024;
   memlog_t* memlog;
-  enum command_type type;
+  command_t command;
+  stat_builder_t builder;
+  size_t line = 0;
 
   memlog = safe_malloc(sizeof(memlog_t));
-  memlog->commands = safe_malloc(sizeof(command_t));
+  memlog->commands = safe_malloc(capacity * sizeof(command_t));
   memlog->command_nr = 0;
 
   input_file = fopen(filename, "r");
@@ -54,46 +84,26 @@ memlog_t* memlog_open(const char* filename) {
     exit(EXIT_FAILURE);
   }
 
+  stat_init(&builder);
   while (fgets(str_buffer, BUFFER_SIZE, input_file) != NULL) {
-    command_chr = str_buffer[0];
-
-    switch (command_chr) {
-    case 'm': type = COMMAND_ALLOCATE;      break;
-    case 'M': type = COMMAND_ALLOCATE_M;    break;
-    case 'f': type = COMMAND_DEALLOCATE;    break;
-    case 'F': type = COMMAND_DEALLOCATE_M;  break;
-    case 'r': type = COMMAND_REALLOCATE;    break;
-    case 'R': type = COMMAND_REALLOCATE_M;  break;
-    case 'd': type = COMMAND_DEREFERENCE;   break;
-    case 's': type = COMMAND_GETSIZE;       break;
-    default:  type = COMMAND_UNKNOWN;
-    }
-    if (type ==COMMAND_UNKNOWN) continue;
-
-    if (command_kind(type) == COMMAND_ALLOCATE ||
-        command_kind(type) == COMMAND_REALLOCATE) {
-      if (sscanf(str_buffer + 1, " %zu %zu", &idx, &size) < 2) {
-        fprintf(stderr, "format error\n");
-        exit(EXIT_FAILURE);
-      }
-      idx_max = MEMLOG_MAX(idx_max, idx);
-      memlog->commands[memlog->command_nr].idx  = idx;
-      memlog->commands[memlog->command_nr].size = size;
-    } else if (command_kind(type) == COMMAND_DEALLOCATE) {
-      if (sscanf(str_buffer + 1, " %zu", &idx) < 1) {
-        fprintf(stderr, "format error\n");
-        exit(EXIT_FAILURE);
-      }
-      memlog->commands[memlog->command_nr].idx = idx;
-    }
+    ++line;
+    if (!parse_line(str_buffer, &command)) continue;
 
-    memlog->commands[memlog->command_nr].type = type;
-    memlog->command_nr++;
-    memlog->commands = realloc(memlog->commands,
-      (memlog->command_nr + 1) * sizeof(command_t));
+    command.line = line;
+    stat_update(&builder, &command);
+    if (memlog->command_nr == capacity) {
+      /* Grow geometrically to keep the amortized cost constant */
+      capacity *= 2;
+      memlog->commands =
+        safe_realloc(memlog->commands, capacity * sizeof(command_t));
+    }
+    memlog->commands[memlog->command_nr++] = command;
   }
-  memlog->block_max = idx_max + 1;
-  generate_stat_info(memlog);
+  memlog->block_max    = builder.idx_max + 1;
+  memlog->mem_min      = builder.mem_min;
+  memlog->mem_max      = builder.mem_max;
+  memlog->require_size = builder.require_size;
+  stat_final(&builder);
 
   fclose(input_file);
   return memlog;
@@ -104,6 +114,201 @@ void memlog_finalize(memlog_t* memlog) {
   free(memlog);
 }
 
+memlog_stream_t* memlog_stream_open(const char* filename) {
+  memlog_stream_t* stream;
+  const memlog_header_t* header;
+  struct stat st;
+  void* addr;
+  int fd;
+
+  stream = safe_malloc(sizeof(memlog_stream_t));
+  stream->text     = NULL;
+  stream->map_addr = NULL;
+  stream->map_size = 0;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    perror("open");
+    exit(EXIT_FAILURE);
+  }
+  if (fstat(fd, &st) < 0) {
+    perror("fstat");
+    exit(EXIT_FAILURE);
+  }
+
+  if ((size_t)st.st_size >= sizeof(memlog_header_t)) {
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      perror("mmap");
+      exit(EXIT_FAILURE);
+    }
+    if (memcmp(addr, MEMLOG_MAGIC, MEMLOG_MAGIC_SIZE) == 0) {
+      stream->map_addr = addr;
+      stream->map_size = st.st_size;
+    } else {
+      munmap(addr, st.st_size);
+    }
+  }
+  close(fd);
+
+  if (stream->map_addr == NULL) {
+    /* Text file */
+    stream->text         = memlog_open(filename);
+    stream->command_nr   = stream->text->command_nr;
+    stream->mem_min      = stream->text->mem_min;
+    stream->mem_max      = stream->text->mem_max;
+    stream->block_max    = stream->text->block_max;
+    stream->require_size = stream->text->require_size;
+  } else {
+    header = (const memlog_header_t*) stream->map_addr;
+    if (header->data_size > stream->map_size - sizeof(memlog_header_t)) {
+      fprintf(stderr, "format error\n");
+      exit(EXIT_FAILURE);
+    }
+    stream->command_nr   = header->command_nr;
+    stream->mem_min      = header->mem_min;
+    stream->mem_max      = header->mem_max;
+    stream->block_max    = header->block_max;
+    stream->require_size = header->require_size;
+    madvise(stream->map_addr, stream->map_size, MADV_SEQUENTIAL);
+  }
+
+  memlog_stream_rewind(stream);
+  return stream;
+}
+
+void memlog_stream_rewind(memlog_stream_t* stream) {
+  const memlog_header_t* header;
+
+  if (stream->text != NULL) {
+    stream->text_pos = 0;
+    return;
+  }
+  header = (const memlog_header_t*) stream->map_addr;
+  stream->curr     = (const uint8_t*)(header + 1);
+  stream->end      = stream->curr + header->data_size;
+  stream->released = (const uint8_t*) stream->map_addr;
+  stream->prev_idx = 0;
+  stream->decoded_nr = 0;
+  stream->prev_timestamp = 0;
+}
+
+void memlog_stream_close(memlog_stream_t* stream) {
+  if (stream->text != NULL) {
+    memlog_finalize(stream->text);
+  } else {
+    munmap(stream->map_addr, stream->map_size);
+  }
+  free(stream);
+}
+
+size_t memlog_stream_read(memlog_stream_t* stream,
+    command_t* commands, size_t nr) {
+  size_t i;
+
+  for (i = 0; i < nr; ++i) {
+    if (!memlog_stream_next(stream, &commands[i])) break;
+  }
+  return i;
+}
+
+void memlog_stream_release(memlog_stream_t* stream) {
+  uintptr_t page_mask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+  const uint8_t* release_end =
+    (const uint8_t*)((uintptr_t)stream->curr & ~page_mask);
+
+  /* The pages are reread from the file if the stream is rewound */
+  madvise((void*)stream->released, release_end - stream->released,
+    MADV_DONTNEED);
+  stream->released = release_end;
+}
+
+bool memlog_convert(const char* input, const char* output) {
+  FILE* input_file;
+  FILE* output_file;
+  char str_buffer[BUFFER_SIZE];
+  command_t command;
+  enum command_type kind;
+  stat_builder_t builder;
+  memlog_header_t header;
+  size_t prev_idx = 0;
+  uint64_t prev_timestamp = 0;
+  uint8_t type_byte;
+  int64_t diff;
+
+  input_file = fopen(input, "r");
+  if (input_file == NULL) {
+    perror("fopen");
+    return false;
+  }
+  output_file = fopen(output, "wb");
+  if (output_file == NULL) {
+    perror("fopen");
+    fclose(input_file);
+    return false;
+  }
+
+  /* The header is written again after all commands are read */
+  memset(&header, 0, sizeof(header));
+  fwrite(&header, sizeof(header), 1, output_file);
+
+  stat_init(&builder);
+  while (fgets(str_buffer, BUFFER_SIZE, input_file) != NULL) {
+    if (!parse_line(str_buffer, &command)) continue;
+    stat_update(&builder, &command);
+
+    type_byte = command.type;
+    if (command.timestamp != MEMLOG_NO_TIMESTAMP) {
+      type_byte |= MEMLOG_HAS_TIMESTAMP;
+    }
+    if (command.tid != 0) type_byte |= MEMLOG_HAS_TID;
+    fputc(type_byte, output_file);
+    header.data_size++;
+    kind = command_kind(command.type);
+    if (kind == COMMAND_ALLOCATE || kind == COMMAND_DEALLOCATE ||
+        kind == COMMAND_REALLOCATE || kind == COMMAND_DEREFERENCE) {
+      diff = (int64_t)(command.idx - prev_idx);
+      write_varint(output_file,
+        ((uint64_t)diff << 1) ^ (uint64_t)(diff >> 63), &header.data_size);
+      prev_idx = command.idx;
+    }
+    if (kind == COMMAND_ALLOCATE || kind == COMMAND_REALLOCATE) {
+      write_varint(output_file, command.size, &header.data_size);
+    }
+    if (type_byte & MEMLOG_HAS_TIMESTAMP) {
+      diff = (int64_t)(command.timestamp - prev_timestamp);
+      write_varint(output_file,
+        ((uint64_t)diff << 1) ^ (uint64_t)(diff >> 63), &header.data_size);
+      prev_timestamp = command.timestamp;
+    }
+    if (type_byte & MEMLOG_HAS_TID) {
+      write_varint(output_file, command.tid, &header.data_size);
+    }
+    header.command_nr++;
+  }
+  fclose(input_file);
+
+  memcpy(header.magic, MEMLOG_MAGIC, MEMLOG_MAGIC_SIZE);
+  header.mem_min      = builder.mem_min;
+  header.mem_max      = builder.mem_max;
+  header.block_max    = builder.idx_max + 1;
+  header.require_size = builder.require_size;
+  stat_final(&builder);
+
+  rewind(output_file);
+  fwrite(&header, sizeof(header), 1, output_file);
+  if (ferror(output_file)) {
+    perror("fwrite");
+    fclose(output_file);
+    return false;
+  }
+  if (fclose(output_file) != 0) {
+    perror("fclose");
+    return false;
+  }
+  return true;
+}
+
 static inline void* safe_malloc(size_t size) {
   void* addr = malloc(size);
 
@@ -114,37 +319,129 @@ static inline void* safe_malloc(size_t size) {
   return addr;
 }
 
-static void generate_stat_info(memlog_t* memlog) {
-  size_t command_idx;
-  size_t* idx2size;
-  size_t mem_min = SIZE_MAX;
-  size_t mem_max = 0;
-  size_t curr_size = 0;
-  size_t require_size  = 0;
-  command_t command;
+static inline void* safe_realloc(void* addr, size_t size) {
+  void* new_addr = realloc(addr, size);
+
+  if (new_addr == NULL) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+  return new_addr;
+}
+
+static bool parse_line(const char* line, command_t* command) {
+  enum command_type type;
+  const char* field;
+
+  switch (line[0]) {
+  case 'm': type = COMMAND_ALLOCATE;      break;
+  case 'M': type = COMMAND_ALLOCATE_M;    break;
+  case 'f': type = COMMAND_DEALLOCATE;    break;
+  case 'F': type = COMMAND_DEALLOCATE_M;  break;
+  case 'r': type = COMMAND_REALLOCATE;    break;
+  case 'R': type = COMMAND_REALLOCATE_M;  break;
+  case 'd': type = COMMAND_DEREFERENCE;   break;
+  case 's': type = COMMAND_GETSIZE;       break;
+  default:  return false;
+  }
+
+  command->type = type;
+  command->idx  = 0;
+  command->size = 0;
+  command->timestamp = MEMLOG_NO_TIMESTAMP;
+  command->tid  = 0;
+  if (command_kind(type) == COMMAND_ALLOCATE ||
+      command_kind(type) == COMMAND_REALLOCATE) {
+    if (sscanf(line + 1, " %zu %zu", &command->idx, &command->size) < 2) {
+      fprintf(stderr, "format error\n");
+      exit(EXIT_FAILURE);
+    }
+  } else if (command_kind(type) == COMMAND_DEALLOCATE ||
+      type == COMMAND_DEREFERENCE) {
+    if (sscanf(line + 1, " %zu", &command->idx) < 1) {
+      fprintf(stderr, "format error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
 
-  idx2size = safe_malloc(memlog->block_max * sizeof(size_t));
-  for (command_idx = 0; command_idx < memlog->command_nr; ++command_idx) {
-    command = memlog->commands[command_idx];
-    if (command_kind(command.type) == COMMAND_ALLOCATE) {
-      idx2size[command.idx] = command.size;
-      mem_min = MEMLOG_MIN(mem_min, command.size);
-      mem_max = MEMLOG_MAX(mem_max, command.size);
-      curr_size += command.size;
-      require_size = MEMLOG_MAX(require_size, curr_size);
-    } else if (command_kind(command.type) == COMMAND_DEALLOCATE) {
-      curr_size -= idx2size[command.idx];
-    } else if (command_kind(command.type) == COMMAND_REALLOCATE) {
-      mem_min = MEMLOG_MIN(mem_min, command.size);
-      mem_max = MEMLOG_MAX(mem_max, command.size);
-      curr_size = curr_size - idx2size[command.idx] + command.size;
-      require_size = MEMLOG_MAX(require_size, curr_size);
-      idx2size[command.idx] = command.size;
+  /* Optional fields follow the arguments */
+  if ((field = strchr(line + 1, '@')) != NULL) {
+    if (sscanf(field + 1, "%" SCNu64, &command->timestamp) < 1) {
+      fprintf(stderr, "format error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  if ((field = strchr(line + 1, '#')) != NULL) {
+    if (sscanf(field + 1, "%" SCNu32, &command->tid) < 1) {
+      fprintf(stderr, "format error\n");
+      exit(EXIT_FAILURE);
     }
   }
-  free(idx2size);
+  return true;
+}
+
+static void stat_init(stat_builder_t* builder) {
+  builder->idx2size_nr  = 1024;
+  builder->idx2size     = calloc(builder->idx2size_nr, sizeof(size_t));
+  if (builder->idx2size == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  builder->idx_max      = 0;
+  builder->mem_min      = SIZE_MAX;
+  builder->mem_max      = 0;
+  builder->curr_size    = 0;
+  builder->require_size = 0;
+}
+
+static void stat_update(stat_builder_t* builder, const command_t* command) {
+  size_t new_nr;
+  enum command_type kind = command_kind(command->type);
+
+  if (kind == COMMAND_ALLOCATE || kind == COMMAND_REALLOCATE) {
+    builder->idx_max = MEMLOG_MAX(builder->idx_max, command->idx);
+  }
+  if (command->idx >= builder->idx2size_nr) {
+    new_nr = builder->idx2size_nr;
+    while (new_nr <= command->idx) new_nr *= 2;
+    builder->idx2size =
+      safe_realloc(builder->idx2size, new_nr * sizeof(size_t));
+    memset(builder->idx2size + builder->idx2size_nr, 0,
+      (new_nr - builder->idx2size_nr) * sizeof(size_t));
+    builder->idx2size_nr = new_nr;
+  }
 
-  memlog->mem_min = mem_min;
-  memlog->mem_max = mem_max;
-  memlog->require_size = require_size;
+  if (kind == COMMAND_ALLOCATE) {
+    builder->idx2size[command->idx] = command->size;
+    builder->mem_min = MEMLOG_MIN(builder->mem_min, command->size);
+    builder->mem_max = MEMLOG_MAX(builder->mem_max, command->size);
+    builder->curr_size += command->size;
+    builder->require_size =
+      MEMLOG_MAX(builder->require_size, builder->curr_size);
+  } else if (kind == COMMAND_DEALLOCATE) {
+    builder->curr_size -= builder->idx2size[command->idx];
+    builder->idx2size[command->idx] = 0;
+  } else if (kind == COMMAND_REALLOCATE) {
+    builder->mem_min = MEMLOG_MIN(builder->mem_min, command->size);
+    builder->mem_max = MEMLOG_MAX(builder->mem_max, command->size);
+    builder->curr_size =
+      builder->curr_size - builder->idx2size[command->idx] + command->size;
+    builder->require_size =
+      MEMLOG_MAX(builder->require_size, builder->curr_size);
+    builder->idx2size[command->idx] = command->size;
+  }
+}
+
+static void stat_final(stat_builder_t* builder) {
+  free(builder->idx2size);
+}
+
+static inline void write_varint(FILE* fp, uint64_t value, uint64_t* size) {
+  while (value >= 0x80) {
+    fputc((int)(value & 0x7f) | 0x80, fp);
+    value >>= 7;
+    (*size)++;
+  }
+  fputc((int)value, fp);
+  (*size)++;
 }
@@ -44,6 +44,9 @@ static inline enum command_type command_kind(enum command_type type) {
   return (enum command_type)(type & (~COMMAND_MEASURE_FLAG));
 }
 
+/* 'timestamp' of a command without it */
+#define MEMLOG_NO_TIMESTAMP UINT64_MAX
+
 typedef struct {
   /* Type of the command */
   enum command_type type;
@@ -51,6 +54,12 @@ typedef struct {
   size_t idx;
   /* Size of block to allocate/reallocate */
   size_t size;
+  /* Line number in a text memlog (command number in a binary memlog) */
+  size_t line;
+  /* Time when the command was recorded [ns] (optional) */
+  uint64_t timestamp;
+  /* ID of the thread which issued the command (0 if not recorded) */
+  uint32_t tid;
 } command_t;
 
 /* Structure for keeping the contents of the memlog file in RAM */
@@ -75,4 +84,157 @@ memlog_t* memlog_open(const char* filename);
 /* Finalize the structure */
 void memlog_finalize(memlog_t* memlog);
 
+/*
+  Binary memlog format
+
+  A binary memlog file starts with 'memlog_header_t' followed by
+  'data_size' bytes of commands. Each command is encoded as
+    - 1 byte of 'enum command_type'
+    - idx  : zigzag varint of the difference from the previous idx
+             (allocate / deallocate / reallocate / dereference only)
+    - size : varint (allocate / reallocate only)
+    - timestamp : zigzag varint of the difference from the previous
+                  timestamp (only if MEMLOG_HAS_TIMESTAMP is set)
+    - tid  : varint (only if MEMLOG_HAS_TID is set)
+  A varint stores 7 bits per byte from the lowest bits, and the highest
+  bit of each byte is set if more bytes follow. All integers in the header
+  are stored in the byte order of the host (little endian on x86).
+ */
+#define MEMLOG_MAGIC "MEMLOGB1"
+#define MEMLOG_MAGIC_SIZE 8
+/* Flags ORed to the command type byte of a binary memlog */
+#define MEMLOG_HAS_TIMESTAMP 0x10
+#define MEMLOG_HAS_TID       0x20
+#define MEMLOG_TYPE_MASK     0x0f
+
+typedef struct {
+  /* MEMLOG_MAGIC (not null-terminated) */
+  char magic[MEMLOG_MAGIC_SIZE];
+  /* Number of commands */
+  uint64_t command_nr;
+  /* The same as the members of memlog_t */
+  uint64_t mem_min;
+  uint64_t mem_max;
+  uint64_t block_max;
+  uint64_t require_size;
+  /* Byte size of the encoded commands following the header */
+  uint64_t data_size;
+} memlog_header_t;
+
+/* Structure for reading a memlog file command by command.
+   A binary file is mapped and decoded on the fly, so only a constant
+   amount of memory is used. A text file is read by memlog_open. */
+typedef struct {
+  /* The same as the members of memlog_t */
+  size_t command_nr;
+  size_t mem_min;
+  size_t mem_max;
+  size_t block_max;
+  size_t require_size;
+
+  /* Next command to be decoded */
+  const uint8_t* curr;
+  /* End of the encoded commands */
+  const uint8_t* end;
+  /* Start of the region which is not given back to the kernel yet */
+  const uint8_t* released;
+  /* idx of the previous command */
+  size_t prev_idx;
+  /* Number of commands decoded */
+  size_t decoded_nr;
+  /* timestamp of the previous command which has it */
+  uint64_t prev_timestamp;
+  /* Mapped file */
+  void*  map_addr;
+  size_t map_size;
+
+  /* Contents of a text file (NULL for a binary file) */
+  memlog_t* text;
+  /* Index of the next command in 'text' */
+  size_t text_pos;
+} memlog_stream_t;
+
+/* Open the text or binary memlog file 'filename' */
+memlog_stream_t* memlog_stream_open(const char* filename);
+/* Restart reading from the first command */
+void memlog_stream_rewind(memlog_stream_t* stream);
+/* Close the stream */
+void memlog_stream_close(memlog_stream_t* stream);
+/* Read at most 'nr' commands into 'commands' and return the number of them */
+size_t memlog_stream_read(memlog_stream_t* stream,
+  command_t* commands, size_t nr);
+/* Give decoded pages back to the kernel (called by memlog_stream_next) */
+void memlog_stream_release(memlog_stream_t* stream);
+/* Convert the text memlog 'input' to the binary memlog 'output'.
+   Return false on failure. */
+bool memlog_convert(const char* input, const char* output);
+
+/* Decoded pages are given back to the kernel every this size */
+#define MEMLOG_RELEASE_SIZE (64 << 20)
+
+static inline uint64_t memlog_read_varint(const uint8_t** curr,
+    const uint8_t* end) {
+  const uint8_t* p = *curr;
+  uint64_t value = 0;
+  unsigned shift = 0;
+
+  while (p < end) {
+    value |= (uint64_t)(*p & 0x7f) << shift;
+    if ((*p++ & 0x80) == 0) break;
+    shift += 7;
+  }
+  *curr = p;
+  return value;
+}
+
+/* Read the next command. Return false at the end of the file */
+static inline bool memlog_stream_next(memlog_stream_t* stream,
+    command_t* command) {
+  uint64_t zigzag;
+  uint8_t type_byte;
+  enum command_type kind;
+
+  if (stream->text != NULL) {
+    if (stream->text_pos >= stream->text->command_nr) return false;
+    *command = stream->text->commands[stream->text_pos++];
+    return true;
+  }
+
+  if (stream->curr >= stream->end) return false;
+  if (stream->curr - stream->released >= MEMLOG_RELEASE_SIZE) {
+    memlog_stream_release(stream);
+  }
+
+  type_byte = *stream->curr++;
+  command->type = (enum command_type)(type_byte & MEMLOG_TYPE_MASK);
+  command->line = ++stream->decoded_nr;
+  kind = command_kind(command->type);
+  if (kind == COMMAND_ALLOCATE || kind == COMMAND_DEALLOCATE ||
+      kind == COMMAND_REALLOCATE || kind == COMMAND_DEREFERENCE) {
+    zigzag = memlog_read_varint(&stream->curr, stream->end);
+    stream->prev_idx += (size_t)((zigzag >> 1) ^ -(zigzag & 1));
+    command->idx = stream->prev_idx;
+  } else {
+    command->idx = 0;
+  }
+  if (kind == COMMAND_ALLOCATE || kind == COMMAND_REALLOCATE) {
+    command->size = (size_t)memlog_read_varint(&stream->curr, stream->end);
+  } else {
+    command->size = 0;
+  }
+  if (type_byte & MEMLOG_HAS_TIMESTAMP) {
+    zigzag = memlog_read_varint(&stream->curr, stream->end);
+    stream->prev_timestamp += (zigzag >> 1) ^ -(zigzag & 1);
+    command->timestamp = stream->prev_timestamp;
+  } else {
+    command->timestamp = MEMLOG_NO_TIMESTAMP;
+  }
+  if (type_byte & MEMLOG_HAS_TID) {
+    command->tid = (uint32_t)memlog_read_varint(&stream->curr, stream->end);
+  } else {
+    command->tid = 0;
+  }
+  return true;
+}
+
 #endif /* MEMLOG_H__ */
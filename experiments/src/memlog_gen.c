@@ -0,0 +1,546 @@
+/*
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "memlog.h"
+
+/* Maximum number of phases */
+#define PHASE_MAX 64
+
+/* Kinds of distributions */
+enum dist_type {
+  DIST_UNIFORM,
+  DIST_LOGNORMAL,
+  DIST_EXPONENTIAL,
+  DIST_EMPIRICAL,
+  DIST_INFINITE,
+};
+
+/* Distribution of sizes or lifetimes */
+typedef struct {
+  enum dist_type type;
+  /* uniform: [a, b], lognormal: median a, sigma b, exponential: mean a */
+  double a;
+  double b;
+  /* Upper bound of samples (0: no bound) */
+  double max;
+  /* Samples of the empirical distribution */
+  size_t* samples;
+  size_t sample_nr;
+} dist_t;
+
+/* Parameters of a phase */
+typedef struct {
+  /* Number of steps */
+  size_t steps;
+  /* Size of allocated blocks [byte] */
+  dist_t size;
+  /* Lifetime of allocated blocks [step] */
+  dist_t life;
+  /* Total size of live blocks to be kept [byte] */
+  size_t live;
+  /* Probability to replace a random live block in a step
+     when the live set reaches 'live' */
+  double churn;
+  /* Probability to reallocate a live block instead of allocating */
+  double realloc;
+} phase_t;
+
+/* Live block */
+typedef struct {
+  size_t size;
+  /* Step when the block is deallocated (SIZE_MAX: never) */
+  size_t death;
+  /* Position in 'g_live' */
+  size_t live_pos;
+} block_t;
+
+/* Entry of the heap of deaths */
+typedef struct {
+  size_t death;
+  size_t idx;
+} death_t;
+
+/* State of the generator */
+static struct {
+  uint64_t rng;
+  FILE* out;
+  /* Time of a step [ns] (0: no timestamp) */
+  uint64_t step_time;
+  size_t step;
+
+  block_t* blocks;
+  size_t block_nr;
+  /* Unused block ids */
+  size_t* free_ids;
+  size_t free_id_nr;
+  /* Ids of live blocks */
+  size_t* live;
+  size_t live_nr;
+  size_t live_size;
+  /* Min-heap of deaths (entries of deallocated blocks are skipped) */
+  death_t* deaths;
+  size_t death_nr;
+  size_t death_capacity;
+} g_gen;
+
+/** Parse a phase description such as "steps=1000,size=uniform:16:64" */
+static void parse_phase(const char* spec, phase_t* phase);
+/** Parse a distribution such as "lognormal:256:1.5" */
+static void parse_dist(const char* spec, dist_t* dist);
+/** Parse a size with an optional suffix K, M or G */
+static size_t parse_size(const char* str);
+/** Parse 'min' to 'max' numbers with optional suffixes separated by ':'
+    and return how many are parsed, or exit if 'str' is invalid */
+static size_t parse_numbers(const char* str, const char* spec, double* values,
+  size_t min, size_t max);
+/** Scale of a suffix K, M or G, which is skipped, or 1 */
+static size_t suffix_scale(char** str);
+/** Run a phase */
+static void run_phase(const phase_t* phase);
+/** Allocate a new block */
+static void gen_allocate(const phase_t* phase);
+/** Deallocate the block 'idx' */
+static void gen_deallocate(size_t idx);
+/** Reallocate the block 'idx' */
+static void gen_reallocate(const phase_t* phase, size_t idx);
+/** Write the timestamp of the current step */
+static void put_timestamp(void);
+/** Draw a sample */
+static double dist_sample(const dist_t* dist);
+/** Push an entry to the heap of deaths */
+static void death_push(size_t death, size_t idx);
+/** Pop the earliest entry from the heap of deaths */
+static death_t death_pop(void);
+/** Uniform random number in [0, 1) */
+static inline double rand_double(void);
+/** Grow an array to hold 'nr' elements */
+static void* grow(void* addr, size_t* capacity, size_t nr, size_t elem_size);
+static void print_usage(const char* program_name);
+
+/** xorshift64* */
+static inline uint64_t rand_u64(void) {
+  g_gen.rng ^= g_gen.rng >> 12;
+  g_gen.rng ^= g_gen.rng << 25;
+  g_gen.rng ^= g_gen.rng >> 27;
+  return g_gen.rng * 0x2545F4914F6CDD1DULL;
+}
+
+int main(int argc, char* argv[]) {
+  phase_t phases[PHASE_MAX];
+  size_t phase_nr = 0;
+  uint64_t seed = 1;
+  int opt;
+  int i;
+  size_t j;
+
+  g_gen.out = stdout;
+  while ((opt = getopt(argc, argv, "s:t:p:o:")) != -1) {
+    switch (opt) {
+    case 's':
+      seed = strtoull(optarg, NULL, 0);
+      break;
+    case 't':
+      g_gen.step_time = strtoull(optarg, NULL, 0);
+      break;
+    case 'o':
+      g_gen.out = fopen(optarg, "w");
+      if (g_gen.out == NULL) {
+        perror("fopen");
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'p':
+      if (phase_nr == PHASE_MAX) {
+        fprintf(stderr, "too many phases\n");
+        return EXIT_FAILURE;
+      }
+      /* A phase inherits unspecified parameters from the previous one */
+      if (phase_nr > 0) {
+        phases[phase_nr] = phases[phase_nr - 1];
+      } else {
+        memset(&phases[0], 0, sizeof(phase_t));
+        phases[0].steps = 100000;
+        parse_dist("uniform:16:4096", &phases[0].size);
+        parse_dist("exp:1000", &phases[0].life);
+      }
+      parse_phase(optarg, &phases[phase_nr++]);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (phase_nr == 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  /* xorshift must not be 0 */
+  g_gen.rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+  if (g_gen.rng == 0) g_gen.rng = 1;
+
+  /* Arguments are recorded so that the trace can be reproduced */
+  fprintf(g_gen.out, "# generated by memlog_gen -s %" PRIu64, seed);
+  for (i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "-o") == 0) {
+      ++i;
+    } else {
+      fprintf(g_gen.out, " %s", argv[i]);
+    }
+  }
+  fputc('\n', g_gen.out);
+
+  for (j = 0; j < phase_nr; ++j) {
+    fprintf(g_gen.out, "# phase %zu\n", j);
+    run_phase(&phases[j]);
+  }
+
+  /* Remaining blocks are deallocated */
+  while (g_gen.live_nr > 0) {
+    gen_deallocate(g_gen.live[g_gen.live_nr - 1]);
+  }
+  if (g_gen.out != stdout) fclose(g_gen.out);
+  return EXIT_SUCCESS;
+}
+
+static void parse_phase(const char* spec, phase_t* phase) {
+  char* buffer = strdup(spec);
+  char* save;
+  char* token;
+  char* value;
+
+  for (token = strtok_r(buffer, ",", &save); token != NULL;
+      token = strtok_r(NULL, ",", &save)) {
+    value = strchr(token, '=');
+    if (value == NULL) {
+      fprintf(stderr, "invalid phase: %s\n", token);
+      exit(EXIT_FAILURE);
+    }
+    *value++ = '\0';
+    if (strcmp(token, "steps") == 0) {
+      phase->steps = parse_size(value);
+    } else if (strcmp(token, "size") == 0) {
+      parse_dist(value, &phase->size);
+    } else if (strcmp(token, "life") == 0) {
+      parse_dist(value, &phase->life);
+    } else if (strcmp(token, "live") == 0) {
+      phase->live = parse_size(value);
+    } else if (strcmp(token, "churn") == 0) {
+      phase->churn = strtod(value, NULL);
+    } else if (strcmp(token, "realloc") == 0) {
+      phase->realloc = strtod(value, NULL);
+    } else {
+      fprintf(stderr, "unknown parameter: %s\n", token);
+      exit(EXIT_FAILURE);
+    }
+  }
+  free(buffer);
+}
+
+static void parse_dist(const char* spec, dist_t* dist) {
+  memlog_stream_t* memlog;
+  command_t command;
+  size_t capacity = 0;
+  double values[3];
+
+  memset(dist, 0, sizeof(dist_t));
+  if (strcmp(spec, "inf") == 0) {
+    dist->type = DIST_INFINITE;
+  } else if (strncmp(spec, "uniform:", 8) == 0) {
+    dist->type = DIST_UNIFORM;
+    parse_numbers(spec + 8, spec, values, 2, 2);
+    dist->a = values[0];
+    dist->b = values[1];
+  } else if (strncmp(spec, "lognormal:", 10) == 0) {
+    dist->type = DIST_LOGNORMAL;
+    if (parse_numbers(spec + 10, spec, values, 2, 3) == 3) {
+      dist->max = values[2];
+    }
+    dist->a = values[0];
+    dist->b = values[1];
+  } else if (strncmp(spec, "exp:", 4) == 0) {
+    dist->type = DIST_EXPONENTIAL;
+    parse_numbers(spec + 4, spec, values, 1, 1);
+    dist->a = values[0];
+  } else if (strncmp(spec, "trace:", 6) == 0) {
+    /* Sizes of allocations in the trace are drawn uniformly */
+    dist->type = DIST_EMPIRICAL;
+    memlog = memlog_stream_open(spec + 6);
+    while (memlog_stream_next(memlog, &command)) {
+      if (command_kind(command.type) != COMMAND_ALLOCATE &&
+          command_kind(command.type) != COMMAND_REALLOCATE) {
+        continue;
+      }
+      dist->samples = grow(dist->samples, &capacity,
+        dist->sample_nr + 1, sizeof(size_t));
+      dist->samples[dist->sample_nr++] = command.size;
+    }
+    memlog_stream_close(memlog);
+    if (dist->sample_nr == 0) {
+      fprintf(stderr, "no allocation in %s\n", spec + 6);
+      exit(EXIT_FAILURE);
+    }
+  } else {
+    fprintf(stderr, "invalid distribution: %s\n", spec);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static size_t parse_size(const char* str) {
+  char* end;
+  size_t value = strtoull(str, &end, 0);
+
+  return value * suffix_scale(&end);
+}
+
+static size_t parse_numbers(const char* str, const char* spec, double* values,
+    size_t min, size_t max) {
+  char* end;
+  size_t nr = 0;
+
+  for (;;) {
+    values[nr] = strtod(str, &end);
+    if (end == str) break;
+    values[nr++] *= suffix_scale(&end);
+    if (*end != ':' || nr == max) break;
+    str = end + 1;
+  }
+  if (nr < min || *end != '\0') {
+    fprintf(stderr, "invalid distribution: %s\n", spec);
+    exit(EXIT_FAILURE);
+  }
+  return nr;
+}
+
+static size_t suffix_scale(char** str) {
+  switch (**str) {
+  case 'K': case 'k': ++*str; return (size_t)1 << 10;
+  case 'M': case 'm': ++*str; return (size_t)1 << 20;
+  case 'G': case 'g': ++*str; return (size_t)1 << 30;
+  default: return 1;
+  }
+}
+
+static void run_phase(const phase_t* phase) {
+  size_t end = g_gen.step + phase->steps;
+  death_t death;
+
+  for (; g_gen.step < end; ++g_gen.step) {
+    /* Blocks whose lifetime has expired */
+    while (g_gen.death_nr > 0 && g_gen.deaths[0].death <= g_gen.step) {
+      death = death_pop();
+      if (death.idx < g_gen.block_nr &&
+          g_gen.blocks[death.idx].death == death.death) {
+        gen_deallocate(death.idx);
+      }
+    }
+    /* Shrink the live set to the target of the phase */
+    while (phase->live > 0 && g_gen.live_size > phase->live) {
+      gen_deallocate(g_gen.live[rand_u64() % g_gen.live_nr]);
+    }
+
+    if (g_gen.live_nr > 0 && rand_double() < phase->realloc) {
+      gen_reallocate(phase, g_gen.live[rand_u64() % g_gen.live_nr]);
+    } else if (phase->live == 0 || g_gen.live_size < phase->live) {
+      gen_allocate(phase);
+    } else if (rand_double() < phase->churn) {
+      gen_deallocate(g_gen.live[rand_u64() % g_gen.live_nr]);
+      gen_allocate(phase);
+    }
+  }
+}
+
+static void gen_allocate(const phase_t* phase) {
+  static size_t block_capacity = 0;
+  static size_t live_capacity = 0;
+  size_t idx;
+  size_t size = (size_t)dist_sample(&phase->size);
+  double life = dist_sample(&phase->life);
+  block_t* block;
+
+  if (size == 0) size = 1;
+  if (g_gen.free_id_nr > 0) {
+    idx = g_gen.free_ids[--g_gen.free_id_nr];
+  } else {
+    idx = g_gen.block_nr++;
+    g_gen.blocks = grow(g_gen.blocks, &block_capacity,
+      g_gen.block_nr, sizeof(block_t));
+    g_gen.free_ids = realloc(g_gen.free_ids,
+      block_capacity * sizeof(size_t));
+  }
+  g_gen.live = grow(g_gen.live, &live_capacity,
+    g_gen.live_nr + 1, sizeof(size_t));
+
+  block = &g_gen.blocks[idx];
+  block->size     = size;
+  block->death    = isinf(life) ? SIZE_MAX : g_gen.step + 1 + (size_t)life;
+  block->live_pos = g_gen.live_nr;
+  g_gen.live[g_gen.live_nr++] = idx;
+  g_gen.live_size += size;
+  if (block->death != SIZE_MAX) death_push(block->death, idx);
+
+  fprintf(g_gen.out, "m %zu %zu", idx, size);
+  put_timestamp();
+}
+
+static void gen_deallocate(size_t idx) {
+  block_t* block = &g_gen.blocks[idx];
+  size_t last = g_gen.live[--g_gen.live_nr];
+
+  /* Remove from the live set by swapping with the last one */
+  g_gen.live[block->live_pos] = last;
+  g_gen.blocks[last].live_pos = block->live_pos;
+  g_gen.live_size -= block->size;
+  /* Entries in the heap of deaths become invalid */
+  block->death = SIZE_MAX - 1;
+  g_gen.free_ids[g_gen.free_id_nr++] = idx;
+
+  fprintf(g_gen.out, "f %zu", idx);
+  put_timestamp();
+}
+
+static void gen_reallocate(const phase_t* phase, size_t idx) {
+  block_t* block = &g_gen.blocks[idx];
+  size_t size = (size_t)dist_sample(&phase->size);
+
+  if (size == 0) size = 1;
+  g_gen.live_size = g_gen.live_size - block->size + size;
+  block->size = size;
+
+  fprintf(g_gen.out, "r %zu %zu", idx, size);
+  put_timestamp();
+}
+
+static void put_timestamp(void) {
+  if (g_gen.step_time != 0) {
+    fprintf(g_gen.out, " @%" PRIu64, (uint64_t)g_gen.step * g_gen.step_time);
+  }
+  fputc('\n', g_gen.out);
+}
+
+static double dist_sample(const dist_t* dist) {
+  double value;
+  double u1, u2;
+
+  switch (dist->type) {
+  case DIST_UNIFORM:
+    value = dist->a + (dist->b - dist->a + 1) * rand_double();
+    if (value > dist->b) value = dist->b;
+    return value;
+  case DIST_LOGNORMAL:
+    /* Box-Muller transform */
+    u1 = 1.0 - rand_double();
+    u2 = rand_double();
+    value = dist->a *
+      exp(dist->b * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2));
+    if (dist->max > 0 && value > dist->max) value = dist->max;
+    return value;
+  case DIST_EXPONENTIAL:
+    return -dist->a * log(1.0 - rand_double());
+  case DIST_EMPIRICAL:
+    return (double)dist->samples[rand_u64() % dist->sample_nr];
+  case DIST_INFINITE:
+  default:
+    return INFINITY;
+  }
+}
+
+static void death_push(size_t death, size_t idx) {
+  size_t i;
+  death_t tmp;
+
+  g_gen.deaths = grow(g_gen.deaths, &g_gen.death_capacity,
+    g_gen.death_nr + 1, sizeof(death_t));
+  i = g_gen.death_nr++;
+  g_gen.deaths[i].death = death;
+  g_gen.deaths[i].idx   = idx;
+  while (i > 0 && g_gen.deaths[(i - 1) / 2].death > g_gen.deaths[i].death) {
+    tmp = g_gen.deaths[i];
+    g_gen.deaths[i] = g_gen.deaths[(i - 1) / 2];
+    g_gen.deaths[(i - 1) / 2] = tmp;
+    i = (i - 1) / 2;
+  }
+}
+
+static death_t death_pop(void) {
+  death_t top = g_gen.deaths[0];
+  death_t tmp;
+  size_t i = 0;
+  size_t child;
+
+  g_gen.deaths[0] = g_gen.deaths[--g_gen.death_nr];
+  while ((child = 2 * i + 1) < g_gen.death_nr) {
+    if (child + 1 < g_gen.death_nr &&
+        g_gen.deaths[child + 1].death < g_gen.deaths[child].death) {
+      ++child;
+    }
+    if (g_gen.deaths[i].death <= g_gen.deaths[child].death) break;
+    tmp = g_gen.deaths[i];
+    g_gen.deaths[i] = g_gen.deaths[child];
+    g_gen.deaths[child] = tmp;
+    i = child;
+  }
+  return top;
+}
+
+static inline double rand_double(void) {
+  return (rand_u64() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void* grow(void* addr, size_t* capacity, size_t nr, size_t elem_size) {
+  if (nr <= *capacity) return addr;
+  *capacity = *capacity == 0 ? 1024 : *capacity * 2;
+  if (*capacity < nr) *capacity = nr;
+  addr = realloc(addr, *capacity * elem_size);
+  if (addr == NULL) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+  return addr;
+}
+
+static void print_usage(const char* program_name) {
+  printf("%s [-s seed] [-t step time] [-o file] -p <phase> [-p <phase> ...]\n",
+    program_name);
+  printf("Generate a memlog from models. Each phase is a comma-separated list\n");
+  printf("of the following parameters. Unspecified ones are inherited from\n");
+  printf("the previous phase.\n");
+  printf("  steps=<n>        number of steps (default 100000)\n");
+  printf("  size=<dist>      size of blocks (default uniform:16:4096)\n");
+  printf("  life=<dist>      lifetime of blocks in steps (default exp:1000)\n");
+  printf("  live=<bytes>     target size of live blocks (default 0: none)\n");
+  printf("  churn=<p>        probability to replace a block at the target\n");
+  printf("  realloc=<p>      probability to reallocate a block\n");
+  printf("Distributions:\n");
+  printf("  uniform:<min>:<max>\n");
+  printf("  lognormal:<median>:<sigma>[:<max>]\n");
+  printf("  exp:<mean>\n");
+  printf("  trace:<memlog>   sizes of allocations in the memlog\n");
+  printf("  inf              (lifetime only) never deallocated\n");
+  printf("With '-t', each command has the timestamp (step * <step time> ns).\n");
+}
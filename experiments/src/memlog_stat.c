@@ -0,0 +1,441 @@
+/*
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "histogram.h"
+#include "memlog.h"
+
+/*
+  Profile of a memlog: sizes, lifetimes, the live set, churn of each size
+  class and growth by reallocation. Times are counted in operations
+  (allocations, deallocations and reallocations), so profiles of traces
+  with and without timestamps are comparable. Size classes are powers of
+  two; the class k holds sizes in (2^(k-1), 2^k].
+ */
+
+/* Number of commands decoded at once */
+#define BATCH_SIZE 65536
+/* Size classes and lifetime buckets are powers of two */
+#define CLASS_NB 65
+/* Default number of points of the live-set curve */
+#define DEFAULT_POINT_NR 100
+/* Relative error of growth ratios regarded as the same */
+#define RATIO_TOLERANCE 0.01
+
+/* Upper bounds of the buckets of ratios of new sizes to old sizes
+   (reallocations to the same size are not counted) */
+static const double ratio_upper[] = {
+  0.5, 1.0, 1.25, 1.5, 2.0, 4.0, INFINITY,
+};
+#define RATIO_BUCKET_NB (sizeof(ratio_upper) / sizeof(ratio_upper[0]))
+
+/* Block being live */
+typedef struct {
+  /* Operation number of the allocation */
+  uint64_t birth;
+  size_t size;
+  /* Reallocations since the allocation */
+  uint32_t realloc_nr;
+  /* Difference and ratio of the last growth (0: none) */
+  int64_t last_delta;
+  double last_ratio;
+  bool live;
+} block_t;
+
+/* Statistics of a size class */
+typedef struct {
+  uint64_t alloc_nr;
+  uint64_t alloc_bytes;
+  uint64_t dealloc_nr;
+  /* Reallocations into and out of the class */
+  uint64_t realloc_in;
+  uint64_t realloc_out;
+  uint64_t live_nr;
+  uint64_t live_peak;
+} class_stat_t;
+
+static command_t g_batch[BATCH_SIZE];
+static bool g_csv = false;
+
+/** Calculate the size class (rounded up log2) of 'size' */
+static inline size_t size_class(size_t size) {
+  if (size <= 1) return 0;
+  return 64 - __builtin_clzll(size - 1);
+}
+
+/** Print the title of a section and the names of its columns */
+static void print_header(const char* section, const char* const* names,
+    size_t nr) {
+  size_t i;
+
+  if (g_csv) {
+    printf("%s", section);
+    for (i = 0; i < nr; ++i) printf(",%s", names[i]);
+  } else {
+    printf("\n[%s]\n", section);
+    for (i = 0; i < nr; ++i) printf("%14s", names[i]);
+  }
+  putchar('\n');
+}
+
+/** Print a row of a section; integers are printed without decimals */
+static void print_row(const char* section, const double* values, size_t nr) {
+  size_t i;
+  double v;
+
+  if (g_csv) printf("%s", section);
+  for (i = 0; i < nr; ++i) {
+    v = values[i];
+    if (g_csv) {
+      printf(v == floor(v) && fabs(v) < 1e15 ? ",%.0f" : ",%.6g", v);
+    } else {
+      printf(v == floor(v) && fabs(v) < 1e15 ? "%14.0f" : "%14.3f", v);
+    }
+  }
+  putchar('\n');
+}
+
+/** Print a named value of the summary */
+static void print_value(const char* name, double value) {
+  if (g_csv) {
+    printf(value == floor(value) ? "summary,%s,%.0f\n" : "summary,%s,%.6g\n",
+      name, value);
+  } else {
+    printf(value == floor(value) ? "%-24s %14.0f\n" : "%-24s %14.3f\n",
+      name, value);
+  }
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+  return whole == 0 ? 0.0 : 100.0 * part / whole;
+}
+
+static void print_usage(const char* program_name) {
+  printf("%s [options] <memlog>\n", program_name);
+  printf("Print the profile of a memlog: sizes, lifetimes, the live set, "
+    "churn of size classes\nand reallocations. Times are counted in "
+    "allocations, deallocations and reallocations.\n");
+  printf("Options:\n");
+  printf("  -c             print CSV (the first column is the section)\n");
+  printf("  -k <interval>  operations between points of the live-set curve "
+    "(default: %d points)\n", DEFAULT_POINT_NR);
+}
+
+int main(int argc, char* argv[]) {
+  memlog_stream_t* memlog;
+  block_t* blocks;
+  block_t* block;
+  class_stat_t classes[CLASS_NB];
+  uint64_t size_realloc[CLASS_NB];
+  uint64_t lifetimes[CLASS_NB];
+  uint64_t chains[CLASS_NB];
+  uint64_t ratios[RATIO_BUCKET_NB];
+  histogram_t* lifetime_histogram;
+  uint64_t interval = 0;
+  uint64_t op_nr = 0, alloc_nr = 0, dealloc_nr = 0, realloc_nr = 0;
+  uint64_t deref_nr = 0, alloc_bytes = 0;
+  uint64_t live_nr = 0, live_bytes = 0, live_nr_peak = 0, live_bytes_peak = 0;
+  uint64_t grow_nr = 0, shrink_nr = 0, same_nr = 0;
+  uint64_t additive_nr = 0, geometric_nr = 0, realloc_class_nr = 0;
+  uint64_t lifetime, cumulative, ratio_nr;
+  size_t i, k, batch_nr, idx, sc, old_sc, last_class = 0;
+  int64_t delta;
+  double ratio, row[10];
+  command_t command;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "ck:")) != -1) {
+    switch (opt) {
+    case 'c': g_csv = true; break;
+    case 'k': interval = strtoull(optarg, NULL, 10); break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind + 1 != argc) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  memlog = memlog_stream_open(argv[optind]);
+  if (interval == 0) {
+    interval = memlog->command_nr / DEFAULT_POINT_NR;
+    if (interval == 0) interval = 1;
+  }
+  blocks = calloc(memlog->block_max, sizeof(block_t));
+  lifetime_histogram = histogram_create();
+  if (blocks == NULL) {
+    perror("malloc");
+    return EXIT_FAILURE;
+  }
+  memset(classes, 0, sizeof(classes));
+  memset(size_realloc, 0, sizeof(size_realloc));
+  memset(lifetimes, 0, sizeof(lifetimes));
+  memset(chains, 0, sizeof(chains));
+  memset(ratios, 0, sizeof(ratios));
+
+  /* The live-set curve is printed while reading the trace */
+  {
+    static const char* const names[] = {
+      "operation", "line", "live_blocks", "live_bytes",
+    };
+    print_header("live", names, 4);
+  }
+
+  while ((batch_nr = memlog_stream_read(memlog, g_batch, BATCH_SIZE)) > 0) {
+    for (i = 0; i < batch_nr; ++i) {
+      command = g_batch[i];
+      idx = command.idx;
+      if (idx >= memlog->block_max) continue;
+      block = &blocks[idx];
+      switch (command_kind(command.type)) {
+      case COMMAND_ALLOCATE:
+        if (block->live) continue;
+        sc = size_class(command.size);
+        block->birth      = op_nr;
+        block->size       = command.size;
+        block->realloc_nr = 0;
+        block->last_delta = 0;
+        block->last_ratio = 0;
+        block->live       = true;
+        alloc_nr++;
+        alloc_bytes += command.size;
+        classes[sc].alloc_nr++;
+        classes[sc].alloc_bytes += command.size;
+        if (++classes[sc].live_nr > classes[sc].live_peak) {
+          classes[sc].live_peak = classes[sc].live_nr;
+        }
+        if (sc + 1 > last_class) last_class = sc + 1;
+        live_nr++;
+        live_bytes += command.size;
+        break;
+      case COMMAND_DEALLOCATE:
+        if (!block->live) continue;
+        sc = size_class(block->size);
+        lifetime = op_nr - block->birth;
+        lifetimes[size_class(lifetime + 1)]++;
+        histogram_record(lifetime_histogram, lifetime);
+        chains[size_class(block->realloc_nr + 1)]++;
+        classes[sc].dealloc_nr++;
+        classes[sc].live_nr--;
+        dealloc_nr++;
+        live_nr--;
+        live_bytes -= block->size;
+        block->live = false;
+        break;
+      case COMMAND_REALLOCATE:
+        if (!block->live) continue;
+        old_sc = size_class(block->size);
+        sc = size_class(command.size);
+        realloc_nr++;
+        size_realloc[sc]++;
+        if (sc != old_sc) {
+          realloc_class_nr++;
+          classes[old_sc].realloc_out++;
+          classes[old_sc].live_nr--;
+          classes[sc].realloc_in++;
+          if (++classes[sc].live_nr > classes[sc].live_peak) {
+            classes[sc].live_peak = classes[sc].live_nr;
+          }
+          if (sc + 1 > last_class) last_class = sc + 1;
+        }
+        if (command.size > block->size) {
+          grow_nr++;
+          /* Growth by the same increment or the same ratio as the last
+             one of the block */
+          delta = (int64_t)(command.size - block->size);
+          ratio = block->size == 0 ? 0.0 : (double)command.size / block->size;
+          if (delta == block->last_delta) {
+            additive_nr++;
+          } else if (ratio > 0 && block->last_ratio > 0 &&
+                     fabs(ratio / block->last_ratio - 1) < RATIO_TOLERANCE) {
+            geometric_nr++;
+          }
+          block->last_delta = delta;
+          block->last_ratio = ratio;
+        } else if (command.size < block->size) {
+          shrink_nr++;
+        } else {
+          same_nr++;
+        }
+        if (block->size > 0 && command.size != block->size) {
+          ratio = (double)command.size / block->size;
+          for (k = 0; ratio > ratio_upper[k]; ++k) {
+          }
+          ratios[k]++;
+        }
+        block->realloc_nr++;
+        live_bytes += command.size;
+        live_bytes -= block->size;
+        block->size = command.size;
+        break;
+      case COMMAND_DEREFERENCE:
+        deref_nr++;
+        continue;
+      default:
+        continue;
+      }
+
+      op_nr++;
+      if (live_nr > live_nr_peak) live_nr_peak = live_nr;
+      if (live_bytes > live_bytes_peak) live_bytes_peak = live_bytes;
+      if (op_nr % interval == 0) {
+        row[0] = op_nr;
+        row[1] = command.line;
+        row[2] = live_nr;
+        row[3] = live_bytes;
+        print_row("live", row, 4);
+      }
+    }
+  }
+
+  {
+    static const char* const names[] = {
+      "class", "max_size", "allocs", "allocs_%", "cumulative_%", "bytes",
+      "bytes_%", "reallocs",
+    };
+    print_header("sizes", names, 8);
+    cumulative = 0;
+    for (sc = 0; sc < last_class; ++sc) {
+      if (classes[sc].alloc_nr == 0 && size_realloc[sc] == 0) continue;
+      cumulative += classes[sc].alloc_nr;
+      row[0] = sc;
+      row[1] = ldexp(1.0, (int)sc);
+      row[2] = classes[sc].alloc_nr;
+      row[3] = percent(classes[sc].alloc_nr, alloc_nr);
+      row[4] = percent(cumulative, alloc_nr);
+      row[5] = classes[sc].alloc_bytes;
+      row[6] = percent(classes[sc].alloc_bytes, alloc_bytes);
+      row[7] = size_realloc[sc];
+      print_row("sizes", row, 8);
+    }
+  }
+
+  {
+    static const char* const names[] = {
+      "max_ops", "blocks", "blocks_%", "cumulative_%",
+    };
+    print_header("lifetimes", names, 4);
+    cumulative = 0;
+    for (k = 0; k < CLASS_NB; ++k) {
+      if (lifetimes[k] == 0) continue;
+      cumulative += lifetimes[k];
+      /* The bucket k holds lifetimes in [2^(k-1), 2^k - 1] */
+      row[0] = ldexp(1.0, (int)k) - 1;
+      row[1] = lifetimes[k];
+      row[2] = percent(lifetimes[k], dealloc_nr);
+      row[3] = percent(cumulative, dealloc_nr);
+      print_row("lifetimes", row, 4);
+    }
+  }
+
+  {
+    static const char* const names[] = {
+      "class", "max_size", "allocs", "deallocs", "realloc_in",
+      "realloc_out", "peak_live", "live_end", "turnover",
+    };
+    print_header("classes", names, 9);
+    for (sc = 0; sc < last_class; ++sc) {
+      if (classes[sc].live_peak == 0) continue;
+      row[0] = sc;
+      row[1] = ldexp(1.0, (int)sc);
+      row[2] = classes[sc].alloc_nr;
+      row[3] = classes[sc].dealloc_nr;
+      row[4] = classes[sc].realloc_in;
+      row[5] = classes[sc].realloc_out;
+      row[6] = classes[sc].live_peak;
+      row[7] = classes[sc].live_nr;
+      /* Blocks leaving the class per block of its peak */
+      row[8] = (double)(classes[sc].dealloc_nr + classes[sc].realloc_out) /
+        classes[sc].live_peak;
+      print_row("classes", row, 9);
+    }
+  }
+
+  {
+    static const char* const names[] = {
+      "max_ratio", "reallocs", "reallocs_%",
+    };
+    print_header("growth", names, 3);
+    ratio_nr = 0;
+    for (k = 0; k < RATIO_BUCKET_NB; ++k) ratio_nr += ratios[k];
+    for (k = 0; k < RATIO_BUCKET_NB; ++k) {
+      if (ratios[k] == 0) continue;
+      row[0] = ratio_upper[k];
+      row[1] = ratios[k];
+      row[2] = percent(ratios[k], ratio_nr);
+      print_row("growth", row, 3);
+    }
+  }
+
+  {
+    static const char* const names[] = {
+      "max_reallocs", "blocks", "blocks_%",
+    };
+    print_header("chains", names, 3);
+    for (k = 0; k < CLASS_NB; ++k) {
+      if (chains[k] == 0) continue;
+      row[0] = ldexp(1.0, (int)k) - 1;
+      row[1] = chains[k];
+      row[2] = percent(chains[k], dealloc_nr);
+      print_row("chains", row, 3);
+    }
+  }
+
+  if (!g_csv) printf("\n[summary]\n");
+  print_value("commands", memlog->command_nr);
+  print_value("operations", op_nr);
+  print_value("allocations", alloc_nr);
+  print_value("deallocations", dealloc_nr);
+  print_value("reallocations", realloc_nr);
+  print_value("dereferences", deref_nr);
+  print_value("block_max", memlog->block_max);
+  print_value("mem_min", memlog->mem_min);
+  print_value("mem_max", memlog->mem_max);
+  print_value("mean_size", alloc_nr == 0 ? 0.0 :
+    (double)alloc_bytes / alloc_nr);
+  print_value("peak_live_blocks", live_nr_peak);
+  print_value("peak_live_bytes", live_bytes_peak);
+  print_value("live_blocks_end", live_nr);
+  print_value("live_bytes_end", live_bytes);
+  print_value("lifetime_p50", histogram_percentile(lifetime_histogram, 50));
+  print_value("lifetime_p90", histogram_percentile(lifetime_histogram, 90));
+  print_value("lifetime_p99", histogram_percentile(lifetime_histogram, 99));
+  print_value("lifetime_max", lifetime_histogram->max);
+  print_value("grows", grow_nr);
+  print_value("additive_grows", additive_nr);
+  print_value("geometric_grows", geometric_nr);
+  print_value("shrinks", shrink_nr);
+  print_value("same_size_reallocs", same_nr);
+  print_value("class_changing_reallocs", realloc_class_nr);
+
+  histogram_destroy(lifetime_histogram);
+  free(blocks);
+  memlog_stream_close(memlog);
+  return EXIT_SUCCESS;
+}
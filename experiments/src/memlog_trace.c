@@ -0,0 +1,588 @@
+/*
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/*
+ * LD_PRELOAD library that records malloc / free / realloc / calloc of a
+ * program as a memlog.
+ *
+ *   MEMLOG_TRACE=out.%p.memlog LD_PRELOAD=./memlog_trace.so <program>
+ *
+ * '%p' in the file name is replaced by the process id. Each thread formats
+ * commands into its own buffer and appends it to the file when it is full,
+ * so the lines of different threads are interleaved by buffer. Every command
+ * has a timestamp ('@') unique in the process and the thread number ('#'),
+ * and the trace is put in order with
+ *
+ *   sort -s -n -t@ -k2 out.1234.memlog > app.memlog
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#define TRACE_INLINE static inline __attribute__((always_inline))
+/* Thread local variables must not call malloc when they are accessed */
+#define TRACE_TLS __thread __attribute__((tls_model("initial-exec")))
+
+/* Size of the buffer of each thread */
+#define BUFFER_SIZE (64 * 1024)
+/* Maximum length of a command */
+#define LINE_MAX_SIZE 96
+/* Initial number of slots of the map from pointers to idx */
+#define MAP_INITIAL_SIZE (1 << 16)
+/* Size of the arena used while dlsym resolves the functions */
+#define BOOTSTRAP_SIZE (64 * 1024)
+/* Maximum length of the file name */
+#define PATH_SIZE 4096
+/* Number of spins before yielding the CPU while waiting for a lock */
+#define SPIN_LIMIT 256
+
+/* Buffer of a thread */
+typedef struct trace_buffer_t {
+  struct trace_buffer_t* next;
+  /* Taken by the owner while writing and by the destructor */
+  int lock;
+  /* Released by an exited thread */
+  bool idle;
+  uint32_t tid;
+  size_t used;
+  char data[BUFFER_SIZE];
+} trace_buffer_t;
+
+/* Slot of the map (ptr == NULL: empty) */
+typedef struct {
+  void* ptr;
+  size_t idx;
+} map_slot_t;
+
+/* Real functions */
+static void* (*real_malloc)(size_t);
+static void  (*real_free)(void*);
+static void* (*real_realloc)(void*, size_t);
+static void* (*real_calloc)(size_t, size_t);
+static int   (*real_posix_memalign)(void**, size_t, size_t);
+static void* (*real_aligned_alloc)(size_t, size_t);
+static void* (*real_memalign)(size_t, size_t);
+
+static struct {
+  /* 0: not initialized, 1: initializing, 2: tracing, 3: disabled */
+  int state;
+  int fd;
+  uint64_t start_time;
+  uint64_t last_time;
+  uint32_t thread_nr;
+
+  /* Protects the map, the ids and the timestamp */
+  int lock;
+  map_slot_t* map;
+  size_t map_size;
+  size_t map_used;
+  /* Unused idx */
+  size_t* free_ids;
+  size_t free_id_capacity;
+  size_t free_id_nr;
+  size_t id_nr;
+
+  /* All buffers, to be flushed at exit */
+  int buffer_lock;
+  trace_buffer_t* buffers;
+
+  char bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(16)));
+  size_t bootstrap_used;
+} g_trace = { .fd = -1 };
+
+static TRACE_TLS trace_buffer_t* t_buffer;
+/* Nonzero while the tracer itself runs in this thread */
+static TRACE_TLS int t_busy;
+
+static pthread_key_t g_thread_key;
+
+static void trace_init(void);
+static void trace_fini(void) __attribute__((destructor));
+static void thread_exit(void* arg);
+static void after_fork(void);
+static void record(char type, void* old_ptr, void* new_ptr, size_t size);
+static void commit(char type, void* old_ptr, void* new_ptr, size_t size,
+  trace_buffer_t* buffer);
+static void flush(trace_buffer_t* buffer);
+static trace_buffer_t* get_buffer(void);
+static bool map_insert(void* ptr, size_t idx);
+static bool map_remove(void* ptr, size_t* idx);
+static void map_grow(void);
+static void* bootstrap_alloc(size_t size);
+
+TRACE_INLINE void spin_lock(int* lock) {
+  int spin = 0;
+
+  while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+      /* The holder may have been preempted */
+      if (++spin < SPIN_LIMIT) {
+        __builtin_ia32_pause();
+      } else {
+        sched_yield();
+      }
+    }
+  }
+}
+
+TRACE_INLINE void spin_unlock(int* lock) {
+  __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+TRACE_INLINE uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+TRACE_INLINE size_t hash_ptr(const void* ptr, size_t map_size) {
+  return (((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL) >> 16 &
+    (map_size - 1);
+}
+
+TRACE_INLINE char* put_uint(char* p, uint64_t value) {
+  char digits[20];
+  int n = 0;
+
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  while (n > 0) *p++ = digits[--n];
+  return p;
+}
+
+TRACE_INLINE bool tracing(void) {
+  if (__builtin_expect(g_trace.state != 2, 0)) {
+    if (g_trace.state == 0) trace_init();
+    if (g_trace.state != 2) return false;
+  }
+  return t_busy == 0;
+}
+
+void* malloc(size_t size) {
+  void* ptr;
+
+  if (real_malloc == NULL) {
+    trace_init();
+    if (real_malloc == NULL) return bootstrap_alloc(size);
+  }
+  ptr = real_malloc(size);
+  if (ptr != NULL && tracing()) record('m', NULL, ptr, size);
+  return ptr;
+}
+
+void* calloc(size_t nmemb, size_t size) {
+  void* ptr;
+
+  /* dlsym calls calloc before the real one is known */
+  if (real_calloc == NULL) {
+    trace_init();
+    if (real_calloc == NULL) return bootstrap_alloc(nmemb * size);
+  }
+  ptr = real_calloc(nmemb, size);
+  if (ptr != NULL && tracing()) record('m', NULL, ptr, nmemb * size);
+  return ptr;
+}
+
+void free(void* ptr) {
+  if (ptr == NULL) return;
+  if (real_free == NULL) trace_init();
+  if ((char*)ptr >= g_trace.bootstrap &&
+      (char*)ptr < g_trace.bootstrap + BOOTSTRAP_SIZE) {
+    return;
+  }
+  if (tracing()) record('f', ptr, NULL, 0);
+  real_free(ptr);
+}
+
+void* realloc(void* ptr, size_t size) {
+  trace_buffer_t* buffer;
+  void* new_ptr;
+
+  if (ptr == NULL) return malloc(size);
+  if ((char*)ptr >= g_trace.bootstrap &&
+      (char*)ptr < g_trace.bootstrap + BOOTSTRAP_SIZE) {
+    /* Blocks of the bootstrap arena are moved out of it */
+    new_ptr = malloc(size);
+    if (new_ptr != NULL) {
+      memcpy(new_ptr, ptr, size < BOOTSTRAP_SIZE ? size : BOOTSTRAP_SIZE);
+    }
+    return new_ptr;
+  }
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+  if (!tracing()) return real_realloc(ptr, size);
+  /* The map is locked until the old pointer is replaced since another
+     thread may get the same address as soon as it is released */
+  t_busy = 1;
+  buffer = get_buffer();
+  spin_lock(&g_trace.lock);
+  new_ptr = real_realloc(ptr, size);
+  if (new_ptr == NULL) {
+    spin_unlock(&g_trace.lock);
+    t_busy = 0;
+    return NULL;
+  }
+  commit('r', ptr, new_ptr, size, buffer);
+  return new_ptr;
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) {
+  int ret;
+
+  if (real_posix_memalign == NULL) trace_init();
+  ret = real_posix_memalign(memptr, alignment, size);
+  if (ret == 0 && tracing()) record('m', NULL, *memptr, size);
+  return ret;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  void* ptr;
+
+  if (real_aligned_alloc == NULL) trace_init();
+  ptr = real_aligned_alloc(alignment, size);
+  if (ptr != NULL && tracing()) record('m', NULL, ptr, size);
+  return ptr;
+}
+
+void* memalign(size_t alignment, size_t size) {
+  void* ptr;
+
+  if (real_memalign == NULL) trace_init();
+  ptr = real_memalign(alignment, size);
+  if (ptr != NULL && tracing()) record('m', NULL, ptr, size);
+  return ptr;
+}
+
+/**
+ * Assign idx to the pointer and write the command
+ * @param type 'm', 'f' or 'r'
+ * @param old_ptr Deallocated or reallocated pointer
+ * @param new_ptr Allocated or reallocated pointer
+ */
+static void record(char type, void* old_ptr, void* new_ptr, size_t size) {
+  trace_buffer_t* buffer;
+
+  t_busy = 1;
+  buffer = get_buffer();
+  spin_lock(&g_trace.lock);
+  commit(type, old_ptr, new_ptr, size, buffer);
+}
+
+/**
+ * Body of record() called with g_trace.lock taken, which is released
+ */
+static void commit(char type, void* old_ptr, void* new_ptr, size_t size,
+    trace_buffer_t* buffer) {
+  uint64_t timestamp;
+  size_t idx;
+  char* p;
+
+  if (type == 'm') {
+    idx = g_trace.free_id_nr > 0 ?
+      g_trace.free_ids[--g_trace.free_id_nr] : g_trace.id_nr++;
+    if (!map_insert(new_ptr, idx)) goto untraced;
+  } else if (!map_remove(old_ptr, &idx)) {
+    /* Allocated before tracing started or by an untraced function */
+    if (type == 'f') goto untraced;
+    idx = g_trace.free_id_nr > 0 ?
+      g_trace.free_ids[--g_trace.free_id_nr] : g_trace.id_nr++;
+    type = 'm';
+    if (!map_insert(new_ptr, idx)) goto untraced;
+  } else if (type == 'f') {
+    if (g_trace.free_id_nr == g_trace.free_id_capacity) {
+      if (g_trace.free_id_capacity == 0) {
+        g_trace.free_id_capacity = MAP_INITIAL_SIZE;
+        g_trace.free_ids = mmap(NULL,
+          g_trace.free_id_capacity * sizeof(size_t), PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      } else {
+        g_trace.free_ids = mremap(g_trace.free_ids,
+          g_trace.free_id_capacity * sizeof(size_t),
+          2 * g_trace.free_id_capacity * sizeof(size_t), MREMAP_MAYMOVE);
+        g_trace.free_id_capacity *= 2;
+      }
+      if (g_trace.free_ids == MAP_FAILED) {
+        g_trace.state = 3;
+        goto untraced;
+      }
+    }
+    g_trace.free_ids[g_trace.free_id_nr++] = idx;
+  } else {
+    map_insert(new_ptr, idx);
+  }
+  /* Commands of different threads are ordered by unique timestamps */
+  timestamp = now_ns() - g_trace.start_time;
+  if (timestamp <= g_trace.last_time) timestamp = g_trace.last_time + 1;
+  g_trace.last_time = timestamp;
+  spin_unlock(&g_trace.lock);
+
+  spin_lock(&buffer->lock);
+  if (buffer->used + LINE_MAX_SIZE > BUFFER_SIZE) flush(buffer);
+  p = buffer->data + buffer->used;
+  *p++ = type;
+  *p++ = ' ';
+  p = put_uint(p, idx);
+  if (type != 'f') {
+    *p++ = ' ';
+    p = put_uint(p, size);
+  }
+  *p++ = ' ';
+  *p++ = '@';
+  p = put_uint(p, timestamp);
+  *p++ = ' ';
+  *p++ = '#';
+  p = put_uint(p, buffer->tid);
+  *p++ = '\n';
+  buffer->used = p - buffer->data;
+  spin_unlock(&buffer->lock);
+  t_busy = 0;
+  return;
+
+untraced:
+  spin_unlock(&g_trace.lock);
+  t_busy = 0;
+}
+
+/**
+ * Write the buffer to the file (buffer->lock must be taken)
+ */
+static void flush(trace_buffer_t* buffer) {
+  size_t done = 0;
+  ssize_t ret;
+
+  while (done < buffer->used) {
+    ret = write(g_trace.fd, buffer->data + done, buffer->used - done);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    done += ret;
+  }
+  buffer->used = 0;
+}
+
+static trace_buffer_t* get_buffer(void) {
+  trace_buffer_t* buffer = t_buffer;
+
+  if (__builtin_expect(buffer != NULL, 1)) return buffer;
+  /* A buffer of an exited thread is reused with its thread number */
+  spin_lock(&g_trace.buffer_lock);
+  for (buffer = g_trace.buffers; buffer != NULL; buffer = buffer->next) {
+    if (buffer->idle) {
+      buffer->idle = false;
+      break;
+    }
+  }
+  spin_unlock(&g_trace.buffer_lock);
+  if (buffer == NULL) {
+    buffer = mmap(NULL, sizeof(trace_buffer_t), PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) abort();
+    buffer->tid = __atomic_fetch_add(&g_trace.thread_nr, 1, __ATOMIC_RELAXED);
+    spin_lock(&g_trace.buffer_lock);
+    buffer->next = g_trace.buffers;
+    g_trace.buffers = buffer;
+    spin_unlock(&g_trace.buffer_lock);
+  }
+  t_buffer = buffer;
+  /* The destructor of the key flushes the buffer when the thread exits */
+  pthread_setspecific(g_thread_key, buffer);
+  return buffer;
+}
+
+static void thread_exit(void* arg) {
+  trace_buffer_t* buffer = arg;
+
+  spin_lock(&buffer->lock);
+  flush(buffer);
+  spin_unlock(&buffer->lock);
+  t_buffer = NULL;
+  spin_lock(&g_trace.buffer_lock);
+  buffer->idle = true;
+  spin_unlock(&g_trace.buffer_lock);
+}
+
+static bool map_insert(void* ptr, size_t idx) {
+  size_t i;
+
+  if (2 * (g_trace.map_used + 1) > g_trace.map_size) {
+    map_grow();
+    if (g_trace.map == NULL) return false;
+  }
+  i = hash_ptr(ptr, g_trace.map_size);
+  while (g_trace.map[i].ptr != NULL && g_trace.map[i].ptr != ptr) {
+    i = (i + 1) & (g_trace.map_size - 1);
+  }
+  if (g_trace.map[i].ptr == NULL) ++g_trace.map_used;
+  g_trace.map[i].ptr = ptr;
+  g_trace.map[i].idx = idx;
+  return true;
+}
+
+static bool map_remove(void* ptr, size_t* idx) {
+  size_t mask = g_trace.map_size - 1;
+  size_t i, j, home;
+
+  if (g_trace.map == NULL) return false;
+  i = hash_ptr(ptr, g_trace.map_size);
+  while (g_trace.map[i].ptr != ptr) {
+    if (g_trace.map[i].ptr == NULL) return false;
+    i = (i + 1) & mask;
+  }
+  *idx = g_trace.map[i].idx;
+  --g_trace.map_used;
+  /* Backward shift deletion keeps probe sequences without tombstones */
+  for (j = (i + 1) & mask; g_trace.map[j].ptr != NULL; j = (j + 1) & mask) {
+    home = hash_ptr(g_trace.map[j].ptr, g_trace.map_size);
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      g_trace.map[i] = g_trace.map[j];
+      i = j;
+    }
+  }
+  g_trace.map[i].ptr = NULL;
+  return true;
+}
+
+static void map_grow(void) {
+  map_slot_t* old_map = g_trace.map;
+  size_t old_size = g_trace.map_size;
+  size_t i;
+
+  g_trace.map_size = old_size == 0 ? MAP_INITIAL_SIZE : 2 * old_size;
+  g_trace.map = mmap(NULL, g_trace.map_size * sizeof(map_slot_t),
+    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (g_trace.map == MAP_FAILED) {
+    g_trace.map = NULL;
+    g_trace.state = 3;
+    return;
+  }
+  g_trace.map_used = 0;
+  for (i = 0; i < old_size; ++i) {
+    if (old_map[i].ptr != NULL) map_insert(old_map[i].ptr, old_map[i].idx);
+  }
+  if (old_map != NULL) munmap(old_map, old_size * sizeof(map_slot_t));
+}
+
+static void* bootstrap_alloc(size_t size) {
+  void* ptr;
+
+  size = (size + 15) & ~(size_t)15;
+  if (g_trace.bootstrap_used + size > BOOTSTRAP_SIZE) return NULL;
+  ptr = g_trace.bootstrap + g_trace.bootstrap_used;
+  g_trace.bootstrap_used += size;
+  return ptr;
+}
+
+static void trace_init(void) {
+  char path[PATH_SIZE];
+  const char* name;
+  char* p;
+  int expected = 0;
+
+  if (!__atomic_compare_exchange_n(&g_trace.state, &expected, 1, false,
+      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    /* dlsym and others call malloc in the initializing thread */
+    if (t_busy) return;
+    /* Another thread is initializing */
+    while (__atomic_load_n(&g_trace.state, __ATOMIC_ACQUIRE) == 1) {
+      __builtin_ia32_pause();
+    }
+    return;
+  }
+
+  t_busy = 1;
+  real_malloc         = dlsym(RTLD_NEXT, "malloc");
+  real_free           = dlsym(RTLD_NEXT, "free");
+  real_realloc        = dlsym(RTLD_NEXT, "realloc");
+  real_calloc         = dlsym(RTLD_NEXT, "calloc");
+  real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+  real_aligned_alloc  = dlsym(RTLD_NEXT, "aligned_alloc");
+  real_memalign       = dlsym(RTLD_NEXT, "memalign");
+
+  name = getenv("MEMLOG_TRACE");
+  if (name == NULL) name = "trace.%p.memlog";
+  /* '%p' is replaced by the pid so that child processes have own files */
+  for (p = path; *name != '\0' && p < path + PATH_SIZE - 24; ++name) {
+    if (name[0] == '%' && name[1] == 'p') {
+      p = put_uint(p, getpid());
+      ++name;
+    } else {
+      *p++ = *name;
+    }
+  }
+  *p = '\0';
+
+  g_trace.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+    0644);
+  if (g_trace.fd < 0 || pthread_key_create(&g_thread_key, thread_exit) != 0) {
+    t_busy = 0;
+    __atomic_store_n(&g_trace.state, 3, __ATOMIC_RELEASE);
+    return;
+  }
+  pthread_atfork(NULL, NULL, after_fork);
+  g_trace.start_time = now_ns();
+  t_busy = 0;
+  __atomic_store_n(&g_trace.state, 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * A forked child stops tracing since the buffers hold commands of the parent
+ */
+static void after_fork(void) {
+  trace_buffer_t* buffer;
+
+  g_trace.state = 3;
+  for (buffer = g_trace.buffers; buffer != NULL; buffer = buffer->next) {
+    buffer->used = 0;
+    buffer->lock = 0;
+  }
+  g_trace.lock = 0;
+  g_trace.buffer_lock = 0;
+}
+
+static void trace_fini(void) {
+  trace_buffer_t* buffer;
+
+  if (g_trace.state != 2) return;
+  g_trace.state = 3;
+  spin_lock(&g_trace.buffer_lock);
+  for (buffer = g_trace.buffers; buffer != NULL; buffer = buffer->next) {
+    spin_lock(&buffer->lock);
+    flush(buffer);
+    spin_unlock(&buffer->lock);
+  }
+  spin_unlock(&g_trace.buffer_lock);
+  close(g_trace.fd);
+}
@@ -23,6 +23,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "allocator.h"
 #include "memlog.h"
@@ -58,6 +61,34 @@
 #  define MAX_BLOCK_SIZE 4096
 #endif
 
+/** Size of buffers to read files in /proc */
+#define PROC_BUFFER_SIZE 65536
+/** Maximum number of regions reported with pagemap */
+#define REGION_MAX 1024
+/** Present bit of an entry of /proc/self/pagemap */
+#define PAGEMAP_PRESENT (1ULL << 63)
+/** Swapped bit of an entry of /proc/self/pagemap */
+#define PAGEMAP_SWAPPED (1ULL << 62)
+
+/** Memory usage seen by the kernel [byte] */
+typedef struct {
+  size_t rss;
+  size_t pss;
+  /** Anonymous part of rss */
+  size_t anon;
+  /** Size of page tables */
+  size_t page_table;
+} kernel_usage_t;
+
+/** Residency of a mapping given by pagemap */
+typedef struct {
+  uintptr_t start;
+  uintptr_t end;
+  size_t resident;
+  size_t swapped;
+  char name[64];
+} region_t;
+
 /** Structure to store allocated memory blocks */
 typedef struct {
   /** Start address of the block */
@@ -87,6 +118,19 @@ static inline void swap_block(memblock_t* block1, memblock_t* block2) {
 static void give_worst(int allocator);
 /** Read memory trace by file and measure allocator's memory consumption  */
 static void memory_trace(const char* filename, int allocator);
+/** Measure memory consumption seen by the kernel every 'interval'
+  operations, and the residency of each mapping with pagemap at the peak */
+static void kernel_trace(const char* filename, int allocator,
+  size_t interval, bool use_pagemap, bool touch);
+/** Read RSS and PSS from smaps_rollup and page tables from status */
+static void read_kernel_usage(kernel_usage_t* usage);
+/** Read resident pages of each mapping with pagemap.
+  The returnvalue is the number of regions. */
+static size_t read_regions(region_t* regions, size_t region_max);
+/** Read a file in /proc into static buffer with NULL terminator */
+static const char* read_proc(const char* path);
+/** Find "<key>: <value> kB" in `text` and return it in byte */
+static size_t proc_field(const char* text, const char* key);
 /** Print usage to standard output */
 static void print_usage(const char* program_name);
 
@@ -125,6 +169,11 @@ static inline bool verify_position(const memblock_t* memblocks, size_t num,
 
 int main(int argc, char* argv[]) {
   int allocator;
+  size_t interval = 0;
+  bool use_pagemap = false;
+  bool touch = false;
+  int i;
+
   if (argc < 3) {
     print_usage(argv[0]);
     return EXIT_FAILURE;
@@ -136,8 +185,36 @@ int main(int argc, char* argv[]) {
     exit(EXIT_FAILURE);
   }
 
+  for (i = 3; i < argc; ++i) {
+    if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+      interval = strtoul(argv[++i], NULL, 10);
+      if (interval == 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "-p") == 0) {
+      use_pagemap = true;
+    } else if (strcmp(argv[i], "-t") == 0) {
+      touch = true;
+    } else {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  /* '-p' and '-t' apply only to the kernel trace of '-k' */
+  if ((use_pagemap || touch) && interval == 0) {
+    fprintf(stderr, "'-p' and '-t' require '-k'\n");
+    return EXIT_FAILURE;
+  }
+  if (strcmp(argv[1], "--worst") == 0 && interval > 0) {
+    fprintf(stderr, "'--worst' does not take '-k'\n");
+    return EXIT_FAILURE;
+  }
+
   if (strcmp(argv[1], "--worst") == 0) {
     give_worst(allocator);
+  } else if (interval > 0) {
+    kernel_trace(argv[1], allocator, interval, use_pagemap, touch);
   } else {
     memory_trace(argv[1], allocator);
   }
@@ -201,40 +278,232 @@ static void give_worst(int allocator) {
 }
 
 static void memory_trace(const char* filename, int allocator) {
-  memlog_t* memlog;
-  size_t i;
+  memlog_stream_t* memlog;
   size_t curr_time;
-  enum command_type type;
-  size_t command_nr, idx, size;
+  command_t command;
 
-  memlog = memlog_open(filename);
+  memlog = memlog_stream_open(filename);
   init_funcs[allocator](memlog->mem_min, memlog->mem_max,
     memlog->block_max, memlog->require_size);
-  command_nr = memlog->command_nr;
   curr_time  = 0;
-  for (i = 0; i < command_nr; ++i) {
-    type = memlog->commands[i].type;
-    idx  = memlog->commands[i].idx;
-    size = memlog->commands[i].size;
-    if (command_kind(type) == COMMAND_ALLOCATE) {
-      allocate_funcs[allocator](idx, size);
-    } else if (command_kind(type) == COMMAND_DEALLOCATE) {
-      deallocate_funcs[allocator](idx);
-    } else if (command_kind(type) == COMMAND_REALLOCATE) {
-      reallocate_funcs[allocator](idx, size);
+  while (memlog_stream_next(memlog, &command)) {
+    if (command_kind(command.type) == COMMAND_ALLOCATE) {
+      allocate_funcs[allocator](command.idx, command.size);
+    } else if (command_kind(command.type) == COMMAND_DEALLOCATE) {
+      deallocate_funcs[allocator](command.idx);
+    } else if (command_kind(command.type) == COMMAND_REALLOCATE) {
+      reallocate_funcs[allocator](command.idx, command.size);
     } else {
       continue;
     }
     curr_time++;
     printf("%zu %zu\n", curr_time, getsize_funcs[allocator]());
   }
+  memlog_stream_close(memlog);
+}
+
+static void kernel_trace(const char* filename, int allocator,
+    size_t interval, bool use_pagemap, bool touch) {
+  static region_t regions[REGION_MAX];
+  memlog_stream_t* memlog;
+  command_t command;
+  kernel_usage_t base, usage;
+  size_t* idx2size;
+  size_t curr_time = 0;
+  size_t live = 0, self, rss;
+  size_t peak_live = 0, peak_self = 0, peak_rss = 0, peak_pt = 0;
+  size_t region_nr = 0;
+  size_t i;
+
+  memlog = memlog_stream_open(filename);
+  idx2size = (size_t*)calloc(memlog->block_max, sizeof(size_t));
+  if (idx2size == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  init_funcs[allocator](memlog->mem_min, memlog->mem_max,
+    memlog->block_max, memlog->require_size);
+  /* Memory of this program and the memlog is excluded */
+  read_kernel_usage(&base);
+
+  printf("# time self live rss pss anon page_table rss/live [byte]\n");
+  while (memlog_stream_next(memlog, &command)) {
+    if (command_kind(command.type) == COMMAND_ALLOCATE) {
+      allocate_funcs[allocator](command.idx, command.size);
+      if (touch) {
+        memset(dereference_funcs[allocator](command.idx), 0xa5, command.size);
+      }
+      live += command.size;
+      idx2size[command.idx] = command.size;
+    } else if (command_kind(command.type) == COMMAND_DEALLOCATE) {
+      deallocate_funcs[allocator](command.idx);
+      live -= idx2size[command.idx];
+    } else if (command_kind(command.type) == COMMAND_REALLOCATE) {
+      reallocate_funcs[allocator](command.idx, command.size);
+      if (touch && command.size > idx2size[command.idx]) {
+        memset((char*)dereference_funcs[allocator](command.idx) +
+          idx2size[command.idx], 0xa5, command.size - idx2size[command.idx]);
+      }
+      live = live - idx2size[command.idx] + command.size;
+      idx2size[command.idx] = command.size;
+    } else {
+      continue;
+    }
+    curr_time++;
+    if (curr_time % interval != 0) continue;
+
+    self = getsize_funcs[allocator]();
+    read_kernel_usage(&usage);
+    rss = usage.rss > base.rss ? usage.rss - base.rss : 0;
+    usage.page_table = usage.page_table > base.page_table ?
+      usage.page_table - base.page_table : 0;
+    printf("%zu %zu %zu %zu %zu %zu %zu %.3f\n", curr_time, self, live, rss,
+      usage.pss > base.pss ? usage.pss - base.pss : 0,
+      usage.anon > base.anon ? usage.anon - base.anon : 0,
+      usage.page_table, live == 0 ? 0.0 : (double)rss / live);
+
+    if (live > peak_live) peak_live = live;
+    if (self > peak_self) peak_self = self;
+    if (usage.page_table > peak_pt) peak_pt = usage.page_table;
+    if (rss > peak_rss) {
+      peak_rss = rss;
+      /* Residency is taken only at a new peak since it is slow */
+      if (use_pagemap) region_nr = read_regions(regions, REGION_MAX);
+    }
+  }
+
+  printf("# peak live %zu, self %zu, rss %zu, page table %zu\n",
+    peak_live, peak_self, peak_rss, peak_pt);
+  if (peak_live > 0) {
+    printf("# fragmentation self %.3f, rss %.3f\n",
+      (double)peak_self / peak_live, (double)peak_rss / peak_live);
+  }
+  if (use_pagemap) {
+    printf("# resident mappings at the peak of rss\n");
+    printf("# %-12s %-12s %12s %12s %12s %s\n",
+      "start", "end", "size", "resident", "swapped", "name");
+    for (i = 0; i < region_nr; ++i) {
+      printf("# %012lx %012lx %12zu %12zu %12zu %s\n",
+        (unsigned long)regions[i].start, (unsigned long)regions[i].end,
+        (size_t)(regions[i].end - regions[i].start), regions[i].resident,
+        regions[i].swapped, regions[i].name);
+    }
+  }
+  free(idx2size);
+  memlog_stream_close(memlog);
+}
+
+static void read_kernel_usage(kernel_usage_t* usage) {
+  const char* text = read_proc("/proc/self/smaps_rollup");
+
+  usage->rss  = proc_field(text, "Rss");
+  usage->pss  = proc_field(text, "Pss");
+  usage->anon = proc_field(text, "Anonymous");
+  usage->page_table = proc_field(read_proc("/proc/self/status"), "VmPTE");
+}
+
+static size_t read_regions(region_t* regions, size_t region_max) {
+  static uint64_t entries[PROC_BUFFER_SIZE / sizeof(uint64_t)];
+  const size_t entry_max = PROC_BUFFER_SIZE / sizeof(uint64_t);
+  const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  char* maps = strdup(read_proc("/proc/self/maps"));
+  char* line;
+  char* save;
+  uintptr_t start, end, page;
+  size_t region_nr = 0;
+  size_t resident, swapped, nr, i;
+  ssize_t read_size;
+  int name_offset;
+  char perms[8];
+  int fd = open("/proc/self/pagemap", O_RDONLY);
+
+  if (fd < 0 || maps == NULL) {
+    perror("pagemap");
+    exit(EXIT_FAILURE);
+  }
+  for (line = strtok_r(maps, "\n", &save);
+      line != NULL && region_nr < region_max;
+      line = strtok_r(NULL, "\n", &save)) {
+    name_offset = 0;
+    if (sscanf(line, "%lx-%lx %7s %*s %*s %*s %n",
+        &start, &end, perms, &name_offset) < 3) {
+      continue;
+    }
+    /* Reserved regions are huge and have no pages */
+    if (strncmp(perms, "---", 3) == 0) continue;
+    resident = swapped = 0;
+    for (page = start / page_size; page < end / page_size; page += nr) {
+      nr = end / page_size - page;
+      if (nr > entry_max) nr = entry_max;
+      read_size = pread(fd, entries, nr * sizeof(uint64_t),
+        (off_t)(page * sizeof(uint64_t)));
+      if (read_size <= 0) break;
+      nr = (size_t)read_size / sizeof(uint64_t);
+      for (i = 0; i < nr; ++i) {
+        if (entries[i] & PAGEMAP_PRESENT) resident += page_size;
+        if (entries[i] & PAGEMAP_SWAPPED) swapped += page_size;
+      }
+    }
+    if (resident == 0 && swapped == 0) continue;
+    regions[region_nr].start    = start;
+    regions[region_nr].end      = end;
+    regions[region_nr].resident = resident;
+    regions[region_nr].swapped  = swapped;
+    snprintf(regions[region_nr].name, sizeof(regions[region_nr].name), "%s",
+      name_offset > 0 && line[name_offset] != '\0' ?
+        line + name_offset : "[anon]");
+    region_nr++;
+  }
+  close(fd);
+  free(maps);
+  return region_nr;
+}
+
+static const char* read_proc(const char* path) {
+  /* stdio is not used not to allocate memory while measuring */
+  static char buffer[PROC_BUFFER_SIZE];
+  size_t used = 0;
+  ssize_t read_size;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  while (used < PROC_BUFFER_SIZE - 1 &&
+      (read_size = read(fd, buffer + used, PROC_BUFFER_SIZE - 1 - used)) > 0) {
+    used += read_size;
+  }
+  buffer[used] = '\0';
+  close(fd);
+  return buffer;
+}
+
+static size_t proc_field(const char* text, const char* key) {
+  size_t key_len = strlen(key);
+  size_t value = 0;
+  const char* p;
+
+  for (p = text; (p = strstr(p, key)) != NULL; p += key_len) {
+    /* The key must be at the beginning of a line */
+    if ((p == text || p[-1] == '\n') && p[key_len] == ':') {
+      sscanf(p + key_len + 1, "%zu", &value);
+      return value * 1024;
+    }
+  }
+  return 0;
 }
 
 static void print_usage(const char* program_name) {
   int i;
-  printf("%s <memlog file> <allocator number>\n", program_name);
+  printf("%s <memlog file> <allocator number> [-k N [-p] [-t]]\n",
+    program_name);
   printf("If <memlog file> is set '--worst', max memory consumption case is ");
   printf("generated automatically.\n");
+  printf("With '-k', the memory usage seen by the kernel is also printed ");
+  printf("every N operations,\nand with '-p', resident pages of each ");
+  printf("mapping are read from pagemap at the peak. With '-t', the ");
+  printf("payload of blocks\nis written so that they are resident.\n");
   putchar('\n');
   printf(" Number |        Allocator Name \n");
   printf("--------+-----------------------\n");
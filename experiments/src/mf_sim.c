@@ -0,0 +1,823 @@
+/*
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "memlog.h"
+
+/*
+  Offline model of the memory usage and the system calls of Multiheap-fit
+  and Virtual Multiheap-fit. Blocks of a size class are packed densely in
+  both allocators, so the state is determined by the number of blocks of
+  each size class and no address is needed. The model follows
+  multiheap_fit.c and virtual_multiheap_fit.c with their default flags
+  (ENABLE_HEURISTIC, !EXACT_SIZE_CLASS, !FIXED_LENGTH_INTEGER and
+  MEMORY_ALIGN 1), and the parameters given as macros there are variables.
+ */
+
+/* The same as multiheap_fit.c and virtual_multiheap_fit.c */
+#define SIZE_CLASS_MAX 128
+#define BINARY_SEARCH_COUNT 7
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+#define ONE_BYTE 8
+
+/* Maximum number of values of a parameter */
+#define VALUE_MAX 256
+
+#define SIM_MIN(x, y) ((x) < (y) ? (x) : (y))
+#define SIM_MAX(x, y) ((x) > (y) ? (x) : (y))
+
+enum model {
+  MODEL_MF,
+  MODEL_VMF,
+};
+
+/* Parameters swept */
+enum param {
+  /* SIZE_CLASS_CONST */
+  PARAM_CLASS,
+  /* EXTRA_PAGE_RATE (MF) */
+  PARAM_EXTRA,
+  /* POOL_NUM_THRESHOLD (MF) or POOL_PAGE_NUM (VMF) */
+  PARAM_POOL,
+  /* GARBAGE_NUM_MAX (MF) */
+  PARAM_GARBAGE,
+  PARAM_NB,
+};
+
+static const char* const param_name[PARAM_NB] = {
+  "class", "extra", "pool", "garbage",
+};
+
+/* Default values of multiheap_fit.c */
+static const double mf_default[PARAM_NB] = { 0.1232, 9.0 / 8, 16, 6 };
+/* Default values of virtual_multiheap_fit.c */
+static const double vmf_default[PARAM_NB] = { 0.1232, 0, 8, 0 };
+
+/* Command of a trace kept in RAM */
+typedef struct {
+  uint8_t type;
+  uint32_t idx;
+  uint32_t size;
+} sim_command_t;
+
+/* A combination of parameters and its result */
+typedef struct {
+  double param[PARAM_NB];
+  /* false if the size classes cannot hold the largest block */
+  bool valid;
+  /* Peak and mean of the size of mapped pages after each command */
+  size_t peak;
+  double mean;
+  /* System calls issued by the commands */
+  size_t syscall;
+} result_t;
+
+/* Pseudo heap of a size class in MF */
+typedef struct {
+  bool has_addr;
+  size_t page_num;
+  size_t extra_num;
+  /* Neighbors in the garbage list (-1: none) */
+  int prev;
+  int next;
+  size_t obj_num;
+  size_t obj_size;
+} mf_heap_t;
+
+/* State of a simulation, reused by a worker thread */
+typedef struct {
+  size_t sizeof_class[SIZE_CLASS_MAX];
+  /* Size class of each block plus 1 (0: not allocated) */
+  uint8_t* block_sc;
+  size_t block_max;
+
+  size_t mapped_num;
+  size_t syscall;
+
+  /* MF */
+  mf_heap_t heaps[SIZE_CLASS_MAX];
+  int garbage_head;
+  int garbage_tail;
+  size_t garbage_num;
+  /* FIFO of the page numbers of pools */
+  size_t* pools;
+  size_t pool_cap;
+  size_t pool_first;
+  size_t pool_len;
+  size_t pool_num;
+  double extra_rate;
+  size_t pool_threshold;
+  size_t garbage_max;
+
+  /* VMF */
+  size_t counts[SIZE_CLASS_MAX];
+  size_t physical_pagesize;
+  size_t blockid_byte;
+  size_t page_byte;
+  size_t info_block_size;
+  size_t pool_nr;
+  size_t pool_page_num;
+  size_t stack_size;
+  size_t page_id_nr;
+} sim_t;
+
+static struct {
+  enum model model;
+  sim_command_t* commands;
+  size_t command_nr;
+  size_t mem_min;
+  size_t mem_max;
+  size_t block_max;
+  size_t require_size;
+
+  double values[PARAM_NB][VALUE_MAX];
+  size_t value_nr[PARAM_NB];
+
+  result_t* results;
+  size_t result_nr;
+  /* Next combination to be simulated */
+  size_t next;
+} g_sim;
+
+/** Run combinations until all of them are done */
+static void* worker(void* arg);
+/** Simulate the trace with a combination */
+static void simulate(sim_t* sim, result_t* result);
+/** Parse "name=v1,v2,..." or "name=first:last:step" */
+static bool parse_param(const char* arg);
+/** Load the commands of a memlog */
+static void load_trace(const char* filename);
+/** Print results, marking the Pareto front of memory and system calls */
+static void print_results(bool print_all, bool use_mean);
+static void print_usage(const char* program_name);
+
+static inline size_t required_byte(uint64_t num) {
+  return num > 1 ?
+    (64 - __builtin_clzll(num - 1) + ONE_BYTE - 1) / ONE_BYTE : 0;
+}
+
+static inline size_t length2page_num(size_t length) {
+  return (length + PAGE_SIZE - 1) >> PAGE_SHIFT;
+}
+
+static inline void size_class_init(sim_t* sim, double class_const) {
+  double curr_size = 8.0;
+  size_t i;
+
+  for (i = 0; i < SIZE_CLASS_MAX; ++i) {
+    sim->sizeof_class[i] = (size_t)curr_size;
+    curr_size *= 1.0 + class_const;
+    curr_size = ceil(curr_size);
+  }
+}
+
+static inline size_t size2sc(const sim_t* sim, size_t size) {
+  int left = -1;
+  int right = SIZE_CLASS_MAX - 1;
+  int middle;
+  unsigned i;
+
+  for (i = 0; i < BINARY_SEARCH_COUNT; ++i) {
+    middle = (left + right) / 2;
+    if (size <= sim->sizeof_class[middle]) {
+      right = middle;
+    } else {
+      left = middle;
+    }
+  }
+  return right;
+}
+
+int main(int argc, char* argv[]) {
+  pthread_t* threads;
+  long thread_nr = sysconf(_SC_NPROCESSORS_ONLN);
+  bool print_all = false, use_mean = false;
+  struct timespec start, end;
+  const double* defaults;
+  double elapsed;
+  size_t i, j, rest;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:j:m:a")) != -1) {
+    switch (opt) {
+    case 'p':
+      if (!parse_param(optarg)) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'j': thread_nr = atol(optarg); break;
+    case 'm': use_mean = strcmp(optarg, "mean") == 0; break;
+    case 'a': print_all = true; break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind + 2 != argc || thread_nr < 1) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (strcmp(argv[optind + 1], "mf") == 0) {
+    g_sim.model = MODEL_MF;
+    defaults = mf_default;
+  } else if (strcmp(argv[optind + 1], "vmf") == 0) {
+    g_sim.model = MODEL_VMF;
+    defaults = vmf_default;
+  } else {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < PARAM_NB; ++i) {
+    if (g_sim.value_nr[i] == 0) {
+      g_sim.values[i][0] = defaults[i];
+      g_sim.value_nr[i] = 1;
+    }
+  }
+  load_trace(argv[optind]);
+
+  /* Combinations are numbered in mixed radix */
+  g_sim.result_nr = 1;
+  for (i = 0; i < PARAM_NB; ++i) g_sim.result_nr *= g_sim.value_nr[i];
+  g_sim.results = calloc(g_sim.result_nr, sizeof(result_t));
+  threads = malloc(thread_nr * sizeof(pthread_t));
+  if (g_sim.results == NULL || threads == NULL) {
+    perror("malloc");
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < g_sim.result_nr; ++i) {
+    rest = i;
+    for (j = 0; j < PARAM_NB; ++j) {
+      g_sim.results[i].param[j] = g_sim.values[j][rest % g_sim.value_nr[j]];
+      rest /= g_sim.value_nr[j];
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < (size_t)thread_nr; ++i) {
+    if (pthread_create(&threads[i], NULL, worker, NULL) != 0) {
+      perror("pthread_create");
+      return EXIT_FAILURE;
+    }
+  }
+  for (i = 0; i < (size_t)thread_nr; ++i) pthread_join(threads[i], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+  print_results(print_all, use_mean);
+  fflush(stdout);
+  fprintf(stderr, "%zu combinations of %zu commands in %.2f s "
+    "with %ld threads\n", g_sim.result_nr, g_sim.command_nr, elapsed,
+    thread_nr);
+
+  free(threads);
+  free(g_sim.results);
+  free(g_sim.commands);
+  return EXIT_SUCCESS;
+}
+
+static void* worker(void* arg) {
+  sim_t* sim = calloc(1, sizeof(sim_t));
+  size_t i;
+
+  (void)arg;
+  if (sim == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  sim->block_max = g_sim.block_max;
+  sim->block_sc  = malloc(sim->block_max);
+  if (sim->block_sc == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  while ((i = __atomic_fetch_add(&g_sim.next, 1, __ATOMIC_RELAXED))
+      < g_sim.result_nr) {
+    simulate(sim, &g_sim.results[i]);
+  }
+  free(sim->pools);
+  free(sim->block_sc);
+  free(sim);
+  return NULL;
+}
+
+/* ========================================================================== */
+/* Multiheap-fit */
+/* ========================================================================== */
+
+static inline void mf_garbage_remove(sim_t* sim, int h) {
+  mf_heap_t* heap = &sim->heaps[h];
+
+  if (heap->prev >= 0) {
+    sim->heaps[heap->prev].next = heap->next;
+  } else {
+    sim->garbage_head = heap->next;
+  }
+  if (heap->next >= 0) {
+    sim->heaps[heap->next].prev = heap->prev;
+  } else {
+    sim->garbage_tail = heap->prev;
+  }
+  sim->garbage_num -= heap->extra_num;
+}
+
+/* garbage_delete and pheap_delete_extra */
+static inline void mf_garbage_delete(sim_t* sim, int h) {
+  mf_garbage_remove(sim, h);
+  sim->syscall++;
+  sim->mapped_num -= sim->heaps[h].extra_num;
+  sim->heaps[h].extra_num = 0;
+}
+
+static inline void mf_garbage_push(sim_t* sim, int h, size_t page_num) {
+  mf_heap_t* heap = &sim->heaps[h];
+
+  if (sim->garbage_num + page_num > sim->garbage_max &&
+      sim->garbage_tail >= 0) {
+    mf_garbage_delete(sim, sim->garbage_tail);
+  }
+  heap->extra_num = page_num;
+  heap->prev = -1;
+  heap->next = sim->garbage_head;
+  if (sim->garbage_head >= 0) {
+    sim->heaps[sim->garbage_head].prev = h;
+  } else {
+    sim->garbage_tail = h;
+  }
+  sim->garbage_head = h;
+  sim->garbage_num += page_num;
+}
+
+static inline void mf_pool_push(sim_t* sim, size_t page_num) {
+  if (sim->pool_num > sim->pool_threshold) {
+    sim->syscall++;
+    sim->mapped_num -= page_num;
+    return;
+  }
+  if (sim->pool_len == sim->pool_cap) {
+    size_t* pools;
+    size_t i, cap = sim->pool_cap == 0 ? 64 : 2 * sim->pool_cap;
+    pools = malloc(cap * sizeof(size_t));
+    if (pools == NULL) {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < sim->pool_len; ++i) {
+      pools[i] = sim->pools[(sim->pool_first + i) % sim->pool_cap];
+    }
+    free(sim->pools);
+    sim->pools = pools;
+    sim->pool_cap = cap;
+    sim->pool_first = 0;
+  }
+  sim->pools[(sim->pool_first + sim->pool_len++) % sim->pool_cap] = page_num;
+  sim->pool_num += page_num;
+}
+
+static inline size_t mf_pool_top(sim_t* sim) {
+  size_t page_num = sim->pools[sim->pool_first];
+
+  sim->pool_first = (sim->pool_first + 1) % sim->pool_cap;
+  sim->pool_len--;
+  sim->pool_num -= page_num;
+  return page_num;
+}
+
+/* pheap_bulge */
+static inline void mf_bulge(sim_t* sim, int h, size_t new_size) {
+  mf_heap_t* heap = &sim->heaps[h];
+  size_t old_page_num = heap->page_num;
+  size_t new_page_num = length2page_num(new_size);
+
+  if (old_page_num >= new_page_num) return;
+  if (!heap->has_addr) {
+    heap->has_addr = true;
+    if (sim->pool_len > 0) {
+      old_page_num = mf_pool_top(sim);
+      if (old_page_num >= new_page_num) {
+        heap->page_num = old_page_num;
+        return;
+      }
+    }
+  } else if (heap->extra_num > 0) {
+    mf_garbage_remove(sim, h);
+    old_page_num += heap->extra_num;
+    heap->extra_num = 0;
+    if (old_page_num >= new_page_num) {
+      heap->page_num = old_page_num;
+      return;
+    }
+  }
+  sim->syscall++;
+  sim->mapped_num += new_page_num - old_page_num;
+  heap->page_num = new_page_num;
+}
+
+/* pheap_shrink */
+static inline void mf_shrink(sim_t* sim, int h, size_t new_size) {
+  mf_heap_t* heap = &sim->heaps[h];
+  size_t old_page_num = heap->page_num;
+  size_t new_page_num = length2page_num(new_size);
+
+  new_page_num = (size_t)(new_page_num * sim->extra_rate + 1e-9);
+  if (old_page_num <= new_page_num) return;
+  if (heap->extra_num > 0) mf_garbage_delete(sim, h);
+  if (new_page_num == 0) {
+    mf_pool_push(sim, old_page_num);
+    heap->has_addr = false;
+    heap->page_num = 0;
+  } else {
+    mf_garbage_push(sim, h, old_page_num - new_page_num);
+    heap->page_num = new_page_num;
+  }
+}
+
+static inline void mf_append(sim_t* sim, int h) {
+  mf_heap_t* heap = &sim->heaps[h];
+  mf_bulge(sim, h, (heap->obj_num + 1) * heap->obj_size);
+  heap->obj_num++;
+}
+
+static inline void mf_remove(sim_t* sim, int h) {
+  mf_heap_t* heap = &sim->heaps[h];
+  heap->obj_num--;
+  mf_shrink(sim, h, heap->obj_num * heap->obj_size);
+}
+
+static void mf_sim_init(sim_t* sim, const result_t* result) {
+  size_t id_byte = required_byte(g_sim.block_max);
+  size_t sc_max = size2sc(sim, g_sim.mem_max);
+  int h;
+
+  sim->extra_rate     = result->param[PARAM_EXTRA];
+  sim->pool_threshold = (size_t)result->param[PARAM_POOL];
+  sim->garbage_max    = (size_t)result->param[PARAM_GARBAGE];
+  sim->garbage_head = sim->garbage_tail = -1;
+  sim->garbage_num = 0;
+  sim->pool_first = sim->pool_len = sim->pool_num = 0;
+  for (h = 0; h < SIZE_CLASS_MAX; ++h) {
+    memset(&sim->heaps[h], 0, sizeof(mf_heap_t));
+    sim->heaps[h].prev = sim->heaps[h].next = -1;
+    sim->heaps[h].obj_size = sim->sizeof_class[h] + id_byte;
+  }
+  /* The same blocks as mf_init allocates */
+  if (g_sim.block_max > 1) {
+    mf_append(sim, sc_max);
+    mf_append(sim, sc_max);
+    mf_remove(sim, sc_max);
+    mf_remove(sim, sc_max);
+  }
+}
+
+/* ========================================================================== */
+/* Virtual Multiheap-fit */
+/* ========================================================================== */
+
+/* pheap_resize of the tables in page_info_t */
+static inline void vmf_resize(sim_t* sim, size_t old_length,
+    size_t new_length) {
+  if ((old_length >> PAGE_SHIFT) != (new_length >> PAGE_SHIFT)) {
+    sim->syscall++;
+  }
+}
+
+/* insert_page */
+static inline void vmf_insert_page(sim_t* sim, bool has_head) {
+  if (sim->pool_nr > 0) {
+    sim->pool_nr--;
+  } else {
+    if (sim->stack_size > 0) {
+      vmf_resize(sim, sim->stack_size * sim->page_byte,
+        (sim->stack_size - 1) * sim->page_byte);
+      sim->stack_size--;
+    } else {
+      vmf_resize(sim, sim->page_id_nr * sim->info_block_size,
+        (sim->page_id_nr + 1) * sim->info_block_size);
+      sim->page_id_nr++;
+    }
+    /* ioctl and mmap of module_allocate */
+    sim->syscall += 2;
+    sim->mapped_num++;
+  }
+  /* module_set_next */
+  if (has_head) sim->syscall++;
+}
+
+/* remove_page */
+static inline void vmf_remove_page(sim_t* sim, bool has_next) {
+  /* module_reset_next */
+  if (has_next) sim->syscall++;
+  if (sim->pool_nr < sim->pool_page_num) {
+    sim->pool_nr++;
+  } else {
+    vmf_resize(sim, sim->stack_size * sim->page_byte,
+      (sim->stack_size + 1) * sim->page_byte);
+    sim->stack_size++;
+    /* munmap and ioctl of module_deallocate */
+    sim->syscall += 2;
+    sim->mapped_num--;
+  }
+}
+
+/* Blocks of a size class fill pages from the end, so the number of pages
+   of the class is ceil(bytes / physical page size) */
+static inline size_t vmf_page_num(const sim_t* sim, size_t sc, size_t count) {
+  size_t real_size = sim->sizeof_class[sc] + sim->blockid_byte;
+  return (count * real_size + sim->physical_pagesize - 1)
+    / sim->physical_pagesize;
+}
+
+static inline void vmf_append(sim_t* sim, size_t sc) {
+  size_t old_page_num = vmf_page_num(sim, sc, sim->counts[sc]);
+  if (vmf_page_num(sim, sc, ++sim->counts[sc]) > old_page_num) {
+    vmf_insert_page(sim, old_page_num > 0);
+  }
+}
+
+static inline void vmf_remove(sim_t* sim, size_t sc) {
+  size_t new_page_num = vmf_page_num(sim, sc, --sim->counts[sc]);
+  if (new_page_num < vmf_page_num(sim, sc, sim->counts[sc] + 1)) {
+    vmf_remove_page(sim, new_page_num > 0);
+  }
+}
+
+static void vmf_sim_init(sim_t* sim, const result_t* result) {
+  size_t sc_max = size2sc(sim, g_sim.mem_max);
+  size_t max_size = sim->sizeof_class[sc_max] + sizeof(uint32_t);
+  size_t ofs_byte;
+
+  /* module_set_pagesize */
+  sim->physical_pagesize = PAGE_SIZE;
+  for (max_size /= PAGE_SIZE; max_size > 0; max_size /= 2) {
+    sim->physical_pagesize *= 2;
+  }
+  sim->blockid_byte = SIM_MAX(required_byte(g_sim.block_max + 1), 1);
+  sim->page_byte = SIM_MAX(required_byte((sim->blockid_byte * g_sim.block_max
+    + g_sim.require_size + PAGE_SIZE - 1) / PAGE_SIZE), 1);
+  sim->page_byte = SIM_MAX(sim->page_byte, sim->blockid_byte);
+  ofs_byte = SIM_MAX(required_byte(sim->physical_pagesize), 1);
+  sim->info_block_size = 2 * sim->page_byte + 2 * ofs_byte;
+  sim->pool_page_num = (size_t)result->param[PARAM_POOL];
+  sim->pool_nr = sim->stack_size = sim->page_id_nr = 0;
+  memset(sim->counts, 0, sizeof(sim->counts));
+  if (g_sim.block_max > 1) {
+    vmf_append(sim, sc_max);
+    vmf_append(sim, sc_max);
+    vmf_remove(sim, sc_max);
+    vmf_remove(sim, sc_max);
+  }
+}
+
+/* ========================================================================== */
+/* simulation */
+/* ========================================================================== */
+
+static inline void sim_append(sim_t* sim, bool mf, size_t sc) {
+  if (mf) {
+    mf_append(sim, sc);
+  } else {
+    vmf_append(sim, sc);
+  }
+}
+
+static inline void sim_remove(sim_t* sim, bool mf, size_t sc) {
+  if (mf) {
+    mf_remove(sim, sc);
+  } else {
+    vmf_remove(sim, sc);
+  }
+}
+
+static void simulate(sim_t* sim, result_t* result) {
+  bool mf = g_sim.model == MODEL_MF;
+  size_t sc_max, sc, new_sc, heap_size;
+  double total = 0.0;
+  size_t i;
+  sim_command_t command;
+
+  size_class_init(sim, result->param[PARAM_CLASS]);
+  sc_max = size2sc(sim, g_sim.mem_max);
+  result->valid = g_sim.mem_max <= sim->sizeof_class[sc_max] &&
+    result->param[PARAM_EXTRA] >= (mf ? 1.0 : 0.0);
+  if (!result->valid) return;
+
+  memset(sim->block_sc, 0, sim->block_max);
+  sim->mapped_num = 0;
+  if (mf) {
+    mf_sim_init(sim, result);
+  } else {
+    vmf_sim_init(sim, result);
+  }
+  /* Only system calls of the trace are counted as the replay does */
+  sim->syscall = 0;
+  result->peak = 0;
+
+  for (i = 0; i < g_sim.command_nr; ++i) {
+    command = g_sim.commands[i];
+    sc = sim->block_sc[command.idx];
+    if (command.type == COMMAND_DEALLOCATE) {
+      if (sc > 0) {
+        sim_remove(sim, mf, sc - 1);
+        sim->block_sc[command.idx] = 0;
+      }
+    } else if (sc != (new_sc = size2sc(sim, command.size)) + 1) {
+      /* A reallocation appends the new block before removing the old one
+         in MF, and the other way around in VMF */
+      if (sc > 0 && !mf) sim_remove(sim, mf, sc - 1);
+      sim_append(sim, mf, new_sc);
+      if (sc > 0 && mf) sim_remove(sim, mf, sc - 1);
+      sim->block_sc[command.idx] = new_sc + 1;
+    }
+    heap_size = mf ? sim->mapped_num << PAGE_SHIFT :
+      sim->mapped_num * sim->physical_pagesize;
+    if (heap_size > result->peak) result->peak = heap_size;
+    total += heap_size;
+  }
+  result->mean    = g_sim.command_nr > 0 ? total / g_sim.command_nr : 0.0;
+  result->syscall = sim->syscall;
+}
+
+static bool parse_param(const char* arg) {
+  const char* value = strchr(arg, '=');
+  double first, last, step, v;
+  char* end;
+  size_t i, nr = 0;
+  int p = -1;
+
+  if (value == NULL) return false;
+  for (i = 0; i < PARAM_NB; ++i) {
+    if (strncmp(arg, param_name[i], value - arg) == 0 &&
+        param_name[i][value - arg] == '\0') {
+      p = i;
+    }
+  }
+  if (p < 0) return false;
+  ++value;
+  if (sscanf(value, "%lf:%lf:%lf", &first, &last, &step) == 3) {
+    if (step <= 0.0 || first > last) return false;
+    /* Values are computed from the first one to avoid accumulating errors */
+    for (v = first; v <= last + step * 1e-9 && nr < VALUE_MAX;
+        v = first + step * nr) {
+      g_sim.values[p][nr++] = v;
+    }
+  } else {
+    while (*value != '\0' && nr < VALUE_MAX) {
+      g_sim.values[p][nr++] = strtod(value, &end);
+      if (end == value || (*end != ',' && *end != '\0')) return false;
+      value = *end == ',' ? end + 1 : end;
+    }
+  }
+  g_sim.value_nr[p] = nr;
+  return nr > 0;
+}
+
+static void load_trace(const char* filename) {
+  memlog_stream_t* memlog = memlog_stream_open(filename);
+  size_t capacity = 1024;
+  sim_command_t* command;
+  command_t input;
+  enum command_type kind;
+
+  g_sim.mem_min      = memlog->mem_min;
+  g_sim.mem_max      = memlog->mem_max;
+  g_sim.block_max    = memlog->block_max;
+  g_sim.require_size = memlog->require_size;
+  g_sim.commands = malloc(capacity * sizeof(sim_command_t));
+  if (g_sim.commands == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  while (memlog_stream_next(memlog, &input)) {
+    kind = command_kind(input.type);
+    if (kind != COMMAND_ALLOCATE && kind != COMMAND_DEALLOCATE &&
+        kind != COMMAND_REALLOCATE) {
+      continue;
+    }
+    if (g_sim.command_nr == capacity) {
+      capacity *= 2;
+      g_sim.commands = realloc(g_sim.commands,
+        capacity * sizeof(sim_command_t));
+      if (g_sim.commands == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+    }
+    command = &g_sim.commands[g_sim.command_nr++];
+    command->type = kind;
+    command->idx  = (uint32_t)input.idx;
+    command->size = (uint32_t)input.size;
+  }
+  memlog_stream_close(memlog);
+}
+
+static int compare_result(const void* a, const void* b) {
+  const result_t* x = a;
+  const result_t* y = b;
+
+  if (x->valid != y->valid) return x->valid ? -1 : 1;
+  if (x->peak != y->peak) return x->peak < y->peak ? -1 : 1;
+  if (x->syscall != y->syscall) return x->syscall < y->syscall ? -1 : 1;
+  return 0;
+}
+
+static int compare_mean(const void* a, const void* b) {
+  const result_t* x = a;
+  const result_t* y = b;
+
+  if (x->valid != y->valid) return x->valid ? -1 : 1;
+  if (x->mean != y->mean) return x->mean < y->mean ? -1 : 1;
+  if (x->syscall != y->syscall) return x->syscall < y->syscall ? -1 : 1;
+  return 0;
+}
+
+static void print_results(bool print_all, bool use_mean) {
+  size_t best_syscall = SIZE_MAX;
+  size_t i, j, invalid = 0;
+  bool pareto;
+  result_t* result;
+
+  qsort(g_sim.results, g_sim.result_nr, sizeof(result_t),
+    use_mean ? compare_mean : compare_result);
+  for (j = 0; j < PARAM_NB; ++j) {
+    if (g_sim.model == MODEL_VMF && (j == PARAM_EXTRA || j == PARAM_GARBAGE)) {
+      continue;
+    }
+    printf("%s ", param_name[j]);
+  }
+  printf("peak_byte mean_byte syscall pareto\n");
+  for (i = 0; i < g_sim.result_nr; ++i) {
+    result = &g_sim.results[i];
+    if (!result->valid) {
+      invalid++;
+      continue;
+    }
+    /* Sorted by memory, a point is on the front if it needs fewer system
+       calls than every point using less memory */
+    pareto = result->syscall < best_syscall;
+    if (pareto) best_syscall = result->syscall;
+    if (!pareto && !print_all) continue;
+    for (j = 0; j < PARAM_NB; ++j) {
+      if (g_sim.model == MODEL_VMF &&
+          (j == PARAM_EXTRA || j == PARAM_GARBAGE)) {
+        continue;
+      }
+      printf("%g ", result->param[j]);
+    }
+    printf("%zu %.0f %zu %s\n", result->peak, result->mean, result->syscall,
+      pareto ? "*" : "-");
+  }
+  if (invalid > 0) {
+    fprintf(stderr, "%zu combinations skipped: size classes do not reach "
+      "%zu bytes (or extra < 1)\n", invalid, g_sim.mem_max);
+  }
+}
+
+static void print_usage(const char* program_name) {
+  size_t i;
+  printf("%s [options] <memlog> <mf|vmf>\n", program_name);
+  printf("Simulate page usage and system calls of (Virtual) Multiheap-fit "
+    "for combinations of parameters.\n");
+  printf("Options:\n");
+  printf("  -p <name>=<v1>,<v2>,...     values of a parameter (repeatable)\n");
+  printf("  -p <name>=<first>:<last>:<step>\n");
+  printf("  -j <threads>  worker threads (default: online CPUs)\n");
+  printf("  -m peak|mean  memory axis of the Pareto front (default: peak)\n");
+  printf("  -a            print all combinations, not only the front\n");
+  printf("Parameters (macros in the allocators):\n");
+  printf("  class    SIZE_CLASS_CONST\n");
+  printf("  extra    EXTRA_PAGE_RATE (mf only)\n");
+  printf("  pool     POOL_NUM_THRESHOLD (mf) or POOL_PAGE_NUM (vmf)\n");
+  printf("  garbage  GARBAGE_NUM_MAX (mf only)\n");
+  printf("Defaults:");
+  for (i = 0; i < PARAM_NB; ++i) {
+    printf(" %s=%g", param_name[i], mf_default[i]);
+  }
+  printf(" (mf), pool=%g (vmf)\n", vmf_default[PARAM_POOL]);
+}
@@ -0,0 +1,301 @@
+/*
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "malloc.h"
+#include "micro_bench.h"
+
+/* Default number of operations of a repetition */
+#define DEFAULT_OP_NR (1 << 16)
+/* Default number of measured repetitions */
+#define DEFAULT_REPEAT_NR 11
+/* Default number of warm-up repetitions */
+#define DEFAULT_WARMUP_NR 2
+
+/* Blocks of DL malloc */
+static mspace g_msp;
+static void** g_dl_addrs;
+static size_t g_dl_nr;
+static const uint32_t* g_dl_order;
+
+static size_t g_sizes[MICRO_SIZE_NR];
+static uint32_t* g_orders[2];
+static size_t g_order_nr[2];
+/* Counter of CPU cycles (-1: the TSC is read instead) */
+static int g_cycle_fd = -1;
+/* Results of the benchmarks, which must not be optimized away */
+static volatile uint64_t g_sink;
+/* State of xorshift64 */
+static uint64_t g_rand_state = 88172645463325252ULL;
+
+static const size_t bid_params[] = { 1 << 10, 1 << 14, 1 << 18, 0 };
+
+/** xorshift64 */
+static uint64_t rand_u64(void) {
+  g_rand_state ^= g_rand_state << 13;
+  g_rand_state ^= g_rand_state >> 7;
+  g_rand_state ^= g_rand_state << 17;
+  return g_rand_state;
+}
+
+/** Read the raw monotonic clock in nanoseconds */
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Read the counter of cycles or the TSC */
+static inline uint64_t now_cycles(void) {
+  uint64_t count = 0;
+
+  if (g_cycle_fd >= 0) {
+    if (read(g_cycle_fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+    return count;
+  }
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/** Open a counter of CPU cycles in user space of this thread */
+static int open_cycle_counter(void) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = PERF_TYPE_HARDWARE;
+  attr.config         = PERF_COUNT_HW_CPU_CYCLES;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv     = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+const size_t* micro_sizes(void) {
+  size_t i;
+
+  if (g_sizes[0] != 0) return g_sizes;
+  for (i = 0; i < MICRO_SIZE_NR; ++i) {
+    /* log-uniform in [1, MICRO_SIZE_MAX] */
+    g_sizes[i] = (size_t)1 << (rand_u64() % 16);
+    g_sizes[i] += rand_u64() % g_sizes[i];
+    if (g_sizes[i] > MICRO_SIZE_MAX) g_sizes[i] = MICRO_SIZE_MAX;
+  }
+  return g_sizes;
+}
+
+const uint32_t* micro_order(size_t nr, bool random) {
+  uint32_t* order = g_orders[random];
+  uint32_t tmp;
+  size_t i, j;
+
+  if (order != NULL && g_order_nr[random] == nr) return order;
+  order = realloc(order, nr * sizeof(uint32_t));
+  if (order == NULL) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nr; ++i) order[i] = (uint32_t)i;
+  if (random) {
+    /* Fisher-Yates shuffle */
+    for (i = nr - 1; i > 0; --i) {
+      j = rand_u64() % (i + 1);
+      tmp = order[i];
+      order[i] = order[j];
+      order[j] = tmp;
+    }
+  }
+  g_orders[random]   = order;
+  g_order_nr[random] = nr;
+  return order;
+}
+
+static void dl_setup_blocks(size_t nr, bool random) {
+  size_t i;
+
+  if (g_msp == NULL) {
+    g_msp = create_mspace(0, 0);
+    g_dl_addrs = malloc(MICRO_BID_MAX * sizeof(void*));
+    if (g_msp == NULL || g_dl_addrs == NULL) {
+      perror("create_mspace");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (i = 0; i < g_dl_nr; ++i) mspace_free(g_msp, g_dl_addrs[i]);
+  for (i = 0; i < nr; ++i) {
+    g_dl_addrs[i] = mspace_malloc(g_msp, MICRO_BLOCK_SIZE);
+    memset(g_dl_addrs[i], (int)i, MICRO_BLOCK_SIZE);
+  }
+  g_dl_nr    = nr;
+  g_dl_order = micro_order(nr, random);
+}
+
+static void dl_setup_sequential(size_t param) {
+  dl_setup_blocks(param, false);
+}
+
+static void dl_setup_random(size_t param) {
+  dl_setup_blocks(param, true);
+}
+
+static uint64_t dl_run_dereference(size_t param, size_t nr) {
+  uint64_t sum = 0;
+  size_t i, j = 0;
+
+  /* A table from ids to pointers, as the wrappers of the experiments */
+  for (i = 0; i < nr; ++i) {
+    sum += *(volatile uint8_t*)g_dl_addrs[g_dl_order[j]];
+    if (++j == param) j = 0;
+  }
+  return sum;
+}
+
+static const micro_case_t micro_dl_cases[] = {
+  { "dl.deref_seq", "blocks", bid_params, dl_setup_sequential,
+    dl_run_dereference },
+  { "dl.deref_rand", "blocks", bid_params, dl_setup_random,
+    dl_run_dereference },
+  { NULL, NULL, NULL, NULL, NULL },
+};
+
+static int compare_double(const void* left, const void* right) {
+  double l = *(const double*)left;
+  double r = *(const double*)right;
+  return (l > r) - (l < r);
+}
+
+/** Run a benchmark and print the median and the minimum per operation */
+static void run_case(const micro_case_t* bench, size_t param, size_t op_nr,
+    size_t repeat_nr, size_t warmup_nr) {
+  double* ns     = malloc(repeat_nr * sizeof(double));
+  double* cycles = malloc(repeat_nr * sizeof(double));
+  uint64_t start_ns, start_cycles, end_cycles;
+  size_t i;
+
+  if (ns == NULL || cycles == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  if (bench->setup != NULL) bench->setup(param);
+  for (i = 0; i < warmup_nr; ++i) g_sink += bench->run(param, op_nr);
+  for (i = 0; i < repeat_nr; ++i) {
+    start_cycles = now_cycles();
+    start_ns = now_ns();
+    g_sink += bench->run(param, op_nr);
+    ns[i] = (double)(now_ns() - start_ns) / op_nr;
+    end_cycles = now_cycles();
+    cycles[i] = (double)(end_cycles - start_cycles) / op_nr;
+  }
+  qsort(ns, repeat_nr, sizeof(double), compare_double);
+  qsort(cycles, repeat_nr, sizeof(double), compare_double);
+
+  printf("%-24s %-7s", bench->name, bench->param_name);
+  if (bench->param_name[0] != '\0') {
+    printf(" %8zu", param);
+  } else {
+    printf(" %8s", "-");
+  }
+  printf(" %10.2f %10.2f %10.1f %10.1f\n", ns[repeat_nr / 2], ns[0],
+    cycles[repeat_nr / 2], cycles[0]);
+  fflush(stdout);
+  free(cycles);
+  free(ns);
+}
+
+static void print_usage(const char* program_name) {
+  printf("%s [options] [filter]\n", program_name);
+  printf("Measure internal primitives of the allocators in isolation. "
+    "Only benchmarks whose\nnames contain 'filter' are run.\n");
+  printf("Options:\n");
+  printf("  -n <N>  operations of a repetition (default: %d)\n",
+    DEFAULT_OP_NR);
+  printf("  -r <N>  measured repetitions (default: %d)\n", DEFAULT_REPEAT_NR);
+  printf("  -w <N>  warm-up repetitions (default: %d)\n", DEFAULT_WARMUP_NR);
+  printf("  -l      list the benchmarks\n");
+}
+
+int main(int argc, char* argv[]) {
+  const micro_case_t* const tables[] = {
+    micro_mf_cases, micro_vmf_cases, micro_dl_cases,
+  };
+  const char* filter = "";
+  size_t op_nr = DEFAULT_OP_NR;
+  size_t repeat_nr = DEFAULT_REPEAT_NR;
+  size_t warmup_nr = DEFAULT_WARMUP_NR;
+  bool list = false;
+  const micro_case_t* bench;
+  const size_t* param;
+  size_t i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:r:w:l")) != -1) {
+    switch (opt) {
+    case 'n': op_nr = strtoul(optarg, NULL, 10); break;
+    case 'r': repeat_nr = strtoul(optarg, NULL, 10); break;
+    case 'w': warmup_nr = strtoul(optarg, NULL, 10); break;
+    case 'l': list = true; break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind < argc) filter = argv[optind];
+  if (op_nr == 0 || repeat_nr == 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (!list) {
+    g_cycle_fd = open_cycle_counter();
+    printf("# %zu repetitions of %zu operations after %zu warm-up; "
+      "cycles are %s\n", repeat_nr, op_nr, warmup_nr, g_cycle_fd >= 0 ?
+      "CPU cycles in user space" : "TSC ticks (perf events unavailable)");
+    printf("%-24s %-7s %8s %10s %10s %10s %10s\n", "primitive", "param",
+      "", "ns/op", "min", "cycles/op", "min");
+  }
+  for (i = 0; i < sizeof(tables) / sizeof(tables[0]); ++i) {
+    for (bench = tables[i]; bench->name != NULL; ++bench) {
+      if (strstr(bench->name, filter) == NULL) continue;
+      if (list) {
+        printf("%s\n", bench->name);
+        continue;
+      }
+      param = bench->params;
+      do {
+        run_case(bench, *param, op_nr, repeat_nr, warmup_nr);
+      } while (*param != 0 && *++param != 0);
+    }
+  }
+  if (g_cycle_fd >= 0) close(g_cycle_fd);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,68 @@
+/*
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef MICRO_BENCH_H__
+#define MICRO_BENCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+  Microbenchmarks of the internal primitives of the allocators. The
+  sources of Multiheap-fit and Virtual Multiheap-fit are included into
+  micro_mf.c and micro_vmf.c, so their static functions are measured as
+  they are inlined in the libraries. They are separate translation units
+  since both libraries define functions of the same names.
+ */
+
+/* Block size of the dereference benchmarks */
+#define MICRO_BLOCK_SIZE 64
+/* Maximum size given to the allocators */
+#define MICRO_SIZE_MAX (1 << 16)
+/* Maximum number of blocks of the dereference benchmarks */
+#define MICRO_BID_MAX (1 << 20)
+/* Number of random sizes of 'micro_sizes' (power of two) */
+#define MICRO_SIZE_NR 4096
+
+/* A benchmarked primitive */
+typedef struct {
+  /* "<allocator>.<primitive>" (NULL terminates a table) */
+  const char* name;
+  /* Meaning of the parameter ("" if unused) */
+  const char* param_name;
+  /* Parameters to run with (terminated by 0, or { 0 } if unused) */
+  const size_t* params;
+  /* Prepare data for the parameter (NULL if nothing) */
+  void (*setup)(size_t param);
+  /* Run 'nr' operations and return a value depending on all of them */
+  uint64_t (*run)(size_t param, size_t nr);
+} micro_case_t;
+
+/* Benchmarks of each allocator */
+extern const micro_case_t micro_mf_cases[];
+extern const micro_case_t micro_vmf_cases[];
+
+/* 'MICRO_SIZE_NR' sizes drawn log-uniformly from [1, MICRO_SIZE_MAX] */
+const size_t* micro_sizes(void);
+/* Order of visiting 'nr' blocks: identity or a random permutation */
+const uint32_t* micro_order(size_t nr, bool random);
+
+#endif /* MICRO_BENCH_H__ */
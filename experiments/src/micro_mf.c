@@ -0,0 +1,212 @@
+/*
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/* The whole library is compiled in this file to reach its primitives */
+#include "multiheap_fit.c"
+
+#include "micro_bench.h"
+
+/* Mask of the index into the buffer of integers */
+#define INT_SLOT_MASK 4095
+
+static mf_t g_mf;
+/* Blocks allocated by the dereference benchmarks */
+static size_t g_bid_nr;
+static const uint32_t* g_order;
+/* Buffer of integers of 'get_int' and 'put_int' */
+static uint8_t g_int_buffer[(INT_SLOT_MASK + 1) * 8];
+static uint8_t* g_copy_buffer;
+static pseudo_heap_t g_pheap;
+
+static const size_t no_param[] = { 0 };
+#if !FIXED_LENGTH_INTEGER
+static const size_t width_params[] = { 1, 2, 3, 4, 5, 6, 7, 8, 0 };
+#endif /* FIXED_LENGTH_INTEGER */
+static const size_t page_params[] = { 1, 4, 16, 64, 0 };
+static const size_t copy_params[] = { 8, 64, 512, 4096, 32768, 0 };
+static const size_t bid_params[] = { 1 << 10, 1 << 14, 1 << 18, 0 };
+
+/** Initialize Multiheap-fit once, which also sets up the size classes */
+static void init_once(void) {
+  if (g_mf != NULL) return;
+  g_mf = mf_init(1, MICRO_SIZE_MAX, MICRO_BID_MAX,
+    (size_t)MICRO_BID_MAX * MICRO_BLOCK_SIZE * 2);
+  if (g_mf == NULL) {
+    fprintf(stderr, "mf_init failed\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void setup_init(size_t param) {
+  (void)param;
+  init_once();
+}
+
+static uint64_t run_size2sc(size_t param, size_t nr) {
+  const size_t* sizes = micro_sizes();
+  uint64_t sum = 0;
+  size_t i;
+
+  (void)param;
+  for (i = 0; i < nr; ++i) sum += size2sc(sizes[i & (MICRO_SIZE_NR - 1)]);
+  return sum;
+}
+
+#if !FIXED_LENGTH_INTEGER
+static void setup_int(size_t param) {
+  size_t i;
+
+  init_once();
+  for (i = 0; i < sizeof(g_int_buffer); ++i) g_int_buffer[i] = (uint8_t)i;
+  (void)param;
+}
+
+static uint64_t run_get_int(size_t param, size_t nr) {
+  uint64_t sum = 0;
+  size_t i;
+
+  for (i = 0; i < nr; ++i) {
+    sum += get_int(g_int_buffer + (i & INT_SLOT_MASK) * param, param);
+  }
+  return sum;
+}
+
+static uint64_t run_put_int(size_t param, size_t nr) {
+  size_t i;
+
+  for (i = 0; i < nr; ++i) {
+    put_int(g_int_buffer + (i & INT_SLOT_MASK) * param, param, i);
+  }
+  return get_int(g_int_buffer, param);
+}
+#endif /* FIXED_LENGTH_INTEGER */
+
+static uint64_t run_pheap_pool(size_t param, size_t nr) {
+  size_t i;
+
+  /* A pair of growing from no page and shrinking to no page. Once warmed
+     up, a page is taken from the pool and given back without mapping. */
+  (void)param;
+  for (i = 0; i < nr; ++i) {
+    if (!pheap_bulge(&g_pheap, (size_t)1 << g_page_shift)) {
+      fprintf(stderr, "pheap_bulge failed\n");
+      exit(EXIT_FAILURE);
+    }
+    pheap_shrink(&g_pheap, 0);
+  }
+  return g_stat.mmap_nr;
+}
+
+static uint64_t run_pheap_map(size_t param, size_t nr) {
+  size_t mmap_nr = g_stat.mmap_nr;
+  size_t i;
+
+  /* The pool is emptied after every shrink, so each bulge maps the pages
+     and each emptying unmaps them */
+  for (i = 0; i < nr; ++i) {
+    if (!pheap_bulge(&g_pheap, param << g_page_shift)) {
+      fprintf(stderr, "pheap_bulge failed\n");
+      exit(EXIT_FAILURE);
+    }
+    pheap_shrink(&g_pheap, 0);
+    virt_space_release_cache();
+  }
+  if (g_stat.mmap_nr - mmap_nr != nr) {
+    fprintf(stderr, "pheap_map: %zu mappings in %zu operations\n",
+      g_stat.mmap_nr - mmap_nr, nr);
+    exit(EXIT_FAILURE);
+  }
+  return g_stat.mmap_nr;
+}
+
+static void setup_pheap(size_t param) {
+  init_once();
+  virt_space_release_cache();
+  pheap_init(&g_pheap);
+  (void)param;
+}
+
+static void setup_copy(size_t param) {
+  init_once();
+  free(g_copy_buffer);
+  g_copy_buffer = safe_malloc(2 * sc2size(size2sc(param)));
+  memset(g_copy_buffer, 1, 2 * sc2size(size2sc(param)));
+}
+
+static uint64_t run_copy(size_t param, size_t nr) {
+  size_t size = sc2size(size2sc(param));
+  size_t i;
+
+  /* The size of the class, as moving a block in 'mf_deallocate' */
+  for (i = 0; i < nr; ++i) {
+    my_memcpy(g_copy_buffer + (i & 1) * size,
+      g_copy_buffer + (~i & 1) * size, size);
+  }
+  return g_copy_buffer[0];
+}
+
+static void setup_blocks(size_t nr, bool random) {
+  size_t i;
+
+  init_once();
+  for (i = 0; i < g_bid_nr; ++i) mf_deallocate(g_mf, i);
+  for (i = 0; i < nr; ++i) {
+    if (mf_allocate(g_mf, i, MICRO_BLOCK_SIZE) != 0) {
+      fprintf(stderr, "mf_allocate failed\n");
+      exit(EXIT_FAILURE);
+    }
+    memset(mf_dereference(g_mf, i), (int)i, MICRO_BLOCK_SIZE);
+  }
+  g_bid_nr = nr;
+  g_order  = micro_order(nr, random);
+}
+
+static void setup_sequential(size_t param) {
+  setup_blocks(param, false);
+}
+
+static void setup_random(size_t param) {
+  setup_blocks(param, true);
+}
+
+static uint64_t run_dereference(size_t param, size_t nr) {
+  uint64_t sum = 0;
+  size_t i, j = 0;
+
+  for (i = 0; i < nr; ++i) {
+    sum += *(volatile uint8_t*)mf_dereference(g_mf, g_order[j]);
+    if (++j == param) j = 0;
+  }
+  return sum;
+}
+
+const micro_case_t micro_mf_cases[] = {
+  { "mf.size2sc", "", no_param, setup_init, run_size2sc },
+#if !FIXED_LENGTH_INTEGER
+  { "mf.get_int", "bytes", width_params, setup_int, run_get_int },
+  { "mf.put_int", "bytes", width_params, setup_int, run_put_int },
+#endif /* FIXED_LENGTH_INTEGER */
+  { "mf.pheap_pool", "", no_param, setup_pheap, run_pheap_pool },
+  { "mf.pheap_map", "pages", page_params, setup_pheap, run_pheap_map },
+  { "mf.my_memcpy", "size", copy_params, setup_copy, run_copy },
+  { "mf.deref_seq", "blocks", bid_params, setup_sequential, run_dereference },
+  { "mf.deref_rand", "blocks", bid_params, setup_random, run_dereference },
+  { NULL, NULL, NULL, NULL, NULL },
+};
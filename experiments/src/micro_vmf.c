@@ -0,0 +1,186 @@
+/*
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/* The whole library is compiled in this file to reach its primitives */
+#include "virtual_multiheap_fit.c"
+
+#include "micro_bench.h"
+
+/* Mask of the index into the buffer of integers */
+#define INT_SLOT_MASK 4095
+
+static vmf_t g_vmf;
+/* Blocks allocated by the dereference benchmarks */
+static size_t g_bid_nr;
+static const uint32_t* g_order;
+/* Buffer of integers of 'get_int' and 'put_int' */
+static uint8_t g_int_buffer[(INT_SLOT_MASK + 1) * 8];
+static uint8_t* g_copy_buffer;
+
+static const size_t no_param[] = { 0 };
+#if !FIXED_LENGTH_INTEGER
+static const size_t width_params[] = { 1, 2, 3, 4, 5, 6, 7, 8, 0 };
+#endif /* FIXED_LENGTH_INTEGER */
+static const size_t copy_params[] = { 8, 64, 512, 4096, 32768, 0 };
+static const size_t bid_params[] = { 1 << 10, 1 << 14, 1 << 18, 0 };
+
+/** Initialize Virtual Multiheap-fit once (in user space, which needs no
+    kernel module) */
+static void init_once(void) {
+  if (g_vmf != NULL) return;
+  g_vmf = vmf_init_flags(1, MICRO_SIZE_MAX, MICRO_BID_MAX,
+    (size_t)MICRO_BID_MAX * MICRO_BLOCK_SIZE * 2, VMF_FLAG_USERSPACE);
+  if (g_vmf == NULL) {
+    fprintf(stderr, "vmf_init_flags failed\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void setup_init(size_t param) {
+  (void)param;
+  init_once();
+}
+
+static uint64_t run_size2sc(size_t param, size_t nr) {
+  const size_t* sizes = micro_sizes();
+  uint64_t sum = 0;
+  size_t i;
+
+  (void)param;
+  for (i = 0; i < nr; ++i) sum += size2sc(sizes[i & (MICRO_SIZE_NR - 1)]);
+  return sum;
+}
+
+#if !FIXED_LENGTH_INTEGER
+static void setup_int(size_t param) {
+  size_t i;
+
+  init_once();
+  for (i = 0; i < sizeof(g_int_buffer); ++i) g_int_buffer[i] = (uint8_t)i;
+  (void)param;
+}
+
+static uint64_t run_get_int(size_t param, size_t nr) {
+  uint64_t sum = 0;
+  size_t i;
+
+  for (i = 0; i < nr; ++i) {
+    sum += get_int(g_int_buffer + (i & INT_SLOT_MASK) * param, param);
+  }
+  return sum;
+}
+
+static uint64_t run_put_int(size_t param, size_t nr) {
+  size_t i;
+
+  for (i = 0; i < nr; ++i) {
+    put_int(g_int_buffer + (i & INT_SLOT_MASK) * param, param, i);
+  }
+  return get_int(g_int_buffer, param);
+}
+#endif /* FIXED_LENGTH_INTEGER */
+
+static void setup_copy(size_t param) {
+  init_once();
+  free(g_copy_buffer);
+  g_copy_buffer = malloc(2 * sc2size(size2sc(param)));
+  if (g_copy_buffer == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  memset(g_copy_buffer, 1, 2 * sc2size(size2sc(param)));
+}
+
+static uint64_t run_copy(size_t param, size_t nr) {
+  size_t size = sc2size(size2sc(param));
+  size_t i;
+
+  /* The size of the class, as moving a block in 'vmf_deallocate' */
+  for (i = 0; i < nr; ++i) {
+    my_memcpy(g_copy_buffer + (i & 1) * size,
+      g_copy_buffer + (~i & 1) * size, size);
+  }
+  return g_copy_buffer[0];
+}
+
+static void setup_blocks(size_t nr, bool random) {
+  size_t i;
+
+  init_once();
+  for (i = 0; i < g_bid_nr; ++i) vmf_deallocate(g_vmf, i);
+  for (i = 0; i < nr; ++i) {
+    if (vmf_allocate(g_vmf, i, MICRO_BLOCK_SIZE) != 0) {
+      fprintf(stderr, "vmf_allocate failed\n");
+      exit(EXIT_FAILURE);
+    }
+    memset(vmf_dereference(g_vmf, i), (int)i, MICRO_BLOCK_SIZE);
+  }
+  g_bid_nr = nr;
+  g_order  = micro_order(nr, random);
+}
+
+static void setup_sequential(size_t param) {
+  setup_blocks(param, false);
+}
+
+static void setup_random(size_t param) {
+  setup_blocks(param, true);
+}
+
+static uint64_t run_block_info(size_t param, size_t nr) {
+  block_info_t* block_info = ((vmf_main_t*)g_vmf)->block_info;
+  uint64_t sum = 0;
+  offset_t ofs;
+  pageid_t page_id;
+  size_t i, j = 0;
+
+  for (i = 0; i < nr; ++i) {
+    block_info_get_all(block_info, g_order[j], &ofs, &page_id);
+    sum += ofs + page_id;
+    if (++j == param) j = 0;
+  }
+  return sum;
+}
+
+static uint64_t run_dereference(size_t param, size_t nr) {
+  uint64_t sum = 0;
+  size_t i, j = 0;
+
+  for (i = 0; i < nr; ++i) {
+    sum += *(volatile uint8_t*)vmf_dereference(g_vmf, g_order[j]);
+    if (++j == param) j = 0;
+  }
+  return sum;
+}
+
+const micro_case_t micro_vmf_cases[] = {
+  { "vmf.size2sc", "", no_param, setup_init, run_size2sc },
+#if !FIXED_LENGTH_INTEGER
+  { "vmf.get_int", "bytes", width_params, setup_int, run_get_int },
+  { "vmf.put_int", "bytes", width_params, setup_int, run_put_int },
+#endif /* FIXED_LENGTH_INTEGER */
+  { "vmf.block_info_get_all", "blocks", bid_params, setup_random,
+    run_block_info },
+  { "vmf.my_memcpy", "size", copy_params, setup_copy, run_copy },
+  { "vmf.deref_seq", "blocks", bid_params, setup_sequential,
+    run_dereference },
+  { "vmf.deref_rand", "blocks", bid_params, setup_random, run_dereference },
+  { NULL, NULL, NULL, NULL, NULL },
+};
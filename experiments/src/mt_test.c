@@ -0,0 +1,531 @@
+/*
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "allocator.h"
+#include "histogram.h"
+#include "memlog.h"
+
+/** Command with the block id used by a thread */
+typedef struct {
+  enum command_type type;
+  size_t idx;
+  size_t size;
+  /* Recorded time (MEMLOG_NO_TIMESTAMP if not recorded) */
+  uint64_t timestamp;
+  /* Number of the commands on 'idx' before this one in the trace */
+  uint64_t seq;
+} mt_command_t;
+
+/** Commands replayed by a thread */
+typedef struct {
+  mt_command_t* commands;
+  size_t command_nr;
+} mt_trace_t;
+
+/** Arguments and results of a thread */
+typedef struct {
+  pthread_t thread;
+  /* Index of the thread */
+  size_t id;
+  const mt_trace_t* trace;
+  /* Latency of operations */
+  histogram_t* histogram;
+} mt_worker_t;
+
+/* How the trace is given to threads */
+enum split_mode {
+  /* Blocks are divided into ranges of ids, one for each thread */
+  SPLIT_BY_ID,
+  /* Each thread replays the whole trace with its own block ids */
+  SPLIT_COPY,
+  /* Commands are replayed by the thread of the recorded thread id */
+  SPLIT_BY_TID,
+};
+
+/* Threads wait less than this time by spinning instead of sleeping [ns] */
+#define SPIN_THRESHOLD 100000
+
+/* Parameters of a run shared by all threads */
+static struct {
+  int allocator;
+  enum split_mode split;
+  /* All threads use one instance protected by 'lock' */
+  bool shared;
+  size_t mem_min;
+  size_t mem_max;
+  size_t block_max;
+  size_t require_size;
+  /* Scale of recorded intervals (0: commands are not paced) */
+  double pace;
+  /* The first timestamp in the trace */
+  uint64_t first_timestamp;
+  /* Time when threads start replaying */
+  uint64_t start_time;
+  /* Recorded thread ids (their indices are used to assign threads) */
+  uint32_t* tids;
+  size_t tid_nr;
+  /* Instance created by the main thread in the shared mode */
+  allocator_instance_t* instance;
+  /* Number of the commands done on each block id, which orders the
+     commands of a block id given to different threads in the tid mode */
+  uint64_t* idx_done;
+  pthread_mutex_t lock;
+  /* Threads wait for 'init_barrier' after initialization and start
+     replaying after 'start_barrier' */
+  pthread_barrier_t init_barrier;
+  pthread_barrier_t start_barrier;
+} g_run;
+
+/** Replay the trace with 'thread_nr' threads and return the throughput,
+    or a negative value if the run failed */
+static double run(const memlog_stream_t* memlog, size_t thread_nr);
+/** Read commands of the thread 'id' of 'thread_nr' threads */
+static void load_trace(const memlog_stream_t* memlog, size_t thread_nr,
+  size_t id, mt_trace_t* trace);
+/** Find timestamps and thread ids in the trace */
+static void scan_trace(memlog_stream_t* memlog);
+/** Index of 'tid' in the recorded thread ids */
+static size_t tid_index(uint32_t tid);
+/** Body of threads */
+static void* worker_main(void* arg);
+/** Wait until 'deadline' of 'now_ns' */
+static void wait_until(uint64_t deadline);
+static void print_usage(const char* program_name);
+
+/** Read the monotonic clock in nanoseconds */
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char* argv[]) {
+  memlog_stream_t* memlog;
+  size_t thread_max, thread_nr;
+  double throughput, base_throughput = 0;
+  int status = EXIT_SUCCESS;
+  int i;
+
+  if (argc < 4) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  memlog     = memlog_stream_open(argv[1]);
+  g_run.allocator = atoi(argv[2]);
+  thread_max = strtoul(argv[3], NULL, 10);
+  if (g_run.allocator >= ALLOC_NB || thread_max == 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  g_run.split  = SPLIT_BY_ID;
+  g_run.shared = !allocator_multi_instance[g_run.allocator];
+  for (i = 4; i < argc; ++i) {
+    if (strcmp(argv[i], "split") == 0) {
+      g_run.split = SPLIT_BY_ID;
+    } else if (strcmp(argv[i], "copy") == 0) {
+      g_run.split = SPLIT_COPY;
+    } else if (strcmp(argv[i], "tid") == 0) {
+      g_run.split = SPLIT_BY_TID;
+    } else if (strncmp(argv[i], "pace=", 5) == 0) {
+      g_run.pace = strtod(argv[i] + 5, NULL);
+    } else if (strcmp(argv[i], "shared") == 0) {
+      g_run.shared = true;
+    } else if (strcmp(argv[i], "private") == 0) {
+      g_run.shared = false;
+    } else {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (g_run.split == SPLIT_BY_TID) {
+    /* A block might be deallocated by another thread */
+    g_run.shared = true;
+  }
+  if (!g_run.shared && !allocator_multi_instance[g_run.allocator]) {
+    fprintf(stderr, "%s can not have an instance for each thread\n",
+      allocator_name[g_run.allocator]);
+    return EXIT_FAILURE;
+  }
+  scan_trace(memlog);
+
+  printf("%s, %s, %s instance", allocator_name[g_run.allocator],
+    g_run.split == SPLIT_BY_ID ? "split by block id" :
+    g_run.split == SPLIT_COPY  ? "copy per thread" : "recorded threads",
+    g_run.shared ? "shared" : "private");
+  if (g_run.pace > 0) printf(", paced x%g", g_run.pace);
+  putchar('\n');
+  for (thread_nr = 1; thread_nr <= thread_max; ++thread_nr) {
+    throughput = run(memlog, thread_nr);
+    if (throughput < 0) {
+      status = EXIT_FAILURE;
+      break;
+    }
+    if (thread_nr == 1) base_throughput = throughput;
+    printf("  aggregate %.0f ops/s, scaling efficiency %.1f %%\n",
+      throughput,
+      100.0 * throughput / (base_throughput * thread_nr));
+    fflush(stdout);
+  }
+  memlog_stream_close(memlog);
+
+  return status;
+}
+
+static double run(const memlog_stream_t* memlog, size_t thread_nr) {
+  mt_worker_t* workers;
+  mt_trace_t* traces;
+  size_t i, op_nr = 0;
+  uint64_t start, elapsed;
+  double throughput = 0;
+  int fds[2];
+  pid_t pid;
+  int status;
+
+  /* Each run is done in a child process because some allocators can be
+     initialized only once in a process. */
+  if (pipe(fds) < 0) {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid > 0) {
+    close(fds[1]);
+    if (read(fds[0], &throughput, sizeof(throughput)) != sizeof(throughput)) {
+      throughput = -1;
+    }
+    close(fds[0]);
+    if (waitpid(pid, &status, 0) < 0) {
+      perror("waitpid");
+      return -1;
+    }
+    if (WIFSIGNALED(status)) {
+      fprintf(stderr, "threads %zu: killed by signal %d (%s)\n", thread_nr,
+        WTERMSIG(status), strsignal(WTERMSIG(status)));
+      return -1;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+      fprintf(stderr, "threads %zu: exited with status %d\n", thread_nr,
+        WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+      return -1;
+    }
+    if (throughput < 0) {
+      fprintf(stderr, "threads %zu: no result\n", thread_nr);
+    }
+    return throughput;
+  }
+  close(fds[0]);
+
+  g_run.mem_min      = memlog->mem_min;
+  g_run.mem_max      = memlog->mem_max;
+  g_run.block_max    = memlog->block_max;
+  g_run.require_size = memlog->require_size;
+  if (g_run.split == SPLIT_COPY) {
+    g_run.require_size *= thread_nr;
+    if (g_run.shared) g_run.block_max *= thread_nr;
+  }
+
+  workers = calloc(thread_nr, sizeof(mt_worker_t));
+  traces  = calloc(thread_nr, sizeof(mt_trace_t));
+  if (workers == NULL || traces == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < thread_nr; ++i) {
+    load_trace(memlog, thread_nr, i, &traces[i]);
+    op_nr += traces[i].command_nr;
+  }
+
+  if (g_run.split == SPLIT_BY_TID) {
+    g_run.idx_done = calloc(memlog->block_max, sizeof(uint64_t));
+    if (g_run.idx_done == NULL) {
+      perror("calloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (g_run.shared) {
+    init_funcs[g_run.allocator](g_run.mem_min, g_run.mem_max,
+      g_run.block_max, g_run.require_size);
+    g_run.instance = allocator_get_instance();
+  }
+  pthread_mutex_init(&g_run.lock, NULL);
+  pthread_barrier_init(&g_run.init_barrier, NULL, thread_nr + 1);
+  pthread_barrier_init(&g_run.start_barrier, NULL, thread_nr + 1);
+
+  for (i = 0; i < thread_nr; ++i) {
+    workers[i].id        = i;
+    workers[i].trace     = &traces[i];
+    workers[i].histogram = histogram_create();
+    if (pthread_create(&workers[i].thread, NULL, worker_main,
+        &workers[i]) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  /* Threads start replaying together after all of them are initialized,
+     so initialization is not timed */
+  pthread_barrier_wait(&g_run.init_barrier);
+  g_run.start_time = now_ns();
+  pthread_barrier_wait(&g_run.start_barrier);
+  start = g_run.start_time;
+  for (i = 0; i < thread_nr; ++i) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  elapsed = now_ns() - start;
+  throughput = op_nr / (elapsed / 1e9);
+
+  printf("threads %zu: %" PRIu64 " us, %zu operations\n",
+    thread_nr, elapsed / 1000, op_nr);
+  printf("  %6s %10s %8s %8s %8s %10s [ns]\n",
+    "thread", "count", "p50", "p99", "p99.9", "max");
+  for (i = 0; i < thread_nr; ++i) {
+    printf("  %6zu %10" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64
+      " %10" PRIu64 "\n", i, workers[i].histogram->count,
+      histogram_percentile(workers[i].histogram, 50.0),
+      histogram_percentile(workers[i].histogram, 99.0),
+      histogram_percentile(workers[i].histogram, 99.9),
+      workers[i].histogram->max);
+  }
+  fflush(stdout);
+
+  if (write(fds[1], &throughput, sizeof(throughput)) < 0) {
+    perror("write");
+  }
+  close(fds[1]);
+  /* Memory is released by the end of the process */
+  _exit(EXIT_SUCCESS);
+}
+
+static void load_trace(const memlog_stream_t* memlog, size_t thread_nr,
+    size_t id, mt_trace_t* trace) {
+  memlog_stream_t* stream = (memlog_stream_t*) memlog;
+  command_t command;
+  enum command_type kind;
+  size_t capacity = 1024;
+  uint64_t* idx_seq = NULL;
+  uint64_t trace_seq = 0;
+
+  trace->commands   = malloc(capacity * sizeof(mt_command_t));
+  trace->command_nr = 0;
+  if (trace->commands == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+
+  if (g_run.split == SPLIT_BY_TID) {
+    idx_seq = calloc(memlog->block_max, sizeof(uint64_t));
+    if (idx_seq == NULL) {
+      perror("calloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  memlog_stream_rewind(stream);
+  while (memlog_stream_next(stream, &command)) {
+    kind = command_kind(command.type);
+    if (kind != COMMAND_ALLOCATE && kind != COMMAND_DEALLOCATE &&
+        kind != COMMAND_REALLOCATE) {
+      continue;
+    }
+    /* Commands of all the threads are numbered per block id */
+    if (idx_seq != NULL) {
+      trace_seq = idx_seq[command.idx]++;
+    }
+    if (g_run.split == SPLIT_BY_ID) {
+      if (command.idx * thread_nr / memlog->block_max != id) continue;
+    } else if (g_run.split == SPLIT_BY_TID) {
+      if (tid_index(command.tid) % thread_nr != id) continue;
+    } else if (g_run.shared) {
+      /* Threads share the instance, so block ids must not conflict */
+      command.idx = command.idx * thread_nr + id;
+    }
+
+    if (trace->command_nr == capacity) {
+      capacity *= 2;
+      trace->commands =
+        realloc(trace->commands, capacity * sizeof(mt_command_t));
+      if (trace->commands == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+    }
+    trace->commands[trace->command_nr].type = kind;
+    trace->commands[trace->command_nr].idx  = command.idx;
+    trace->commands[trace->command_nr].size = command.size;
+    trace->commands[trace->command_nr].timestamp = command.timestamp;
+    trace->commands[trace->command_nr].seq  = trace_seq;
+    trace->command_nr++;
+  }
+  free(idx_seq);
+}
+
+static void* worker_main(void* arg) {
+  mt_worker_t* worker = (mt_worker_t*) arg;
+  const mt_trace_t* trace = worker->trace;
+  int allocator = g_run.allocator;
+  bool shared = g_run.shared;
+  mt_command_t command;
+  uint64_t start;
+  size_t i;
+
+  /* Initialization of some allocators (e.g. DLmalloc) is not thread-safe */
+  pthread_mutex_lock(&g_run.lock);
+  if (shared) {
+    allocator_set_instance(g_run.instance);
+  } else {
+    init_funcs[allocator](g_run.mem_min, g_run.mem_max,
+      g_run.block_max, g_run.require_size);
+  }
+  pthread_mutex_unlock(&g_run.lock);
+  pthread_barrier_wait(&g_run.init_barrier);
+  pthread_barrier_wait(&g_run.start_barrier);
+
+  for (i = 0; i < trace->command_nr; ++i) {
+    command = trace->commands[i];
+    if (g_run.pace > 0 && command.timestamp != MEMLOG_NO_TIMESTAMP) {
+      wait_until(g_run.start_time + (uint64_t)(g_run.pace *
+        (command.timestamp - g_run.first_timestamp)));
+    }
+    /* The previous command on the block id (e.g. its allocation before a
+       deallocation) may be in another thread */
+    if (g_run.idx_done != NULL) {
+      while (__atomic_load_n(&g_run.idx_done[command.idx], __ATOMIC_ACQUIRE)
+          != command.seq) {
+        sched_yield();
+      }
+    }
+    start = now_ns();
+    if (shared) pthread_mutex_lock(&g_run.lock);
+    if (command.type == COMMAND_ALLOCATE) {
+      allocate_funcs[allocator](command.idx, command.size);
+    } else if (command.type == COMMAND_DEALLOCATE) {
+      deallocate_funcs[allocator](command.idx);
+    } else {
+      reallocate_funcs[allocator](command.idx, command.size);
+    }
+    if (g_run.idx_done != NULL) {
+      __atomic_store_n(&g_run.idx_done[command.idx], command.seq + 1,
+        __ATOMIC_RELEASE);
+    }
+    if (shared) pthread_mutex_unlock(&g_run.lock);
+    histogram_record(worker->histogram, now_ns() - start);
+  }
+  return NULL;
+}
+
+static void scan_trace(memlog_stream_t* memlog) {
+  command_t command;
+  size_t capacity = 16;
+  size_t i;
+
+  g_run.first_timestamp = MEMLOG_NO_TIMESTAMP;
+  g_run.tid_nr = 0;
+  g_run.tids = malloc(capacity * sizeof(uint32_t));
+  if (g_run.tids == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+
+  memlog_stream_rewind(memlog);
+  while (memlog_stream_next(memlog, &command)) {
+    if (command.timestamp < g_run.first_timestamp) {
+      g_run.first_timestamp = command.timestamp;
+    }
+    for (i = 0; i < g_run.tid_nr; ++i) {
+      if (g_run.tids[i] == command.tid) break;
+    }
+    if (i < g_run.tid_nr) continue;
+    if (g_run.tid_nr == capacity) {
+      capacity *= 2;
+      g_run.tids = realloc(g_run.tids, capacity * sizeof(uint32_t));
+      if (g_run.tids == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+    }
+    g_run.tids[g_run.tid_nr++] = command.tid;
+  }
+}
+
+static size_t tid_index(uint32_t tid) {
+  size_t i;
+
+  for (i = 0; i < g_run.tid_nr; ++i) {
+    if (g_run.tids[i] == tid) return i;
+  }
+  return 0;
+}
+
+static void wait_until(uint64_t deadline) {
+  struct timespec ts;
+  uint64_t now = now_ns();
+  uint64_t sleep_time;
+
+  if (now + SPIN_THRESHOLD < deadline) {
+    /* Sleeping is not accurate, so wake up a little earlier */
+    sleep_time = deadline - now - SPIN_THRESHOLD / 2;
+    ts.tv_sec  = sleep_time / 1000000000;
+    ts.tv_nsec = sleep_time % 1000000000;
+    nanosleep(&ts, NULL);
+  }
+  while (now_ns() < deadline) {
+    __builtin_ia32_pause();
+  }
+}
+
+static void print_usage(const char* program_name) {
+  int i;
+  printf("%s <memlog file> <allocator number> <max threads> "
+    "[split|copy|tid] [shared|private] [pace=<scale>]\n", program_name);
+  printf("The trace is replayed with 1 to <max threads> threads.\n");
+  printf("  split   : blocks are divided into id ranges (default)\n");
+  printf("  copy    : each thread replays the whole trace\n");
+  printf("  tid     : commands are assigned by the recorded thread id\n");
+  printf("            (always shared)\n");
+  printf("  pace    : recorded intervals multiplied by <scale> are kept\n");
+  printf("  shared  : threads use one instance with a lock\n");
+  printf("  private : each thread has its own instance\n");
+  printf("            (default if the allocator supports it)\n");
+  putchar('\n');
+  printf(" Number |        Allocator Name \n");
+  printf("--------+-----------------------\n");
+  for (i = 0; i < ALLOC_NB; ++i) {
+    printf("%7d | %21s\n", i, allocator_name[i]);
+  }
+}
@@ -0,0 +1,568 @@
+/*
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "histogram.h"
+#include "memlog.h"
+
+/*
+  Soak test: the traces are replayed in a loop (or a synthetic workload
+  runs) for a long time on one instance of an allocator, so that slow
+  leaks in its bookkeeping show up. All blocks still live at the end of a
+  trace are deallocated, so every pass starts from the same live set and
+  its statistics are comparable. A monotone trend of a statistic over the
+  passes is detected by the Mann-Kendall test.
+ */
+
+/* Number of commands decoded at once */
+#define BATCH_SIZE 65536
+/* Default number of passes over the traces */
+#define DEFAULT_PASS_NR 10
+/* Default number of operations between samples */
+#define DEFAULT_INTERVAL 100000
+/* Z of the one-sided Mann-Kendall test at the significance level of 1% */
+#define DRIFT_Z 2.326
+/* Default smallest change over the run reported as a drift [%] */
+#define DEFAULT_DRIFT_PERCENT 1.0
+/* Operations of a pass of the synthetic workload per live block */
+#define SYNTHETIC_PASS_RATE 16
+
+/* Statistics of a pass tested for a drift */
+enum pass_stat {
+  /* peak of 'getsize_funcs' */
+  STAT_PEAK_USING,
+  /* peak of the resident set size */
+  STAT_PEAK_RSS,
+  /* sum of 'getsize_funcs' per sum of live bytes over the operations of
+     the workload (the final deallocations are excluded) */
+  STAT_USING_PER_LIVE,
+  /* 'getsize_funcs' after the blocks are deallocated at the end */
+  STAT_RESIDUAL,
+  /* pages kept for reuse at the end */
+  STAT_POOL,
+  /* peak number of mappings at the samples */
+  STAT_VMA,
+  /* 99th percentile of the latency of operations [ns] */
+  STAT_P99,
+  STAT_NB,
+};
+
+static const char* const stat_name[STAT_NB] = {
+  "peak_using", "peak_rss", "using_per_live", "residual", "pool", "vma",
+  "p99_ns",
+};
+
+/* State of the replay */
+typedef struct {
+  int allocator;
+  size_t block_max;
+  size_t* idx2size;
+  bool* live;
+  size_t live_nr;
+  size_t live_bytes;
+  uint64_t op_nr;
+  /* Operations in the current pass, so that every pass is sampled at the
+     same operations */
+  uint64_t pass_op_nr;
+  /* Latencies since the last sample and in the pass */
+  histogram_t window;
+  histogram_t pass;
+  /* Statistics of the current pass */
+  double stat[STAT_NB];
+  double live_sum;
+  /* Whether the blocks left live are being deallocated. The live set
+     shrinks to nothing then, so 'STAT_USING_PER_LIVE' is not taken. */
+  bool draining;
+  /* Whether the peak RSS of the kernel is reset at each pass */
+  bool hwm_reset;
+  /* Output of the time series */
+  FILE* out;
+  uint64_t interval;
+  uint64_t start_ns;
+  uint64_t pass_nr;
+} soak_t;
+
+static command_t g_batch[BATCH_SIZE];
+/* State of xorshift64 of the synthetic workload */
+static uint64_t g_rand_state = 88172645463325252ULL;
+
+/** Read the raw monotonic clock in nanoseconds */
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** xorshift64 */
+static inline uint64_t rand_u64(void) {
+  g_rand_state ^= g_rand_state << 13;
+  g_rand_state ^= g_rand_state >> 7;
+  g_rand_state ^= g_rand_state << 17;
+  return g_rand_state;
+}
+
+/** Resident set size from /proc/self/statm [byte] */
+static size_t read_rss(void) {
+  char buffer[128];
+  unsigned long size = 0, resident = 0;
+  ssize_t read_size;
+  int fd = open("/proc/self/statm", O_RDONLY);
+
+  if (fd < 0) return 0;
+  read_size = read(fd, buffer, sizeof(buffer) - 1);
+  close(fd);
+  if (read_size <= 0) return 0;
+  buffer[read_size] = '\0';
+  if (sscanf(buffer, "%lu %lu", &size, &resident) != 2) return 0;
+  return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/** Reset the peak resident set size of the process kept by the kernel.
+    It returns false if it is not supported. */
+static bool reset_peak_rss(void) {
+  int fd = open("/proc/self/clear_refs", O_WRONLY);
+  bool success;
+
+  if (fd < 0) return false;
+  success = write(fd, "5", 1) == 1;
+  close(fd);
+  return success;
+}
+
+/** Peak resident set size since the last reset (VmHWM) [byte] */
+static size_t read_peak_rss(void) {
+  /* stdio is not used not to allocate memory while measuring */
+  char buffer[4096];
+  const char* line;
+  ssize_t read_size;
+  int fd = open("/proc/self/status", O_RDONLY);
+
+  if (fd < 0) return 0;
+  read_size = read(fd, buffer, sizeof(buffer) - 1);
+  close(fd);
+  if (read_size <= 0) return 0;
+  buffer[read_size] = '\0';
+  line = strstr(buffer, "VmHWM:");
+  if (line == NULL) return 0;
+  return strtoull(line + strlen("VmHWM:"), NULL, 10) * 1024;
+}
+
+/** Count mappings in /proc/self/maps */
+static size_t count_vma(void) {
+  /* stdio is not used not to allocate memory while measuring */
+  static char buffer[65536];
+  ssize_t read_size;
+  size_t vma_nr = 0;
+  ssize_t i;
+  int fd = open("/proc/self/maps", O_RDONLY);
+
+  if (fd < 0) return 0;
+  while ((read_size = read(fd, buffer, sizeof(buffer))) > 0) {
+    for (i = 0; i < read_size; ++i) {
+      if (buffer[i] == '\n') vma_nr++;
+    }
+  }
+  close(fd);
+  return vma_nr;
+}
+
+/** Write a row of the time series and update the statistics of the pass */
+static void take_sample(soak_t* soak) {
+  getpool_t getpool = getpool_funcs[soak->allocator];
+  size_t using_mem = getsize_funcs[soak->allocator]();
+  size_t rss = read_rss();
+  size_t vma = count_vma();
+  size_t pool = getpool != NULL ? getpool() : 0;
+  double* stat = soak->stat;
+
+  /* Without the peak of the kernel, the peak RSS is taken at the samples */
+  if (!soak->hwm_reset && rss > stat[STAT_PEAK_RSS]) stat[STAT_PEAK_RSS] = rss;
+  if (vma > stat[STAT_VMA]) stat[STAT_VMA] = vma;
+
+  fprintf(soak->out, "%.3f,%" PRIu64 ",%" PRIu64 ",%zu,%zu,%zu,%zu,%zu,%zu,"
+    "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+    (now_ns() - soak->start_ns) * 1e-9, soak->op_nr, soak->pass_nr,
+    soak->live_nr, soak->live_bytes, using_mem, rss, vma, pool,
+    histogram_percentile(&soak->window, 50),
+    histogram_percentile(&soak->window, 99),
+    histogram_percentile(&soak->window, 99.9), soak->window.max);
+  memset(&soak->window, 0, sizeof(histogram_t));
+}
+
+/** Record the latency of an operation, update the peaks of the pass and
+    sample periodically. It is called after the live set is updated. */
+static inline void count_op(soak_t* soak, uint64_t elapsed) {
+  size_t using_mem = getsize_funcs[soak->allocator]();
+  double* stat = soak->stat;
+
+  histogram_record(&soak->window, elapsed);
+  histogram_record(&soak->pass, elapsed);
+  if (using_mem > stat[STAT_PEAK_USING]) stat[STAT_PEAK_USING] = using_mem;
+  if (!soak->draining) {
+    stat[STAT_USING_PER_LIVE] += using_mem;
+    soak->live_sum += soak->live_bytes;
+  }
+  soak->op_nr++;
+  if (++soak->pass_op_nr % soak->interval == 0) take_sample(soak);
+}
+
+static void soak_allocate(soak_t* soak, size_t idx, size_t size) {
+  uint64_t start = now_ns();
+  uint64_t elapsed;
+
+  allocate_funcs[soak->allocator](idx, size);
+  elapsed = now_ns() - start;
+  soak->idx2size[idx] = size;
+  soak->live[idx] = true;
+  soak->live_nr++;
+  soak->live_bytes += size;
+  count_op(soak, elapsed);
+}
+
+static void soak_deallocate(soak_t* soak, size_t idx) {
+  uint64_t start = now_ns();
+  uint64_t elapsed;
+
+  deallocate_funcs[soak->allocator](idx);
+  elapsed = now_ns() - start;
+  soak->live[idx] = false;
+  soak->live_nr--;
+  soak->live_bytes -= soak->idx2size[idx];
+  count_op(soak, elapsed);
+}
+
+static void soak_reallocate(soak_t* soak, size_t idx, size_t size) {
+  uint64_t start = now_ns();
+  uint64_t elapsed;
+
+  reallocate_funcs[soak->allocator](idx, size);
+  elapsed = now_ns() - start;
+  soak->live_bytes += size;
+  soak->live_bytes -= soak->idx2size[idx];
+  soak->idx2size[idx] = size;
+  count_op(soak, elapsed);
+}
+
+/** Deallocate the blocks left live at the end of a pass */
+static void deallocate_live(soak_t* soak) {
+  size_t i;
+
+  soak->draining = true;
+  for (i = 0; i < soak->block_max && soak->live_nr > 0; ++i) {
+    if (soak->live[i]) soak_deallocate(soak, i);
+  }
+  soak->draining = false;
+}
+
+/** Replay a trace and deallocate the blocks left live */
+static void replay_trace(soak_t* soak, memlog_stream_t* memlog) {
+  command_t command;
+  size_t i, batch_nr;
+
+  memlog_stream_rewind(memlog);
+  while ((batch_nr = memlog_stream_read(memlog, g_batch, BATCH_SIZE)) > 0) {
+    for (i = 0; i < batch_nr; ++i) {
+      command = g_batch[i];
+      switch (command_kind(command.type)) {
+      case COMMAND_ALLOCATE:
+        soak_allocate(soak, command.idx, command.size);
+        break;
+      case COMMAND_DEALLOCATE:
+        soak_deallocate(soak, command.idx);
+        break;
+      case COMMAND_REALLOCATE:
+        soak_reallocate(soak, command.idx, command.size);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+  deallocate_live(soak);
+}
+
+/** Random size drawn log-uniformly from [1, max_size] */
+static size_t synthetic_size(size_t max_size) {
+  size_t size = (size_t)1 << (rand_u64() % (64 - __builtin_clzll(max_size)));
+  size += rand_u64() % size;
+  return size > max_size ? max_size : size;
+}
+
+/** A pass of the synthetic workload: a random slot of 'block_max' is
+    allocated if it is free, and otherwise deallocated or reallocated.
+    The blocks left live are deallocated at the end as with the traces. */
+static void run_synthetic(soak_t* soak, size_t max_size) {
+  uint64_t i, step_nr = (uint64_t)soak->block_max * SYNTHETIC_PASS_RATE;
+  size_t idx;
+
+  for (i = 0; i < step_nr; ++i) {
+    idx = rand_u64() % soak->block_max;
+    if (!soak->live[idx]) {
+      soak_allocate(soak, idx, synthetic_size(max_size));
+    } else if (rand_u64() & 1) {
+      soak_deallocate(soak, idx);
+    } else {
+      soak_reallocate(soak, idx, synthetic_size(max_size));
+    }
+  }
+  deallocate_live(soak);
+}
+
+static int compare_double(const void* lhs, const void* rhs) {
+  double l = *(const double*)lhs, r = *(const double*)rhs;
+  return (l > r) - (l < r);
+}
+
+/** Mann-Kendall statistic Z of the trend of 'nr' values and Sen's slope
+    per pass */
+static double mann_kendall(const double* values, size_t nr, double* slope) {
+  double* slopes = malloc(nr * nr / 2 * sizeof(double) + sizeof(double));
+  double s = 0, variance;
+  size_t i, j, slope_nr = 0;
+  int k;
+
+  if (slopes == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nr; ++i) {
+    for (j = i + 1; j < nr; ++j) {
+      s += (values[j] > values[i]) - (values[j] < values[i]);
+      slopes[slope_nr++] = (values[j] - values[i]) / (double)(j - i);
+    }
+  }
+  /* Median of the pairwise slopes by insertion sort (few passes) */
+  for (i = 1; i < slope_nr; ++i) {
+    double v = slopes[i];
+    for (k = (int)i - 1; k >= 0 && slopes[k] > v; --k) slopes[k + 1] = slopes[k];
+    slopes[k + 1] = v;
+  }
+  *slope = slope_nr == 0 ? 0.0 : slopes[slope_nr / 2];
+  free(slopes);
+
+  variance = (double)nr * (nr - 1) * (2 * nr + 5) / 18;
+  if (variance == 0 || s == 0) return 0.0;
+  return (s > 0 ? s - 1 : s + 1) / sqrt(variance);
+}
+
+static void print_usage(const char* program_name) {
+  printf("%s [options] <allocator number> [<memlog> ...]\n", program_name);
+  printf("Replay the memlogs in a loop (or a synthetic workload) on one "
+    "allocator instance,\nsample its memory and latency, and detect "
+    "drifts over the passes.\n");
+  printf("Options:\n");
+  printf("  -g <blocks>:<max size>  synthetic workload instead of memlogs\n");
+  printf("  -n <N>       passes (default: %d; 0: until -d)\n",
+    DEFAULT_PASS_NR);
+  printf("  -d <seconds> stop after the pass running at this time\n");
+  printf("  -k <N>       operations between samples (default: %d)\n",
+    DEFAULT_INTERVAL);
+  printf("  -o <file>    time series in CSV (default: soak.csv)\n");
+  printf("  -T <percent> smallest change over the run reported as a drift "
+    "(default: %.0f)\n", DEFAULT_DRIFT_PERCENT);
+  printf("The exit status is 1 if a drift is detected.\n");
+}
+
+int main(int argc, char* argv[]) {
+  memlog_stream_t** memlogs = NULL;
+  size_t memlog_nr = 0;
+  size_t synthetic_blocks = 0, synthetic_max = 0;
+  uint64_t pass_max = DEFAULT_PASS_NR;
+  double duration = 0, threshold = DEFAULT_DRIFT_PERCENT;
+  const char* output = "soak.csv";
+  size_t mem_min = SIZE_MAX, mem_max = 0, require_size = 0;
+  double* history = NULL;
+  double* series;
+  double* sorted;
+  double z, slope, median, change;
+  bool drift = false;
+  soak_t soak;
+  size_t i, j;
+  int opt;
+
+  memset(&soak, 0, sizeof(soak));
+  soak.interval = DEFAULT_INTERVAL;
+  while ((opt = getopt(argc, argv, "g:n:d:k:o:T:")) != -1) {
+    switch (opt) {
+    case 'g':
+      if (sscanf(optarg, "%zu:%zu", &synthetic_blocks, &synthetic_max) != 2 ||
+          synthetic_blocks == 0 || synthetic_max == 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'n': pass_max = strtoull(optarg, NULL, 10); break;
+    case 'd': duration = strtod(optarg, NULL); break;
+    case 'k': soak.interval = strtoull(optarg, NULL, 10); break;
+    case 'o': output = optarg; break;
+    case 'T': threshold = strtod(optarg, NULL); break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind >= argc || soak.interval == 0 ||
+      (pass_max == 0 && duration <= 0) ||
+      (synthetic_blocks == 0) == (optind + 1 == argc)) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  soak.allocator = atoi(argv[optind]);
+  if (soak.allocator < 0 || soak.allocator >= ALLOC_NB) {
+    fprintf(stderr, "allocator error\n");
+    return EXIT_FAILURE;
+  }
+
+  /* The instance is large enough for all the memlogs */
+  if (synthetic_blocks > 0) {
+    mem_min = 1;
+    mem_max = synthetic_max;
+    soak.block_max = synthetic_blocks;
+    require_size = synthetic_blocks * synthetic_max;
+  } else {
+    memlog_nr = argc - optind - 1;
+    memlogs = malloc(memlog_nr * sizeof(memlog_stream_t*));
+    if (memlogs == NULL) {
+      perror("malloc");
+      return EXIT_FAILURE;
+    }
+    for (i = 0; i < memlog_nr; ++i) {
+      memlogs[i] = memlog_stream_open(argv[optind + 1 + i]);
+      if (memlogs[i]->mem_min < mem_min) mem_min = memlogs[i]->mem_min;
+      if (memlogs[i]->mem_max > mem_max) mem_max = memlogs[i]->mem_max;
+      if (memlogs[i]->block_max > soak.block_max) {
+        soak.block_max = memlogs[i]->block_max;
+      }
+      if (memlogs[i]->require_size > require_size) {
+        require_size = memlogs[i]->require_size;
+      }
+    }
+  }
+  soak.idx2size = calloc(soak.block_max, sizeof(size_t));
+  soak.live     = calloc(soak.block_max, sizeof(bool));
+  soak.out      = fopen(output, "w");
+  if (soak.idx2size == NULL || soak.live == NULL) {
+    perror("malloc");
+    return EXIT_FAILURE;
+  }
+  if (soak.out == NULL) {
+    perror(output);
+    return EXIT_FAILURE;
+  }
+  fprintf(soak.out, "time_s,operations,pass,live_blocks,live_bytes,"
+    "using_mem,rss,vma,pool,p50_ns,p99_ns,p999_ns,max_ns\n");
+
+  init_funcs[soak.allocator](mem_min, mem_max, soak.block_max, require_size);
+  printf("%s: %s\n", allocator_name[soak.allocator],
+    synthetic_blocks > 0 ? "synthetic workload" : "memlogs in a loop");
+  printf("%6s", "pass");
+  for (i = 0; i < STAT_NB; ++i) printf(" %14s", stat_name[i]);
+  putchar('\n');
+
+  soak.start_ns = now_ns();
+  while (pass_max == 0 || soak.pass_nr < pass_max) {
+    memset(soak.stat, 0, sizeof(soak.stat));
+    memset(&soak.pass, 0, sizeof(histogram_t));
+    memset(&soak.window, 0, sizeof(histogram_t));
+    soak.live_sum    = 0;
+    soak.pass_op_nr  = 0;
+    soak.hwm_reset   = reset_peak_rss();
+    if (synthetic_blocks > 0) {
+      run_synthetic(&soak, synthetic_max);
+    } else {
+      for (i = 0; i < memlog_nr; ++i) replay_trace(&soak, memlogs[i]);
+    }
+
+    /* The end of a pass is always sampled */
+    take_sample(&soak);
+    soak.stat[STAT_USING_PER_LIVE] = soak.live_sum == 0 ? 0.0 :
+      soak.stat[STAT_USING_PER_LIVE] / soak.live_sum;
+    if (soak.hwm_reset) soak.stat[STAT_PEAK_RSS] = read_peak_rss();
+    soak.stat[STAT_RESIDUAL] = getsize_funcs[soak.allocator]();
+    soak.stat[STAT_POOL] = getpool_funcs[soak.allocator] != NULL ?
+      getpool_funcs[soak.allocator]() : 0;
+    soak.stat[STAT_P99] = histogram_percentile(&soak.pass, 99);
+
+    history = realloc(history, (soak.pass_nr + 1) * sizeof(soak.stat));
+    if (history == NULL) {
+      perror("realloc");
+      return EXIT_FAILURE;
+    }
+    memcpy(history + soak.pass_nr * STAT_NB, soak.stat, sizeof(soak.stat));
+    printf("%6" PRIu64, soak.pass_nr);
+    for (i = 0; i < STAT_NB; ++i) printf(" %14.6g", soak.stat[i]);
+    putchar('\n');
+    fflush(stdout);
+    fflush(soak.out);
+    soak.pass_nr++;
+    if (duration > 0 && (now_ns() - soak.start_ns) * 1e-9 >= duration) break;
+  }
+
+  /* Drifts are upward trends which change the statistic by more than the
+     threshold over the run. The first pass warms the allocator up, so it
+     is excluded. */
+  putchar('\n');
+  if (soak.pass_nr < 5) {
+    printf("drift: - (at least 5 passes are needed)\n");
+  } else {
+    series = malloc(soak.pass_nr * sizeof(double));
+    sorted = malloc(soak.pass_nr * sizeof(double));
+    if (series == NULL || sorted == NULL) {
+      perror("malloc");
+      return EXIT_FAILURE;
+    }
+    printf("%-16s %10s %14s %10s\n", "statistic", "Z", "slope/pass",
+      "change[%]");
+    for (i = 0; i < STAT_NB; ++i) {
+      for (j = 1; j < soak.pass_nr; ++j) {
+        series[j - 1] = history[j * STAT_NB + i];
+      }
+      z = mann_kendall(series, soak.pass_nr - 1, &slope);
+      memcpy(sorted, series, (soak.pass_nr - 1) * sizeof(double));
+      qsort(sorted, soak.pass_nr - 1, sizeof(double), compare_double);
+      median = (sorted[(soak.pass_nr - 2) / 2]
+        + sorted[(soak.pass_nr - 1) / 2]) / 2;
+      change = median == 0 ? 0.0 : 100.0 * slope * (soak.pass_nr - 2) / median;
+      printf("%-16s %10.2f %14.6g %10.2f%s\n", stat_name[i], z, slope, change,
+        z > DRIFT_Z && change > threshold ? " DRIFT" : "");
+      if (z > DRIFT_Z && change > threshold) drift = true;
+    }
+    free(series);
+    free(sorted);
+  }
+
+  fclose(soak.out);
+  for (i = 0; i < memlog_nr; ++i) memlog_stream_close(memlogs[i]);
+  free(memlogs);
+  free(history);
+  free(soak.live);
+  free(soak.idx2size);
+  return drift ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -20,68 +20,1027 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include "allocator.h"
+#include "histogram.h"
 #include "memlog.h"
 
+/* Number of commands decoded at once outside the measured section */
+#define BATCH_SIZE 65536
+/* Number of the slowest operations reported by default */
+#define DEFAULT_TOP_NR 10
+/* Number of samples to estimate the timing overhead */
+#define CALIBRATION_NR 100000
+/* Size classes of the latency mode are powers of two */
+#define SIZE_CLASS_NB 65
+/* Default probability that a synthetic read hits a recently used block */
+#define DEFAULT_LOCALITY 0.9
+/* Number of recently used blocks for synthetic reads (power of two) */
+#define HOT_NR 64
+/* Stride of reading a block */
+#define CACHE_LINE_SIZE 64
+/* Default probability that a random live block is verified after each
+   operation in the validation mode */
+#define DEFAULT_VERIFY_RATE 0.01
+/* Number of corrupted blocks reported in detail */
+#define CORRUPTION_REPORT_NR 10
+
+/* Operations measured in the latency mode */
+enum operation {
+  OP_ALLOCATE,
+  OP_DEALLOCATE,
+  OP_REALLOCATE,
+  OP_NB,
+};
+
+static const char* const op_name[OP_NB] = {
+  "allocate", "deallocate", "reallocate",
+};
+
+/* Hardware events counted in the touch mode */
+enum cache_event {
+  EVENT_CACHE_REFERENCE,
+  EVENT_CACHE_MISS,
+  EVENT_L1D_READ,
+  EVENT_L1D_READ_MISS,
+  EVENT_NB,
+};
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} cache_event_attr[EVENT_NB] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+    (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16) },
+  { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+};
+
+/* An operation reported as one of the slowest */
+typedef struct {
+  /* Latency without the timing overhead [ns] */
+  uint64_t latency;
+  /* Line number in the memlog */
+  size_t line;
+  enum operation op;
+  size_t idx;
+  size_t size;
+} slow_op_t;
+
+/* Blocks of the validation mode */
+typedef struct {
+  size_t* idx2size;
+  /* Generation of the payload written to each block */
+  uint32_t* generation;
+  /* Address where each block was last seen, to detect moves lazily */
+  void** idx2addr;
+  size_t verify_nr;
+  uint64_t verify_bytes;
+  size_t corrupt_nr;
+  size_t relocated_nr;
+  uint64_t relocated_bytes;
+} validation_t;
+
+/** Measure the total time of the trace */
+static int64_t measure_total(memlog_stream_t* memlog, int allocator);
+/** Measure the total time of the trace with the replay loop specialized
+    for the allocator and count the operations into 'op_nr' */
+static uint64_t measure_replay(memlog_stream_t* memlog, int allocator,
+  size_t* op_nr);
+/** Measure the latency of each operation and print the statistics */
+static void measure_latency(memlog_stream_t* memlog, int allocator,
+  size_t top_nr);
+/** Count system calls, page faults and VMAs of each operation */
+static void measure_counters(memlog_stream_t* memlog, int allocator);
+/** Measure the time of the trace with accesses to the payload of blocks */
+static void measure_touch(memlog_stream_t* memlog, int allocator,
+  size_t read_nr, double locality);
+/** Replay the trace with patterned payloads, verify them and measure the
+    cost of moving blocks (false: a payload was corrupted) */
+static bool measure_validate(memlog_stream_t* memlog, int allocator,
+  double verify_rate);
+/** Verify the first 'size' bytes of the block 'idx' and record a move */
+static void verify_payload(validation_t* validation, dereference_t dereference,
+  size_t idx, size_t size, size_t line, const char* when);
+/** Open a counter of a hardware event of this thread (-1: unavailable) */
+static int open_event(uint32_t type, uint64_t config);
+/** Count mappings in /proc/self/maps */
+static size_t count_vma(void);
+/** Estimate the time taken by a pair of 'now_ns' */
+static uint64_t calibrate_overhead(void);
+/** Keep the 'cap' slowest operations in the min-heap 'heap' */
+static void push_slow_op(slow_op_t* heap, size_t* nr, size_t cap,
+  const slow_op_t* op);
+/** Compare operator to sort operations in descending order of latency */
+static int slow_op_compare(const void* left, const void* right);
+/** Print percentiles of 'histogram' */
+static void print_histogram(const char* op, const char* size_class,
+  const histogram_t* histogram);
 static void print_usage(const char* program_name);
 
+static command_t g_batch[BATCH_SIZE];
+static replay_command_t g_replay[BATCH_SIZE];
+/* Results of reads, which must not be optimized away */
+static volatile uint64_t g_sink;
+/* State of the generator of synthetic reads */
+static uint64_t g_rand_state = 88172645463325252ULL;
+
+/** Read the raw monotonic clock in nanoseconds */
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** xorshift64 */
+static inline uint64_t rand_u64(void) {
+  g_rand_state ^= g_rand_state << 13;
+  g_rand_state ^= g_rand_state >> 7;
+  g_rand_state ^= g_rand_state << 17;
+  return g_rand_state;
+}
+
+/** Read a cache line of every CACHE_LINE_SIZE bytes of a block */
+static inline uint64_t touch_read(const void* addr, size_t size) {
+  const volatile unsigned char* p = addr;
+  uint64_t sum = 0;
+  size_t i;
+
+  for (i = 0; i < size; i += CACHE_LINE_SIZE) sum += p[i];
+  return sum;
+}
+
+/** Seed of the payload written to the block 'idx' in generation 'gen' */
+static inline uint64_t payload_seed(size_t idx, uint32_t gen) {
+  /* splitmix64 finalizer */
+  uint64_t x = ((uint64_t)idx << 32 | gen) + 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+/** Word 'i' of the payload of 'seed' (distinct for every word) */
+static inline uint64_t payload_word(uint64_t seed, size_t i) {
+  return seed + (uint64_t)i * 0x9E3779B97F4A7C15ULL;
+}
+
+/** Fill 'size' bytes at 'addr' with the payload of 'seed' */
+static inline void payload_fill(void* addr, size_t size, uint64_t seed) {
+  unsigned char* p = addr;
+  size_t i, word_nr = size / sizeof(uint64_t);
+  uint64_t word;
+
+  for (i = 0; i < word_nr; ++i) {
+    word = payload_word(seed, i);
+    memcpy(p + i * sizeof(uint64_t), &word, sizeof(uint64_t));
+  }
+  word = payload_word(seed, word_nr);
+  memcpy(p + word_nr * sizeof(uint64_t), &word, size % sizeof(uint64_t));
+}
+
+/** Find the first byte of 'size' bytes at 'addr' differing from the
+    payload of 'seed' (SIZE_MAX: none) */
+static inline size_t payload_check(const void* addr, size_t size,
+    uint64_t seed) {
+  const unsigned char* p = addr;
+  size_t word_nr = (size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+  size_t i, j, length;
+  uint64_t word, expected;
+
+  for (i = 0; i < word_nr; ++i) {
+    length = size - i * sizeof(uint64_t);
+    if (length > sizeof(uint64_t)) length = sizeof(uint64_t);
+    expected = payload_word(seed, i);
+    word = expected;
+    memcpy(&word, p + i * sizeof(uint64_t), length);
+    if (word == expected) continue;
+    for (j = 0; ((unsigned char*)&word)[j] == ((unsigned char*)&expected)[j];
+         ++j) {
+    }
+    return i * sizeof(uint64_t) + j;
+  }
+  return SIZE_MAX;
+}
+
+/** Calculate the size class (rounded up log2) of 'size' */
+static inline size_t size_class(size_t size) {
+  if (size <= 1) return 0;
+  return 64 - __builtin_clzll(size - 1);
+}
+
 int main(int argc, char* argv[]) {
-  memlog_t* memlog;
+  memlog_stream_t* memlog;
   int allocator;
-  size_t i;
-  enum command_type type;
-  size_t command_nr, idx, size;
-  struct timeval start_tv, end_tv;
-  int64_t elapsed_time;
+  size_t top_nr = DEFAULT_TOP_NR;
+  bool latency_mode = false;
+  bool counter_mode = false;
+  bool touch_mode = false;
+  bool validate_mode = false;
+  bool replay_mode = false;
+  size_t op_nr = 0;
+  uint64_t elapsed;
+  size_t read_nr = 0;
+  double locality = DEFAULT_LOCALITY;
+  double verify_rate = DEFAULT_VERIFY_RATE;
+  bool valid = true;
 
   if (argc < 3) {
     print_usage(argv[0]);
     return EXIT_FAILURE;
   }
 
-  memlog    = memlog_open(argv[1]);
+  memlog    = memlog_stream_open(argv[1]);
   allocator = atoi(argv[2]);
   if (allocator >= ALLOC_NB) {
     fprintf(stderr, "allocator error\n");
     return EXIT_FAILURE;
   }
+  if (argc >= 4) {
+    if (strcmp(argv[3], "-l") == 0) {
+      latency_mode = true;
+      if (argc >= 5) top_nr = strtoul(argv[4], NULL, 10);
+    } else if (strcmp(argv[3], "-c") == 0) {
+      counter_mode = true;
+    } else if (strcmp(argv[3], "-t") == 0) {
+      touch_mode = true;
+      if (argc >= 5) read_nr = strtoul(argv[4], NULL, 10);
+      if (argc >= 6) locality = strtod(argv[5], NULL);
+    } else if (strcmp(argv[3], "-s") == 0) {
+      replay_mode = true;
+    } else if (strcmp(argv[3], "-v") == 0) {
+      validate_mode = true;
+      if (argc >= 5) verify_rate = strtod(argv[4], NULL);
+    } else {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
 
   init_funcs[allocator](memlog->mem_min, memlog->mem_max,
       memlog->block_max, memlog->require_size);
 
-  gettimeofday(&start_tv, NULL);
+  if (latency_mode) {
+    measure_latency(memlog, allocator, top_nr);
+  } else if (counter_mode) {
+    measure_counters(memlog, allocator);
+  } else if (touch_mode) {
+    measure_touch(memlog, allocator, read_nr, locality);
+  } else if (validate_mode) {
+    valid = measure_validate(memlog, allocator, verify_rate);
+  } else if (replay_mode) {
+    elapsed = measure_replay(memlog, allocator, &op_nr);
+    printf("%s %" PRIu64 " us\n", allocator_name[allocator], elapsed / 1000);
+    putchar('\n');
+    printf("operations %zu, %.1f ns/op\n", op_nr,
+      op_nr == 0 ? 0.0 : (double)elapsed / op_nr);
+  } else {
+    printf("%s %" PRId64 " us\n", allocator_name[allocator],
+      measure_total(memlog, allocator) / 1000);
+  }
+  memlog_stream_close(memlog);
 
-  command_nr = memlog->command_nr;
-  for (i = 0; i < command_nr; ++i) {
-    type = memlog->commands[i].type;
-    idx  = memlog->commands[i].idx;
-    size = memlog->commands[i].size;
-    if (command_kind(type) == COMMAND_ALLOCATE) {
-      allocate_funcs[allocator](idx, size);
-    } else if (command_kind(type) == COMMAND_DEALLOCATE) {
-      deallocate_funcs[allocator](idx);
-    } else if (command_kind(type) == COMMAND_REALLOCATE) {
-      reallocate_funcs[allocator](idx, size);
+  return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int64_t measure_total(memlog_stream_t* memlog, int allocator) {
+  command_t command;
+  size_t i, batch_nr;
+  struct timespec start_ts, end_ts;
+  int64_t elapsed_time = 0;
+
+  /* Decoding the memlog is excluded from the measured time */
+  while ((batch_nr = memlog_stream_read(memlog, g_batch, BATCH_SIZE)) > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+    for (i = 0; i < batch_nr; ++i) {
+      command = g_batch[i];
+      if (command_kind(command.type) == COMMAND_ALLOCATE) {
+        allocate_funcs[allocator](command.idx, command.size);
+      } else if (command_kind(command.type) == COMMAND_DEALLOCATE) {
+        deallocate_funcs[allocator](command.idx);
+      } else if (command_kind(command.type) == COMMAND_REALLOCATE) {
+        reallocate_funcs[allocator](command.idx, command.size);
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_ts);
+    elapsed_time +=
+      (int64_t)(end_ts.tv_sec - start_ts.tv_sec) * 1000000000
+      + (end_ts.tv_nsec - start_ts.tv_nsec);
+  }
+  return elapsed_time;
+}
+
+static uint64_t measure_replay(memlog_stream_t* memlog, int allocator,
+    size_t* op_nr) {
+  replay_t replay = replay_funcs[allocator];
+  size_t i, batch_nr, replay_nr;
+  uint64_t start, elapsed = 0;
+  enum command_type kind;
+
+  *op_nr = 0;
+  /* Commands are converted into the compact form outside the measured
+     section, and only allocations, deallocations and reallocations are
+     kept */
+  while ((batch_nr = memlog_stream_read(memlog, g_batch, BATCH_SIZE)) > 0) {
+    replay_nr = 0;
+    for (i = 0; i < batch_nr; ++i) {
+      kind = command_kind(g_batch[i].type);
+      if (kind != COMMAND_ALLOCATE && kind != COMMAND_DEALLOCATE &&
+          kind != COMMAND_REALLOCATE) {
+        continue;
+      }
+      g_replay[replay_nr].kind = kind;
+      g_replay[replay_nr].idx  = (uint32_t)g_batch[i].idx;
+      g_replay[replay_nr].size = g_batch[i].size;
+      replay_nr++;
+    }
+    start = now_ns();
+    replay(g_replay, replay_nr);
+    elapsed += now_ns() - start;
+    *op_nr += replay_nr;
+  }
+  return elapsed;
+}
+
+static void measure_latency(memlog_stream_t* memlog, int allocator,
+    size_t top_nr) {
+  histogram_t* total_histograms[OP_NB];
+  histogram_t* class_histograms[OP_NB][SIZE_CLASS_NB] = {{NULL}};
+  slow_op_t* slow_ops;
+  slow_op_t slow_op;
+  size_t slow_nr = 0;
+  size_t* idx2size;
+  size_t i, batch_nr, sc;
+  command_t command;
+  enum operation op;
+  uint64_t overhead, start, elapsed;
+  uint64_t total_time = 0;
+  char label[32];
+
+  overhead = calibrate_overhead();
+  for (op = 0; op < OP_NB; ++op) total_histograms[op] = histogram_create();
+  slow_ops = calloc(top_nr + 1, sizeof(slow_op_t));
+  /* Sizes of blocks are needed to classify deallocations */
+  idx2size = calloc(memlog->block_max, sizeof(size_t));
+  if (slow_ops == NULL || idx2size == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+
+  while ((batch_nr = memlog_stream_read(memlog, g_batch, BATCH_SIZE)) > 0) {
+    for (i = 0; i < batch_nr; ++i) {
+      command = g_batch[i];
+      if (command_kind(command.type) == COMMAND_ALLOCATE) {
+        op = OP_ALLOCATE;
+        start = now_ns();
+        allocate_funcs[allocator](command.idx, command.size);
+        elapsed = now_ns() - start;
+        idx2size[command.idx] = command.size;
+      } else if (command_kind(command.type) == COMMAND_DEALLOCATE) {
+        op = OP_DEALLOCATE;
+        start = now_ns();
+        deallocate_funcs[allocator](command.idx);
+        elapsed = now_ns() - start;
+        command.size = idx2size[command.idx];
+      } else if (command_kind(command.type) == COMMAND_REALLOCATE) {
+        op = OP_REALLOCATE;
+        start = now_ns();
+        reallocate_funcs[allocator](command.idx, command.size);
+        elapsed = now_ns() - start;
+        idx2size[command.idx] = command.size;
+      } else {
+        continue;
+      }
+      elapsed = elapsed > overhead ? elapsed - overhead : 0;
+      total_time += elapsed;
+
+      histogram_record(total_histograms[op], elapsed);
+      sc = size_class(command.size);
+      if (class_histograms[op][sc] == NULL) {
+        class_histograms[op][sc] = histogram_create();
+      }
+      histogram_record(class_histograms[op][sc], elapsed);
+
+      slow_op.latency = elapsed;
+      slow_op.line    = command.line;
+      slow_op.op      = op;
+      slow_op.idx     = command.idx;
+      slow_op.size    = command.size;
+      push_slow_op(slow_ops, &slow_nr, top_nr, &slow_op);
     }
   }
 
+  printf("%s %" PRIu64 " us\n", allocator_name[allocator], total_time / 1000);
+  printf("timing overhead %" PRIu64 " ns (subtracted)\n", overhead);
+  putchar('\n');
+  printf("%-10s %-10s %10s %8s %8s %8s %10s [ns]\n",
+    "operation", "size", "count", "p50", "p99", "p99.9", "max");
+  for (op = 0; op < OP_NB; ++op) {
+    if (total_histograms[op]->count == 0) continue;
+    print_histogram(op_name[op], "all", total_histograms[op]);
+    for (sc = 0; sc < SIZE_CLASS_NB; ++sc) {
+      if (class_histograms[op][sc] == NULL) continue;
+      snprintf(label, sizeof(label), "<=%zu", (size_t)1 << sc);
+      print_histogram(op_name[op], label, class_histograms[op][sc]);
+      histogram_destroy(class_histograms[op][sc]);
+    }
+    histogram_destroy(total_histograms[op]);
+  }
+
+  qsort(slow_ops, slow_nr, sizeof(slow_op_t), slow_op_compare);
+  putchar('\n');
+  printf("slowest %zu operations\n", slow_nr);
+  printf("%10s %10s %-10s %10s %10s\n",
+    "ns", "line", "operation", "idx", "size");
+  for (i = 0; i < slow_nr; ++i) {
+    printf("%10" PRIu64 " %10zu %-10s %10zu %10zu\n", slow_ops[i].latency,
+      slow_ops[i].line, op_name[slow_ops[i].op], slow_ops[i].idx,
+      slow_ops[i].size);
+  }
+
+  free(idx2size);
+  free(slow_ops);
+}
+
+static void measure_counters(memlog_stream_t* memlog, int allocator) {
+  getsyscall_t getsyscall = getsyscall_funcs[allocator];
+  size_t count[OP_NB]    = {0};
+  uint64_t time[OP_NB]   = {0};
+  size_t syscall[OP_NB]  = {0};
+  long minflt[OP_NB]     = {0};
+  long majflt[OP_NB]     = {0};
+  long vma_delta[OP_NB]  = {0};
+  size_t vma_start, vma_prev, vma_curr, vma_max;
+  size_t syscall_prev = 0, syscall_curr = 0;
+  size_t syscall_diff = 0;
+  uint64_t total_time = 0;
+  size_t i, batch_nr;
+  command_t command;
+  enum operation op;
+  uint64_t start, elapsed;
+  struct rusage usage_prev, usage_curr;
 
-  gettimeofday(&end_tv, NULL);
-  elapsed_time =
-    (int64_t)(end_tv.tv_sec - start_tv.tv_sec) * 1000000
-    + (end_tv.tv_usec - start_tv.tv_usec);
-  printf("%s %" PRId64 " us\n", allocator_name[allocator], elapsed_time);
+  vma_start = vma_prev = vma_max = count_vma();
+  if (getsyscall != NULL) syscall_prev = getsyscall();
+  getrusage(RUSAGE_SELF, &usage_prev);
+
+  while ((batch_nr = memlog_stream_read(memlog, g_batch, BATCH_SIZE)) > 0) {
+    for (i = 0; i < batch_nr; ++i) {
+      command = g_batch[i];
+      if (command_kind(command.type) == COMMAND_ALLOCATE) {
+        op = OP_ALLOCATE;
+        start = now_ns();
+        allocate_funcs[allocator](command.idx, command.size);
+        elapsed = now_ns() - start;
+      } else if (command_kind(command.type) == COMMAND_DEALLOCATE) {
+        op = OP_DEALLOCATE;
+        start = now_ns();
+        deallocate_funcs[allocator](command.idx);
+        elapsed = now_ns() - start;
+      } else if (command_kind(command.type) == COMMAND_REALLOCATE) {
+        op = OP_REALLOCATE;
+        start = now_ns();
+        reallocate_funcs[allocator](command.idx, command.size);
+        elapsed = now_ns() - start;
+      } else {
+        continue;
+      }
+
+      /* Counters are read outside the measured section */
+      getrusage(RUSAGE_SELF, &usage_curr);
+      count[op]++;
+      time[op]   += elapsed;
+      total_time += elapsed;
+      minflt[op] += usage_curr.ru_minflt - usage_prev.ru_minflt;
+      majflt[op] += usage_curr.ru_majflt - usage_prev.ru_majflt;
+
+      /* Mappings are changed only by system calls, so /proc/self/maps
+         is read only after them if the allocator counts them. */
+      if (getsyscall != NULL) {
+        syscall_curr = getsyscall();
+        syscall_diff = syscall_curr - syscall_prev;
+        syscall[op] += syscall_diff;
+        syscall_prev = syscall_curr;
+      }
+      if (getsyscall == NULL || syscall_diff != 0) {
+        vma_curr = count_vma();
+        vma_delta[op] += (long)vma_curr - (long)vma_prev;
+        if (vma_curr > vma_max) vma_max = vma_curr;
+        vma_prev = vma_curr;
+      }
+      /* Faults of the above are not counted */
+      getrusage(RUSAGE_SELF, &usage_prev);
+    }
+  }
+
+  printf("%s %" PRIu64 " us\n", allocator_name[allocator], total_time / 1000);
+  putchar('\n');
+  printf("%-10s %10s %10s %10s %10s %10s %10s\n", "operation",
+    "count", "time[us]", "syscalls", "minflt", "majflt", "VMAs");
+  for (op = 0; op < OP_NB; ++op) {
+    printf("%-10s %10zu %10" PRIu64, op_name[op], count[op], time[op] / 1000);
+    if (getsyscall != NULL) {
+      printf(" %10zu", syscall[op]);
+    } else {
+      printf(" %10s", "-");
+    }
+    printf(" %10ld %10ld %+10ld\n", minflt[op], majflt[op], vma_delta[op]);
+  }
+  putchar('\n');
+  printf("VMAs: start %zu, end %zu, max %zu\n", vma_start, vma_prev, vma_max);
+}
+
+static void measure_touch(memlog_stream_t* memlog, int allocator,
+    size_t read_nr, double locality) {
+  dereference_t dereference = dereference_funcs[allocator];
+  size_t block_max = memlog->block_max;
+  /* Sizes of live blocks and their positions in 'live' */
+  size_t* idx2size = calloc(block_max, sizeof(size_t));
+  size_t* live_pos = malloc(block_max * sizeof(size_t));
+  size_t* live     = malloc(block_max * sizeof(size_t));
+  size_t hot[HOT_NR];
+  size_t hot_pos = 0;
+  size_t live_nr = 0;
+  uint64_t locality_threshold;
+  uint64_t event_count[EVENT_NB];
+  int event_fd[EVENT_NB];
+  size_t op_nr = 0, deref_nr = 0, synthetic_nr = 0;
+  uint64_t write_bytes = 0, read_bytes = 0;
+  uint64_t sum = 0;
+  size_t i, j, batch_nr, idx, size, old_size;
+  unsigned char* addr;
+  command_t command;
+  uint64_t start, elapsed = 0;
+  enum cache_event event;
+
+  if (idx2size == NULL || live_pos == NULL || live == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < block_max; ++i) live_pos[i] = SIZE_MAX;
+  for (i = 0; i < HOT_NR; ++i) hot[i] = SIZE_MAX;
+  locality_threshold = (uint64_t)(locality * (double)UINT64_MAX);
+
+  for (event = 0; event < EVENT_NB; ++event) {
+    event_fd[event] = open_event(cache_event_attr[event].type,
+      cache_event_attr[event].config);
+  }
+
+  while ((batch_nr = memlog_stream_read(memlog, g_batch, BATCH_SIZE)) > 0) {
+    for (event = 0; event < EVENT_NB; ++event) {
+      if (event_fd[event] >= 0) ioctl(event_fd[event], PERF_EVENT_IOC_ENABLE);
+    }
+    start = now_ns();
+    for (i = 0; i < batch_nr; ++i) {
+      command = g_batch[i];
+      idx = command.idx;
+      switch (command_kind(command.type)) {
+      case COMMAND_ALLOCATE:
+        allocate_funcs[allocator](idx, command.size);
+        /* The whole payload is written as a program initializes a block */
+        addr = dereference(idx);
+        memset(addr, (int)idx, command.size);
+        write_bytes += command.size;
+        idx2size[idx] = command.size;
+        live_pos[idx] = live_nr;
+        live[live_nr++] = idx;
+        hot[hot_pos++ & (HOT_NR - 1)] = idx;
+        ++op_nr;
+        break;
+      case COMMAND_DEALLOCATE:
+        deallocate_funcs[allocator](idx);
+        live[live_pos[idx]] = live[--live_nr];
+        live_pos[live[live_nr]] = live_pos[idx];
+        live_pos[idx] = SIZE_MAX;
+        ++op_nr;
+        break;
+      case COMMAND_REALLOCATE:
+        old_size = idx2size[idx];
+        reallocate_funcs[allocator](idx, command.size);
+        /* The extended part is written */
+        if (command.size > old_size) {
+          addr = dereference(idx);
+          memset(addr + old_size, (int)idx, command.size - old_size);
+          write_bytes += command.size - old_size;
+        }
+        idx2size[idx] = command.size;
+        hot[hot_pos++ & (HOT_NR - 1)] = idx;
+        ++op_nr;
+        break;
+      case COMMAND_DEREFERENCE:
+        if (idx >= block_max || live_pos[idx] == SIZE_MAX) continue;
+        sum += touch_read(dereference(idx), idx2size[idx]);
+        read_bytes += idx2size[idx];
+        hot[hot_pos++ & (HOT_NR - 1)] = idx;
+        ++deref_nr;
+        continue;
+      default:
+        continue;
+      }
+
+      /* Synthetic reads of a cache line of a recently used block or of any
+         live block */
+      for (j = 0; j < read_nr && live_nr > 0; ++j) {
+        idx = hot[rand_u64() & (HOT_NR - 1)];
+        if (rand_u64() > locality_threshold || idx == SIZE_MAX ||
+            live_pos[idx] == SIZE_MAX) {
+          idx = live[rand_u64() % live_nr];
+        }
+        size = idx2size[idx];
+        if (size == 0) continue;
+        addr = dereference(idx);
+        sum += addr[rand_u64() % size];
+        ++synthetic_nr;
+      }
+    }
+    elapsed += now_ns() - start;
+    for (event = 0; event < EVENT_NB; ++event) {
+      if (event_fd[event] >= 0) ioctl(event_fd[event], PERF_EVENT_IOC_DISABLE);
+    }
+  }
+  g_sink = sum;
+
+  for (event = 0; event < EVENT_NB; ++event) {
+    event_count[event] = 0;
+    if (event_fd[event] >= 0) {
+      if (read(event_fd[event], &event_count[event], sizeof(uint64_t)) !=
+          sizeof(uint64_t)) {
+        event_count[event] = 0;
+      }
+      close(event_fd[event]);
+    }
+  }
+
+  printf("%s %" PRIu64 " us\n", allocator_name[allocator], elapsed / 1000);
+  putchar('\n');
+  printf("operations %zu, dereferences %zu, synthetic reads %zu\n",
+    op_nr, deref_nr, synthetic_nr);
+  printf("written %" PRIu64 " bytes, dereferenced %" PRIu64 " bytes\n",
+    write_bytes, read_bytes);
+  printf("throughput %.0f ops/s\n",
+    elapsed == 0 ? 0.0 : (double)op_nr * 1e9 / elapsed);
+  if (event_fd[EVENT_CACHE_REFERENCE] >= 0 && event_fd[EVENT_CACHE_MISS] >= 0) {
+    printf("cache references %" PRIu64 ", misses %" PRIu64 " (%.2f %%)\n",
+      event_count[EVENT_CACHE_REFERENCE], event_count[EVENT_CACHE_MISS],
+      event_count[EVENT_CACHE_REFERENCE] == 0 ? 0.0 :
+      100.0 * event_count[EVENT_CACHE_MISS] /
+      event_count[EVENT_CACHE_REFERENCE]);
+  } else {
+    printf("cache references -, misses - (perf events unavailable)\n");
+  }
+  if (event_fd[EVENT_L1D_READ] >= 0 && event_fd[EVENT_L1D_READ_MISS] >= 0) {
+    printf("L1D reads %" PRIu64 ", misses %" PRIu64 " (%.2f %%)\n",
+      event_count[EVENT_L1D_READ], event_count[EVENT_L1D_READ_MISS],
+      event_count[EVENT_L1D_READ] == 0 ? 0.0 :
+      100.0 * event_count[EVENT_L1D_READ_MISS] / event_count[EVENT_L1D_READ]);
+  }
+
+  free(live);
+  free(live_pos);
+  free(idx2size);
+}
+
+static bool measure_validate(memlog_stream_t* memlog, int allocator,
+    double verify_rate) {
+  dereference_t dereference = dereference_funcs[allocator];
+  getmoved_t getmoved = getmoved_funcs[allocator];
+  getsyscall_t getsyscall = getsyscall_funcs[allocator];
+  size_t block_max = memlog->block_max;
+  validation_t validation;
+  /* Positions of live blocks in 'live' */
+  size_t* live_pos = malloc(block_max * sizeof(size_t));
+  size_t* live     = malloc(block_max * sizeof(size_t));
+  size_t live_nr = 0;
+  uint64_t verify_threshold;
+  /* Operations which moved blocks and which did not, both without
+     system calls */
+  size_t moving_nr[OP_NB]      = {0};
+  uint64_t moving_time[OP_NB]  = {0};
+  uint64_t moving_bytes[OP_NB] = {0};
+  size_t still_nr[OP_NB]       = {0};
+  uint64_t still_time[OP_NB]   = {0};
+  size_t syscall_nr[OP_NB]     = {0};
+  size_t moved_prev = 0, moved_curr, moved_diff = 0;
+  size_t syscall_prev = 0, syscall_curr, syscall_diff = 0;
+  uint64_t total_time = 0;
+  size_t i, batch_nr, idx, size, old_size;
+  double copy_time;
+  void* addr;
+  command_t command;
+  enum operation op;
+  uint64_t start, elapsed;
+
+  validation.idx2size   = calloc(block_max, sizeof(size_t));
+  validation.generation = calloc(block_max, sizeof(uint32_t));
+  validation.idx2addr   = calloc(block_max, sizeof(void*));
+  if (validation.idx2size == NULL || validation.generation == NULL ||
+      validation.idx2addr == NULL || live_pos == NULL || live == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  validation.verify_nr       = 0;
+  validation.verify_bytes    = 0;
+  validation.corrupt_nr      = 0;
+  validation.relocated_nr    = 0;
+  validation.relocated_bytes = 0;
+  for (i = 0; i < block_max; ++i) live_pos[i] = SIZE_MAX;
+  verify_threshold = verify_rate >= 1.0 ? UINT64_MAX :
+    (uint64_t)(verify_rate * (double)UINT64_MAX);
+  if (getmoved != NULL) moved_prev = getmoved();
+  if (getsyscall != NULL) syscall_prev = getsyscall();
+
+  while ((batch_nr = memlog_stream_read(memlog, g_batch, BATCH_SIZE)) > 0) {
+    for (i = 0; i < batch_nr; ++i) {
+      command = g_batch[i];
+      idx = command.idx;
+      switch (command_kind(command.type)) {
+      case COMMAND_ALLOCATE:
+        op = OP_ALLOCATE;
+        start = now_ns();
+        allocate_funcs[allocator](idx, command.size);
+        elapsed = now_ns() - start;
+        addr = dereference(idx);
+        payload_fill(addr, command.size,
+          payload_seed(idx, ++validation.generation[idx]));
+        validation.idx2size[idx] = command.size;
+        validation.idx2addr[idx] = addr;
+        live_pos[idx] = live_nr;
+        live[live_nr++] = idx;
+        break;
+      case COMMAND_DEALLOCATE:
+        op = OP_DEALLOCATE;
+        /* Blocks are verified lastly before they are freed */
+        verify_payload(&validation, dereference, idx,
+          validation.idx2size[idx], command.line, "deallocate");
+        start = now_ns();
+        deallocate_funcs[allocator](idx);
+        elapsed = now_ns() - start;
+        validation.idx2size[idx] = 0;
+        live[live_pos[idx]] = live[--live_nr];
+        live_pos[live[live_nr]] = live_pos[idx];
+        live_pos[idx] = SIZE_MAX;
+        break;
+      case COMMAND_REALLOCATE:
+        op = OP_REALLOCATE;
+        old_size = validation.idx2size[idx];
+        start = now_ns();
+        reallocate_funcs[allocator](idx, command.size);
+        elapsed = now_ns() - start;
+        /* The block itself may be moved by reallocation, which is not
+           counted as a move by compaction */
+        addr = dereference(idx);
+        validation.idx2addr[idx] = addr;
+        verify_payload(&validation, dereference, idx,
+          old_size < command.size ? old_size : command.size, command.line,
+          "reallocate");
+        payload_fill(addr, command.size,
+          payload_seed(idx, ++validation.generation[idx]));
+        validation.idx2size[idx] = command.size;
+        break;
+      case COMMAND_DEREFERENCE:
+        if (idx >= block_max || live_pos[idx] == SIZE_MAX) continue;
+        verify_payload(&validation, dereference, idx,
+          validation.idx2size[idx], command.line, "dereference");
+        continue;
+      default:
+        continue;
+      }
+
+      total_time += elapsed;
+      if (getmoved != NULL) {
+        moved_curr = getmoved();
+        moved_diff = moved_curr - moved_prev;
+        moved_prev = moved_curr;
+      }
+      if (getsyscall != NULL) {
+        syscall_curr = getsyscall();
+        syscall_diff = syscall_curr - syscall_prev;
+        syscall_prev = syscall_curr;
+      }
+      /* System calls would dominate the time of copies */
+      if (syscall_diff != 0) {
+        syscall_nr[op]++;
+        moving_bytes[op] += moved_diff;
+      } else if (moved_diff != 0) {
+        moving_nr[op]++;
+        moving_time[op]  += elapsed;
+        moving_bytes[op] += moved_diff;
+      } else {
+        still_nr[op]++;
+        still_time[op] += elapsed;
+      }
+
+      /* Sampled verification of a random live block */
+      if (live_nr > 0 && rand_u64() < verify_threshold) {
+        idx = live[rand_u64() % live_nr];
+        verify_payload(&validation, dereference, idx,
+          validation.idx2size[idx], command.line, "sampled");
+      }
+    }
+  }
+
+  printf("%s %" PRIu64 " us\n", allocator_name[allocator], total_time / 1000);
+  putchar('\n');
+  printf("verified %zu blocks (%" PRIu64 " bytes), corrupted %zu\n",
+    validation.verify_nr, validation.verify_bytes, validation.corrupt_nr);
+  printf("blocks found at a new address %zu (%" PRIu64 " bytes)\n",
+    validation.relocated_nr, validation.relocated_bytes);
+  putchar('\n');
+  if (getmoved == NULL) {
+    printf("moved bytes - (the allocator does not count them)\n");
+  } else {
+    /* The time of copies is estimated as the excess over the mean time of
+       the operations of the same type which moved nothing. Operations
+       issuing system calls are only counted in 'syscall'. When the copies
+       are hidden by the noise of the other work, the excess is not
+       positive and no estimate is given. */
+    printf("%-10s %12s %10s %10s %10s %10s %10s %10s %10s\n", "operation",
+      "moved[B]", "syscall", "moving", "time[us]", "still", "time[us]",
+      "copy[us]", "MB/s");
+    for (op = 0; op < OP_NB; ++op) {
+      size = moving_bytes[op];
+      copy_time = (double)moving_time[op];
+      if (still_nr[op] > 0) {
+        copy_time -= (double)moving_nr[op] * still_time[op] / still_nr[op];
+      }
+      printf("%-10s %12zu %10zu %10zu %10" PRIu64 " %10zu %10" PRIu64,
+        op_name[op], size, syscall_nr[op], moving_nr[op],
+        moving_time[op] / 1000, still_nr[op], still_time[op] / 1000);
+      if (moving_nr[op] > 0 && copy_time > 0) {
+        printf(" %10.1f %10.1f\n", copy_time / 1000, size * 1e3 / copy_time);
+      } else {
+        printf(" %10s %10s\n", "n/a", "n/a");
+      }
+    }
+  }
+
+  free(live);
+  free(live_pos);
+  free(validation.idx2addr);
+  free(validation.generation);
+  free(validation.idx2size);
+  return validation.corrupt_nr == 0;
+}
+
+static void verify_payload(validation_t* validation, dereference_t dereference,
+    size_t idx, size_t size, size_t line, const char* when) {
+  void* addr = dereference(idx);
+  size_t offset;
+
+  if (addr != validation->idx2addr[idx]) {
+    validation->relocated_nr++;
+    validation->relocated_bytes += validation->idx2size[idx];
+    validation->idx2addr[idx] = addr;
+  }
+  offset = payload_check(addr, size,
+    payload_seed(idx, validation->generation[idx]));
+  validation->verify_nr++;
+  validation->verify_bytes += size;
+  if (offset == SIZE_MAX) return;
+  if (validation->corrupt_nr++ < CORRUPTION_REPORT_NR) {
+    fprintf(stderr, "line %zu: block %zu corrupted at byte %zu of %zu (%s)\n",
+      line, idx, offset, size, when);
+  }
+}
+
+static int open_event(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = type;
+  attr.config         = config;
+  attr.disabled       = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv     = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static size_t count_vma(void) {
+  /* stdio is not used not to allocate memory while measuring */
+  static char buffer[65536];
+  ssize_t read_size;
+  size_t vma_nr = 0;
+  ssize_t i;
+  int fd = open("/proc/self/maps", O_RDONLY);
+
+  if (fd < 0) return 0;
+  while ((read_size = read(fd, buffer, sizeof(buffer))) > 0) {
+    for (i = 0; i < read_size; ++i) {
+      if (buffer[i] == '\n') vma_nr++;
+    }
+  }
+  close(fd);
+  return vma_nr;
+}
+
+static uint64_t calibrate_overhead(void) {
+  histogram_t* histogram = histogram_create();
+  uint64_t start, overhead;
+  size_t i;
+
+  for (i = 0; i < CALIBRATION_NR; ++i) {
+    start = now_ns();
+    histogram_record(histogram, now_ns() - start);
+  }
+  /* The median is robust against interrupts */
+  overhead = histogram_percentile(histogram, 50.0);
+  histogram_destroy(histogram);
+  return overhead;
+}
+
+static void push_slow_op(slow_op_t* heap, size_t* nr, size_t cap,
+    const slow_op_t* op) {
+  size_t i, child;
+  slow_op_t tmp;
+
+  if (cap == 0) return;
+  if (*nr < cap) {
+    /* sift up */
+    i = (*nr)++;
+    heap[i] = *op;
+    while (i > 0 && heap[(i - 1) / 2].latency > heap[i].latency) {
+      tmp = heap[i];
+      heap[i] = heap[(i - 1) / 2];
+      heap[(i - 1) / 2] = tmp;
+      i = (i - 1) / 2;
+    }
+    return;
+  }
+  if (op->latency <= heap[0].latency) return;
+
+  /* Replace the fastest one and sift down */
+  heap[0] = *op;
+  i = 0;
+  while ((child = 2 * i + 1) < *nr) {
+    if (child + 1 < *nr && heap[child + 1].latency < heap[child].latency) {
+      ++child;
+    }
+    if (heap[i].latency <= heap[child].latency) break;
+    tmp = heap[i];
+    heap[i] = heap[child];
+    heap[child] = tmp;
+    i = child;
+  }
+}
+
+static int slow_op_compare(const void* left, const void* right) {
+  uint64_t left_latency  = ((const slow_op_t*)left)->latency;
+  uint64_t right_latency = ((const slow_op_t*)right)->latency;
+
+  if (left_latency > right_latency) {
+    return -1;
+  } else if (left_latency == right_latency) {
+    return 0;
+  } else {
+    return 1;
+  }
+}
 
-  return EXIT_SUCCESS;
+static void print_histogram(const char* op, const char* size_class,
+    const histogram_t* histogram) {
+  printf("%-10s %-10s %10" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64
+    " %10" PRIu64 "\n", op, size_class, histogram->count,
+    histogram_percentile(histogram, 50.0),
+    histogram_percentile(histogram, 99.0),
+    histogram_percentile(histogram, 99.9),
+    histogram->max);
 }
 
 static void print_usage(const char* program_name) {
   int i;
-  printf("%s <memlog file> <allocator number>\n", program_name);
+  printf("%s <memlog file> <allocator number> "
+    "[-l [N] | -c | -t [R [L]] | -v [P] | -s]\n", program_name);
+  printf("With '-l', the latency of each operation is measured and ");
+  printf("the N slowest operations are reported.\n");
+  printf("With '-c', system calls, page faults and VMAs are counted ");
+  printf("for each operation type.\n");
+  printf("With '-t', the payload of blocks is written on allocation, ");
+  printf("'d' commands read blocks,\nand R reads of a random byte follow ");
+  printf("each operation, which hit one of the\n%d recently used blocks ",
+    HOT_NR);
+  printf("with the probability L (default %.1f).\n", DEFAULT_LOCALITY);
+  printf("With '-v', blocks are filled with patterns and verified before ");
+  printf("being freed or reallocated,\non 'd' commands and at random with ");
+  printf("the probability P (default %.2f) after each\noperation, and ",
+    DEFAULT_VERIFY_RATE);
+  printf("the bytes and time taken to move blocks are reported.\n");
+  printf("With '-s', a pre-decoded trace is replayed by a loop specialized ");
+  printf("for the allocator,\nwhich calls its functions without the ");
+  printf("tables of function pointers.\n");
   putchar('\n');
   printf(" Number |        Allocator Name \n");
   printf("--------+-----------------------\n");
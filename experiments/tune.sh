@@ -0,0 +1,192 @@
+#!/bin/sh
+# Tune compile-time parameters of Multiheap-fit and Virtual Multiheap-fit.
+# Random configurations of the macros are built as variants and compared on
+# a memlog with bench.sh by successive halving: every round measures the
+# surviving variants with twice as many runs as the previous round and
+# keeps the better half by the weighted score
+#   w * time / time_default + (1 - w) * memory / memory_default.
+# The default is ranked in every round, and it is the result unless a
+# variant beats it in the last round.
+
+usage() {
+  cat <<EOF
+Usage: $0 [options] <memlog>
+
+Options:
+  -a <number>     allocator measured (default: 0, Multiheap-fit)
+  -k "<M>=<v>,.." values of a macro (repeatable; default: all macros below
+                  except COPYLESS)
+  -N <N>          number of configurations including the default (default: 16)
+  -w <weight>     weight of time in [0, 1] (default: 0.5)
+  -M rss|self     memory metric, see memory_test.out -k (default: rss)
+  -n <N>          timed runs of each variant in the first round (default: 2)
+  -s <seed>       seed of the random configurations (default: 1)
+  -c <cpu>        CPU to pin runs with taskset, or "none" (default: 0)
+  -d <dir>        work directory for the variants (default: tune.d)
+
+Macros:
+$(echo "$default_knobs" | tr ' ' '\n' | sed 's/^/  /')
+  COPYLESS=0,1 (moved blocks lose their contents; searched only with -k)
+EOF
+  exit 1
+}
+
+default_knobs="POOL_NUM_THRESHOLD=0,4,8,16,32,64
+GARBAGE_NUM_MAX=0,3,6,12,24
+EXTRA_PAGE_RATE=1,9/8,5/4,3/2,2
+POOL_PAGE_NUM=1,2,4,8,16
+SIZE_CLASS_CONST=0.08,0.1232,0.18,0.25,0.35
+FIXED_LENGTH_INTEGER=0,1"
+
+allocator=0
+knobs=""
+configs=16
+weight=0.5
+memory=rss
+repeat=2
+seed=1
+cpu=0
+work=tune.d
+
+while getopts a:k:N:w:M:n:s:c:d: opt; do
+  case $opt in
+    a) allocator=$OPTARG ;;
+    k) knobs="$knobs $OPTARG" ;;
+    N) configs=$OPTARG ;;
+    w) weight=$OPTARG ;;
+    M) memory=$OPTARG ;;
+    n) repeat=$OPTARG ;;
+    s) seed=$OPTARG ;;
+    c) cpu=$OPTARG ;;
+    d) work=$OPTARG ;;
+    *) usage ;;
+  esac
+done
+shift $((OPTIND - 1))
+[ $# -eq 1 ] || usage
+trace=$1
+[ -z "$knobs" ] && knobs=$default_knobs
+
+here=$(cd "$(dirname "$0")" && pwd)
+mkdir -p "$work"
+work=$(cd "$work" && pwd)
+
+# Build the libraries with the flags in $2 and link the experiment
+# programs with them into the directory $1
+build() {
+  mkdir -p "$1"
+  echo "$2" > "$1/flags"
+  make -s -C "$here/../multiheap_fit" OBJ_DIR="$1/mf_obj" \
+    LIB_TARGET="$1/multiheap_fit.a" \
+    CFLAGS="-O3 -I./src -I./include -Wall -MMD -MP -DNDEBUG $2" &&
+  make -s -C "$here/../virtual_multiheap_fit/allocator" \
+    OBJ_DIR="$1/vmf_obj" LIB_TARGET="$1/virtual_multiheap_fit.a" \
+    CFLAGS="-O3 -I./src -Wall -MMD -MP -DNDEBUG -I./include $2" &&
+  make -s -C "$here" LIB_MF="$1/multiheap_fit.a" \
+    LIB_VMF="$1/virtual_multiheap_fit.a" TIME_EXE="$1/time_test.out" \
+    MEMORY_EXE="$1/memory_test.out" "$1/time_test.out" "$1/memory_test.out"
+}
+
+# Print $configs lines of -D flags, the first one being the defaults
+echo "$knobs" | tr ' ' '\n' | awk -v n="$configs" -v seed="$seed" '
+  /=/ {
+    split($0, kv, "=")
+    name[++k] = kv[1]
+    nr[k] = split(kv[2], tmp, ",")
+    for (i = 1; i <= nr[k]; ++i) value[k, i] = tmp[i]
+  }
+  END {
+    srand(seed)
+    print ""
+    seen[""] = 1
+    for (c = 1; c < n && attempt < 100 * n; ++attempt) {
+      flags = ""
+      for (i = 1; i <= k; ++i) {
+        flags = flags " -D" name[i] "=" value[i, int(rand() * nr[i]) + 1]
+      }
+      flags = substr(flags, 2)
+      if (flags in seen) continue
+      seen[flags] = 1
+      print flags
+      ++c
+    }
+  }' > "$work/configs"
+
+# Variants other than the default which are still candidates
+survivors=""
+default_built=0
+i=0
+while IFS= read -r flags; do
+  echo "build: v$i $flags" >&2
+  if build "$work/v$i" "$flags" >/dev/null; then
+    [ $i -eq 0 ] && default_built=1 || survivors="$survivors v$i"
+  else
+    echo "skip: v$i does not build" >&2
+  fi
+  i=$((i + 1))
+done < "$work/configs"
+if [ $default_built -eq 0 ]; then
+  echo "the default configuration does not build" >&2
+  exit 1
+fi
+
+round=0
+runs=$repeat
+while :; do
+  # The default is always measured as the reference of the scores
+  variants="-b v0=$work/v0"
+  for v in $survivors; do
+    variants="$variants -b $v=$work/$v"
+  done
+  [ $round -eq 0 ] && metrics="time memory" || metrics=time
+  echo "round $round: $(echo $survivors | wc -w) variant(s) and the default," \
+    "$runs run(s)" >&2
+  "$here/bench.sh" -a "$allocator" -t "$trace" -m "$metrics" -n "$runs" \
+    -w 1 -c "$cpu" -o "$work/round$round" $variants 2>/dev/null
+
+  # Memory does not change between runs, so it is taken from round 0
+  awk -F, -v weight="$weight" -v memory="peak_$memory" \
+    -v survivors="v0 $survivors" '
+    BEGIN { n = split(survivors, s, " ") }
+    FNR == 1 { next }
+    NR == FNR { if ($4 == memory) mem[$1] = $6; next }
+    $4 == "time_us" { time[$1] = $6 }
+    END {
+      if (!(("v0") in time) || mem["v0"] == 0) exit 1
+      for (i = 1; i <= n; ++i) {
+        v = s[i]
+        # Variants which failed (e.g. size classes too small) are last
+        if (!(v in time) || !(v in mem)) { printf "%s inf - -\n", v; continue }
+        t = time[v] / time["v0"]
+        m = mem[v] / mem["v0"]
+        printf "%s %.6f %.4f %.4f\n", v, weight * t + (1 - weight) * m, t, m
+      }
+    }' "$work/round0.csv" "$work/round$round.csv" > "$work/scores" || {
+    echo "the default configuration cannot be measured" >&2
+    exit 1
+  }
+  sort -k2,2g "$work/scores" > "$work/round$round.scores"
+  sed "s/^/round $round: /" "$work/round$round.scores" >&2
+
+  count=$(echo $survivors | wc -w)
+  [ "$count" -le 1 ] && break
+  keep=$(((count + 1) / 2))
+  survivors=$(awk '$1 != "v0"' "$work/round$round.scores" | head -n "$keep" |
+    awk '$2 != "inf" { printf "%s ", $1 }')
+  [ -z "$survivors" ] && break
+  round=$((round + 1))
+  runs=$((runs * 2))
+done
+
+# sort puts v0 first among equal scores, so ties are left to the default
+best=$(awk 'NR == 1 { print $1 }' \
+  "$work/round$round.scores")
+cp "$work/$best/flags" "$work/best.flags"
+if [ "$best" = v0 ]; then
+  echo "# no variant beats the default configuration"
+  exit 0
+fi
+awk -v w="$weight" 'NR == 1 {
+    printf "# best of %s: time %.3f, memory %.3f of the default (score %.4f, weight %s)\n", $1, $3, $4, $2, w
+  }' "$work/round$round.scores"
+echo "CFLAGS += $(cat "$work/best.flags")"
@@ -20,20 +20,85 @@
   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
+#define _GNU_SOURCE /* syscall */
 #include <ctype.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
+#include <inttypes.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #include "internal.h"
 #include "instruction_counter.h"
 
+/* State of the perf backend, which is used if 'g_perf_fd' is valid */
+static int g_perf_fd = -1;
+static uint64_t g_perf_start;
+static uint64_t g_perf_bias;
+static bool g_perf_initializing = false;
+static char g_perf_tag_name[32] = "COUNT";
+
+/**
+ * Open a counter of this thread in user space
+ * @param type    PERF_TYPE_*
+ * @param config  event of the type
+ * @return file descriptor, or -1 if the event is unavailable
+ */
+static int perf_open(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = type;
+  attr.config         = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv     = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+    PERF_FLAG_FD_CLOEXEC);
+}
+
+/** Read the counter of the perf backend */
+static uint64_t perf_read(void) {
+  uint64_t value;
+
+  if (read(g_perf_fd, &value, sizeof(value)) != sizeof(value)) {
+    perror("read perf counter");
+    exit(EXIT_FAILURE);
+  }
+  return value;
+}
+
+/**
+ * Start the perf backend. 'inst_counter.out' only selects it when the
+ * hardware counter is available, so it is an error here: no other event
+ * counts instructions.
+ */
+static void perf_init(void) {
+  g_perf_fd = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+  if (g_perf_fd < 0) {
+    perror("perf_event_open");
+    fprintf(stderr, "error  no hardware instruction counter; count with "
+      "'inst_counter.out -s' instead\n");
+    exit(EXIT_FAILURE);
+  }
+  ioctl(g_perf_fd, PERF_EVENT_IOC_RESET, 0);
+  ioctl(g_perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+  g_perf_initializing = true;
+}
+
 void __attribute__((optimize("0"))) instruction_count_init(void) {
+  const char* backend = getenv(BACKEND_ENV);
   int size;
 
-  size = write(PIPE_FD, INIT_STRING, sizeof(INIT_STRING));
-  if (size != sizeof(INIT_STRING)) exit(EXIT_FAILURE);
+  if (backend != NULL && strcmp(backend, PERF_BACKEND) == 0) {
+    perf_init();
+  } else {
+    size = write(PIPE_FD, INIT_STRING, sizeof(INIT_STRING));
+    if (size != sizeof(INIT_STRING)) exit(EXIT_FAILURE);
+  }
 
   instruction_count_start();
   instruction_count_end();
@@ -61,6 +126,11 @@ void instruction_count_set_string(const char* str) {
     buf[i] = '\0';
   }
 
+  if (g_perf_fd >= 0) {
+    snprintf(g_perf_tag_name, sizeof(g_perf_tag_name), "%s", buf);
+    return;
+  }
+
   snprintf(out_str, sizeof(out_str), "%s%s", NAME_STRING, buf);
 
   size = write(PIPE_FD, out_str, sizeof(NAME_STRING) - 1 + i);
@@ -70,13 +140,32 @@ void instruction_count_set_string(const char* str) {
 void __attribute__((optimize("0"))) instruction_count_start(void) {
   int size;
 
+  if (g_perf_fd >= 0) {
+    g_perf_start = perf_read();
+    return;
+  }
+
   size = write(PIPE_FD, START_STRING, sizeof(START_STRING));
   if (size != sizeof(START_STRING)) exit(EXIT_FAILURE);
 }
 
 void __attribute__((optimize("0"))) instruction_count_end(void) {
+  uint64_t count;
   int size;
 
+  if (g_perf_fd >= 0) {
+    /* The same output as inst_counter.out in the single-step mode */
+    count = perf_read() - g_perf_start;
+    if (g_perf_initializing) {
+      g_perf_initializing = false;
+      g_perf_bias = count;
+    } else {
+      fprintf(stderr, "%s\t%8" PRIu64 "\n", g_perf_tag_name,
+        count > g_perf_bias ? count - g_perf_bias : 0);
+    }
+    return;
+  }
+
   size = write(PIPE_FD, END_STRING, sizeof(END_STRING));
   if (size != sizeof(END_STRING)) exit(EXIT_FAILURE);
 }
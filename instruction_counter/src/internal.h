@@ -32,4 +32,11 @@
 #define START_STRING "start"
 #define END_STRING   "end"
 
+/* Environment variable selecting the backend of the measured program */
+#define BACKEND_ENV  "INSTRUCTION_COUNTER_BACKEND"
+#define PERF_BACKEND "perf"
+
+/* Bias before instruction_count_init measures it */
+#define BIAS_INIT_VALUE 0xdeadbeefull
+
 #endif /* INTERNAL_H__ */
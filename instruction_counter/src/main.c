@@ -20,6 +20,7 @@
   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
+#define _GNU_SOURCE /* getopt, setenv, syscall */
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
@@ -31,15 +32,51 @@
 #include <sys/wait.h>
 #include <sys/user.h>
 #include <sys/select.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include "internal.h"
 #include "instruction_counter.h"
+#include "profile.h"
 
 #define READ_IDX  0
 #define WRITE_IDX 1
-#define BIAS_INIT_VALUE 0xdeadbeefull
+/* Lines printed per function in the profile */
+#define PROFILE_LINE_MAX 10
+
+/** Whether the hardware counter of user-space instructions can be opened,
+    with the attributes used by the perf backend */
+static bool has_instruction_counter(void) {
+  struct perf_event_attr attr;
+  int fd;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = PERF_TYPE_HARDWARE;
+  attr.config         = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv     = 1;
+  attr.disabled       = 1;
+  fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  if (fd < 0) return false;
+  close(fd);
+  return true;
+}
+
+static void print_usage(const char* program_name) {
+  fprintf(stderr, "usage  %s [-s] [-p] program [program args]\n",
+    program_name);
+  fprintf(stderr, "  -s  count by single-stepping with ptrace (exact but "
+    "slow)\n");
+  fprintf(stderr, "      instead of the performance counter of the program "
+    "itself\n");
+  fprintf(stderr, "      (selected anyway if no hardware counter is "
+    "available)\n");
+  fprintf(stderr, "  -p  print the instructions per function and source "
+    "line (implies -s)\n");
+}
 
-int main(int argc, char* argv[], char* envp[]) {
+int main(int argc, char* argv[]) {
   int pid, status;
   fd_set fds;
   struct timeval t;
@@ -52,13 +89,60 @@ int main(int argc, char* argv[], char* envp[]) {
   char buffer[256];
   char tag_name[256];
   int size;
+  bool single_step = false;
+  profile_t* profile = NULL;
+  /* Instructions of instruction_count_start/end measured at init */
+  profile_t* bias_profile = NULL;
+  uint64_t range_nr = 0;
+  struct user_regs_struct regs;
+  int opt;
 
   snprintf(tag_name, sizeof(tag_name), "COUNT");
 
-  if (argc <= 1) {
-    fprintf(stderr, "usage  %s program [program args]\n", argv[0]);
+  /* Options of the measured program are not parsed */
+  while ((opt = getopt(argc, argv, "+sp")) != -1) {
+    switch (opt) {
+    case 's': single_step = true; break;
+    case 'p':
+      single_step = true;
+      if (profile == NULL) {
+        profile = profile_create();
+        bias_profile = profile_create();
+      }
+      if (profile == NULL || bias_profile == NULL) {
+        perror("profile_create");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    default:
+      print_usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (optind >= argc) {
+    print_usage(argv[0]);
     exit(EXIT_FAILURE);
   }
+  argv += optind - 1;
+
+  /* Only the hardware counter counts instructions */
+  if (!single_step && !has_instruction_counter()) {
+    fprintf(stderr, "warning  no hardware instruction counter; counting "
+      "by single-stepping\n");
+    single_step = true;
+  }
+  if (!single_step) {
+    /* The program counts its instructions by itself through
+       perf_event_open, so it neither is traced nor needs the pipe */
+    if (setenv(BACKEND_ENV, PERF_BACKEND, 1) < 0) {
+      perror("setenv");
+      exit(EXIT_FAILURE);
+    }
+    execve(argv[1], argv + 1, environ);
+    perror("execve");
+    exit(EXIT_FAILURE);
+  }
+  unsetenv(BACKEND_ENV);
 
   if (pipe(pipe_child2parent) < 0) {
     perror("pipe child2parent failed");
@@ -78,7 +162,7 @@ int main(int argc, char* argv[], char* envp[]) {
     close(pipe_child2parent[WRITE_IDX]);
 
     ptrace(PTRACE_TRACEME, 0, NULL, NULL);
-    execve(argv[1], argv + 1, envp);
+    execve(argv[1], argv + 1, environ);
     perror("execve");
     exit(EXIT_FAILURE);
   }
@@ -110,6 +194,9 @@ int main(int argc, char* argv[], char* envp[]) {
               iteration_count - counter_bias);
           }
           fflush(stderr);
+          range_nr++;
+          /* Mappings are taken while the process is alive */
+          if (profile != NULL) profile_update_maps(profile, pid);
         } else {
           is_initializing = false;
           counter_bias = iteration_count;
@@ -123,6 +210,11 @@ int main(int argc, char* argv[], char* envp[]) {
     }
 
     if (is_counting) {
+      /* The instruction at RIP is executed by the next step */
+      if (profile != NULL &&
+          ptrace(PTRACE_GETREGS, pid, NULL, &regs) == 0) {
+        profile_record(is_initializing ? bias_profile : profile, regs.rip);
+      }
       ptrace(PTRACE_SINGLESTEP, pid, NULL, NULL);
       iteration_count++;
     } else {
@@ -130,6 +222,14 @@ int main(int argc, char* argv[], char* envp[]) {
     }
   }
 
+  if (profile != NULL) {
+    /* Each range executes the instrumentation measured as the bias, which
+       is not counted in the printed counts either */
+    profile_subtract(profile, bias_profile, range_nr);
+    profile_print(profile, stderr, PROFILE_LINE_MAX);
+    profile_destroy(profile);
+    profile_destroy(bias_profile);
+  }
   return EXIT_SUCCESS;
 
 fork_failed:
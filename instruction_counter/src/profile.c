@@ -0,0 +1,603 @@
+/*
+  Instruction Counter is a counter counting  number of instructions
+  by `ptrace` system call
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#define _GNU_SOURCE /* popen, strdup, mkstemp */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <elf.h>
+
+#include "profile.h"
+
+/* Initial capacity of the hash table (power of 2) */
+#define TABLE_INIT_CAPACITY 4096
+/* Name of unknown functions and lines */
+#define UNKNOWN_NAME "??"
+
+/* Count of an address. 'rip' is 0 in empty slots of the hash table. */
+typedef struct {
+  uint64_t rip;
+  uint64_t count;
+} rip_count_t;
+
+/* Executable mapping of the traced process */
+typedef struct {
+  uint64_t start;
+  uint64_t end;
+  uint64_t offset;
+  char* path;
+} map_t;
+
+/* Maximum number of PLT sections of an object */
+#define PLT_MAX 4
+/* Name of the code in PLT sections */
+#define PLT_NAME "[plt]"
+
+/* Function in an ELF symbol table */
+typedef struct {
+  uint64_t value;
+  uint64_t size;
+  char* name;
+} symbol_t;
+
+/* Mapped file whose symbols are loaded */
+typedef struct {
+  const char* path;
+  const char* name;
+  symbol_t* symbols;
+  size_t symbol_nr;
+  /* PT_LOAD segments to convert file offsets into virtual addresses */
+  Elf64_Phdr* loads;
+  size_t load_nr;
+  /* Ranges of the stubs in .plt, .plt.got and .plt.sec, which are not
+     covered by symbols */
+  uint64_t plt_begin[PLT_MAX];
+  uint64_t plt_end[PLT_MAX];
+  size_t plt_nr;
+} object_t;
+
+/* Instructions attributed to a source line of a function */
+typedef struct {
+  const char* object;
+  const char* function;
+  char* line;
+  uint64_t count;
+} site_t;
+
+/* Sites of a function, which are 'sites[begin, end)' */
+typedef struct {
+  size_t begin;
+  size_t end;
+  uint64_t count;
+} function_t;
+
+struct profile {
+  rip_count_t* table;
+  size_t capacity;
+  size_t used;
+  uint64_t total;
+  /* Instructions removed by 'profile_subtract', and those to remove which
+     were not recorded in this profile */
+  uint64_t excluded;
+  uint64_t unmatched;
+  map_t* maps;
+  size_t map_nr;
+};
+
+static void* xmalloc(size_t size) {
+  void* ptr = malloc(size);
+  if (ptr == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+static inline size_t hash_rip(uint64_t rip, size_t capacity) {
+  return (size_t)((rip * 0x9e3779b97f4a7c15ull) >> 32) & (capacity - 1);
+}
+
+profile_t* profile_create(void) {
+  profile_t* profile = calloc(1, sizeof(profile_t));
+
+  if (profile == NULL) return NULL;
+  profile->capacity = TABLE_INIT_CAPACITY;
+  profile->table = calloc(profile->capacity, sizeof(rip_count_t));
+  if (profile->table == NULL) {
+    free(profile);
+    return NULL;
+  }
+  return profile;
+}
+
+static void free_maps(profile_t* profile) {
+  size_t i;
+
+  for (i = 0; i < profile->map_nr; ++i) free(profile->maps[i].path);
+  free(profile->maps);
+  profile->maps = NULL;
+  profile->map_nr = 0;
+}
+
+void profile_destroy(profile_t* profile) {
+  if (profile == NULL) return;
+  free_maps(profile);
+  free(profile->table);
+  free(profile);
+}
+
+/** Double the hash table */
+static void grow_table(profile_t* profile) {
+  rip_count_t* old = profile->table;
+  size_t old_capacity = profile->capacity;
+  size_t i, j;
+
+  profile->capacity *= 2;
+  profile->table = calloc(profile->capacity, sizeof(rip_count_t));
+  if (profile->table == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < old_capacity; ++i) {
+    if (old[i].rip == 0) continue;
+    j = hash_rip(old[i].rip, profile->capacity);
+    while (profile->table[j].rip != 0) j = (j + 1) & (profile->capacity - 1);
+    profile->table[j] = old[i];
+  }
+  free(old);
+}
+
+void profile_record(profile_t* profile, uint64_t rip) {
+  size_t i = hash_rip(rip, profile->capacity);
+
+  while (profile->table[i].rip != rip) {
+    if (profile->table[i].rip == 0) {
+      profile->table[i].rip = rip;
+      if (++profile->used * 2 > profile->capacity) {
+        grow_table(profile);
+        i = hash_rip(rip, profile->capacity);
+        while (profile->table[i].rip != rip) {
+          i = (i + 1) & (profile->capacity - 1);
+        }
+      }
+      break;
+    }
+    i = (i + 1) & (profile->capacity - 1);
+  }
+  profile->table[i].count++;
+  profile->total++;
+}
+
+/** Slot of 'rip', or NULL if it is not recorded */
+static rip_count_t* find_rip(const profile_t* profile, uint64_t rip) {
+  size_t i = hash_rip(rip, profile->capacity);
+
+  while (profile->table[i].rip != rip) {
+    if (profile->table[i].rip == 0) return NULL;
+    i = (i + 1) & (profile->capacity - 1);
+  }
+  return &profile->table[i];
+}
+
+void profile_subtract(profile_t* profile, const profile_t* other,
+    uint64_t times) {
+  rip_count_t* entry;
+  uint64_t removed;
+  size_t i;
+
+  for (i = 0; i < other->capacity; ++i) {
+    if (other->table[i].rip == 0) continue;
+    entry = find_rip(profile, other->table[i].rip);
+    removed = other->table[i].count * times;
+    if (entry == NULL) {
+      profile->unmatched += removed;
+      continue;
+    }
+    if (removed > entry->count) {
+      profile->unmatched += removed - entry->count;
+      removed = entry->count;
+    }
+    entry->count -= removed;
+    profile->total -= removed;
+    profile->excluded += removed;
+  }
+}
+
+void profile_update_maps(profile_t* profile, pid_t pid) {
+  char path[64];
+  char line[4096];
+  char perms[8];
+  unsigned long long start, end, offset;
+  int name_pos;
+  size_t capacity = 0;
+  FILE* fp;
+
+  snprintf(path, sizeof(path), "/proc/%d/maps", (int)pid);
+  fp = fopen(path, "r");
+  if (fp == NULL) return;
+  free_maps(profile);
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    name_pos = 0;
+    if (sscanf(line, "%llx-%llx %7s %llx %*s %*s %n", &start, &end, perms,
+          &offset, &name_pos) < 4 || perms[2] != 'x') {
+      continue;
+    }
+    line[strcspn(line, "\n")] = '\0';
+    if (profile->map_nr == capacity) {
+      capacity = capacity == 0 ? 16 : capacity * 2;
+      profile->maps = realloc(profile->maps, capacity * sizeof(map_t));
+      if (profile->maps == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+    }
+    profile->maps[profile->map_nr].start  = start;
+    profile->maps[profile->map_nr].end    = end;
+    profile->maps[profile->map_nr].offset = offset;
+    profile->maps[profile->map_nr].path   =
+      strdup(name_pos > 0 && line[name_pos] != '\0' ? line + name_pos : "");
+    profile->map_nr++;
+  }
+  fclose(fp);
+}
+
+static int compare_symbol(const void* a, const void* b) {
+  const symbol_t* x = a;
+  const symbol_t* y = b;
+  return (x->value > y->value) - (x->value < y->value);
+}
+
+/** Read the whole file, or return NULL */
+static unsigned char* read_file(const char* path, size_t* size) {
+  unsigned char* data;
+  long length;
+  FILE* fp = fopen(path, "rb");
+
+  if (fp == NULL) return NULL;
+  if (fseek(fp, 0, SEEK_END) != 0 || (length = ftell(fp)) <= 0) {
+    fclose(fp);
+    return NULL;
+  }
+  rewind(fp);
+  data = xmalloc(length);
+  if (fread(data, 1, length, fp) != (size_t)length) {
+    free(data);
+    data = NULL;
+  }
+  fclose(fp);
+  *size = length;
+  return data;
+}
+
+/**
+ * Load the functions of .symtab (.dynsym if stripped) and the PT_LOAD
+ * segments of an ELF64 file. The object is left empty if it is not one.
+ */
+static void load_object(object_t* object) {
+  unsigned char* data;
+  size_t size, i, j, symbol_count;
+  Elf64_Ehdr* ehdr;
+  Elf64_Shdr* shdr;
+  Elf64_Shdr* symtab = NULL;
+  Elf64_Sym* sym;
+  const char* strtab;
+
+  data = object->path[0] == '/' ? read_file(object->path, &size) : NULL;
+  if (data == NULL) return;
+  ehdr = (Elf64_Ehdr*)data;
+  if (size < sizeof(Elf64_Ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+      ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+      ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf64_Phdr) > size ||
+      ehdr->e_shoff + ehdr->e_shnum * sizeof(Elf64_Shdr) > size) {
+    free(data);
+    return;
+  }
+
+  object->loads = xmalloc((ehdr->e_phnum + 1) * sizeof(Elf64_Phdr));
+  for (i = 0; i < ehdr->e_phnum; ++i) {
+    Elf64_Phdr* phdr = (Elf64_Phdr*)(data + ehdr->e_phoff) + i;
+    if (phdr->p_type == PT_LOAD) object->loads[object->load_nr++] = *phdr;
+  }
+
+  shdr = (Elf64_Shdr*)(data + ehdr->e_shoff);
+  for (i = 0; i < ehdr->e_shnum; ++i) {
+    if (shdr[i].sh_type == SHT_SYMTAB) symtab = &shdr[i];
+    if (shdr[i].sh_type == SHT_DYNSYM && symtab == NULL) symtab = &shdr[i];
+  }
+  if (ehdr->e_shstrndx < ehdr->e_shnum &&
+      shdr[ehdr->e_shstrndx].sh_offset + shdr[ehdr->e_shstrndx].sh_size
+        <= size) {
+    const char* shstrtab = (const char*)(data + shdr[ehdr->e_shstrndx].sh_offset);
+    for (i = 0; i < ehdr->e_shnum && object->plt_nr < PLT_MAX; ++i) {
+      if (shdr[i].sh_name < shdr[ehdr->e_shstrndx].sh_size &&
+          strncmp(shstrtab + shdr[i].sh_name, ".plt", 4) == 0) {
+        object->plt_begin[object->plt_nr] = shdr[i].sh_addr;
+        object->plt_end[object->plt_nr]   = shdr[i].sh_addr + shdr[i].sh_size;
+        object->plt_nr++;
+      }
+    }
+  }
+  if (symtab == NULL || symtab->sh_link >= ehdr->e_shnum ||
+      symtab->sh_offset + symtab->sh_size > size ||
+      shdr[symtab->sh_link].sh_offset + shdr[symtab->sh_link].sh_size > size) {
+    free(data);
+    return;
+  }
+  sym = (Elf64_Sym*)(data + symtab->sh_offset);
+  strtab = (const char*)(data + shdr[symtab->sh_link].sh_offset);
+  symbol_count = symtab->sh_size / sizeof(Elf64_Sym);
+  object->symbols = xmalloc((symbol_count + 1) * sizeof(symbol_t));
+  for (i = 0, j = 0; i < symbol_count; ++i) {
+    if (ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC || sym[i].st_value == 0 ||
+        sym[i].st_name >= shdr[symtab->sh_link].sh_size) {
+      continue;
+    }
+    object->symbols[j].value = sym[i].st_value;
+    object->symbols[j].size  = sym[i].st_size;
+    object->symbols[j].name  = strdup(strtab + sym[i].st_name);
+    j++;
+  }
+  object->symbol_nr = j;
+  qsort(object->symbols, j, sizeof(symbol_t), compare_symbol);
+  free(data);
+}
+
+static void unload_object(object_t* object) {
+  size_t i;
+
+  for (i = 0; i < object->symbol_nr; ++i) free(object->symbols[i].name);
+  free(object->symbols);
+  free(object->loads);
+}
+
+/** Virtual address in the file of a file offset, or 'offset' if unknown */
+static uint64_t offset2vaddr(const object_t* object, uint64_t offset) {
+  size_t i;
+
+  for (i = 0; i < object->load_nr; ++i) {
+    const Elf64_Phdr* load = &object->loads[i];
+    if (load->p_offset <= offset && offset < load->p_offset + load->p_filesz) {
+      return load->p_vaddr + (offset - load->p_offset);
+    }
+  }
+  return offset;
+}
+
+/** Name of the function containing 'vaddr' */
+static const char* find_function(const object_t* object, uint64_t vaddr) {
+  size_t low = 0, high = object->symbol_nr, mid;
+  const symbol_t* symbol;
+
+  for (mid = 0; mid < object->plt_nr; ++mid) {
+    if (object->plt_begin[mid] <= vaddr && vaddr < object->plt_end[mid]) {
+      return PLT_NAME;
+    }
+  }
+
+  /* Last symbol whose value is at most 'vaddr' */
+  while (low < high) {
+    mid = (low + high) / 2;
+    if (object->symbols[mid].value <= vaddr) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == 0) return UNKNOWN_NAME;
+  symbol = &object->symbols[low - 1];
+  /* Symbols without a size (e.g. _init) cover only their first address */
+  if (vaddr >= symbol->value + (symbol->size != 0 ? symbol->size : 1)) {
+    return UNKNOWN_NAME;
+  }
+  return symbol->name;
+}
+
+/**
+ * Look up the source lines of addresses by addr2line. 'lines[i]' is set to
+ * "file:line" of 'vaddrs[i]' without directories.
+ */
+static void find_lines(const char* path, const uint64_t* vaddrs, size_t nr,
+                       char** lines) {
+  char tmp_path[] = "/tmp/inst_counter_XXXXXX";
+  char command[4352];
+  char buffer[4096];
+  char* name;
+  FILE* fp = NULL;
+  size_t i;
+  int fd;
+
+  for (i = 0; i < nr; ++i) lines[i] = NULL;
+  fd = path[0] == '/' ? mkstemp(tmp_path) : -1;
+  if (fd >= 0) {
+    fp = fdopen(fd, "w");
+    for (i = 0; fp != NULL && i < nr; ++i) {
+      fprintf(fp, "0x%" PRIx64 "\n", vaddrs[i]);
+    }
+    if (fp != NULL) fclose(fp); else close(fd);
+    snprintf(command, sizeof(command), "addr2line -e '%s' < %s 2>/dev/null",
+      path, tmp_path);
+    fp = popen(command, "r");
+  }
+  for (i = 0; fp != NULL && i < nr; ++i) {
+    if (fgets(buffer, sizeof(buffer), fp) == NULL) break;
+    buffer[strcspn(buffer, " \n")] = '\0';
+    name = strrchr(buffer, '/');
+    name = name != NULL ? name + 1 : buffer;
+    if (strncmp(name, "??", 2) != 0) lines[i] = strdup(name);
+  }
+  if (fp != NULL) pclose(fp);
+  if (fd >= 0) unlink(tmp_path);
+  for (i = 0; i < nr; ++i) {
+    if (lines[i] == NULL) lines[i] = strdup(UNKNOWN_NAME);
+  }
+}
+
+static int compare_rip(const void* a, const void* b) {
+  const rip_count_t* x = a;
+  const rip_count_t* y = b;
+  return (x->rip > y->rip) - (x->rip < y->rip);
+}
+
+static int compare_site(const void* a, const void* b) {
+  const site_t* x = a;
+  const site_t* y = b;
+  int result = strcmp(x->object, y->object);
+  if (result == 0) result = strcmp(x->function, y->function);
+  if (result == 0) result = strcmp(x->line, y->line);
+  return result;
+}
+
+static int compare_site_count(const void* a, const void* b) {
+  const site_t* x = a;
+  const site_t* y = b;
+  return (x->count < y->count) - (x->count > y->count);
+}
+
+static int compare_function_count(const void* a, const void* b) {
+  const function_t* x = a;
+  const function_t* y = b;
+  return (x->count < y->count) - (x->count > y->count);
+}
+
+void profile_print(profile_t* profile, FILE* fp, size_t line_max) {
+  rip_count_t* rips = xmalloc((profile->used + 1) * sizeof(rip_count_t));
+  site_t* sites = xmalloc((profile->used + 1) * sizeof(site_t));
+  object_t* objects = calloc(profile->map_nr + 1, sizeof(object_t));
+  function_t* functions;
+  uint64_t* vaddrs;
+  char** lines;
+  const char* name;
+  size_t rip_nr = 0, site_nr, function_nr;
+  size_t i, j, k, begin;
+  const map_t* map;
+
+  if (objects == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < profile->capacity; ++i) {
+    if (profile->table[i].count != 0) rips[rip_nr++] = profile->table[i];
+  }
+  qsort(rips, rip_nr, sizeof(rip_count_t), compare_rip);
+  vaddrs = xmalloc((rip_nr + 1) * sizeof(uint64_t));
+  lines  = xmalloc((rip_nr + 1) * sizeof(char*));
+
+  /* Maps are sorted by address, so the addresses of each are contiguous */
+  for (i = 0, j = 0; i < profile->map_nr; ++i) {
+    map = &profile->maps[i];
+    while (j < rip_nr && rips[j].rip < map->start) {
+      sites[j].object = sites[j].function = UNKNOWN_NAME;
+      sites[j].line = strdup(UNKNOWN_NAME);
+      sites[j].count = rips[j].count;
+      j++;
+    }
+    for (k = j; k < rip_nr && rips[k].rip < map->end; ++k) {}
+    if (k == j) continue;
+
+    objects[i].path = map->path;
+    name = strrchr(map->path, '/');
+    objects[i].name = name != NULL ? name + 1 : map->path;
+    if (objects[i].name[0] == '\0') objects[i].name = UNKNOWN_NAME;
+    load_object(&objects[i]);
+    for (begin = j; j < k; ++j) {
+      vaddrs[j - begin] =
+        offset2vaddr(&objects[i], rips[j].rip - map->start + map->offset);
+      sites[j].object   = objects[i].name;
+      sites[j].function = find_function(&objects[i], vaddrs[j - begin]);
+      sites[j].count    = rips[j].count;
+    }
+    find_lines(map->path, vaddrs, k - begin, lines);
+    for (j = begin; j < k; ++j) sites[j].line = lines[j - begin];
+  }
+  for (; j < rip_nr; ++j) {
+    sites[j].object = sites[j].function = UNKNOWN_NAME;
+    sites[j].line = strdup(UNKNOWN_NAME);
+    sites[j].count = rips[j].count;
+  }
+
+  /* Merge the addresses of the same line */
+  qsort(sites, rip_nr, sizeof(site_t), compare_site);
+  for (i = 0, site_nr = 0; i < rip_nr; ++i) {
+    if (site_nr > 0 && compare_site(&sites[site_nr - 1], &sites[i]) == 0) {
+      sites[site_nr - 1].count += sites[i].count;
+      free(sites[i].line);
+    } else {
+      sites[site_nr++] = sites[i];
+    }
+  }
+
+  /* Group the lines by function */
+  functions = xmalloc((site_nr + 1) * sizeof(function_t));
+  for (i = 0, function_nr = 0; i < site_nr; ++i) {
+    if (function_nr == 0 ||
+        strcmp(sites[i].object, sites[functions[function_nr - 1].begin].object) ||
+        strcmp(sites[i].function,
+          sites[functions[function_nr - 1].begin].function)) {
+      functions[function_nr].begin = i;
+      functions[function_nr].count = 0;
+      function_nr++;
+    }
+    functions[function_nr - 1].end = i + 1;
+    functions[function_nr - 1].count += sites[i].count;
+  }
+  for (i = 0; i < function_nr; ++i) {
+    qsort(sites + functions[i].begin, functions[i].end - functions[i].begin,
+      sizeof(site_t), compare_site_count);
+  }
+  qsort(functions, function_nr, sizeof(function_t), compare_function_count);
+
+  fprintf(fp, "PROFILE\t%8" PRIu64 " instructions", profile->total);
+  if (profile->excluded > 0) {
+    fprintf(fp, " (%" PRIu64 " of instrumentation excluded)",
+      profile->excluded);
+  }
+  fputc('\n', fp);
+  /* e.g. the call of instruction_count_end in instruction_count_init, which
+     is counted as the bias but is done by the measured code in ranges */
+  if (profile->unmatched > 0) {
+    fprintf(fp, "\t%8" PRIu64 " more are subtracted from the counts as the "
+      "bias, executed at init only\n", profile->unmatched);
+  }
+  for (i = 0; i < function_nr; ++i) {
+    const site_t* first = &sites[functions[i].begin];
+    fprintf(fp, "%10" PRIu64 " %6.2f%%  %s (%s)\n", functions[i].count,
+      100.0 * functions[i].count / profile->total, first->function,
+      first->object);
+    for (j = functions[i].begin;
+         j < functions[i].end && j - functions[i].begin < line_max; ++j) {
+      fprintf(fp, "%10" PRIu64 " %6.2f%%    %s\n", sites[j].count,
+        100.0 * sites[j].count / profile->total, sites[j].line);
+    }
+  }
+
+  for (i = 0; i < site_nr; ++i) free(sites[i].line);
+  for (i = 0; i < profile->map_nr; ++i) unload_object(&objects[i]);
+  free(functions);
+  free(lines);
+  free(vaddrs);
+  free(objects);
+  free(sites);
+  free(rips);
+}
@@ -0,0 +1,69 @@
+/*
+  Instruction Counter is a counter counting  number of instructions
+  by `ptrace` system call
+  Copyright (c) 2016-2017 Toshinori Tsuboi
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy of
+  this software and associated documentation files (the "Software"), to deal in
+  the Software without restriction, including without limitation the rights to
+  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+  the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+  FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+  COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+  IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef PROFILE_H__
+#define PROFILE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Instructions executed per address, symbolized when printed */
+typedef struct profile profile_t;
+
+/** Create an empty profile, or return NULL if memory is exhausted */
+profile_t* profile_create(void);
+/** Destroy a profile */
+void profile_destroy(profile_t* profile);
+/**
+ * Count an instruction
+ * @param profile  profile
+ * @param rip      address of the instruction
+ */
+void profile_record(profile_t* profile, uint64_t rip);
+/**
+ * Remove executions of the instructions counted in another profile, e.g.
+ * the instrumentation measured while instruction_count_init runs
+ * @param profile  profile
+ * @param other    instructions executed once per 'times'
+ * @param times    number of executions removed
+ */
+void profile_subtract(profile_t* profile, const profile_t* other,
+  uint64_t times);
+/**
+ * Take the executable mappings of a process, which are needed to symbolize
+ * the addresses after it exits
+ * @param profile  profile
+ * @param pid      process whose addresses are recorded
+ */
+void profile_update_maps(profile_t* profile, pid_t pid);
+/**
+ * Print the counts per function and per source line. Functions are named by
+ * the ELF symbol tables of the mapped files, and lines are looked up by
+ * addr2line in their debug information.
+ * @param profile   profile
+ * @param fp        output
+ * @param line_max  maximum number of lines printed per function
+ */
+void profile_print(profile_t* profile, FILE* fp, size_t line_max);
+
+#endif /* PROFILE_H__ */
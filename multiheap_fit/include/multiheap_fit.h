@@ -29,6 +29,22 @@
 typedef void*  mf_t;
 /* block id */
 typedef uint32_t blockid_t;
+/* Numbers of system calls issued and blocks moved by Multiheap-fit */
+typedef struct {
+  /* mmap to map pages */
+  size_t mmap_nr;
+  /* mmap to unmap pages (they are replaced with PROT_NONE mappings) */
+  size_t unmap_nr;
+  /* blocks moved into holes left by deallocation */
+  size_t moved_nr;
+  /* bytes copied to move them (only the ids with COPYLESS) */
+  size_t moved_bytes;
+  /* current size of pages kept in the pool and the garbage list */
+  size_t pool_bytes;
+  size_t garbage_bytes;
+} mf_stat_t;
+/* Function called when an allocation would exceed the soft limit */
+typedef void (*mf_limit_handler_t)(mf_t mf, size_t using_size, void* arg);
 
 /**
  * Initialize Multiheap-fit's internal data.
@@ -54,10 +70,15 @@ void mf_final(mf_t mf);
  * @param bid     allocating block id   [0, elem_nr_max)
  * @param length  required memory size  [mem_min, mem_max]
  *
+ * @return        0 on success, -1 on failure (errno is set)
+ *
  * The block id management must be done by the application.
  * The argument 'bid' must not comflict with other allocated block id.
+ * This function fails with ENOMEM if the hard limit would be exceeded
+ * (see 'mf_set_limit'), or with the errno of 'mmap' if pages cannot be
+ * mapped. The block is not allocated on failure.
  */
-void mf_allocate(mf_t mf, blockid_t bid, size_t length);
+int mf_allocate(mf_t mf, blockid_t bid, size_t length);
 
 /**
  * deallocate memory block
@@ -71,10 +92,14 @@ void mf_deallocate(mf_t mf, blockid_t bid);
  * change size of allocated memory block
  * @param bid         resizing block id
  * @param new_length  new block length
+ * @return            0 on success, -1 on failure (errno is set)
  *
  * This is an experimental function.
+ * An unallocated block is allocated. This function fails like
+ * 'mf_allocate', and on failure the block remains as it was, except that
+ * it fails with ENOENT if the limit handler deallocates the block itself.
  */
-void mf_reallocate(mf_t mf, blockid_t bid, size_t new_length);
+int mf_reallocate(mf_t mf, blockid_t bid, size_t new_length);
 
 /**
  * dereference memory block
@@ -120,4 +145,39 @@ size_t mf_dereference_and_length(mf_t mf, blockid_t bid, void** block_addr);
  */
 size_t mf_using_mem(const mf_t mf);
 
+/**
+ * set limits of the size of pages used for blocks
+ * @param soft_limit  'handler' is called before exceeding it (0: no limit)
+ * @param hard_limit  allocating fails instead of exceeding it (0: no limit)
+ * @param handler     function called with the size after the allocation,
+ *                    or NULL
+ * @param arg         passed to 'handler'
+ *
+ * The limits are compared with 'mf_heap_size'. The handler is called
+ * before the allocation which would exceed the soft limit, so it can
+ * deallocate other blocks (e.g. evict caches) to keep the size. It is not
+ * called recursively. Before failing, pages kept for reuse are unmapped.
+ */
+void mf_set_limit(mf_t mf, size_t soft_limit, size_t hard_limit,
+  mf_limit_handler_t handler, void* arg);
+
+/**
+ * calculate total size of pages mapped for blocks
+ *
+ * Unlike 'mf_using_mem', this function takes constant time. The size
+ * includes pages kept for reuse but excludes the block information.
+ */
+size_t mf_heap_size(const mf_t mf);
+
+/**
+ * get the numbers of system calls issued and blocks moved since 'mf_init'
+ * @param stat  the numbers are stored here
+ *
+ * The reservation of the virtual address space in 'mf_init' is not
+ * counted. Each counter is incremented just before the system call,
+ * so a replay harness can attribute system calls to each operation.
+ * 'pool_bytes' and 'garbage_bytes' are the sizes at the call.
+ */
+void mf_get_stat(const mf_t mf, mf_stat_t* stat);
+
 #endif /* MULTIHEAP_FIT_H__ */
@@ -28,6 +28,7 @@
 #endif
 
 #include <assert.h>
+#include <errno.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -122,13 +123,17 @@ typedef uint_fast16_t bytenum_t;
 /* ========================================================================== */
 /* OS memory management wrapper */
 /* ========================================================================== */
-/** Create anonymous mapping from addr to addr + size */
-MF_INLINE void safe_anon_mmap(void* addr, size_t size);
+/** Create anonymous mapping from addr to addr + size.
+    Return false (errno is set) if 'mmap' is failed */
+MF_INLINE bool try_anon_mmap(void* addr, size_t size);
 /** Destroy anonymous mapping from addr to addr + size */
 MF_INLINE void safe_zero_mmap(void* addr, size_t size);
 /** Call 'malloc' and exit if 'malloc' is failed */
 MF_INLINE void* safe_malloc(size_t size);
 
+/* Number of system calls issued after initialization */
+static mf_stat_t g_stat;
+
 
 /* ========================================================================== */
 /* commonly used functions */
@@ -202,8 +207,12 @@ MF_INLINE void pheap_first_reserve(size_t max_nr);
 MF_INLINE void pheap_init(pseudo_heap_t* pheap_ptr);
 /** Destructor */
 MF_INLINE void pheap_final(pseudo_heap_t* pheap_ptr);
-/** Bluge the length of heap to new_sc(faster than 'pheap_resize') */
-MF_INLINE void pheap_bulge(pseudo_heap_t* pheap_ptr, size_t new_size);
+/** Bluge the length of heap to new_sc(faster than 'pheap_resize').
+    Return false if pages cannot be mapped. */
+MF_INLINE bool pheap_bulge(pseudo_heap_t* pheap_ptr, size_t new_size);
+/** The number of pages newly mapped by 'pheap_bulge(pheap_ptr, new_size)' */
+MF_INLINE size_t pheap_growth(const pseudo_heap_t* pheap_ptr,
+  size_t new_size);
 /** Change the length of heap to new_sc(faster than 'pheap_resize') */
 MF_INLINE void pheap_shrink(pseudo_heap_t* pheap_ptr, size_t new_size);
 /** Head address of pseudo heap */
@@ -243,8 +252,11 @@ MF_INLINE void   block_manager_final(block_manager_t* bm_ptr);
 MF_INLINE void*  block_manager_addr(block_manager_t* bm_ptr, size_t index);
 /** Block_manager_addr(bm_ptr, bm_ptr->obj_num - 1) */
 MF_INLINE void*  block_manager_last_addr(block_manager_t* bm_ptr);
-/** Append new memory block to tail */
-MF_INLINE size_t block_manager_append(block_manager_t* bm_ptr);
+/** Append new memory block to tail and store its index in 'index'.
+    Return false if the heap cannot be extended. */
+MF_INLINE bool block_manager_append(block_manager_t* bm_ptr, size_t* index);
+/** The number of pages newly mapped by 'block_manager_append' */
+MF_INLINE size_t block_manager_growth(const block_manager_t* bm_ptr);
 /** Remove tail memory block. */
 MF_INLINE void block_manager_remove(block_manager_t* bm_ptr);
 /** Get obj_num */
@@ -343,6 +355,16 @@ typedef struct {
   /* Structures that store blocks corresponding to each size class */
   block_manager_t** block_managers;
 
+  /* Limits of the size of mapped pages (0 means no limit) */
+  size_t soft_limit;
+  size_t hard_limit;
+  /* Called when an allocation would exceed 'soft_limit' */
+  mf_limit_handler_t limit_handler;
+  /* Argument of 'limit_handler' */
+  void* limit_arg;
+  /* true while 'limit_handler' is called */
+  bool in_limit_handler;
+
 #if !FIXED_LENGTH_INTEGER
   /* ID byte to represent 'bid' */
   bytenum_t  id_byte;
@@ -358,17 +380,20 @@ typedef struct {
 /* OS memory management wrapper */
 /* ========================================================================== */
 
-MF_INLINE void safe_anon_mmap(void* addr, size_t size) {
-  void* ret_addr = MMAP_WRAPPER(addr, size, PROT_READ | PROT_WRITE,
+MF_INLINE bool try_anon_mmap(void* addr, size_t size) {
+  void* ret_addr;
+
+  g_stat.mmap_nr++;
+  ret_addr = MMAP_WRAPPER(addr, size, PROT_READ | PROT_WRITE,
       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
-  if (ret_addr == MAP_FAILED) {
-    perror("MMAP_WRAPPER(anon)");
-    exit(EXIT_FAILURE);
-  }
+  return ret_addr != MAP_FAILED;
 }
 
 MF_INLINE void safe_zero_mmap(void* addr, size_t size) {
-  void* ret_addr = MMAP_WRAPPER(addr, size, PROT_NONE,
+  void* ret_addr;
+
+  g_stat.unmap_nr++;
+  ret_addr = MMAP_WRAPPER(addr, size, PROT_NONE,
     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
   if (ret_addr == MAP_FAILED) {
     perror("MMAP_WRAPPER(zero)");
@@ -597,6 +622,9 @@ struct virt_space {
   size_t garbage_num;
 #endif /* ENABLE_HEURISTIC */
 
+  /* Total number of mapped pages (heaps, pools and garbages) */
+  size_t mapped_num;
+
   /* Head addr reserved for the first time */
   void* addr_start;
   /* Max number of pseudo_heap structures */
@@ -609,6 +637,8 @@ struct virt_space {
 static struct virt_space g_virt_space = {.initialized = false};
 /** Finalize g_virt_space */
 MF_INLINE void virt_space_final(void);
+/** Unmap pages kept for reuse (pools and garbages) */
+MF_INLINE void virt_space_release_cache(void);
 
 #if ENABLE_HEURISTIC
 #define IS_POOL_EMPTY() \
@@ -687,6 +717,11 @@ MF_INLINE void pheap_first_reserve(size_t max_nr) {
   g_virt_space.garbage_num = 0;
 #endif /* ENABLE_HEURISTIC */
   g_virt_space.size_per_space = size_per_space;
+  g_virt_space.mapped_num = 0;
+  g_stat.mmap_nr  = 0;
+  g_stat.unmap_nr = 0;
+  g_stat.moved_nr = 0;
+  g_stat.moved_bytes = 0;
   g_virt_space.addr_nr = max_nr;
   g_virt_space.max_nr  = max_nr;
   g_virt_space.reserved_size = mmap_size;
@@ -702,14 +737,33 @@ MF_INLINE void virt_space_final(void) {
   /* munmap virtual space involve pools */
   munmap(g_virt_space.addr_start, g_virt_space.reserved_size);
   g_virt_space.max_nr = 0;
+  g_virt_space.mapped_num = 0;
   g_virt_space.initialized = false;
 }
 
+MF_INLINE void virt_space_release_cache(void) {
+#if ENABLE_HEURISTIC
+  struct garbage_header* garbage_sentinel = g_virt_space.garbage_sentinel;
+  struct pool_header* pool;
+
+  while (garbage_sentinel->next != garbage_sentinel->prev) {
+    garbage_delete(garbage_sentinel->next);
+  }
+  while (!IS_POOL_EMPTY()) {
+    pool = pool_top();
+    g_virt_space.mapped_num -= pool->page_num;
+    safe_zero_mmap(pool, pool->page_num << g_page_shift);
+    g_virt_space.addrs[g_virt_space.addr_nr++] = (void*)pool;
+  }
+#endif /* ENABLE_HEURISTIC */
+}
+
 #if ENABLE_HEURISTIC
 MF_INLINE void pool_push(struct pool_header* inserted) {
   struct pool_header* last_pool_sentinel = g_virt_space.pool_sentinel->prev;
 
   if (g_virt_space.pool_num > POOL_NUM_THRESHOLD) {
+    g_virt_space.mapped_num -= inserted->page_num;
     safe_zero_mmap(inserted, inserted->page_num << g_page_shift);
     g_virt_space.addrs[g_virt_space.addr_nr++] = (void*)inserted;
   } else {
@@ -794,13 +848,13 @@ MF_INLINE void pheap_final(pseudo_heap_t* pheap_ptr) {
   }
 }
 
-MF_INLINE void pheap_bulge(pseudo_heap_t* pheap_ptr,
+MF_INLINE bool pheap_bulge(pseudo_heap_t* pheap_ptr,
     size_t new_size) {
   size_t old_page_num = pheap_ptr->page_num;
   size_t new_page_num = length2page_num(new_size);
   void* addr = pheap_ptr->addr;
 
-  if (old_page_num >= new_page_num) return;
+  if (old_page_num >= new_page_num) return true;
   if (addr == NULL) {
 #if ENABLE_HEURISTIC
     if (!IS_POOL_EMPTY()) {
@@ -812,7 +866,7 @@ MF_INLINE void pheap_bulge(pseudo_heap_t* pheap_ptr,
       }
       if (old_page_num >= new_page_num) {
         pheap_ptr->page_num = old_page_num;
-        return;
+        return true;
       }
     } else
 #endif /* ENABLE_HEURISTIC */
@@ -830,13 +884,43 @@ MF_INLINE void pheap_bulge(pseudo_heap_t* pheap_ptr,
     pheap_ptr->extra_num = 0;
     if (old_page_num >= new_page_num) {
       pheap_ptr->page_num = old_page_num;
-      return;
+      return true;
     }
   }
 #endif /* ENABLE_HEURISTIC */
-  safe_anon_mmap(ptr_offset(addr, old_page_num << g_page_shift),
-    (new_page_num - old_page_num) << g_page_shift);
+  if (!try_anon_mmap(ptr_offset(addr, old_page_num << g_page_shift),
+      (new_page_num - old_page_num) << g_page_shift)) {
+    /* Keep pages which have already been mapped */
+    pheap_ptr->page_num = old_page_num;
+    if (old_page_num == 0) {
+      g_virt_space.addrs[g_virt_space.addr_nr++] = addr;
+      pheap_ptr->addr = NULL;
+    }
+    return false;
+  }
+  g_virt_space.mapped_num += new_page_num - old_page_num;
   pheap_ptr->page_num = new_page_num;
+  return true;
+}
+
+MF_INLINE size_t pheap_growth(const pseudo_heap_t* pheap_ptr,
+    size_t new_size) {
+  size_t old_page_num = pheap_ptr->page_num;
+  size_t new_page_num = length2page_num(new_size);
+
+  if (pheap_ptr->addr == NULL) {
+#if ENABLE_HEURISTIC
+    if (!IS_POOL_EMPTY()) {
+      old_page_num = g_virt_space.pool_sentinel->next->page_num;
+    }
+#endif /* ENABLE_HEURISTIC */
+  }
+#if ENABLE_HEURISTIC
+  else {
+    old_page_num += pheap_ptr->extra_num;
+  }
+#endif /* ENABLE_HEURISTIC */
+  return old_page_num >= new_page_num ? 0 : new_page_num - old_page_num;
 }
 
 MF_INLINE void pheap_shrink(pseudo_heap_t* pheap_ptr,
@@ -882,6 +966,7 @@ MF_INLINE void pheap_shrink(pseudo_heap_t* pheap_ptr,
 #else  /* ENABLE_HEURISTIC */
   safe_zero_mmap(ptr_offset(addr, new_page_num << g_page_shift),
     (old_page_num - new_page_num) << g_page_shift);
+  g_virt_space.mapped_num -= old_page_num - new_page_num;
   pheap_ptr->page_num = new_page_num;
   if (new_page_num == 0) {
     g_virt_space.addrs[g_virt_space.addr_nr++] = addr;
@@ -911,6 +996,7 @@ MF_INLINE void pheap_delete_extra(pseudo_heap_t* pheap_ptr) {
 
   safe_zero_mmap(ptr_offset(addr, page_num << g_page_shift),
       extra_num << g_page_shift);
+  g_virt_space.mapped_num -= extra_num;
   pheap_ptr->extra_num = 0;
 }
 #endif /* ENABLE_HEURISTIC */
@@ -949,14 +1035,20 @@ MF_INLINE void* block_manager_last_addr(block_manager_t* bm_ptr) {
   return block_manager_addr(bm_ptr, bm_ptr->obj_num - 1);
 }
 
-MF_INLINE size_t block_manager_append(block_manager_t* bm_ptr) {
-  size_t appended_index = bm_ptr->obj_num++;
+MF_INLINE bool block_manager_append(block_manager_t* bm_ptr,
+    size_t* index) {
   size_t new_heap_size;
   pseudo_heap_t* pseudo_heap = &bm_ptr->pseudo_heap;
 
-  new_heap_size = bm_ptr->obj_num * bm_ptr->obj_size;
-  pheap_bulge(pseudo_heap, new_heap_size);
-  return appended_index;
+  new_heap_size = (bm_ptr->obj_num + 1) * bm_ptr->obj_size;
+  if (!pheap_bulge(pseudo_heap, new_heap_size)) return false;
+  *index = bm_ptr->obj_num++;
+  return true;
+}
+
+MF_INLINE size_t block_manager_growth(const block_manager_t* bm_ptr) {
+  return pheap_growth(&bm_ptr->pseudo_heap,
+    (bm_ptr->obj_num + 1) * bm_ptr->obj_size);
 }
 
 MF_INLINE void block_manager_remove(block_manager_t* bm_ptr) {
@@ -992,6 +1084,11 @@ MF_INLINE const void* elem_block_addr_c(const block_info_t* elem_info,
   blockid_t id);
 #endif /* FIXED_LENGTH_INTEGER */
 
+/** Check whether a block can be appended to 'block_manager' under the
+    limits. The limit handler is called if the soft limit would be exceeded. */
+MF_INLINE bool limit_admit(mf_main_t* mf_main,
+  const block_manager_t* block_manager);
+
 #if FIXED_LENGTH_INTEGER
 MF_INLINE block_info_t* block_info_init(blockid_t element_nr_max)
 #else  /* FIXED_LENGTH_INTEGER */
@@ -1159,6 +1256,11 @@ mf_t mf_init(size_t mem_min, size_t mem_max, size_t elem_nr_max,
   mf_main->sc_max         = sc_max;
   mf_main->elem_nr_max    = elem_nr_max;
   mf_main->max_byte       = max_byte;
+  mf_main->soft_limit     = 0;
+  mf_main->hard_limit     = 0;
+  mf_main->limit_handler  = NULL;
+  mf_main->limit_arg      = NULL;
+  mf_main->in_limit_handler = false;
   mf_main->block_managers =
     (block_manager_t**) safe_malloc(sizeof(block_manager_t*) * block_manager_nr);
   for (sc = sc_min; sc <= sc_max; ++sc) {
@@ -1195,14 +1297,15 @@ void mf_final(mf_t mf) {
   free(mf_main);
 }
 
-void mf_allocate(mf_t mf, blockid_t bid, size_t length) {
+int mf_allocate(mf_t mf, blockid_t bid, size_t length) {
   mf_main_t* mf_main = (mf_main_t*)mf;
-  offset_t ofs;
+  size_t ofs;
   size_class_t size_class = size2sc(length);
   size_class_t bmanager_idx = size_class - mf_main->sc_min;
   block_manager_t* block_manager = mf_main->block_managers[bmanager_idx];
 
-  ofs = block_manager_append(block_manager);
+  if (!limit_admit(mf_main, block_manager)) return -1;
+  if (!block_manager_append(block_manager, &ofs)) return -1;
 #if FIXED_LENGTH_INTEGER
   *(blockid_t*)block_manager_last_addr(block_manager) = bid;
 #else /* FIXED_LENGTH_INTEGER */
@@ -1210,6 +1313,7 @@ void mf_allocate(mf_t mf, blockid_t bid, size_t length) {
 #endif /* FIXED_LENGTH_INTEGER */
   block_info_put_sc_and_ofs(mf_main->block_info_ptr, bid,
     bmanager_idx + 1, ofs);
+  return 0;
 }
 
 void mf_deallocate(mf_t mf, blockid_t bid) {
@@ -1251,32 +1355,45 @@ void mf_deallocate(mf_t mf, blockid_t bid) {
 #if COPYLESS
 #if FIXED_LENGTH_INTEGER
     *(blockid_t*)dst_addr = *(blockid_t*)src_addr;
+    g_stat.moved_bytes += sizeof(blockid_t);
 #else  /* FIXED_LENGTH_INTEGER */
     my_memcpy(dst_addr, src_addr, id_byte);
+    g_stat.moved_bytes += id_byte;
 #endif /* FIXED_LENGTH_INTEGER */
 #else  /* COPYLESS */
     my_memcpy(dst_addr, src_addr, block_manager->obj_size);
+    g_stat.moved_bytes += block_manager->obj_size;
 #endif /* COPYLESS */
+    g_stat.moved_nr++;
   }
 
   block_manager_remove(block_manager);
 }
 
-void mf_reallocate(mf_t mf, blockid_t bid, size_t new_length) {
+int mf_reallocate(mf_t mf, blockid_t bid, size_t new_length) {
   mf_main_t* mf_main = (mf_main_t*) mf;
   size_class_t old_sc, new_sc;
-  offset_t old_ofs, new_ofs;
+  offset_t old_ofs;
+  size_t new_ofs;
   block_manager_t* old_block_manager, *new_block_manager;
 
   old_sc = block_info_get_sc(mf_main->block_info_ptr, bid);
+  if (old_sc == 0) return mf_allocate(mf_main, bid, new_length);
   new_sc = size2sc(new_length) - mf_main->sc_min + 1;
-  if (new_sc == old_sc) return;
+  if (new_sc == old_sc) return 0;
 
-  old_block_manager = mf_main->block_managers[old_sc - 1];
   new_block_manager = mf_main->block_managers[new_sc - 1];
-
+  if (!limit_admit(mf_main, new_block_manager)) return -1;
+  /* The handler might have moved or deallocated the block. Its contents
+     are lost in the latter case, which is not hidden by allocating it. */
+  old_sc = block_info_get_sc(mf_main->block_info_ptr, bid);
+  if (old_sc == 0) {
+    errno = ENOENT;
+    return -1;
+  }
+  old_block_manager = mf_main->block_managers[old_sc - 1];
   old_ofs = block_info_get_offset(mf_main->block_info_ptr, bid);
-  new_ofs = block_manager_append(new_block_manager);
+  if (!block_manager_append(new_block_manager, &new_ofs)) return -1;
 
   memcpy(block_manager_addr(new_block_manager, new_ofs),
     block_manager_addr(old_block_manager, old_ofs),
@@ -1285,6 +1402,7 @@ void mf_reallocate(mf_t mf, blockid_t bid, size_t new_length) {
 
   block_info_put_sc(mf_main->block_info_ptr, bid, new_sc);
   block_info_put_offset(mf_main->block_info_ptr, bid, new_ofs);
+  return 0;
 }
 
 void* mf_dereference(mf_t mf, blockid_t bid) {
@@ -1375,3 +1493,61 @@ size_t mf_using_mem(const mf_t mf) {
 #endif /* ENABLE_HEURISTIC */
   return ret_size;
 }
+
+void mf_set_limit(mf_t mf, size_t soft_limit, size_t hard_limit,
+    mf_limit_handler_t handler, void* arg) {
+  mf_main_t* mf_main = (mf_main_t*)mf;
+
+  mf_main->soft_limit    = soft_limit;
+  mf_main->hard_limit    = hard_limit;
+  mf_main->limit_handler = handler;
+  mf_main->limit_arg     = arg;
+}
+
+void mf_get_stat(const mf_t mf, mf_stat_t* stat) {
+  *stat = g_stat;
+#if ENABLE_HEURISTIC
+  stat->pool_bytes    = g_virt_space.pool_num << g_page_shift;
+  stat->garbage_bytes = g_virt_space.garbage_num << g_page_shift;
+#else  /* ENABLE_HEURISTIC */
+  stat->pool_bytes    = 0;
+  stat->garbage_bytes = 0;
+#endif /* ENABLE_HEURISTIC */
+}
+
+size_t mf_heap_size(const mf_t mf) {
+  return g_virt_space.mapped_num << g_page_shift;
+}
+
+MF_INLINE bool limit_admit(mf_main_t* mf_main,
+    const block_manager_t* block_manager) {
+  size_t required_size;
+
+  if (mf_main->soft_limit == 0 && mf_main->hard_limit == 0) return true;
+
+  required_size = block_manager_growth(block_manager) << g_page_shift;
+  if (required_size == 0) return true;
+  required_size += mf_heap_size(mf_main);
+
+  if (mf_main->soft_limit != 0 && required_size > mf_main->soft_limit
+      && mf_main->limit_handler != NULL && !mf_main->in_limit_handler) {
+    /* The handler may deallocate blocks */
+    mf_main->in_limit_handler = true;
+    mf_main->limit_handler(mf_main, required_size, mf_main->limit_arg);
+    mf_main->in_limit_handler = false;
+    required_size = mf_heap_size(mf_main)
+      + (block_manager_growth(block_manager) << g_page_shift);
+  }
+
+  if (mf_main->hard_limit != 0 && required_size > mf_main->hard_limit) {
+    /* Pages kept for reuse are given back before giving up */
+    virt_space_release_cache();
+    required_size = mf_heap_size(mf_main)
+      + (block_manager_growth(block_manager) << g_page_shift);
+    if (required_size > mf_main->hard_limit) {
+      errno = ENOMEM;
+      return false;
+    }
+  }
+  return true;
+}
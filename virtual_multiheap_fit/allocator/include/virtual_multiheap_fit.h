@@ -29,8 +29,38 @@
 
 /* Type of Virtual Multiheap-fit */
 typedef void* vmf_t;
+/* Type of read-only view of a shared Virtual Multiheap-fit */
+typedef void* vmf_reader_t;
 /* block id */
 typedef uint32_t blockid_t;
+/* Numbers of system calls issued and blocks moved by Virtual Multiheap-fit */
+typedef struct {
+  /* mmap to map physical pages */
+  size_t mmap_nr;
+  /* mmap to unmap physical pages (replaced with PROT_NONE mappings) */
+  size_t unmap_nr;
+  /* mremap to resize internal tables */
+  size_t mremap_nr;
+  /* requests to allocate or free physical pages (ioctl to the kernel
+     module, or fallocate in user space) */
+  size_t driver_nr;
+  /* blocks moved into holes left by deallocation */
+  size_t moved_nr;
+  /* bytes copied to move them (only the ids with COPYLESS) */
+  size_t moved_bytes;
+  /* current size of physical pages kept in the pool of the instance */
+  size_t pool_bytes;
+} vmf_stat_t;
+/* Function called when an allocation would exceed the soft limit */
+typedef void (*vmf_limit_handler_t)(vmf_t vmf, size_t using_size, void* arg);
+
+/* Flags for 'vmf_init_flags' */
+/* Keep block and page information in shared memory so that other
+   processes can dereference blocks (see 'vmf_send_handle') */
+#define VMF_FLAG_SHARED 0x1u
+/* Emulate the kernel module by a memory file (memfd) in user space.
+   This is slower, but does not require /dev/vmf_module0. */
+#define VMF_FLAG_USERSPACE 0x2u
 
 /**
  * Initialize Virtual Multiheap-fit's internal data.
@@ -46,6 +76,15 @@ typedef uint32_t blockid_t;
 vmf_t vmf_init(size_t mem_min, size_t mem_max,
     size_t element_nr_max, size_t total_sup);
 
+/**
+ * Initialize Virtual Multiheap-fit's internal data with flags.
+ * @param flags  bitwise OR of VMF_FLAG_*
+ *
+ * The other parameters are the same as 'vmf_init'.
+ */
+vmf_t vmf_init_flags(size_t mem_min, size_t mem_max,
+    size_t element_nr_max, size_t total_sup, unsigned flags);
+
 /**
  * Finalize Virtual Multiheap-fit's internal data.
  */
@@ -56,10 +95,15 @@ void vmf_final(vmf_t vmf);
  * @param bid     allocating block id   [0, elem_nr_max)
  * @param length  required memory size  [mem_min, mem_max]
  *
+ * @return        0 on success, -1 on failure (errno is set)
+ *
  * The block id management must be done by the application.
  * The argument 'bid' must not comflict with other allocated block id.
+ * This function fails with ENOMEM if the hard limit would be exceeded
+ * (see 'vmf_set_limit'), or with the errno of the driver if a page
+ * cannot be allocated. The block is not allocated on failure.
  */
-void vmf_allocate(vmf_t vmf, blockid_t bid, size_t length);
+int vmf_allocate(vmf_t vmf, blockid_t bid, size_t length);
 
 /**
  * deallocate memory block
@@ -73,10 +117,14 @@ void vmf_deallocate(vmf_t vmf, blockid_t bid);
  * change size of allocated memory block
  * @param bid         resizing block id
  * @param new_length  new block length
+ * @return            0 on success, -1 on failure (errno is set)
  *
  * This is an experimental function.
+ * The old block is kept until the new one is allocated, so on failure the
+ * block remains as it was, except that it fails with ENOENT if the limit
+ * handler deallocates the block itself.
  */
-void vmf_reallocate(vmf_t vmf, blockid_t bid, size_t new_length);
+int vmf_reallocate(vmf_t vmf, blockid_t bid, size_t new_length);
 
 /**
  * dereference memory block
@@ -122,4 +170,82 @@ size_t vmf_dereference_and_length(vmf_t vmf, blockid_t bid, void** block_addr);
  */
 size_t vmf_using_mem(const vmf_t vmf);
 
+/**
+ * set limits of the size of pages used for blocks
+ * @param soft_limit  'handler' is called before exceeding it (0: no limit)
+ * @param hard_limit  allocating fails instead of exceeding it (0: no limit)
+ * @param handler     function called with the size after the allocation,
+ *                    or NULL
+ * @param arg         passed to 'handler'
+ *
+ * The limits are compared with 'vmf_heap_size' and checked only when a
+ * new physical page is needed. The handler can deallocate other blocks
+ * to keep the size, and it is not called recursively. Before failing,
+ * pooled pages are released to the driver.
+ */
+void vmf_set_limit(vmf_t vmf, size_t soft_limit, size_t hard_limit,
+  vmf_limit_handler_t handler, void* arg);
+
+/**
+ * calculate total size of physical pages allocated by the driver
+ *
+ * Unlike 'vmf_using_mem', this function takes constant time.
+ */
+size_t vmf_heap_size(const vmf_t vmf);
+
+/**
+ * get the numbers of system calls issued and blocks moved on allocating,
+ * deallocating and reallocating
+ * @param stat  the numbers are stored here
+ *
+ * The counters are shared by all instances in the process and never
+ * reset, so take the difference of two calls. System calls only issued
+ * in 'vmf_init' and 'vmf_final' are not counted. 'pool_bytes' is taken
+ * from the instance 'vmf' at the call.
+ */
+void vmf_get_stat(const vmf_t vmf, vmf_stat_t* stat);
+
+/**
+ * send the handle of a shared instance to another process
+ * @param socket_fd  connected UNIX domain socket
+ * @return           0 on success, -1 on failure (errno is set)
+ *
+ * The instance must be initialized with VMF_FLAG_SHARED. The driver file
+ * and the shared block information are passed by SCM_RIGHTS.
+ */
+int vmf_send_handle(const vmf_t vmf, int socket_fd);
+
+/**
+ * receive the handle sent by 'vmf_send_handle'
+ * @param socket_fd  connected UNIX domain socket
+ * @return           reader handler, or NULL on failure
+ *
+ * The reader can only dereference blocks. Pages are mapped read-only
+ * and lazily, and the mappings are dropped whenever the owner frees
+ * or relinks pages. The application has to synchronize the owner and
+ * readers by itself (e.g. by a lock in another shared memory).
+ */
+vmf_reader_t vmf_attach(int socket_fd);
+
+/**
+ * Finalize the reader
+ */
+void vmf_detach(vmf_reader_t reader);
+
+/**
+ * dereference memory block from another process
+ * @param bid  dereferencing block id
+ * @return     current address of the block in this process, or NULL
+ *
+ * The address is valid until the owner deallocates or moves the block.
+ */
+const void* vmf_reader_dereference(vmf_reader_t reader, blockid_t bid);
+
+/**
+ * calculate the length of the block from another process
+ * @param  bid  allocated block id
+ * @return      internal length of bid, or 0 if bid is not allocated
+ */
+size_t vmf_reader_length(vmf_reader_t reader, blockid_t bid);
+
 #endif /* VIRTUAL_MULTIHEAP_FIT_H__ */
@@ -23,6 +23,7 @@
 #define _GNU_SOURCE
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <math.h>
 #include <stdbool.h>
@@ -32,6 +33,7 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include "ioctl.h"
 #include "virtual_multiheap_fit.h"
@@ -157,6 +159,30 @@ VMF_INLINE size_t sc2size(size_t size_class);
 /* kernel module communication */
 /* ========================================================================== */
 
+/* Magic number written at the head of the shared region */
+#define SHARED_MAGIC 0x564d465348415245ULL  /* "VMFSHARE" */
+
+/* Header of the shared region. The region is laid out as
+   [header][block_info data][page_info data], each part page aligned. */
+typedef struct {
+  uint64_t magic;
+  /* Whole size of the shared region */
+  uint64_t region_size;
+  /* Offsets of block_info and page_info data in the region */
+  uint64_t block_info_offset;
+  uint64_t page_info_offset;
+  /* Parameters to decode block_info and page_info */
+  uint64_t block_nr_max;
+  uint64_t page_nr_max;
+  uint64_t physical_pagesize;
+  uint32_t blockid_byte;
+  uint32_t page_byte;
+  uint32_t ofs_byte;
+  /* Incremented whenever a page is freed or relinked. Readers drop their
+     mappings when this value changes. */
+  uint64_t epoch;
+} shared_header_t;
+
 /* Structure that stores information related to the driver */
 typedef struct {
   /* driver file */
@@ -168,21 +194,38 @@ typedef struct {
 
   /* physical pagesize. This value is not necessarily equal to 4096. */
   size_t physical_pagesize;
+  /* max number of pages in the driver */
+  size_t page_nr_max;
+
+  /* shared region (NULL if the instance is not shared) */
+  shared_header_t* shared;
+  /* file of the shared region */
+  int shared_fd;
+
+  /* If this flag is set, 'driver_fd' is a memory file which emulates
+     the kernel module in user space. */
+  bool userspace;
+  /* number of pages allocated from the driver */
+  size_t page_count;
 } module_t;
 
+/* Number of system calls issued in this process */
+static vmf_stat_t g_stat;
+
 /** Initialize module_t */
-VMF_INLINE module_t* module_init(size_t mem_max, size_t total_sup);
+VMF_INLINE module_t* module_init(size_t mem_max, size_t total_sup,
+  size_t extra_page_nr, bool userspace);
 /** Finalize module_t */
 VMF_INLINE void module_final(module_t* module);
 /** Calculate 'pid' page's address */
 VMF_INLINE void* module_get_address(const module_t* module, pageid_t pid);
-/** Create nextpage's mapping */
-VMF_INLINE void module_set_next(module_t* module,
+/** Create nextpage's mapping. Return false (errno is set) on failure */
+VMF_INLINE bool module_set_next(module_t* module,
   pageid_t main_page, pageid_t next_page);
 /** Destroy nextpage's mapping */
 VMF_INLINE void module_reset_next(module_t* module, pageid_t main_page);
-/** Allocate physical page */
-VMF_INLINE void module_allocate(module_t* module, pageid_t pid);
+/** Allocate physical page. Return false (errno is set) on failure */
+VMF_INLINE bool module_allocate(module_t* module, pageid_t pid);
 /** Deallocate physical page */
 VMF_INLINE void module_deallocate(module_t* module, pageid_t pid);
 /** Set physical page size */
@@ -192,6 +235,11 @@ VMF_INLINE size_t module_get_pagesize(module_t* module);
 
 /** Total using vmf_main in 'module' */
 VMF_INLINE size_t module_get_size(const module_t* module);
+/** Create the shared region and return the head of it */
+VMF_INLINE void* module_share(module_t* module,
+  size_t block_info_size, size_t page_info_size);
+/** Tell readers that mappings of pages have changed */
+VMF_INLINE void module_notify(module_t* module);
 
 /* ========================================================================== */
 /* pseudo_heap */
@@ -207,10 +255,15 @@ typedef struct {
   size_t page_size;
   /* shift num to multiple 'page_size' */
   size_t page_shift;
+  /* If this flag is set, the heap is placed on the fixed region
+     (e.g. the shared region) and never remapped. */
+  bool fixed;
 } pseudo_heap_t;
 
 /** Initialize pseudo_heap */
 VMF_INLINE pseudo_heap_t* pheap_init(void);
+/** Initialize pseudo_heap on the fixed region 'addr' */
+VMF_INLINE pseudo_heap_t* pheap_init_fixed(void* addr);
 /** Finalize pseudo_heap */
 VMF_INLINE void pheap_final(pseudo_heap_t* pheap);
 /** pheap->addr */
@@ -264,13 +317,22 @@ typedef struct {
   /* ELEM_INFO_SIZE(l, o) */
   size_t block_size;
 #endif /* FIXED_LENGTH_INTEGER */
+  /* true if 'data_start' is not malloced (e.g. in the shared region) */
+  bool fixed;
 } block_info_t;
 
-/** Constructor */
+/** Constructor. If 'region' is NULL, the data region is malloced. */
 #if FIXED_LENGTH_INTEGER
-VMF_INLINE block_info_t* block_info_init(size_t block_nr_max);
+VMF_INLINE block_info_t* block_info_init(size_t block_nr_max, void* region);
 #else  /* FIXED_LENGTH_INTEGER */
 VMF_INLINE block_info_t* block_info_init(
+  bytenum_t ofs_byte, bytenum_t page_byte, size_t block_nr_max, void* region);
+#endif /* FIXED_LENGTH_INTEGER */
+/** Size of the data region for 'block_nr_max' blocks */
+#if FIXED_LENGTH_INTEGER
+VMF_INLINE size_t block_info_data_size(size_t block_nr_max);
+#else  /* FIXED_LENGTH_INTEGER */
+VMF_INLINE size_t block_info_data_size(
   bytenum_t ofs_byte, bytenum_t page_byte, size_t block_nr_max);
 #endif /* FIXED_LENGTH_INTEGER */
 /** block_info->block_size */
@@ -371,11 +433,19 @@ typedef struct {
   size_t stack_size;
 } page_info_t;
 
-/** Constructor */
+/** Constructor. If 'region' is not NULL, page data is placed on it. */
 #if FIXED_LENGTH_INTEGER
-VMF_INLINE page_info_t* page_info_init(void);
+VMF_INLINE page_info_t* page_info_init(void* region);
 #else  /* FIXED_LENGTH_INTEGER */
-VMF_INLINE page_info_t* page_info_init(bytenum_t page_byte, bytenum_t ofs_byte);
+VMF_INLINE page_info_t* page_info_init(bytenum_t page_byte, bytenum_t ofs_byte,
+  void* region);
+#endif /* FIXED_LENGTH_INTEGER */
+/** Size of page data for 'page_nr_max' pages */
+#if FIXED_LENGTH_INTEGER
+VMF_INLINE size_t page_info_data_size(size_t page_nr_max);
+#else  /* FIXED_LENGTH_INTEGER */
+VMF_INLINE size_t page_info_data_size(bytenum_t page_byte, bytenum_t ofs_byte,
+  size_t page_nr_max);
 #endif /* FIXED_LENGTH_INTEGER */
 /** Destructor */
 VMF_INLINE void page_info_final(page_info_t* page_info);
@@ -388,6 +458,8 @@ VMF_INLINE bool page_info_push_freeid(page_info_t* page_info,
     pageid_t free_id);
 /** Get free page ID */
 VMF_INLINE pageid_t page_info_pop_freeid(page_info_t* page_info, bool* mapping);
+/** Push the page ID whose physical page has been deallocated */
+VMF_INLINE void push_stacktop(page_info_t* page_info, pageid_t free_id);
 /** Rewrite all information about the page 'page_id' */
 VMF_INLINE void page_info_replace(page_info_t* page_info,
   pageid_t page_id, pageid_t prev_id, pageid_t next_id,
@@ -446,7 +518,8 @@ typedef struct {
   size_class_t  mem_min;          /* a */
   /* max size of allocated vmf_main */
   size_class_t  mem_max;          /* b */
-  /* max number of vmf_main blocks */
+  /* max number of vmf_main blocks. The block id 'block_nr_max' is kept
+     for the new block of 'vmf_reallocate'. */
   blockid_t     block_nr_max;   /* m */
 
 #if !FIXED_LENGTH_INTEGER
@@ -473,8 +546,42 @@ typedef struct {
   page_info_t*  page_info;
   /* kernel module communication */
   module_t* module;
+
+  /* Limits of the size of pages (0 means no limit) */
+  size_t soft_limit;
+  size_t hard_limit;
+  /* Called when an allocation would exceed 'soft_limit' */
+  vmf_limit_handler_t limit_handler;
+  /* Argument of 'limit_handler' */
+  void* limit_arg;
+  /* true while 'limit_handler' is called */
+  bool in_limit_handler;
 } vmf_main_t;
 
+/* Read-only view of a shared instance in another process */
+typedef struct {
+  /* head of the shared region */
+  const shared_header_t* header;
+  /* epoch when the current mappings were created */
+  uint64_t epoch;
+  /* bit 0: main page is mapped, bit 1: next page is mapped */
+  uint8_t* mapped;
+  /* min size class of the owner */
+  size_class_t mem_min;
+#if !FIXED_LENGTH_INTEGER
+  /* byte num to represent block ID */
+  bytenum_t blockid_byte;
+  /* page ID which represents nullptr */
+  pageid_t null_page;
+#endif /* !FIXED_LENGTH_INTEGER */
+
+  /* views of the owner's structures */
+  module_t      module;
+  block_info_t  block_info;
+  pseudo_heap_t page_heap;
+  page_info_t   page_info;
+} vmf_reader_main_t;
+
 /* ========================================================================== */
 /* Commonly used functions */
 /* ========================================================================== */
@@ -642,8 +749,9 @@ VMF_INLINE size_t sc2size(size_t size_class) {
 /* kernel module communication */
 /* ========================================================================== */
 
-/** Create mapping from `index`(virtual) to `page_id`(physical) */
-VMF_INLINE void my_mmap(module_t* info, size_t index, pageid_t page_id);
+/** Create mapping from `index`(virtual) to `page_id`(physical).
+    Return false (errno is set) on failure */
+VMF_INLINE bool my_mmap(module_t* info, size_t index, pageid_t page_id);
 /** Destroy mapping from `index` */
 VMF_INLINE void my_munmap(module_t* info, size_t index);
 
@@ -661,7 +769,8 @@ VMF_INLINE void* get_address_by_index(const module_t* module,
   return ptr_offset(module->addr_min, pid * module->physical_pagesize);
 }
 
-VMF_INLINE module_t* module_init(size_t mem_max, size_t total_sup) {
+VMF_INLINE module_t* module_init(size_t mem_max, size_t total_sup,
+    size_t extra_page_nr, bool userspace) {
   int err;
   size_t mmap_size;
   size_t physical_pagesize;
@@ -670,12 +779,25 @@ VMF_INLINE module_t* module_init(size_t mem_max, size_t total_sup) {
 
   module = (module_t*) safe_malloc(sizeof(module_t));
 
-  module->driver_fd = file_open(DEVICE_NAME);
+  module->userspace  = userspace;
+  module->page_count = 0;
+  if (userspace) {
+    module->driver_fd = memfd_create("vmf_pages", MFD_CLOEXEC);
+    if (module->driver_fd < 0) {
+      perror("memfd_create");
+      exit(EXIT_FAILURE);
+    }
+  } else {
+    module->driver_fd = file_open(DEVICE_NAME);
+  }
   module_set_pagesize(module, mem_max);
 
   physical_pagesize = module->physical_pagesize;
   mmap_size = (total_sup * 4 + physical_pagesize - 1)
     & ~(physical_pagesize - 1);
+  /* Pages which are not filled (e.g. head pages of each size class)
+     are needed in addition to 'total_sup' */
+  mmap_size += extra_page_nr * physical_pagesize;
   module->addr_min = mmap64(0, 2 * mmap_size, PROT_NONE,
     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
   if (module->addr_min == MAP_FAILED) {
@@ -684,18 +806,32 @@ VMF_INLINE module_t* module_init(size_t mem_max, size_t total_sup) {
   }
 
   page_nr_max = mmap_size / module->physical_pagesize;
-  err = ioctl(module->driver_fd, ALLOCATOR_IOC_RESIZE, &page_nr_max);
+  if (userspace) {
+    /* The file is sparse, so only allocated pages consume memory */
+    err = ftruncate(module->driver_fd, mmap_size);
+  } else {
+    err = ioctl(module->driver_fd, ALLOCATOR_IOC_RESIZE, &page_nr_max);
+  }
   if (err < 0) {
     perror("ioctl alloc");
     exit(EXIT_FAILURE);
   }
 
   module->addr_max = ptr_offset(module->addr_min, 2 * mmap_size);
+  module->page_nr_max = page_nr_max;
+  module->shared = NULL;
+  module->shared_fd = -1;
 
   return module;
 }
 
 VMF_INLINE void module_final(module_t* module) {
+  if (module->shared != NULL) {
+    munmap(module->shared, module->shared->region_size);
+    close(module->shared_fd);
+  }
+  munmap(module->addr_min,
+    (uint8_t*)module->addr_max - (uint8_t*)module->addr_min);
   close(module->driver_fd);
   free(module);
 }
@@ -704,34 +840,56 @@ VMF_INLINE void* module_get_address(const module_t* module, pageid_t pid) {
   return get_address_by_index(module, main_index(pid));
 }
 
-VMF_INLINE void module_set_next(module_t* module,
+VMF_INLINE bool module_set_next(module_t* module,
     pageid_t main_page, pageid_t next_page) {
-  my_mmap(module, sub_index(main_page), next_page);
+  module_notify(module);
+  return my_mmap(module, sub_index(main_page), next_page);
 }
 
 VMF_INLINE void module_reset_next(module_t* module, pageid_t main_page) {
+  module_notify(module);
   my_munmap(module, sub_index(main_page));
 }
 
-VMF_INLINE void module_allocate(module_t* module, pageid_t pid) {
+VMF_INLINE bool module_allocate(module_t* module, pageid_t pid) {
   int err;
   unsigned long page_id_arg = pid;
 
-  err = ioctl(module->driver_fd, ALLOCATOR_IOC_ALLOC, &page_id_arg);
-  if (err < 0) {
-    perror(__FUNCTION__);
-    exit(EXIT_FAILURE);
+  g_stat.driver_nr++;
+  if (module->userspace) {
+    err = fallocate(module->driver_fd, 0,
+      (off_t)pid * module->physical_pagesize, module->physical_pagesize);
+  } else {
+    err = ioctl(module->driver_fd, ALLOCATOR_IOC_ALLOC, &page_id_arg);
   }
+  if (err < 0) return false;
+  module->page_count++;
 
-  my_mmap(module, main_index(pid), pid);
+  if (!my_mmap(module, main_index(pid), pid)) {
+    err = errno;
+    module_deallocate(module, pid);
+    errno = err;
+    return false;
+  }
+  return true;
 }
 
 VMF_INLINE void module_deallocate(module_t* module, pageid_t pid) {
   unsigned long page_id_arg = pid;
   int err;
 
+  module_notify(module);
   my_munmap(module, main_index(pid));
-  err = ioctl(module->driver_fd, ALLOCATOR_IOC_DEALLOC, &page_id_arg);
+  module->page_count--;
+  g_stat.driver_nr++;
+  if (module->userspace) {
+    /* Give the page back to the system */
+    err = fallocate(module->driver_fd,
+      FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+      (off_t)pid * module->physical_pagesize, module->physical_pagesize);
+  } else {
+    err = ioctl(module->driver_fd, ALLOCATOR_IOC_DEALLOC, &page_id_arg);
+  }
   if (err < 0) {
     perror(__FUNCTION__);
     exit(EXIT_FAILURE);
@@ -748,7 +906,9 @@ VMF_INLINE void module_set_pagesize(module_t* module, size_t max_size) {
     max_size /= 2;
     physical_pagesize *= 2;
   }
-  ioctl(module->driver_fd, ALLOCATOR_IOC_SET_PAGESIZE_ORDER, &order);
+  if (!module->userspace) {
+    ioctl(module->driver_fd, ALLOCATOR_IOC_SET_PAGESIZE_ORDER, &order);
+  }
   module->physical_pagesize = physical_pagesize;
 }
 
@@ -760,24 +920,77 @@ VMF_INLINE size_t module_get_pagesize(module_t* module) {
 VMF_INLINE size_t module_get_size(const module_t* module) {
   unsigned long driver_using_size;
 
-  ioctl(module->driver_fd, ALLOCATOR_IOC_TOTAL_SIZE, &driver_using_size);
+  if (module->userspace) {
+    /* same as the kernel module except the page table */
+    driver_using_size = module->page_count * module->physical_pagesize;
+  } else {
+    ioctl(module->driver_fd, ALLOCATOR_IOC_TOTAL_SIZE, &driver_using_size);
+  }
   return sizeof(module_t) + driver_using_size;
 }
 
-VMF_INLINE void my_mmap(module_t* module, size_t index, pageid_t pid) {
-  void* addr = mmap64(
+VMF_INLINE void* module_share(module_t* module,
+    size_t block_info_size, size_t page_info_size) {
+  shared_header_t* header;
+  size_t header_size = (sizeof(shared_header_t) + PAGE_SIZE - 1)
+    & ~(PAGE_SIZE - 1);
+  size_t region_size;
+
+  block_info_size = (block_info_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  page_info_size  = (page_info_size  + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  region_size = header_size + block_info_size + page_info_size;
+
+  module->shared_fd = memfd_create("vmf_shared", MFD_CLOEXEC);
+  if (module->shared_fd < 0) {
+    perror("memfd_create");
+    exit(EXIT_FAILURE);
+  }
+  /* Pages of the region are not consumed until they are touched */
+  if (ftruncate(module->shared_fd, region_size) < 0) {
+    perror("ftruncate");
+    exit(EXIT_FAILURE);
+  }
+  header = mmap(0, region_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+    module->shared_fd, 0);
+  if (header == MAP_FAILED) {
+    perror("module_share");
+    exit(EXIT_FAILURE);
+  }
+
+  header->magic = SHARED_MAGIC;
+  header->region_size = region_size;
+  header->block_info_offset = header_size;
+  header->page_info_offset  = header_size + block_info_size;
+  header->page_nr_max = module->page_nr_max;
+  header->physical_pagesize = module->physical_pagesize;
+  header->epoch = 0;
+  module->shared = header;
+  return header;
+}
+
+VMF_INLINE void module_notify(module_t* module) {
+  if (module->shared != NULL) {
+    __atomic_add_fetch(&module->shared->epoch, 1, __ATOMIC_RELEASE);
+  }
+}
+
+VMF_INLINE bool my_mmap(module_t* module, size_t index, pageid_t pid) {
+  void* addr;
+
+  g_stat.mmap_nr++;
+  addr = mmap64(
       get_address_by_index(module, index),
       module->physical_pagesize, PROT_READ | PROT_WRITE,
       MAP_SHARED | MAP_FIXED, module->driver_fd,
       pid * module->physical_pagesize);
-  if (addr == MAP_FAILED) {
-    perror(__FUNCTION__);
-    exit(EXIT_FAILURE);
-  }
+  return addr != MAP_FAILED;
 }
 
 VMF_INLINE void my_munmap(module_t* module, size_t index) {
-  void* ret_addr =
+  void* ret_addr;
+
+  g_stat.unmap_nr++;
+  ret_addr =
     mmap64(
       get_address_by_index(module, index), module->physical_pagesize,
       PROT_NONE, MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS | MAP_NORESERVE,
@@ -820,12 +1033,24 @@ VMF_INLINE pseudo_heap_t* pheap_init(void) {
     page_size /= 2;
   }
   pheap->page_shift = page_shift;
+  pheap->fixed = false;
 
   return pheap;
 }
 
+VMF_INLINE pseudo_heap_t* pheap_init_fixed(void* addr) {
+  pseudo_heap_t* pheap = pheap_init();
+
+  munmap(pheap->addr, pheap->page_size);
+  pheap->addr  = addr;
+  pheap->fixed = true;
+  return pheap;
+}
+
 VMF_INLINE void pheap_final(pseudo_heap_t* pheap) {
-  munmap(pheap->addr, pheap->page_num << pheap->page_shift);
+  if (!pheap->fixed) {
+    munmap(pheap->addr, pheap->page_num << pheap->page_shift);
+  }
   free(pheap);
 }
 
@@ -840,6 +1065,12 @@ VMF_INLINE void pheap_resize(pseudo_heap_t* pheap, size_t new_length) {
   size_t new_page_num = calc_page_num(pheap, new_length);
 
   if (new_page_num == old_page_num) return;
+  if (pheap->fixed) {
+    /* The region is already reserved. Only the size is recorded. */
+    pheap->page_num = new_page_num;
+    return;
+  }
+  g_stat.mremap_nr++;
   pheap->addr = mremap(heap_addr, old_page_num << page_shift,
       new_page_num << page_shift, MREMAP_MAYMOVE);
   pheap->page_num = new_page_num;
@@ -858,10 +1089,21 @@ VMF_INLINE size_t pheap_get_size(const pseudo_heap_t* pheap) {
 /* ========================================================================== */
 
 #if FIXED_LENGTH_INTEGER
-VMF_INLINE block_info_t* block_info_init(size_t block_nr_max)
+VMF_INLINE size_t block_info_data_size(size_t block_nr_max) {
+  return block_nr_max * sizeof(block_data_t);
+}
+#else  /* FIXED_LENGTH_INTEGER */
+VMF_INLINE size_t block_info_data_size(bytenum_t ofs_byte,
+    bytenum_t page_byte, size_t block_nr_max) {
+  return block_nr_max * ELEMENT_BLOCK_SIZE(ofs_byte, page_byte);
+}
+#endif /* FIXED_LENGTH_INTEGER */
+
+#if FIXED_LENGTH_INTEGER
+VMF_INLINE block_info_t* block_info_init(size_t block_nr_max, void* region)
 #else  /* FIXED_LENGTH_INTEGER */
 VMF_INLINE block_info_t* block_info_init(bytenum_t ofs_byte,
-    bytenum_t page_byte, size_t block_nr_max)
+    bytenum_t page_byte, size_t block_nr_max, void* region)
 #endif /* FIXED_LENGTH_INTEGER */
 {
   block_info_t* block_info;
@@ -872,14 +1114,15 @@ VMF_INLINE block_info_t* block_info_init(bytenum_t ofs_byte,
 
   block_info->block_nr = block_nr_max;
 #if FIXED_LENGTH_INTEGER
-  data_size = block_nr_max * sizeof(block_data_t);
+  data_size = block_info_data_size(block_nr_max);
 #else  /* FIXED_LENGTH_INTEGER */
-  data_size = block_nr_max * ELEMENT_BLOCK_SIZE(ofs_byte, page_byte);
+  data_size = block_info_data_size(ofs_byte, page_byte, block_nr_max);
   block_info->page_byte   = page_byte;
   block_info->ofs_byte    = ofs_byte;
   block_info->block_size  = ELEMENT_BLOCK_SIZE(ofs_byte, page_byte);
 #endif /* FIXED_LENGTH_INTEGER */
-  block_info->data_start = safe_malloc(data_size);
+  block_info->fixed = (region != NULL);
+  block_info->data_start = (region != NULL ? region : safe_malloc(data_size));
   /* Initialize page to 'null_page' */
   memset(block_info->data_start, 0xff, data_size);
 
@@ -895,7 +1138,7 @@ VMF_INLINE size_t block_info_block_size(const block_info_t* block_info) {
 }
 
 VMF_INLINE void block_info_final(block_info_t* block_info) {
-  free(block_info->data_start);
+  if (!block_info->fixed) free(block_info->data_start);
   block_info->data_start = NULL;
   free(block_info);
 }
@@ -1156,10 +1399,21 @@ VMF_INLINE pageid_t pop_stacktop(page_info_t* page_info) {
 }
 
 #if FIXED_LENGTH_INTEGER
-VMF_INLINE page_info_t* page_info_init(void)
+VMF_INLINE size_t page_info_data_size(size_t page_nr_max) {
+  return page_nr_max * sizeof(page_data_t);
+}
+#else  /* FIXED_LENGTH_INTEGER */
+VMF_INLINE size_t page_info_data_size(bytenum_t page_byte, bytenum_t ofs_byte,
+    size_t page_nr_max) {
+  return page_nr_max * PAGE_INFO_SIZE(page_byte, ofs_byte);
+}
+#endif /* FIXED_LENGTH_INTEGER */
+
+#if FIXED_LENGTH_INTEGER
+VMF_INLINE page_info_t* page_info_init(void* region)
 #else  /* FIXED_LENGTH_INTEGER */
 VMF_INLINE page_info_t* page_info_init(bytenum_t page_byte,
-    bytenum_t ofs_byte)
+    bytenum_t ofs_byte, void* region)
 #endif /* FIXED_LENGTH_INTEGER */
 {
   page_info_t* page_info;
@@ -1167,7 +1421,8 @@ VMF_INLINE page_info_t* page_info_init(bytenum_t page_byte,
   page_info = (page_info_t*) malloc(sizeof(page_info_t));
   if (page_info == NULL) exit(EXIT_FAILURE);
 
-  page_info->data_heap   = pheap_init();
+  page_info->data_heap   =
+    (region != NULL ? pheap_init_fixed(region) : pheap_init());
   page_info->page_num    = 0;
 
 #if !FIXED_LENGTH_INTEGER
@@ -1194,9 +1449,6 @@ VMF_INLINE void page_info_final(page_info_t* page_info) {
 
 VMF_INLINE bool page_info_push_freeid(page_info_t* page_info,
     pageid_t free_id) {
-  size_t new_heap_size;
-  void* stacktop_addr;
-
 #if ENABLE_HEURISTIC
   if (page_info->pool_nr < POOL_PAGE_NUM) {
     page_info->pool_stack[page_info->pool_nr++] = free_id;
@@ -1204,23 +1456,29 @@ VMF_INLINE bool page_info_push_freeid(page_info_t* page_info,
   } else
 #endif /* ENABLE_HEURISTIC */
   {
-    page_info->stack_size++;
+    push_stacktop(page_info, free_id);
+    return false;
+  }
+}
+
+VMF_INLINE void push_stacktop(page_info_t* page_info, pageid_t free_id) {
+  size_t new_heap_size;
+  void* stacktop_addr;
+
+  page_info->stack_size++;
 #if FIXED_LENGTH_INTEGER
-    new_heap_size = page_info->stack_size * sizeof(pageid_t);
-    pheap_resize(page_info->id_heap, new_heap_size);
-    stacktop_addr = ptr_offset(pheap_addr(page_info->id_heap),
-      new_heap_size - sizeof(pageid_t));
-    *(pageid_t*)stacktop_addr = free_id;
+  new_heap_size = page_info->stack_size * sizeof(pageid_t);
+  pheap_resize(page_info->id_heap, new_heap_size);
+  stacktop_addr = ptr_offset(pheap_addr(page_info->id_heap),
+    new_heap_size - sizeof(pageid_t));
+  *(pageid_t*)stacktop_addr = free_id;
 #else  /* FIXED_LENGTH_INTEGER */
-    new_heap_size = page_info->stack_size * page_info->page_byte;
-    pheap_resize(page_info->id_heap, new_heap_size);
-    stacktop_addr = ptr_offset(pheap_addr(page_info->id_heap),
-      new_heap_size - page_info->page_byte);
-    put_int(stacktop_addr, page_info->page_byte, free_id);
+  new_heap_size = page_info->stack_size * page_info->page_byte;
+  pheap_resize(page_info->id_heap, new_heap_size);
+  stacktop_addr = ptr_offset(pheap_addr(page_info->id_heap),
+    new_heap_size - page_info->page_byte);
+  put_int(stacktop_addr, page_info->page_byte, free_id);
 #endif /* FIXED_LENGTH_INTEGER */
-
-    return false;
-  }
 }
 
 VMF_INLINE pageid_t page_info_pop_freeid(page_info_t* page_info,
@@ -1537,10 +1795,10 @@ VMF_INLINE bytenum_t required_byte(uint64_t num);
 VMF_INLINE void* get_page_head_address(vmf_main_t* vmf_main,
     size_class_t size_class);
 /** Insert new page to the head */
-VMF_INLINE pageid_t insert_page(
+VMF_INLINE bool insert_page(
     vmf_main_t* vmf_main,
     void* head_addr, pageid_t old_head_id,
-    offset_t page_offset, size_t size_class);
+    offset_t page_offset, size_t size_class, pageid_t* new_head_id);
 /** Delete head page */
 VMF_INLINE void remove_page(vmf_main_t* vmf_main,
     pageid_t removepage_id, void* headpage_addr, void* headpage_block);
@@ -1556,14 +1814,35 @@ VMF_INLINE void put_datahead_id(
     offset_t ofs, blockid_t bid);
 /** Check whether the block 'bid' is allocated or not */
 VMF_INLINE bool vmf_is_null(vmf_main_t* vmf_main, blockid_t bid);
+/** Check whether the block 'bid' has a page */
+VMF_INLINE bool vmf_has_page(vmf_main_t* vmf_main, blockid_t bid);
+/** Read the head page of a size class and its offset.
+    Return true if the block of 'real_size' fits in the head page. */
+VMF_INLINE bool find_position(vmf_main_t* vmf_main, void* head_addr,
+  size_t real_size, pageid_t* page_id, offset_t* page_offset);
+/** Check whether a new page can be allocated under the limits.
+    The limit handler is called if the soft limit would be exceeded. */
+VMF_INLINE bool limit_admit(vmf_main_t* vmf_main);
+/** Unmap all pages kept in the pool */
+VMF_INLINE void release_pool(vmf_main_t* vmf_main);
 
 vmf_t vmf_init(size_t mem_min, size_t mem_max,
     size_t block_nr_max, size_t total_sup) {
+  return vmf_init_flags(mem_min, mem_max, block_nr_max, total_sup, 0);
+}
+
+vmf_t vmf_init_flags(size_t mem_min, size_t mem_max,
+    size_t block_nr_max, size_t total_sup, unsigned flags) {
   unsigned range_length;
+  size_t extra_page_nr;
   size_t spell_size;
   vmf_main_t* vmf_main;
+  void* block_region = NULL;
+  void* page_region  = NULL;
+  shared_header_t* header;
 #if !FIXED_LENGTH_INTEGER
-  bytenum_t blockid_byte = required_byte(block_nr_max + 1);
+  /* ids up to 'block_nr_max' (the spare one) and the null block */
+  bytenum_t blockid_byte = required_byte(block_nr_max + 2);
   bytenum_t page_byte = required_byte(
     (blockid_byte * block_nr_max + total_sup + (PAGE_SIZE - 1)) / PAGE_SIZE);
   bytenum_t ofs_byte;
@@ -1579,6 +1858,11 @@ vmf_t vmf_init(size_t mem_min, size_t mem_max,
   vmf_main->mem_min        = mem_min;
   vmf_main->mem_max        = mem_max;
   vmf_main->block_nr_max   = block_nr_max;
+  vmf_main->soft_limit     = 0;
+  vmf_main->hard_limit     = 0;
+  vmf_main->limit_handler  = NULL;
+  vmf_main->limit_arg      = NULL;
+  vmf_main->in_limit_handler = false;
 
   range_length = mem_max - mem_min + 1;
 #if FIXED_LENGTH_INTEGER
@@ -1594,18 +1878,51 @@ vmf_t vmf_init(size_t mem_min, size_t mem_max,
   memset(vmf_main->page_heads, 0xff, page_byte * range_length);
 #endif /* FIXED_LENGTH_INTEGER */
 
-  vmf_main->module  = module_init(sc2size(mem_max) + sizeof(blockid_t), total_sup);
+  /* Each size class has a head page which may be almost empty */
+#if ENABLE_HEURISTIC
+  extra_page_nr = range_length + POOL_PAGE_NUM;
+#else  /* ENABLE_HEURISTIC */
+  extra_page_nr = range_length;
+#endif /* ENABLE_HEURISTIC */
+  vmf_main->module  = module_init(sc2size(mem_max) + sizeof(blockid_t),
+    total_sup, extra_page_nr, (flags & VMF_FLAG_USERSPACE) != 0);
 
   /* block_info cannot be initialized unless ofs_byte is determined */
   vmf_main->physical_pagesize = module_get_pagesize(vmf_main->module);
-#if FIXED_LENGTH_INTEGER
-  vmf_main->block_info = block_info_init(block_nr_max);
-  vmf_main->page_info  = page_info_init();
-#else  /* FIXED_LENGTH_INTEGER */
+#if !FIXED_LENGTH_INTEGER
   ofs_byte = required_byte(vmf_main->physical_pagesize);
   vmf_main->ofs_byte = ofs_byte;
-  vmf_main->block_info = block_info_init(ofs_byte, page_byte, block_nr_max);
-  vmf_main->page_info = page_info_init(page_byte, ofs_byte);
+#endif /* !FIXED_LENGTH_INTEGER */
+
+  if (flags & VMF_FLAG_SHARED) {
+#if FIXED_LENGTH_INTEGER
+    header = module_share(vmf_main->module,
+      block_info_data_size(block_nr_max + 1),
+      page_info_data_size(vmf_main->module->page_nr_max));
+    header->blockid_byte = sizeof(blockid_t);
+    header->page_byte    = sizeof(pageid_t);
+    header->ofs_byte     = sizeof(offset_t);
+#else  /* FIXED_LENGTH_INTEGER */
+    header = module_share(vmf_main->module,
+      block_info_data_size(ofs_byte, page_byte, block_nr_max + 1),
+      page_info_data_size(page_byte, ofs_byte,
+        vmf_main->module->page_nr_max));
+    header->blockid_byte = blockid_byte;
+    header->page_byte    = page_byte;
+    header->ofs_byte     = ofs_byte;
+#endif /* FIXED_LENGTH_INTEGER */
+    header->block_nr_max = block_nr_max + 1;
+    block_region = ptr_offset(header, header->block_info_offset);
+    page_region  = ptr_offset(header, header->page_info_offset);
+  }
+
+#if FIXED_LENGTH_INTEGER
+  vmf_main->block_info = block_info_init(block_nr_max + 1, block_region);
+  vmf_main->page_info  = page_info_init(page_region);
+#else  /* FIXED_LENGTH_INTEGER */
+  vmf_main->block_info =
+    block_info_init(ofs_byte, page_byte, block_nr_max + 1, block_region);
+  vmf_main->page_info = page_info_init(page_byte, ofs_byte, page_region);
 #endif /* FIXED_LENGTH_INTEGER */
 
 #ifdef ENABLE_HEURISTIC
@@ -1632,7 +1949,7 @@ void vmf_final(vmf_t vmf) {
   module_final(vmf_main->module);
 }
 
-void vmf_allocate(vmf_t vmf, blockid_t bid, size_t length) {
+int vmf_allocate(vmf_t vmf, blockid_t bid, size_t length) {
   vmf_main_t* vmf_main = (vmf_main_t*) vmf;
   void* head_addr;
   pageid_t page_id;
@@ -1645,11 +1962,12 @@ void vmf_allocate(vmf_t vmf, blockid_t bid, size_t length) {
 #endif /* FIXED_LENGTH_INTEGER */
 
   head_addr = get_page_head_address(vmf_main, size_class);
-#if FIXED_LENGTH_INTEGER
-  page_id = *(pageid_t*)head_addr;
-#else /* FIXED_LENGTH_INTEGER */
-  page_id = get_int(head_addr, vmf_main->page_byte);
-#endif /* FIXED_LENGTH_INTEGER */
+  if (!find_position(vmf_main, head_addr, real_size,
+      &page_id, &page_offset)) {
+    if (!limit_admit(vmf_main)) return -1;
+    /* The limit handler might have changed the head page */
+    find_position(vmf_main, head_addr, real_size, &page_id, &page_offset);
+  }
 
 #if FIXED_LENGTH_INTEGER
   if (page_id == (pageid_t)(-1))
@@ -1659,22 +1977,24 @@ void vmf_allocate(vmf_t vmf, blockid_t bid, size_t length) {
   {
     /* If head page is null page, new page should be inserted there */
     page_offset = vmf_main->physical_pagesize - real_size;
-    page_id = insert_page(vmf_main, head_addr,
-      page_id, page_offset, size_class);
+    if (!insert_page(vmf_main, head_addr,
+        page_id, page_offset, size_class, &page_id)) {
+      return -1;
+    }
+  } else if (page_offset >= real_size) {
+    page_offset -= real_size;
+    page_info_put_offset(vmf_main->page_info, page_id, page_offset);
   } else {
-    page_offset = page_info_get_offset(vmf_main->page_info, page_id);
-    if (page_offset >= real_size) {
-      page_offset -= real_size;
-      page_info_put_offset(vmf_main->page_info, page_id, page_offset);
-    } else {
-      page_offset = page_offset + vmf_main->physical_pagesize - real_size;
-      page_id = insert_page(vmf_main, head_addr, page_id,
-          page_offset, size_class);
+    page_offset = page_offset + vmf_main->physical_pagesize - real_size;
+    if (!insert_page(vmf_main, head_addr, page_id,
+        page_offset, size_class, &page_id)) {
+      return -1;
     }
   }
 
   block_info_push(vmf_main->block_info, bid, page_offset, page_id);
   put_datahead_id(vmf_main, page_id, page_offset, bid);
+  return 0;
 }
 
 void vmf_deallocate(vmf_t vmf, blockid_t bid) {
@@ -1731,12 +2051,16 @@ void vmf_deallocate(vmf_t vmf, blockid_t bid) {
 #if COPYLESS
 #if FIXED_LENGTH_INTEGER
     *(blockid_t*)dst_block_addr = *(blockid_t*)headpage_block_addr;
+    g_stat.moved_bytes += sizeof(blockid_t);
 #else /* FIXED_LENGTH_INTEGER */
     my_memcpy(dst_block_addr, headpage_block_addr, vmf_main->blockid_byte);
+    g_stat.moved_bytes += vmf_main->blockid_byte;
 #endif /* FIXED_LENGTH_INTEGER */
 #else  /* COPYLESS */
     my_memcpy(dst_block_addr, headpage_block_addr, real_length);
+    g_stat.moved_bytes += real_length;
 #endif
+    g_stat.moved_nr++;
     my_memcpy(head_block_data_addr, block_data_addr,
         block_info_block_size(vmf_main->block_info));
   }
@@ -1752,17 +2076,18 @@ void vmf_deallocate(vmf_t vmf, blockid_t bid) {
 }
 
 
-void vmf_reallocate(vmf_t vmf, blockid_t bid, size_t size) {
+int vmf_reallocate(vmf_t vmf, blockid_t bid, size_t size) {
   vmf_main_t* vmf_main = (vmf_main_t*) vmf;
+  blockid_t spare_bid = vmf_main->block_nr_max;
   pageid_t page_id;
+  offset_t page_offset;
   size_class_t block_sc;
-  size_class_t copy_size;
-  void* buffer;
 
   if (size == 0) {
     vmf_deallocate(vmf_main, bid);
+    return 0;
   } else if
-#ifdef FIXED_LENGTH_INTEGER
+#if FIXED_LENGTH_INTEGER
     ((page_id = block_info_get_pid(vmf_main->block_info, bid)) ==
       (pageid_t)(-1))
 #else
@@ -1770,19 +2095,33 @@ void vmf_reallocate(vmf_t vmf, blockid_t bid, size_t size) {
       vmf_main->null_page)
 #endif
   {
-    vmf_allocate(vmf_main, bid, size);
+    return vmf_allocate(vmf_main, bid, size);
   } else {
     size = sc2size(size2sc(size));
     block_sc = sc2size(page_info_get_sc(vmf_main->page_info, page_id));
-    if (size == block_sc) return;
-
-    copy_size = VMF_MIN(size, block_sc);
-    buffer = malloc(copy_size);
-    my_memcpy(buffer, vmf_dereference(vmf_main, bid), copy_size);
+    if (size == block_sc) return 0;
+
+    /* The new block is allocated by the spare id, so the block is kept
+       as it was until the allocation succeeds. */
+    if (vmf_allocate(vmf_main, spare_bid, size) < 0) return -1;
+    /* The limit handler might have deallocated the block itself */
+    if (!vmf_has_page(vmf_main, bid)) {
+      vmf_deallocate(vmf_main, spare_bid);
+      errno = ENOENT;
+      return -1;
+    }
+    my_memcpy(vmf_dereference(vmf_main, spare_bid),
+      vmf_dereference(vmf_main, bid), VMF_MIN(size, block_sc));
     vmf_deallocate(vmf_main, bid);
-    vmf_allocate(vmf_main, bid, size);
-    my_memcpy(vmf_dereference(vmf_main, bid), buffer, copy_size);
-    free(buffer);
+
+    /* Give the new block the id of the block */
+    block_info_get_all(vmf_main->block_info, spare_bid,
+      &page_offset, &page_id);
+    block_info_push(vmf_main->block_info, bid, page_offset, page_id);
+    put_datahead_id(vmf_main, page_id, page_offset, bid);
+    block_info_fastput_null_page(vmf_main->block_info,
+      block_info_get_block_ptr(vmf_main->block_info, spare_bid));
+    return 0;
   }
 }
 
@@ -1826,6 +2165,27 @@ size_t vmf_length(vmf_t vmf, blockid_t bid) {
   return sc2size(page_info_get_sc(vmf_main->page_info, page_id));
 }
 
+size_t vmf_dereference_and_length(vmf_t vmf, blockid_t bid,
+    void** block_addr) {
+  vmf_main_t* vmf_main = (vmf_main_t*) vmf;
+  offset_t ofs;
+  pageid_t page_id;
+
+  if (vmf_is_null(vmf_main, bid)) {
+    *block_addr = NULL;
+    return 0;
+  }
+  block_info_get_all(vmf_main->block_info, bid, &ofs, &page_id);
+#if FIXED_LENGTH_INTEGER
+  *block_addr = ptr_offset(get_data_address(vmf_main, page_id, ofs),
+    sizeof(blockid_t));
+#else /* FIXED_LENGTH_INTEGER */
+  *block_addr = ptr_offset(get_data_address(vmf_main, page_id, ofs),
+    vmf_main->blockid_byte);
+#endif /* FIXED_LENGTH_INTEGER */
+  return sc2size(page_info_get_sc(vmf_main->page_info, page_id));
+}
+
 size_t vmf_using_mem(vmf_t vmf) {
   vmf_main_t* vmf_main = (vmf_main_t*) vmf;
   return sizeof(vmf_main_t)
@@ -1839,6 +2199,355 @@ size_t vmf_using_mem(vmf_t vmf) {
     + module_get_size(vmf_main->module);
 }
 
+void vmf_set_limit(vmf_t vmf, size_t soft_limit, size_t hard_limit,
+    vmf_limit_handler_t handler, void* arg) {
+  vmf_main_t* vmf_main = (vmf_main_t*) vmf;
+
+  vmf_main->soft_limit    = soft_limit;
+  vmf_main->hard_limit    = hard_limit;
+  vmf_main->limit_handler = handler;
+  vmf_main->limit_arg     = arg;
+}
+
+void vmf_get_stat(const vmf_t vmf, vmf_stat_t* stat) {
+  const vmf_main_t* vmf_main = (const vmf_main_t*) vmf;
+
+  *stat = g_stat;
+  stat->pool_bytes =
+    vmf_main->page_info->pool_nr * vmf_main->physical_pagesize;
+}
+
+size_t vmf_heap_size(const vmf_t vmf) {
+  const vmf_main_t* vmf_main = (const vmf_main_t*) vmf;
+  return vmf_main->module->page_count * vmf_main->physical_pagesize;
+}
+
+VMF_INLINE bool find_position(vmf_main_t* vmf_main, void* head_addr,
+    size_t real_size, pageid_t* page_id, offset_t* page_offset) {
+#if FIXED_LENGTH_INTEGER
+  *page_id = *(pageid_t*)head_addr;
+  if (*page_id == (pageid_t)(-1)) return false;
+#else /* FIXED_LENGTH_INTEGER */
+  *page_id = get_int(head_addr, vmf_main->page_byte);
+  if (*page_id == vmf_main->null_page) return false;
+#endif /* FIXED_LENGTH_INTEGER */
+  *page_offset = page_info_get_offset(vmf_main->page_info, *page_id);
+  return *page_offset >= real_size;
+}
+
+VMF_INLINE void release_pool(vmf_main_t* vmf_main) {
+#if ENABLE_HEURISTIC
+  page_info_t* page_info = vmf_main->page_info;
+  pageid_t page_id;
+
+  while (page_info->pool_nr > 0) {
+    page_id = page_info->pool_stack[--page_info->pool_nr];
+    module_deallocate(vmf_main->module, page_id);
+    push_stacktop(page_info, page_id);
+  }
+#endif /* ENABLE_HEURISTIC */
+}
+
+VMF_INLINE bool limit_admit(vmf_main_t* vmf_main) {
+  size_t required_size;
+
+  if (vmf_main->soft_limit == 0 && vmf_main->hard_limit == 0) return true;
+#if ENABLE_HEURISTIC
+  /* A pooled page is still mapped, so reusing it costs nothing */
+  if (vmf_main->page_info->pool_nr > 0) return true;
+#endif /* ENABLE_HEURISTIC */
+
+  required_size = vmf_heap_size(vmf_main) + vmf_main->physical_pagesize;
+  if (vmf_main->soft_limit != 0 && required_size > vmf_main->soft_limit
+      && vmf_main->limit_handler != NULL && !vmf_main->in_limit_handler) {
+    /* The handler may deallocate blocks */
+    vmf_main->in_limit_handler = true;
+    vmf_main->limit_handler(vmf_main, required_size, vmf_main->limit_arg);
+    vmf_main->in_limit_handler = false;
+    required_size = vmf_heap_size(vmf_main) + vmf_main->physical_pagesize;
+  }
+
+  if (vmf_main->hard_limit != 0 && required_size > vmf_main->hard_limit) {
+    /* Pooled pages are given back before giving up */
+    release_pool(vmf_main);
+    required_size = vmf_heap_size(vmf_main) + vmf_main->physical_pagesize;
+    if (required_size > vmf_main->hard_limit) {
+      errno = ENOMEM;
+      return false;
+    }
+  }
+  return true;
+}
+
+/* ========================================================================== */
+/* shared instance */
+/* ========================================================================== */
+
+/** Map the page 'pid' (or its next page if 'sub' is set) read-only */
+VMF_INLINE bool reader_map(vmf_reader_main_t* reader, pageid_t pid,
+    bool sub);
+/** Drop all mappings if the owner has changed them */
+VMF_INLINE void reader_validate(vmf_reader_main_t* reader);
+/** Open the memory file 'fd' again as a read-only file */
+VMF_INLINE int reopen_rdonly(int fd);
+
+/* The size class is needed to be sent with the handle. */
+typedef struct {
+  uint32_t mem_min;
+} handle_message_t;
+
+int vmf_send_handle(const vmf_t vmf, int socket_fd) {
+  const vmf_main_t* vmf_main = (const vmf_main_t*) vmf;
+  const module_t* module = vmf_main->module;
+  handle_message_t message;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr* cmsg;
+  int fds[2];
+  int ret_value = -1;
+  int err;
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } control;
+
+  if (module->shared == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  message.mem_min = vmf_main->mem_min;
+  /* The device refuses writes from readers by itself, but a memory file
+     does not, so readers only receive read-only files of them. */
+  fds[0] = module->userspace
+    ? reopen_rdonly(module->driver_fd) : module->driver_fd;
+  fds[1] = reopen_rdonly(module->shared_fd);
+  if (fds[0] < 0 || fds[1] < 0) {
+    err = errno;
+    goto send_failed;
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &message;
+  iov.iov_len  = sizeof(message);
+  msg.msg_iov  = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  ret_value = sendmsg(socket_fd, &msg, 0) < 0 ? -1 : 0;
+  err = errno;
+send_failed:
+  if (module->userspace && fds[0] >= 0) close(fds[0]);
+  if (fds[1] >= 0) close(fds[1]);
+  errno = err;
+  return ret_value;
+}
+
+VMF_INLINE int reopen_rdonly(int fd) {
+  char path[32];
+
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+vmf_reader_t vmf_attach(int socket_fd) {
+  vmf_reader_main_t* reader;
+  handle_message_t message;
+  shared_header_t header;
+  void* region;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr* cmsg;
+  int fds[2];
+  size_t reserved_size;
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } control;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &message;
+  iov.iov_len  = sizeof(message);
+  msg.msg_iov  = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  if (recvmsg(socket_fd, &msg, 0) != sizeof(message)) return NULL;
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS
+      || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+    errno = EPROTO;
+    return NULL;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  if (pread(fds[1], &header, sizeof(header), 0) != sizeof(header)
+      || header.magic != SHARED_MAGIC) {
+    errno = EPROTO;
+    goto header_failed;
+  }
+  region = mmap(0, header.region_size, PROT_READ, MAP_SHARED, fds[1], 0);
+  if (region == MAP_FAILED) goto header_failed;
+
+  reader = (vmf_reader_main_t*) safe_malloc(sizeof(vmf_reader_main_t));
+  reader->header  = (const shared_header_t*) region;
+  reader->mem_min = message.mem_min;
+  reader->mapped  = calloc(header.page_nr_max, sizeof(uint8_t));
+  if (reader->mapped == NULL) exit(EXIT_FAILURE);
+  reader->epoch = __atomic_load_n(&reader->header->epoch, __ATOMIC_ACQUIRE);
+
+  /* reserve the same layout as the owner's */
+  reserved_size = 2 * header.page_nr_max * header.physical_pagesize;
+  reader->module.driver_fd = fds[0];
+  reader->module.physical_pagesize = header.physical_pagesize;
+  reader->module.page_nr_max = header.page_nr_max;
+  reader->module.shared    = (shared_header_t*) region;
+  reader->module.shared_fd = fds[1];
+  reader->module.addr_min  = mmap64(0, reserved_size, PROT_NONE,
+    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reader->module.addr_min == MAP_FAILED) {
+    perror("vmf_attach");
+    exit(EXIT_FAILURE);
+  }
+  reader->module.addr_max = ptr_offset(reader->module.addr_min, reserved_size);
+
+  reader->block_info.block_nr   = header.block_nr_max;
+  reader->block_info.data_start =
+    ptr_offset(region, header.block_info_offset);
+  reader->block_info.fixed      = true;
+  reader->page_heap.addr  = ptr_offset(region, header.page_info_offset);
+  reader->page_heap.fixed = true;
+  reader->page_info.data_heap = &reader->page_heap;
+  reader->page_info.page_num  = header.page_nr_max;
+#if !FIXED_LENGTH_INTEGER
+  reader->blockid_byte = header.blockid_byte;
+  reader->null_page    = get_allone_value(header.page_byte);
+  reader->block_info.page_byte  = header.page_byte;
+  reader->block_info.ofs_byte   = header.ofs_byte;
+  reader->block_info.block_size =
+    ELEMENT_BLOCK_SIZE(header.ofs_byte, header.page_byte);
+  reader->page_info.page_byte  = header.page_byte;
+  reader->page_info.ofs_byte   = header.ofs_byte;
+  reader->page_info.block_size =
+    PAGE_INFO_SIZE(header.page_byte, header.ofs_byte);
+#endif /* !FIXED_LENGTH_INTEGER */
+
+  size_manager_init();
+  return (vmf_reader_t) reader;
+
+header_failed:
+  close(fds[0]);
+  close(fds[1]);
+  return NULL;
+}
+
+void vmf_detach(vmf_reader_t reader_handle) {
+  vmf_reader_main_t* reader = (vmf_reader_main_t*) reader_handle;
+
+  munmap(reader->module.addr_min,
+    (uint8_t*)reader->module.addr_max - (uint8_t*)reader->module.addr_min);
+  munmap((void*)reader->header, reader->header->region_size);
+  close(reader->module.driver_fd);
+  close(reader->module.shared_fd);
+  free(reader->mapped);
+  free(reader);
+}
+
+const void* vmf_reader_dereference(vmf_reader_t reader_handle,
+    blockid_t bid) {
+  vmf_reader_main_t* reader = (vmf_reader_main_t*) reader_handle;
+  offset_t ofs;
+  pageid_t page_id;
+  size_t real_size;
+
+  if (bid >= reader->block_info.block_nr) return NULL;
+  reader_validate(reader);
+  block_info_get_all(&reader->block_info, bid, &ofs, &page_id);
+#if FIXED_LENGTH_INTEGER
+  if (page_id == (pageid_t)(-1)) return NULL;
+  real_size = sc2size(page_info_get_sc(&reader->page_info, page_id))
+    + sizeof(blockid_t);
+#else  /* FIXED_LENGTH_INTEGER */
+  if (page_id == reader->null_page) return NULL;
+  real_size = sc2size(page_info_get_sc(&reader->page_info, page_id))
+    + reader->blockid_byte;
+#endif /* FIXED_LENGTH_INTEGER */
+
+  if (!reader_map(reader, page_id, false)) return NULL;
+  /* The block straddles the next page */
+  if (ofs + real_size > reader->module.physical_pagesize) {
+    if (!reader_map(reader, page_id, true)) return NULL;
+  }
+
+#if FIXED_LENGTH_INTEGER
+  return ptr_offset(module_get_address(&reader->module, page_id),
+    ofs + sizeof(blockid_t));
+#else  /* FIXED_LENGTH_INTEGER */
+  return ptr_offset(module_get_address(&reader->module, page_id),
+    ofs + reader->blockid_byte);
+#endif /* FIXED_LENGTH_INTEGER */
+}
+
+size_t vmf_reader_length(vmf_reader_t reader_handle, blockid_t bid) {
+  vmf_reader_main_t* reader = (vmf_reader_main_t*) reader_handle;
+  pageid_t page_id;
+
+  if (bid >= reader->block_info.block_nr) return 0;
+  page_id = block_info_get_pid(&reader->block_info, bid);
+#if FIXED_LENGTH_INTEGER
+  if (page_id == (pageid_t)(-1)) return 0;
+#else  /* FIXED_LENGTH_INTEGER */
+  if (page_id == reader->null_page) return 0;
+#endif /* FIXED_LENGTH_INTEGER */
+  return sc2size(page_info_get_sc(&reader->page_info, page_id));
+}
+
+VMF_INLINE bool reader_map(vmf_reader_main_t* reader, pageid_t pid,
+    bool sub) {
+  module_t* module = &reader->module;
+  uint8_t flag = sub ? 2 : 1;
+  pageid_t mapped_pid = pid;
+  void* addr;
+
+  if (reader->mapped[pid] & flag) return true;
+  if (sub) {
+    mapped_pid = page_info_get_next(&reader->page_info, pid);
+  }
+
+  addr = mmap64(
+      get_address_by_index(module, sub ? sub_index(pid) : main_index(pid)),
+      module->physical_pagesize, PROT_READ, MAP_SHARED | MAP_FIXED,
+      module->driver_fd, (off64_t)mapped_pid * module->physical_pagesize);
+  if (addr == MAP_FAILED) return false;
+  reader->mapped[pid] |= flag;
+  return true;
+}
+
+VMF_INLINE void reader_validate(vmf_reader_main_t* reader) {
+  module_t* module = &reader->module;
+  uint64_t epoch =
+    __atomic_load_n(&reader->header->epoch, __ATOMIC_ACQUIRE);
+  void* addr;
+
+  if (epoch == reader->epoch) return;
+  addr = mmap64(module->addr_min,
+    (uint8_t*)module->addr_max - (uint8_t*)module->addr_min,
+    PROT_NONE, MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (addr == MAP_FAILED) {
+    perror(__FUNCTION__);
+    exit(EXIT_FAILURE);
+  }
+  memset(reader->mapped, 0, module->page_nr_max);
+  reader->epoch = epoch;
+}
+
 #if !FIXED_LENGTH_INTEGER
 VMF_INLINE bytenum_t required_byte(uint64_t num) {
   uint64_t bit_size;
@@ -1873,16 +2582,34 @@ VMF_INLINE void* get_page_head_address(vmf_main_t* vmf_main,
   return ptr_offset(vmf_main->page_heads, offset);
 }
 
-VMF_INLINE pageid_t insert_page(vmf_main_t* vmf_main,
+VMF_INLINE bool insert_page(vmf_main_t* vmf_main,
     void* head_addr, pageid_t old_head_id,
-    offset_t page_offset, size_t size_class) {
+    offset_t page_offset, size_t size_class, pageid_t* new_head_id_ptr) {
   pageid_t new_head_id;
   bool mapping;
   void* page_head = head_addr;
+  int err;
 
   new_head_id = page_info_pop_freeid(vmf_main->page_info, &mapping);
-  if (!mapping) {
-    module_allocate(vmf_main->module, new_head_id);
+  if (!mapping && !module_allocate(vmf_main->module, new_head_id)) {
+    push_stacktop(vmf_main->page_info, new_head_id);
+    return false;
+  }
+
+#if FIXED_LENGTH_INTEGER
+  if (old_head_id != (pageid_t)(-1))
+#else /* FIXED_LENGTH_INTEGER */
+  if (old_head_id != vmf_main->null_page)
+#endif /* FIXED_LENGTH_INTEGER */
+  {
+    if (!module_set_next(vmf_main->module, new_head_id, old_head_id)) {
+      err = errno;
+      if (!page_info_push_freeid(vmf_main->page_info, new_head_id)) {
+        module_deallocate(vmf_main->module, new_head_id);
+      }
+      errno = err;
+      return false;
+    }
   }
 
   page_info_replace(vmf_main->page_info, new_head_id,
@@ -1905,11 +2632,11 @@ VMF_INLINE pageid_t insert_page(vmf_main_t* vmf_main,
   if (old_head_id != vmf_main->null_page)
 #endif /* FIXED_LENGTH_INTEGER */
   {
-    module_set_next(vmf_main->module, new_head_id, old_head_id);
     page_info_put_prev(vmf_main->page_info, old_head_id, new_head_id);
   }
 
-  return new_head_id;
+  *new_head_id_ptr = new_head_id;
+  return true;
 }
 
 VMF_INLINE void remove_page(vmf_main_t* vmf_main,
@@ -1979,3 +2706,11 @@ VMF_INLINE bool vmf_is_null(vmf_main_t* vmf_main, blockid_t bid) {
   return bid == vmf_main->null_block;
 #endif /* FIXED_LENGTH_INTEGER */
 }
+
+VMF_INLINE bool vmf_has_page(vmf_main_t* vmf_main, blockid_t bid) {
+#if FIXED_LENGTH_INTEGER
+  return block_info_get_pid(vmf_main->block_info, bid) != (pageid_t)(-1);
+#else /* FIXED_LENGTH_INTEGER */
+  return block_info_get_pid(vmf_main->block_info, bid) != vmf_main->null_page;
+#endif /* FIXED_LENGTH_INTEGER */
+}
@@ -55,6 +55,7 @@ address_vector_t* alloc_addr_vec(size_t init_array_size) {
   }
   vector_ptr->pagesize_order = 0;
   vector_ptr->id_max         = 0;
+  mutex_init(&vector_ptr->lock);
   return vector_ptr;
 }
 
@@ -24,6 +24,7 @@
 #define ADDRESS_VECTOR_H__
 
 #include <linux/types.h>  /* Necessary to use size_t */
+#include <linux/mutex.h>
 
 /* Variable length array of void*. It behaves like 'std::vector<void *>'. */
 typedef struct {
@@ -37,6 +38,12 @@ typedef struct {
   unsigned pagesize_order;
   /* max required page id */
   size_t id_max;
+  /* process which opened the device. Other processes which received
+     the file descriptor may only map the pages read-only. */
+  pid_t owner;
+  /* serializes the owner's page table changes and 'mmap' of the
+     processes sharing the file. */
+  struct mutex lock;
 } address_vector_t;
 
 /** allocate 'address_vector'. The memory allocated by this function
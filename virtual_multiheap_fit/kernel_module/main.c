@@ -29,6 +29,7 @@
 #include <linux/errno.h>
 #include <asm/uaccess.h>   /* access_ok */
 #include <linux/mm.h>      /* vm_operations */
+#include <linux/sched.h>   /* current */
 
 #include "ioctl.h"
 #include "address_vector.h"
@@ -131,6 +132,7 @@ static int cdev_open(struct inode* inode_ptr, struct file* file_ptr) {
   PRINT_ENTERING();
   vector_ptr = alloc_addr_vec(0);
   if (vector_ptr == NULL) return -ENOMEM;
+  vector_ptr->owner = current->tgid;
 
   /* store 'vector_ptr' in 'private_data' to respond to
     'mmap' and 'ioctl' requests. */
@@ -169,12 +171,19 @@ static long cdev_unlocked_ioctl(struct file* file_ptr,
 
   vector_ptr = (address_vector_t*) file_ptr->private_data;
   if (vector_ptr == NULL) return -ENODATA;
+  /* only the owner can change the page table */
+  if (vector_ptr->owner != current->tgid
+      && cmd != ALLOCATOR_IOC_TOTAL_SIZE) {
+    return -EPERM;
+  }
 
+  /* readers may be mapping pages at the same time */
+  mutex_lock(&vector_ptr->lock);
   switch (cmd) {
   case ALLOCATOR_IOC_ALLOC:
     err_code = __get_user(index, (unsigned long __user*)arg);
     if (err_code >= 0) {
-      allocate_page(vector_ptr, index);
+      err_code = allocate_page(vector_ptr, index);
     }
     break;
 
@@ -204,6 +213,7 @@ static long cdev_unlocked_ioctl(struct file* file_ptr,
     }
     break;
   }
+  mutex_unlock(&vector_ptr->lock);
 
   return err_code;
 }
@@ -214,15 +224,25 @@ static int cdev_mmap(struct file* file_ptr, struct vm_area_struct* vma_ptr) {
   address_vector_t* vector_ptr
     = (address_vector_t*) file_ptr->private_data;
   void* page_addr;
+  struct page* page;
   unsigned long vm_start = vma_ptr->vm_start;
   unsigned long vm_end   = vma_ptr->vm_end;
   unsigned long pseudo_pagesize;
-  int err_code;
+  unsigned long i;
+  int err_code = 0;
 
   if (vector_ptr == NULL) {
     printk(KERN_ALERT "%s: vector_ptr is nullptr\n", __FUNCTION__);
     return -ENODATA;
   }
+  /* processes other than the owner can only read pages */
+  if (vector_ptr->owner != current->tgid) {
+    if (vma_ptr->vm_flags & VM_WRITE) return -EPERM;
+    vma_ptr->vm_flags &= ~VM_MAYWRITE;
+  }
+
+  /* the owner may be changing the page table at the same time */
+  mutex_lock(&vector_ptr->lock);
   pseudo_pagesize = get_pseudo_pagesize(vector_ptr);
   page_id = vma_ptr->vm_pgoff >> vector_ptr->pagesize_order;
 
@@ -231,22 +251,30 @@ static int cdev_mmap(struct file* file_ptr, struct vm_area_struct* vma_ptr) {
     if (page_addr == NULL) {
       printk(KERN_ALERT "%s: page not found(page %ld)\n",
           __FUNCTION__, page_id);
-      return -ENODATA;
+      err_code = -ENODATA;
+      break;
     }
 
-    err_code = remap_pfn_range(vma_ptr, vm_start,
-      (unsigned long)virt_to_phys(page_addr) >> PAGE_SHIFT,
-      pseudo_pagesize, vma_ptr->vm_page_prot);
+    /* Each mapping holds a reference of the pages, so they are not freed
+       by 'ALLOCATOR_IOC_DEALLOC' until the mapping is removed. */
+    page = virt_to_page(page_addr);
+    for (i = 0; i < pseudo_pagesize >> PAGE_SHIFT; ++i) {
+      err_code = vm_insert_page(vma_ptr, vm_start + (i << PAGE_SHIFT),
+        page + i);
+      if (err_code < 0) break;
+    }
     if (err_code < 0) {
-      printk(KERN_ALERT "%s: remap_pfn_range failed\n", __FUNCTION__);
-      return -EAGAIN;
+      printk(KERN_ALERT "%s: vm_insert_page failed\n", __FUNCTION__);
+      err_code = -EAGAIN;
+      break;
     }
 
     ++page_id;
     vm_start += pseudo_pagesize;
   }
+  mutex_unlock(&vector_ptr->lock);
 
-  return 0;
+  return err_code;
 }
 
 static int cmmand_varify(unsigned int cmd, void __user* arg_ptr) {
@@ -29,6 +29,10 @@
 
 #define PRINT_ENTERING() printk(KERN_ALERT "Entering %s\n", __FUNCTION__)
 
+/* Drop the module's reference to each 4KiB page of a pseudo page. Pages
+   still mapped by some process are freed when the last mapping is gone. */
+static void put_pseudo_page(void* page_address, unsigned pagesize_order);
+
 int allocate_page(address_vector_t* vector_ptr, size_t index) {
   void* page_address;
 
@@ -39,6 +43,11 @@ int allocate_page(address_vector_t* vector_ptr, size_t index) {
     printk(KERN_ALERT "%s: __get_free_page failed\n", __FUNCTION__);
     return -ENOMEM;
   }
+  /* 'vm_insert_page' takes a reference of each 4KiB page, so they have
+     to be counted separately. */
+  if (vector_ptr->pagesize_order > 0) {
+    split_page(virt_to_page(page_address), vector_ptr->pagesize_order);
+  }
 
   return put_addr_vec(vector_ptr, index, page_address);
 }
@@ -48,7 +57,7 @@ int deallocate_page(address_vector_t* vector_ptr, size_t index) {
 
   page_address = get_addr_vec(vector_ptr, index);
   if (page_address == NULL) return 0;
-  free_pages((unsigned long) page_address, vector_ptr->pagesize_order);
+  put_pseudo_page(page_address, vector_ptr->pagesize_order);
   return put_addr_vec(vector_ptr, index, NULL);
 }
 
@@ -60,8 +69,17 @@ int freeall_page(address_vector_t* vector_ptr) {
   for (index = 0; index < size; ++index) {
     page_address = get_addr_vec(vector_ptr, index);
     if (page_address == NULL) continue;
-    free_pages((unsigned long) page_address, vector_ptr->pagesize_order);
+    put_pseudo_page(page_address, vector_ptr->pagesize_order);
   }
 
   return 0;
 }
+
+static void put_pseudo_page(void* page_address, unsigned pagesize_order) {
+  struct page* page = virt_to_page(page_address);
+  unsigned long i;
+
+  for (i = 0; i < (1ul << pagesize_order); ++i) {
+    put_page(page + i);
+  }
+}
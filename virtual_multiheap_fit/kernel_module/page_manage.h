@@ -28,7 +28,8 @@
 
 /* Allocate 'index' physical page */
 int allocate_page(address_vector_t* vector_ptr, size_t index);
-/* Deallocate 'index' physical page */
+/* Deallocate 'index' physical page. Pages still mapped by other processes
+   are freed when they unmap them. */
 int deallocate_page(address_vector_t* vector_ptr, size_t index);
 /* Deallocate all physical pages */
 int freeall_page(address_vector_t* vector_ptr);